@@ -0,0 +1,238 @@
+/**
+ * @file bench.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "bench.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+
+namespace dfa
+{
+namespace
+{
+/**
+ * log2 of LatencyHistogram::kSubBuckets.
+ */
+constexpr unsigned kSubBucketBits = 6;
+
+static_assert(std::size_t{1} << kSubBucketBits == LatencyHistogram::kSubBuckets);
+
+/**
+ * Values below this are counted exactly, one bucket each.
+ */
+constexpr std::uint64_t kExactValues = 2 * LatencyHistogram::kSubBuckets;
+
+/**
+ * Powers of two past kExactValues, each of which is split into kSubBuckets buckets.
+ */
+constexpr std::size_t kShifts = 64 - kSubBucketBits - 1;
+
+constexpr std::size_t kReadSize = 1 << 20;
+
+double Seconds(std::chrono::nanoseconds duration) { return std::chrono::duration<double>(duration).count(); }
+}  // namespace
+
+LatencyHistogram::LatencyHistogram() : counts_(kExactValues + kShifts * kSubBuckets) {}
+
+std::size_t LatencyHistogram::Bucket(std::uint64_t value) noexcept
+{
+  if (value < kExactValues)
+  {
+    return static_cast<std::size_t>(value);
+  }
+  // The top kSubBucketBits + 1 bits of the value pick the bucket within its power of two.
+  const auto shift = static_cast<unsigned>(63 - __builtin_clzll(value)) - kSubBucketBits;
+  return std::size_t{shift} * kSubBuckets + static_cast<std::size_t>(value >> shift);
+}
+
+std::uint64_t LatencyHistogram::BucketEnd(std::size_t bucket) noexcept
+{
+  if (bucket < kExactValues)
+  {
+    return bucket;
+  }
+  const auto shift = static_cast<unsigned>(bucket / kSubBuckets - 1);
+  const std::uint64_t top = bucket - std::size_t{shift} * kSubBuckets;
+  // The end of the last bucket wraps around to the largest value.
+  return ((top + 1) << shift) - 1;
+}
+
+std::uint64_t LatencyHistogram::Percentile(double share) const noexcept
+{
+  if (count_ == 0)
+  {
+    return 0;
+  }
+  const auto rank =
+      std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(share * static_cast<double>(count_))));
+  std::uint64_t seen = 0;
+  for (std::size_t bucket = 0; bucket < counts_.size(); ++bucket)
+  {
+    seen += counts_[bucket];
+    if (seen >= rank)
+    {
+      return std::min(BucketEnd(bucket), max_);
+    }
+  }
+  return max_;
+}
+
+Corpus::Corpus(int fd)
+{
+  for (;;)
+  {
+    const std::size_t size = data_.size();
+    data_.resize(size + kReadSize);
+    const ssize_t bytes = read(fd, data_.data() + size, kReadSize);
+    if (bytes < 0 && errno == EINTR)
+    {
+      data_.resize(size);
+      continue;
+    }
+    if (bytes < 0)
+    {
+      throw std::system_error(errno, std::generic_category(), "Failed to read the corpus");
+    }
+    data_.resize(size + static_cast<std::size_t>(bytes));
+    if (bytes == 0)
+    {
+      break;
+    }
+  }
+  Split();
+}
+
+Corpus::Corpus(const std::vector<std::filesystem::path>& files)
+{
+  for (const auto& file : files)
+  {
+    std::ifstream in(file, std::ios::binary);
+    if (!in)
+    {
+      throw std::runtime_error("Failed to read file: " + file.string());
+    }
+    data_.append(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    if (in.bad())
+    {
+      throw std::runtime_error("Failed to read file: " + file.string());
+    }
+    // The last line of a file doesn't run into the first line of the next.
+    if (!data_.empty() && data_.back() != '\n')
+    {
+      data_ += '\n';
+    }
+  }
+  Split();
+}
+
+void Corpus::Split()
+{
+  const std::string_view data(data_);
+  for (std::size_t begin = 0; begin < data.size();)
+  {
+    const std::size_t end = std::min(data.find('\n', begin), data.size());
+    records_.push_back(data.substr(begin, end - begin));
+    bytes_ += end - begin;
+    begin = end + 1;
+  }
+}
+
+double BenchResult::RecordsPerSecond() const noexcept
+{
+  return elapsed.count() == 0 ? 0 : static_cast<double>(records * runs) / Seconds(elapsed);
+}
+
+double BenchResult::MegabytesPerSecond() const noexcept
+{
+  return elapsed.count() == 0 ? 0 : static_cast<double>(bytes * runs) / 1e6 / Seconds(elapsed);
+}
+
+BenchResult Bench(const Dfa& dfa, const Corpus& corpus, const BenchOptions& options)
+{
+  using Clock = std::chrono::steady_clock;
+
+  const auto& records = corpus.Records();
+  BenchResult result;
+  result.records = records.size();
+  result.bytes = corpus.Bytes();
+  result.runs = options.runs;
+
+  std::vector<std::string_view> batch;
+  std::vector<Dfa::Acceptance> verdicts;
+  // Matches every record once, and counts verdicts. Clocks are only read if latencies are recorded.
+  const auto pass = [&](LatencyHistogram* latencies) {
+    std::array<std::uint64_t, 4> counts{};
+    if (options.batch_size == 0)
+    {
+      for (const auto record : records)
+      {
+        if (latencies == nullptr)
+        {
+          ++counts[dfa.AcceptsString(record)];
+          continue;
+        }
+        const auto start = Clock::now();
+        const auto verdict = dfa.AcceptsString(record);
+        latencies->Record(static_cast<std::uint64_t>((Clock::now() - start).count()));
+        ++counts[verdict];
+      }
+      return counts;
+    }
+
+    for (std::size_t begin = 0; begin < records.size(); begin += options.batch_size)
+    {
+      const std::size_t end = std::min(records.size(), begin + options.batch_size);
+      batch.assign(records.begin() + static_cast<std::ptrdiff_t>(begin),
+                   records.begin() + static_cast<std::ptrdiff_t>(end));
+      if (latencies == nullptr)
+      {
+        dfa.AcceptsBatch(batch, verdicts);
+      }
+      else
+      {
+        const auto start = Clock::now();
+        dfa.AcceptsBatch(batch, verdicts);
+        const auto latency = static_cast<std::uint64_t>((Clock::now() - start).count()) / (end - begin);
+        for (std::size_t i = begin; i < end; ++i)
+        {
+          latencies->Record(latency);
+        }
+      }
+      for (const auto verdict : verdicts)
+      {
+        ++counts[verdict];
+      }
+    }
+    return counts;
+  };
+
+  for (unsigned run = 0; run < options.warmup_runs; ++run)
+  {
+    pass(nullptr);
+  }
+  for (unsigned run = 0; run < options.runs; ++run)
+  {
+    const auto start = Clock::now();
+    result.verdicts = pass(nullptr);
+    const std::chrono::nanoseconds elapsed = Clock::now() - start;
+    result.elapsed += elapsed;
+    result.fastest = run == 0 ? elapsed : std::min(result.fastest, elapsed);
+  }
+  for (unsigned run = 0; run < options.runs; ++run)
+  {
+    pass(&result.latencies);
+  }
+  return result;
+}
+
+}  // namespace dfa
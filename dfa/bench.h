@@ -0,0 +1,188 @@
+/**
+ * @file bench.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dfa/dfa.h"
+
+namespace dfa
+{
+/**
+ * A histogram of latencies in nanoseconds, bucketed like HdrHistogram: every power of two is split into the same number
+ * of buckets, so the relative error of a percentile is below 1 / kSubBuckets over the whole range, and recording a
+ * value takes a few instructions and no allocation.
+ */
+class LatencyHistogram
+{
+ public:
+  /**
+   * Buckets per power of two; values below twice this many are counted exactly.
+   */
+  static constexpr std::size_t kSubBuckets = 64;
+
+  LatencyHistogram();
+
+  inline void Record(std::uint64_t nanoseconds) noexcept
+  {
+    ++counts_[Bucket(nanoseconds)];
+    ++count_;
+    max_ = nanoseconds > max_ ? nanoseconds : max_;
+  }
+
+  inline std::uint64_t Count() const noexcept { return count_; }
+
+  inline std::uint64_t Max() const noexcept { return max_; }
+
+  /**
+   * The smallest value that at least a share of the recorded values don't exceed, rounded up to the end of its bucket
+   * but never past Max.
+   * @param share between 0 and 1, such as 0.99 for p99
+   * @return 0 if nothing was recorded
+   */
+  std::uint64_t Percentile(double share) const noexcept;
+
+ private:
+  static std::size_t Bucket(std::uint64_t value) noexcept;
+
+  /**
+   * The largest value of a bucket.
+   */
+  static std::uint64_t BucketEnd(std::size_t bucket) noexcept;
+
+  std::vector<std::uint64_t> counts_;
+
+  std::uint64_t count_ = 0;
+
+  std::uint64_t max_ = 0;
+};
+
+/**
+ * Records to benchmark with, read into memory up front so that reading them isn't measured. Records are lines without
+ * their newlines. Not copyable, since the records are views of its buffer.
+ */
+class Corpus
+{
+ public:
+  /**
+   * Reads records from a descriptor until its end.
+   * @throws std::system_error if reading fails
+   */
+  explicit Corpus(int fd);
+
+  /**
+   * Reads the records of files, one after another.
+   * @throws std::runtime_error if a file can't be read
+   */
+  explicit Corpus(const std::vector<std::filesystem::path>& files);
+
+  Corpus(const Corpus&) = delete;
+
+  Corpus& operator=(const Corpus&) = delete;
+
+  inline const std::vector<std::string_view>& Records() const noexcept { return records_; }
+
+  /**
+   * Size of all records, without newlines.
+   */
+  inline std::uint64_t Bytes() const noexcept { return bytes_; }
+
+ private:
+  /**
+   * Splits data_ into records_, once all of it is read.
+   */
+  void Split();
+
+  std::string data_;
+
+  std::vector<std::string_view> records_;
+
+  std::uint64_t bytes_ = 0;
+};
+
+/**
+ * Settings for Bench.
+ */
+struct BenchOptions
+{
+  /**
+   * Passes over the corpus before measuring, which fault in the table and warm the caches.
+   */
+  unsigned warmup_runs = 1;
+
+  /**
+   * Measured passes over the corpus. Each is made twice: once timed as a whole, for throughput, and once with every
+   * record timed, for latencies. Reading the clock takes a few tens of nanoseconds, which is part of every latency but
+   * not of the throughput.
+   */
+  unsigned runs = 5;
+
+  /**
+   * If not zero, records are matched this many at a time by Dfa::AcceptsBatch instead of one at a time by
+   * AcceptsString. The latency of each record is then that of its batch divided by its size.
+   */
+  std::size_t batch_size = 0;
+};
+
+/**
+ * Measurements of Bench.
+ */
+struct BenchResult
+{
+  /**
+   * Records matched by each run.
+   */
+  std::uint64_t records = 0;
+
+  /**
+   * Bytes matched by each run.
+   */
+  std::uint64_t bytes = 0;
+
+  /**
+   * Number of throughput passes.
+   */
+  unsigned runs = 0;
+
+  /**
+   * Time the throughput passes took, together.
+   */
+  std::chrono::nanoseconds elapsed{0};
+
+  /**
+   * Time of the fastest throughput pass.
+   */
+  std::chrono::nanoseconds fastest{0};
+
+  /**
+   * Number of records with each Dfa::Acceptance in one pass, indexed by it.
+   */
+  std::array<std::uint64_t, 4> verdicts{};
+
+  LatencyHistogram latencies;
+
+  double RecordsPerSecond() const noexcept;
+
+  /**
+   * Throughput in millions of bytes per second.
+   */
+  double MegabytesPerSecond() const noexcept;
+};
+
+/**
+ * Matches a corpus repeatedly, and measures throughput and per-record latencies.
+ */
+BenchResult Bench(const Dfa& dfa, const Corpus& corpus, const BenchOptions& options = BenchOptions());
+
+}  // namespace dfa
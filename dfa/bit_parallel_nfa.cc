@@ -0,0 +1,304 @@
+/**
+ * @file bit_parallel_nfa.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "bit_parallel_nfa.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <utility>
+
+#include "nfa.h"
+#include "utf8.h"
+
+namespace dfa
+{
+namespace
+{
+constexpr std::size_t kNumBytes = 256;
+
+constexpr std::size_t kWordBits = 64;
+
+/**
+ * Positions whose Follow sets are combined in one table lookup.
+ */
+constexpr std::size_t kChunkBits = 8;
+
+constexpr std::size_t kChunksPerWord = kWordBits / kChunkBits;
+
+constexpr std::uint64_t kChunkMask = (std::uint64_t{1} << kChunkBits) - 1;
+
+using ByteMask = std::array<std::uint64_t, kNumBytes / kWordBits>;
+
+/**
+ * The positions of an NFA. Position 0 is the start, which isn't entered by any byte.
+ */
+struct PositionSet
+{
+  std::vector<Nfa::StateId> targets{0};
+
+  std::vector<ByteMask> labels{ByteMask{}};
+
+  /**
+   * The positions that each NFA state enters.
+   */
+  std::vector<std::vector<std::size_t>> entered_from;
+};
+
+PositionSet CollectPositions(const Nfa& nfa)
+{
+  PositionSet positions;
+  positions.entered_from.resize(nfa.state_names.size());
+  std::map<std::pair<Nfa::StateId, ByteMask>, std::size_t> ids;
+  std::vector<std::pair<Nfa::StateId, unsigned char>> moves;
+  for (std::size_t state = 0; state < nfa.transitions.size(); ++state)
+  {
+    moves.clear();
+    for (const auto& [symbol, target] : nfa.transitions[state])
+    {
+      const auto range = LabelRange(nfa.symbols[symbol]);
+      if (const auto bytes = range ? RangeBytes(*range) : std::nullopt)
+      {
+        for (unsigned b = bytes->first; b <= bytes->second; ++b)
+        {
+          moves.emplace_back(target, static_cast<unsigned char>(b));
+        }
+      }
+    }
+    std::sort(moves.begin(), moves.end());
+
+    for (std::size_t i = 0; i < moves.size();)
+    {
+      const Nfa::StateId target = moves[i].first;
+      ByteMask mask{};
+      for (; i < moves.size() && moves[i].first == target; ++i)
+      {
+        mask[moves[i].second / kWordBits] |= std::uint64_t{1} << (moves[i].second % kWordBits);
+      }
+
+      const auto [iter, inserted] = ids.emplace(std::make_pair(target, mask), positions.targets.size());
+      if (inserted)
+      {
+        positions.targets.push_back(target);
+        positions.labels.push_back(mask);
+      }
+      positions.entered_from[state].push_back(iter->second);
+    }
+  }
+  return positions;
+}
+
+inline void SetBit(std::uint64_t* set, std::size_t bit)
+{
+  set[bit / kWordBits] |= std::uint64_t{1} << (bit % kWordBits);
+}
+}  // namespace
+
+std::size_t BitParallelNfa::CountPositions(const Nfa& nfa) { return CollectPositions(nfa).targets.size(); }
+
+BitParallelNfa::BitParallelNfa(const Nfa& nfa, const std::array<bool, 256>& alphabet) : alphabet_(alphabet)
+{
+  const PositionSet positions = CollectPositions(nfa);
+  positions_ = positions.targets.size();
+  if (positions_ > kMaxPositions)
+  {
+    throw std::length_error("NFA has " + std::to_string(positions_) + " positions, more than bit-parallel simulation "
+                            "supports");
+  }
+  words_ = positions_ <= kWordBits ? 1 : positions_ <= 2 * kWordBits ? 2 : 4;
+
+  labels_.assign(kNumBytes * words_, 0);
+  for (std::size_t p = 1; p < positions_; ++p)
+  {
+    for (std::size_t c = 0; c < kNumBytes; ++c)
+    {
+      if (((positions.labels[p][c / kWordBits] >> (c % kWordBits)) & 1U) != 0)
+      {
+        SetBit(&labels_[c * words_], p);
+      }
+    }
+  }
+
+  // Follow(p) is every position entered from the epsilon closure of p's target.
+  std::vector<std::uint64_t> follow(positions_ * words_);
+  start_.assign(words_, 0);
+  accepting_.assign(words_, 0);
+  position_states_.resize(positions_);
+  std::vector<bool> visited(nfa.state_names.size());
+  std::vector<Nfa::StateId> closure;
+  for (std::size_t p = 0; p < positions_; ++p)
+  {
+    std::fill(visited.begin(), visited.end(), false);
+    closure.clear();
+    if (p == 0)
+    {
+      closure.insert(closure.end(), nfa.start.begin(), nfa.start.end());
+    }
+    else
+    {
+      closure.push_back(positions.targets[p]);
+    }
+    for (const auto state : closure)
+    {
+      visited[state] = true;
+    }
+    for (std::size_t i = 0; i < closure.size(); ++i)
+    {
+      for (const auto next : nfa.epsilon_transitions[closure[i]])
+      {
+        if (!visited[next])
+        {
+          visited[next] = true;
+          closure.push_back(next);
+        }
+      }
+    }
+
+    for (const auto state : closure)
+    {
+      for (const auto entered : positions.entered_from[state])
+      {
+        SetBit(&follow[p * words_], entered);
+      }
+      if (nfa.final_states[state])
+      {
+        SetBit(accepting_.data(), p);
+      }
+      position_states_[p].emplace_back(nfa.state_names[state]);
+    }
+  }
+  SetBit(start_.data(), 0);
+
+  // Each table entry extends the one without its lowest bit by the Follow set of that bit's position.
+  const std::size_t chunks = (positions_ + kChunkBits - 1) / kChunkBits;
+  follow_.assign(chunks * (kChunkMask + 1) * words_, 0);
+  for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+  {
+    for (std::size_t bits = 1; bits <= kChunkMask; ++bits)
+    {
+      std::size_t lowest = 0;
+      while (((bits >> lowest) & 1U) == 0)
+      {
+        ++lowest;
+      }
+      const std::size_t position = chunk * kChunkBits + lowest;
+      std::uint64_t* entry = &follow_[(chunk * (kChunkMask + 1) + bits) * words_];
+      const std::uint64_t* rest = &follow_[(chunk * (kChunkMask + 1) + (bits & (bits - 1))) * words_];
+      for (std::size_t w = 0; w < words_; ++w)
+      {
+        entry[w] = rest[w] | (position < positions_ ? follow[position * words_ + w] : 0);
+      }
+    }
+  }
+}
+
+std::size_t BitParallelNfa::TableBytes() const noexcept
+{
+  return (follow_.capacity() + labels_.capacity() + start_.capacity() + accepting_.capacity()) * sizeof(std::uint64_t);
+}
+
+BitParallelNfa::Outcome BitParallelNfa::Match(std::string_view input, std::ostream* trace) const
+{
+  switch (words_)
+  {
+    case 1:
+      return Run<1>(input, trace);
+    case 2:
+      return Run<2>(input, trace);
+    default:
+      return Run<4>(input, trace);
+  }
+}
+
+template <std::size_t kWords>
+BitParallelNfa::Outcome BitParallelNfa::Run(std::string_view input, std::ostream* trace) const
+{
+  std::array<std::uint64_t, kWords> active;
+  std::copy(start_.begin(), start_.end(), active.begin());
+  if (trace != nullptr)
+  {
+    *trace << "Starting States: ";
+    Print(active.data(), *trace);
+    *trace << std::endl;
+  }
+
+  for (const char symbol : input)
+  {
+    const auto byte = static_cast<unsigned char>(symbol);
+    if (!alphabet_[byte])
+    {
+      return INVALID_SYMBOL;
+    }
+
+    // Only chunks with active positions are looked up.
+    std::array<std::uint64_t, kWords> next{};
+    for (std::size_t w = 0; w < kWords; ++w)
+    {
+      for (std::uint64_t word = active[w]; word != 0;)
+      {
+        const auto shift = static_cast<std::size_t>(__builtin_ctzll(word)) / kChunkBits * kChunkBits;
+        const std::size_t chunk = w * kChunksPerWord + shift / kChunkBits;
+        const std::uint64_t* entry = &follow_[(chunk * (kChunkMask + 1) + ((word >> shift) & kChunkMask)) * kWords];
+        for (std::size_t v = 0; v < kWords; ++v)
+        {
+          next[v] |= entry[v];
+        }
+        word &= ~(kChunkMask << shift);
+      }
+    }
+
+    const std::uint64_t* label = &labels_[byte * kWords];
+    std::uint64_t any = 0;
+    for (std::size_t v = 0; v < kWords; ++v)
+    {
+      next[v] &= label[v];
+      any |= next[v];
+    }
+    if (any == 0)
+    {
+      return NO_TRANSITION;
+    }
+    active = next;
+
+    if (trace != nullptr)
+    {
+      *trace << "Symbol: " << symbol << " -> Active States: ";
+      Print(active.data(), *trace);
+      *trace << std::endl;
+    }
+  }
+
+  for (std::size_t v = 0; v < kWords; ++v)
+  {
+    if ((active[v] & accepting_[v]) != 0)
+    {
+      return ACCEPTED;
+    }
+  }
+  return REJECTED;
+}
+
+void BitParallelNfa::Print(const std::uint64_t* set, std::ostream& os) const
+{
+  std::set<std::string> states;
+  for (std::size_t p = 0; p < positions_; ++p)
+  {
+    if (((set[p / kWordBits] >> (p % kWordBits)) & 1U) != 0)
+    {
+      states.insert(position_states_[p].begin(), position_states_[p].end());
+    }
+  }
+
+  os << '{';
+  for (auto iter = states.begin(); iter != states.end(); ++iter)
+  {
+    os << (iter == states.begin() ? "" : ", ") << *iter;
+  }
+  os << '}';
+}
+
+}  // namespace dfa
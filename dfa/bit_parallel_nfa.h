@@ -0,0 +1,115 @@
+/**
+ * @file bit_parallel_nfa.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dfa
+{
+struct Nfa;
+
+/**
+ * Matches an NFA without determinizing it, by keeping its active states in a few machine words.
+ *
+ * States are grouped into positions, as in a Glushkov automaton: a position is a target state together with the set
+ * of bytes that lead to it from some source, so that a byte selects positions regardless of where they are entered
+ * from. The active positions after a byte c are then Follow(S) & B[c], where Follow(S) is looked up eight positions at
+ * a time in precomputed tables, with epsilon closures already folded in. Matching takes time linear in the input and
+ * no memory, however large the equivalent DFA would be.
+ *
+ * Only single byte Symbols and ranges of them can match.
+ */
+class BitParallelNfa
+{
+ public:
+  /**
+   * Most positions that can be simulated, in four 64-bit words.
+   */
+  static constexpr std::size_t kMaxPositions = 256;
+
+  enum Outcome
+  {
+    ACCEPTED,
+    REJECTED,
+    /**
+     * A byte is not part of the alphabet.
+     */
+    INVALID_SYMBOL,
+    /**
+     * A byte left no states active.
+     */
+    NO_TRANSITION
+  };
+
+  /**
+   * Counts the positions of an NFA, which is cheap compared to building the tables.
+   */
+  static std::size_t CountPositions(const Nfa& nfa);
+
+  /**
+   * @param nfa the NFA to simulate
+   * @param alphabet which bytes are Symbols of the alphabet; others fail matching with INVALID_SYMBOL
+   * @throws std::length_error if the NFA has more than kMaxPositions positions
+   */
+  BitParallelNfa(const Nfa& nfa, const std::array<bool, 256>& alphabet);
+
+  /**
+   * Runs the NFA on input.
+   * @param trace if not null, receives the active NFA states after every byte
+   */
+  Outcome Match(std::string_view input, std::ostream* trace = nullptr) const;
+
+  inline std::size_t Positions() const noexcept { return positions_; }
+
+  /**
+   * Memory taken by the Follow and label tables and the position sets, but not the names of NFA states.
+   */
+  std::size_t TableBytes() const noexcept;
+
+ private:
+  template <std::size_t kWords>
+  Outcome Run(std::string_view input, std::ostream* trace) const;
+
+  void Print(const std::uint64_t* set, std::ostream& os) const;
+
+  std::size_t positions_ = 0;
+
+  /**
+   * Words per set of positions: 1, 2 or 4.
+   */
+  std::size_t words_ = 1;
+
+  /**
+   * Follow sets of every combination of 8 positions: entry [(chunk * 256 + bits) * words_] is the union of the Follow
+   * sets of positions chunk * 8 + i for the set bits i of bits.
+   */
+  std::vector<std::uint64_t> follow_;
+
+  /**
+   * B[c]: the positions that byte c enters, words_ words per byte.
+   */
+  std::vector<std::uint64_t> labels_;
+
+  std::array<bool, 256> alphabet_{};
+
+  std::vector<std::uint64_t> start_;
+
+  std::vector<std::uint64_t> accepting_;
+
+  /**
+   * Names of the NFA states that each position stands for, for tracing.
+   */
+  std::vector<std::vector<std::string>> position_states_;
+};
+
+}  // namespace dfa
@@ -0,0 +1,331 @@
+/**
+ * @file builder.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "builder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utf8.h"
+
+namespace dfa
+{
+namespace
+{
+const Dfa::Symbol kEpsilon = "epsilon";
+
+/**
+ * Where bytes from 0x80 up start among the values of pieces, after the last scalar value.
+ */
+constexpr char32_t kFirstHighByte = 0x110000;
+
+/**
+ * The values of pieces that a range covers: one interval, or two for a range of bytes that crosses 0x80. Intervals of
+ * scalar values that end right before the surrogates take them in, so pieces never start inside them.
+ */
+std::vector<std::pair<char32_t, char32_t>> RangeValues(const SymbolRange& range)
+{
+  if (!range.bytes || range.high < kFirstMultiByte)
+  {
+    return {{range.low, range.high == kFirstSurrogate - 1 ? kLastSurrogate : range.high}};
+  }
+  if (range.low >= kFirstMultiByte)
+  {
+    return {{kFirstHighByte + range.low, kFirstHighByte + range.high}};
+  }
+  return {{range.low, kFirstMultiByte - 1}, {kFirstHighByte + kFirstMultiByte, kFirstHighByte + range.high}};
+}
+
+/**
+ * The label of the piece [low, high].
+ */
+std::string PieceLabel(char32_t low, char32_t high)
+{
+  if (low >= kFirstHighByte)
+  {
+    return RangeLabel({low - kFirstHighByte, high - kFirstHighByte, true});
+  }
+  return RangeLabel({low, IsSurrogate(high) ? kFirstSurrogate - 1 : high, high < kFirstMultiByte});
+}
+
+std::uint64_t TransitionKey(Nfa::SymbolId symbol, Nfa::StateId to) { return (std::uint64_t{symbol} << 32U) | to; }
+}  // namespace
+
+DfaBuilder::DfaBuilder(const Options& options) : options_(options), nfa_(std::pmr::new_delete_resource()) {}
+
+DfaBuilder::DfaBuilder(const std::string& dfa_file_contents, const Options& options) : DfaBuilder(options)
+{
+  Dfa definition;
+  std::pmr::monotonic_buffer_resource arena;
+  definition.Parse(dfa_file_contents, arena);
+  Add(definition);
+}
+
+DfaBuilder::DfaBuilder(const Dfa::Json& dfa_file_contents, const Options& options) : DfaBuilder(options)
+{
+  Dfa definition;
+  definition.Parse(dfa_file_contents);
+  Add(definition);
+}
+
+void DfaBuilder::AddStartState(const std::string& state)
+{
+  const auto id = StateId(state);
+  if (std::find(nfa_.start.begin(), nfa_.start.end(), id) == nfa_.start.end())
+  {
+    nfa_.start.push_back(id);
+  }
+}
+
+void DfaBuilder::AddTransition(const std::string& from, const Dfa::Symbol& symbol, const std::string& to)
+{
+  const auto from_id = StateId(from);
+  const auto to_id = StateId(to);
+  if (symbol == kEpsilon)
+  {
+    auto& targets = nfa_.epsilon_transitions[from_id];
+    if (std::find(targets.begin(), targets.end(), to_id) == targets.end())
+    {
+      targets.push_back(to_id);
+      determinizer_.EpsilonTransitionsChanged(from_id);
+    }
+    return;
+  }
+
+  alphabet_.insert(symbol);
+  for (const auto symbol_id : LabelSymbols(symbol, true))
+  {
+    AddTransition(from_id, symbol_id, to_id);
+  }
+}
+
+bool DfaBuilder::RemoveTransition(const std::string& from, const Dfa::Symbol& symbol, const std::string& to)
+{
+  const auto from_state = state_ids_.find(from);
+  const auto to_state = state_ids_.find(to);
+  if (from_state == state_ids_.end() || to_state == state_ids_.end())
+  {
+    return false;
+  }
+
+  if (symbol == kEpsilon)
+  {
+    auto& targets = nfa_.epsilon_transitions[from_state->second];
+    const auto target = std::find(targets.begin(), targets.end(), to_state->second);
+    if (target == targets.end())
+    {
+      return false;
+    }
+    targets.erase(target);
+    determinizer_.EpsilonTransitionsChanged(from_state->second);
+    return true;
+  }
+
+  bool removed = false;
+  for (const auto symbol_id : LabelSymbols(symbol, false))
+  {
+    removed = RemoveTransition(from_state->second, symbol_id, to_state->second) || removed;
+  }
+  return removed;
+}
+
+void DfaBuilder::AddFinalState(const std::string& state) { nfa_.final_states[StateId(state)] = true; }
+
+Dfa DfaBuilder::Build()
+{
+  using Clock = std::chrono::steady_clock;
+
+  const auto start = Clock::now();
+  MemoryBudget budget(options_.max_bytes);
+  try
+  {
+    expanded_ = determinizer_.Update(options_.max_states, &budget);
+  }
+  catch (const StateLimitError&)
+  {
+    throw BudgetExceededError(std::to_string(options_.max_states) + " states", options_.max_states, budget.Used());
+  }
+
+  std::pmr::monotonic_buffer_resource arena(&budget);
+  Dfa dfa;
+  dfa.alphabet_ = alphabet_;
+  dfa.AdoptSubsetDfa(nfa_, determinizer_.Result(), true, budget, arena);
+  const auto determinized = Clock::now();
+  dfa.Compile(options_, budget, arena);
+  dfa.Replicate(options_.numa_replicas);
+  dfa.build_times_.determinize = determinized - start;
+  dfa.build_times_.compile = Clock::now() - determinized;
+  return dfa;
+}
+
+void DfaBuilder::Add(const Dfa& definition)
+{
+  for (const auto& state : definition.states_)
+  {
+    StateId(*state.begin());
+  }
+  alphabet_.insert(definition.alphabet_.begin(), definition.alphabet_.end());
+  for (const auto& state : definition.start_state_)
+  {
+    AddStartState(state);
+  }
+  for (const auto& [state, transitions] : definition.transitions_)
+  {
+    for (const auto& [symbol, targets] : transitions)
+    {
+      for (const auto& target : targets)
+      {
+        AddTransition(*state.begin(), symbol, target);
+      }
+    }
+  }
+  for (const auto& state : definition.final_states_)
+  {
+    AddFinalState(*state.begin());
+  }
+}
+
+Nfa::StateId DfaBuilder::StateId(const std::string& state)
+{
+  const auto [iter, inserted] = state_ids_.emplace(state, static_cast<Nfa::StateId>(nfa_.state_names.size()));
+  if (inserted)
+  {
+    nfa_.state_names.emplace_back(state);
+    nfa_.transitions.emplace_back();
+    nfa_.epsilon_transitions.emplace_back();
+    nfa_.final_states.push_back(false);
+    transition_keys_.emplace_back();
+  }
+  return iter->second;
+}
+
+Nfa::SymbolId DfaBuilder::NewSymbol(const std::string& symbol)
+{
+  nfa_.symbols.emplace_back(symbol);
+  symbol_sources_.emplace_back();
+  return static_cast<Nfa::SymbolId>(nfa_.symbols.size() - 1);
+}
+
+void DfaBuilder::Cut(char32_t value)
+{
+  auto piece = pieces_.upper_bound(value);
+  if (piece == pieces_.begin())
+  {
+    return;
+  }
+  --piece;
+  if (piece->first == value || piece->second.high < value)
+  {
+    return;
+  }
+
+  // Narrowing the old Symbol is safe, since every NFA state with a transition on it is reported as changed below.
+  const auto old_symbol = piece->second.symbol;
+  const Piece rest{piece->second.high, NewSymbol(PieceLabel(value, piece->second.high))};
+  piece->second.high = value - 1;
+  nfa_.symbols[old_symbol].assign(PieceLabel(piece->first, value - 1));
+  pieces_.emplace(value, rest);
+
+  auto sources = symbol_sources_[old_symbol];
+  std::sort(sources.begin(), sources.end());
+  sources.erase(std::unique(sources.begin(), sources.end()), sources.end());
+  symbol_sources_[old_symbol] = sources;
+  for (const auto state : sources)
+  {
+    auto& transitions = nfa_.transitions[state];
+    const auto count = transitions.size();
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      if (transitions[i].first == old_symbol)
+      {
+        AddTransition(state, rest.symbol, transitions[i].second);
+      }
+    }
+  }
+}
+
+std::vector<Nfa::SymbolId> DfaBuilder::Pieces(char32_t low, char32_t high, bool add)
+{
+  Cut(low);
+  Cut(high + 1);
+  std::vector<Nfa::SymbolId> symbols;
+  const auto add_piece = [&](char32_t piece_low, char32_t piece_high) {
+    const auto symbol = NewSymbol(PieceLabel(piece_low, piece_high));
+    pieces_.emplace(piece_low, Piece{piece_high, symbol});
+    symbols.push_back(symbol);
+  };
+
+  char32_t next = low;
+  for (auto piece = pieces_.lower_bound(low); piece != pieces_.end() && piece->first <= high; ++piece)
+  {
+    if (add && next < piece->first)
+    {
+      add_piece(next, piece->first - 1);
+    }
+    symbols.push_back(piece->second.symbol);
+    next = piece->second.high + 1;
+  }
+  if (add && next <= high)
+  {
+    add_piece(next, high);
+  }
+  return symbols;
+}
+
+std::vector<Nfa::SymbolId> DfaBuilder::LabelSymbols(const Dfa::Symbol& symbol, bool add)
+{
+  if (const auto range = LabelRange(symbol))
+  {
+    std::vector<Nfa::SymbolId> symbols;
+    for (const auto& [low, high] : RangeValues(*range))
+    {
+      const auto pieces = Pieces(low, high, add);
+      symbols.insert(symbols.end(), pieces.begin(), pieces.end());
+    }
+    return symbols;
+  }
+
+  if (const auto id = symbol_ids_.find(symbol); id != symbol_ids_.end())
+  {
+    return {id->second};
+  }
+  if (!add)
+  {
+    return {};
+  }
+  const auto id = NewSymbol(symbol);
+  symbol_ids_.emplace(symbol, id);
+  return {id};
+}
+
+void DfaBuilder::AddTransition(Nfa::StateId from, Nfa::SymbolId symbol, Nfa::StateId to)
+{
+  if (transition_keys_[from].insert(TransitionKey(symbol, to)).second)
+  {
+    nfa_.transitions[from].emplace_back(symbol, to);
+    symbol_sources_[symbol].push_back(from);
+    determinizer_.TransitionsChanged(from);
+  }
+}
+
+bool DfaBuilder::RemoveTransition(Nfa::StateId from, Nfa::SymbolId symbol, Nfa::StateId to)
+{
+  if (transition_keys_[from].erase(TransitionKey(symbol, to)) == 0)
+  {
+    return false;
+  }
+  auto& transitions = nfa_.transitions[from];
+  transitions.erase(std::find(transitions.begin(), transitions.end(), std::make_pair(symbol, to)));
+  determinizer_.TransitionsChanged(from);
+  return true;
+}
+
+}  // namespace dfa
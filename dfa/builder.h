@@ -0,0 +1,171 @@
+/**
+ * @file builder.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "dfa/dfa.h"
+#include "dfa/nfa.h"
+
+namespace dfa
+{
+/**
+ * Builds Dfas out of an NFA that is edited a few transitions at a time, such as a set of rules.
+ *
+ * The builder keeps the subset construction of its NFA between builds. An edit marks the DFA states whose subsets
+ * contain the edited NFA state, and Build expands only those and the states that become reachable from them; the rows
+ * of all other states are reused. See IncrementalDeterminizer.
+ *
+ * Built Dfas are always determinized, like a Dfa constructed from an NFA: States are named by the NFA states they are
+ * made of, and States that can't be reached are left out.
+ *
+ * Ranges are kept as intervals: the values that transitions are labeled with are split into disjoint pieces, each of
+ * which is one Symbol of the NFA. A range that cuts through a piece splits it in two, and the new piece gets a copy of
+ * every transition on the old one, so a range costs a few pieces however many values it covers.
+ */
+class DfaBuilder
+{
+ public:
+  /**
+   * Starts from an NFA without states.
+   * @param options settings for the Dfas that Build returns; threads and max_dfa_states don't apply
+   */
+  explicit DfaBuilder(const Options& options = Options());
+
+  /**
+   * Starts from the definition in a DFA file, which may be an NFA.
+   * @throws std::runtime_error if the file can't be parsed
+   */
+  explicit DfaBuilder(const std::string& dfa_file_contents, const Options& options = Options());
+
+  /**
+   * Starts from the definition in a JSON file, which may be an NFA.
+   * @throws std::runtime_error if the file can't be parsed
+   */
+  explicit DfaBuilder(const Dfa::Json& dfa_file_contents, const Options& options = Options());
+
+  DfaBuilder(const DfaBuilder&) = delete;
+
+  DfaBuilder& operator=(const DfaBuilder&) = delete;
+
+  /**
+   * Adds a start state. States are created as they are first named.
+   */
+  void AddStartState(const std::string& state);
+
+  /**
+   * Adds a transition, unless it exists already. Its Symbol joins the Alphabet.
+   * @param symbol the Symbol, "epsilon", or a range like "a-z", which adds a transition on each piece in it
+   */
+  void AddTransition(const std::string& from, const Dfa::Symbol& symbol, const std::string& to);
+
+  /**
+   * Removes a transition, or the transitions on each piece of a range. The Alphabet keeps its Symbols.
+   * @return whether a transition existed
+   */
+  bool RemoveTransition(const std::string& from, const Dfa::Symbol& symbol, const std::string& to);
+
+  /**
+   * Makes a state final. This doesn't change the subset construction, so the next Build expands nothing for it.
+   */
+  void AddFinalState(const std::string& state);
+
+  /**
+   * Brings the subset construction up to date with the edits since the last Build, and compiles it.
+   * @throws BudgetExceededError if the Dfa exceeds Options::max_states or Options::max_bytes; the next Build then
+   * expands every state again
+   */
+  Dfa Build();
+
+  /**
+   * Number of DFA states that the last Build expanded.
+   */
+  inline std::size_t ExpandedStates() const noexcept { return expanded_; }
+
+ private:
+  /**
+   * Adds the States, Alphabet, transitions, start State and final States of a parsed definition.
+   */
+  void Add(const Dfa& definition);
+
+  Nfa::StateId StateId(const std::string& state);
+
+  /**
+   * A run of values that is one Symbol of the NFA. Pieces are keyed by their first value, in a space where scalar
+   * values are themselves and bytes from 0x80 up come after U+10FFFF, since they are different Symbols.
+   */
+  struct Piece
+  {
+    char32_t high;
+    Nfa::SymbolId symbol;
+  };
+
+  /**
+   * Appends a Symbol to the NFA.
+   */
+  Nfa::SymbolId NewSymbol(const std::string& symbol);
+
+  /**
+   * Splits the piece that covers a value, if the value isn't its first one. The piece from the value on gets a new
+   * Symbol, and every NFA state with a transition on the old one gets the same transition on it.
+   */
+  void Cut(char32_t value);
+
+  /**
+   * The Symbols of the pieces that make up [low, high], splitting the pieces that stick out.
+   * @param add whether to add pieces for the values that aren't covered yet
+   */
+  std::vector<Nfa::SymbolId> Pieces(char32_t low, char32_t high, bool add);
+
+  /**
+   * The Symbols that a label stands for, which are pieces if it is a single value or a range.
+   * @param add whether to create the Symbols that don't exist yet
+   */
+  std::vector<Nfa::SymbolId> LabelSymbols(const Dfa::Symbol& symbol, bool add);
+
+  void AddTransition(Nfa::StateId from, Nfa::SymbolId symbol, Nfa::StateId to);
+
+  bool RemoveTransition(Nfa::StateId from, Nfa::SymbolId symbol, Nfa::StateId to);
+
+  Options options_;
+
+  Nfa nfa_;
+
+  IncrementalDeterminizer determinizer_{nfa_};
+
+  Dfa::Alphabet alphabet_;
+
+  std::unordered_map<std::string, Nfa::StateId> state_ids_;
+
+  /**
+   * Symbols of several bytes that are not scalar values, like "GET".
+   */
+  std::unordered_map<std::string, Nfa::SymbolId> symbol_ids_;
+
+  std::map<char32_t, Piece> pieces_;
+
+  /**
+   * The NFA states that have had a transition on each Symbol, which Cut copies transitions of. May hold a state more
+   * than once, or states whose transitions were removed since.
+   */
+  std::vector<std::vector<Nfa::StateId>> symbol_sources_;
+
+  /**
+   * The non-epsilon transitions of each NFA state, as (symbol << 32) | target, to find existing ones quickly.
+   */
+  std::vector<std::unordered_set<std::uint64_t>> transition_keys_;
+
+  std::size_t expanded_ = 0;
+};
+
+}  // namespace dfa
@@ -0,0 +1,107 @@
+/**
+ * @file client.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "client.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+namespace dfa
+{
+Client::Client(const std::filesystem::path& socket_path)
+{
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  const std::string& native_path = socket_path.native();
+  if (native_path.size() >= sizeof(address.sun_path))
+  {
+    throw std::system_error(std::make_error_code(std::errc::filename_too_long), "Socket path too long");
+  }
+  std::memcpy(address.sun_path, native_path.c_str(), native_path.size() + 1);
+
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0)
+  {
+    throw std::system_error(errno, std::generic_category(), "socket");
+  }
+  if (connect(fd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+  {
+    const int error = errno;
+    close(fd_);
+    throw std::system_error(error, std::generic_category(), "connect");
+  }
+}
+
+Client::~Client() { close(fd_); }
+
+std::vector<Dfa::Acceptance> Client::Classify(const std::vector<std::string>& records, std::uint32_t automaton)
+{
+  buffer_.clear();
+  AppendRequest(automaton, records, buffer_);
+  SendAll(buffer_);
+
+  char header[kFrameHeaderSize];
+  ReceiveAll(header, sizeof(header));
+  buffer_.resize(FrameSize(header));
+  ReceiveAll(buffer_.data(), buffer_.size());
+
+  std::vector<Dfa::Acceptance> verdicts;
+  switch (ParseResponse(buffer_, verdicts))
+  {
+    case BATCH_OK:
+      return verdicts;
+    case UNKNOWN_AUTOMATON:
+      throw std::runtime_error("Server has no automaton " + std::to_string(automaton) + ".");
+    default:
+      throw std::runtime_error("Server rejected the batch as malformed.");
+  }
+}
+
+void Client::SendAll(const std::string& bytes)
+{
+  for (std::size_t offset = 0; offset < bytes.size();)
+  {
+    const ssize_t sent = send(fd_, bytes.data() + offset, bytes.size() - offset, MSG_NOSIGNAL);
+    if (sent < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      throw std::system_error(errno, std::generic_category(), "send");
+    }
+    offset += static_cast<std::size_t>(sent);
+  }
+}
+
+void Client::ReceiveAll(char* bytes, std::size_t size)
+{
+  for (std::size_t offset = 0; offset < size;)
+  {
+    const ssize_t received = recv(fd_, bytes + offset, size - offset, 0);
+    if (received == 0)
+    {
+      throw std::system_error(std::make_error_code(std::errc::connection_reset), "Server closed the connection");
+    }
+    if (received < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      throw std::system_error(errno, std::generic_category(), "recv");
+    }
+    offset += static_cast<std::size_t>(received);
+  }
+}
+
+}  // namespace dfa
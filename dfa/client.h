@@ -0,0 +1,55 @@
+/**
+ * @file client.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "dfa/protocol.h"
+
+namespace dfa
+{
+/**
+ * A blocking connection to a Server.
+ */
+class Client
+{
+ public:
+  /**
+   * Connects to a Server.
+   * @throws std::system_error if the connection fails
+   */
+  explicit Client(const std::filesystem::path& socket_path);
+
+  ~Client();
+
+  Client(const Client&) = delete;
+  Client& operator=(const Client&) = delete;
+
+  /**
+   * Matches a batch of records on the Server.
+   * @param records the input Languages
+   * @param automaton index of the automaton to match against, in the order the Server was given them
+   * @return the Acceptance of each record, in order
+   * @throws std::system_error if the connection fails
+   * @throws std::runtime_error if the Server rejects the batch
+   */
+  std::vector<Dfa::Acceptance> Classify(const std::vector<std::string>& records, std::uint32_t automaton = 0);
+
+ private:
+  void SendAll(const std::string& bytes);
+
+  void ReceiveAll(char* bytes, std::size_t size);
+
+  int fd_;
+
+  std::string buffer_;
+};
+
+}  // namespace dfa
@@ -0,0 +1,1071 @@
+/**
+ * @file compiled_dfa.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "compiled_dfa.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+namespace dfa
+{
+namespace
+{
+constexpr std::size_t kNumBytes = 256;
+
+/**
+ * Compiled DFA files start with this, followed by a FileHeader.
+ */
+constexpr char kFileMagic[8] = {'D', 'F', 'A', 'T', 'A', 'B', 'L', 'E'};
+
+constexpr std::uint32_t kFileVersion = 2;
+
+/**
+ * The fixed-size part of a compiled DFA file. It is followed by:
+ *  - the byte class of each of the 256 bytes, one byte each
+ *  - the table, num_states x num_classes 32-bit targets
+ *  - the ACCEPTING and PARTIAL flags of each state, one byte each
+ *  - the End of each state, 32 bits each (since version 2)
+ *  - the name of each state, as a 32-bit length followed by its bytes
+ *
+ * The other flags and the self-loop ranges are derived again when loading.
+ */
+struct FileHeader
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t start;
+  std::uint64_t num_states;
+  std::uint32_t num_classes;
+  std::uint32_t reserved;
+};
+
+template <typename T>
+void WriteRaw(std::ostream& out, const T* data, std::size_t count)
+{
+  out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(sizeof(T) * count));
+}
+
+template <typename T>
+void ReadRaw(std::istream& in, T* data, std::size_t count)
+{
+  if (!in.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(sizeof(T) * count)))
+  {
+    throw std::runtime_error("Compiled DFA file is truncated.");
+  }
+}
+
+inline bool InRanges(std::uint8_t count, const std::array<std::uint8_t, CompiledDfa::kMaxLoopRanges>& low,
+                     const std::array<std::uint8_t, CompiledDfa::kMaxLoopRanges>& width, unsigned char byte)
+{
+  for (std::uint8_t i = 0; i < count; ++i)
+  {
+    if (static_cast<std::uint8_t>(byte - low[i]) <= width[i])
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+using StateId = CompiledDfa::StateId;
+
+/**
+ * Stands for missing transitions and invalid bytes when walking two tables at once. It never accepts, and every byte
+ * leads back to it.
+ */
+constexpr StateId kSink = CompiledDfa::kNoTransition;
+
+inline StateId Step(const CompiledDfa& table, StateId state, unsigned char byte)
+{
+  if (state == kSink)
+  {
+    return kSink;
+  }
+  const StateId next = table.Next(state, byte);
+  return next >= CompiledDfa::kFirstSentinel ? kSink : next;
+}
+
+inline bool Accepting(const CompiledDfa& table, StateId state) { return state != kSink && table.IsAccepting(state); }
+
+/**
+ * Whether no string leads from the state to acceptance.
+ */
+inline bool Dead(const CompiledDfa& table, StateId state)
+{
+  return state == kSink || (table.Flags(state) & CompiledDfa::DEAD) != 0;
+}
+
+/**
+ * The smallest byte of each class of bytes that both tables treat alike, in ascending order.
+ */
+std::vector<unsigned char> JointBytes(const CompiledDfa& a, const CompiledDfa& b)
+{
+  std::vector<bool> seen(a.NumClasses() * b.NumClasses());
+  std::vector<unsigned char> bytes;
+  for (std::size_t byte = 0; byte < kNumBytes; ++byte)
+  {
+    const auto c = static_cast<unsigned char>(byte);
+    const std::size_t joint = a.ByteClass(c) * b.NumClasses() + b.ByteClass(c);
+    if (!seen[joint])
+    {
+      seen[joint] = true;
+      bytes.push_back(c);
+    }
+  }
+  return bytes;
+}
+
+/**
+ * Set of state pairs packed into 64-bit keys, with open addressing.
+ */
+class PairSet
+{
+ public:
+  static std::uint64_t Key(StateId a, StateId b) { return (static_cast<std::uint64_t>(a) << 32U) | b; }
+
+  /**
+   * @return whether the key wasn't in the set yet
+   */
+  bool Insert(std::uint64_t key)
+  {
+    // The empty slot marker can't be stored, so it is tracked apart.
+    if (key == kEmpty)
+    {
+      return !std::exchange(has_empty_key_, true);
+    }
+    if ((size_ + 1) * 2 > slots_.size())
+    {
+      Grow();
+    }
+    return InsertSlot(key);
+  }
+
+ private:
+  static constexpr std::uint64_t kEmpty = ~std::uint64_t{0};
+
+  static std::size_t Hash(std::uint64_t key)
+  {
+    key ^= key >> 33U;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33U;
+    return static_cast<std::size_t>(key);
+  }
+
+  bool InsertSlot(std::uint64_t key)
+  {
+    const std::size_t mask = slots_.size() - 1;
+    for (std::size_t i = Hash(key) & mask;; i = (i + 1) & mask)
+    {
+      if (slots_[i] == kEmpty)
+      {
+        slots_[i] = key;
+        ++size_;
+        return true;
+      }
+      if (slots_[i] == key)
+      {
+        return false;
+      }
+    }
+  }
+
+  void Grow()
+  {
+    std::vector<std::uint64_t> old(std::max<std::size_t>(64, slots_.size() * 2), kEmpty);
+    old.swap(slots_);
+    size_ = 0;
+    for (const auto key : old)
+    {
+      if (key != kEmpty)
+      {
+        InsertSlot(key);
+      }
+    }
+  }
+
+  std::vector<std::uint64_t> slots_;
+
+  std::size_t size_ = 0;
+
+  bool has_empty_key_ = false;
+};
+
+/**
+ * Searches the product of two tables breadth-first, following bytes in ascending order.
+ * @param differs whether a pair of states is a counterexample, given whether each of them accepts
+ * @param prune whether no counterexample is reachable from a pair of states
+ * @return a shortest string that leads to a counterexample, if there is one
+ */
+template <typename Differs, typename Prune>
+std::optional<std::string> FindDifference(const CompiledDfa& a, const CompiledDfa& b, Differs differs, Prune prune)
+{
+  struct Node
+  {
+    StateId a;
+    StateId b;
+    std::uint32_t parent;
+    unsigned char byte;
+  };
+
+  const auto bytes = JointBytes(a, b);
+  PairSet visited;
+  std::vector<Node> queue;
+  queue.push_back({a.Start(), b.Start(), 0, 0});
+  visited.Insert(PairSet::Key(a.Start(), b.Start()));
+
+  for (std::size_t i = 0; i < queue.size(); ++i)
+  {
+    const Node node = queue[i];
+    if (differs(Accepting(a, node.a), Accepting(b, node.b)))
+    {
+      std::string word;
+      for (std::size_t j = i; j != 0; j = queue[j].parent)
+      {
+        word += static_cast<char>(queue[j].byte);
+      }
+      std::reverse(word.begin(), word.end());
+      return word;
+    }
+    if (prune(node.a, node.b))
+    {
+      continue;
+    }
+
+    for (const auto byte : bytes)
+    {
+      const StateId next_a = Step(a, node.a, byte);
+      const StateId next_b = Step(b, node.b, byte);
+      if (visited.Insert(PairSet::Key(next_a, next_b)))
+      {
+        queue.push_back({next_a, next_b, static_cast<std::uint32_t>(i), byte});
+      }
+    }
+  }
+  return std::nullopt;
+}
+}  // namespace
+
+bool CompiledDfa::ByteRanges::Assign(const std::array<bool, 256>& bytes)
+{
+  count = 0;
+  for (std::size_t b = 0; b < kNumBytes;)
+  {
+    if (!bytes[b])
+    {
+      ++b;
+      continue;
+    }
+
+    std::size_t e = b;
+    while (e + 1 < kNumBytes && bytes[e + 1])
+    {
+      ++e;
+    }
+
+    if (count == kMaxLoopRanges)
+    {
+      count = 0;
+      return false;
+    }
+
+    low[count] = static_cast<std::uint8_t>(b);
+    width[count] = static_cast<std::uint8_t>(e - b);
+    ++count;
+    b = e + 1;
+  }
+  return true;
+}
+
+CompiledDfa::CompiledDfa(const StateId* byte_table, const std::vector<bool>& accepting, StateId start,
+                         std::vector<std::string> names, const std::vector<StateId>& ends)
+    : start_(start), names_(std::move(names))
+{
+  const std::size_t num_states = accepting.size();
+  flags_.resize(num_states);
+  for (std::size_t s = 0; s < num_states; ++s)
+  {
+    const StateId end = ends.empty() ? static_cast<StateId>(s) : ends[s];
+    flags_[s] = end < kFirstSentinel && accepting[end] ? ACCEPTING : 0;
+    flags_[s] |= end != s ? PARTIAL : 0;
+  }
+  if (std::any_of(flags_.begin(), flags_.end(), [](std::uint8_t flags) { return (flags & PARTIAL) != 0; }))
+  {
+    ends_ = ends;
+  }
+
+  ComputeByteClasses(byte_table);
+  FindAlphabet();
+  AnalyzeSinks();
+  AnalyzeSelfLoops();
+  ChooseFormat();
+}
+
+void CompiledDfa::ComputeByteClasses(const StateId* byte_table)
+{
+  const std::size_t num_states = flags_.size();
+
+  // Refine the partition of bytes one row at a time: two bytes stay in the same class only if they have the same
+  // target in every row seen so far. Classes are numbered in order of their first byte. (class, target) keys are
+  // numbered through a small open-addressing table that is reused for every row, so this doesn't allocate.
+  constexpr std::size_t kSlots = 2 * kNumBytes;
+  constexpr unsigned kSlotBits = 9;
+  std::array<std::uint64_t, kSlots> keys{};
+  std::array<std::uint16_t, kSlots> values{};
+  std::array<std::uint32_t, kSlots> stamps{};
+
+  std::array<std::uint16_t, 256> classes{};
+  std::size_t num_classes = 1;
+  for (std::size_t s = 0; s < num_states && num_classes < kNumBytes; ++s)
+  {
+    const auto stamp = static_cast<std::uint32_t>(s + 1);
+    std::uint16_t count = 0;
+    const StateId* row = &byte_table[s * kNumBytes];
+    for (std::size_t b = 0; b < kNumBytes; ++b)
+    {
+      const std::uint64_t key = (static_cast<std::uint64_t>(classes[b]) << 32U) | row[b];
+      std::size_t slot = (key * 0x9E3779B97F4A7C15ULL) >> (64U - kSlotBits);
+      while (stamps[slot] == stamp && keys[slot] != key)
+      {
+        slot = (slot + 1) % kSlots;
+      }
+      if (stamps[slot] != stamp)
+      {
+        stamps[slot] = stamp;
+        keys[slot] = key;
+        values[slot] = count++;
+      }
+      classes[b] = values[slot];
+    }
+    num_classes = count;
+  }
+
+  num_classes_ = num_states == 0 ? 0 : num_classes;
+  std::vector<std::size_t> representatives(num_classes_, kNumBytes);
+  for (std::size_t b = 0; b < kNumBytes; ++b)
+  {
+    byte_classes_[b] = static_cast<std::uint8_t>(classes[b]);
+    if (num_classes_ != 0 && representatives[classes[b]] == kNumBytes)
+    {
+      representatives[classes[b]] = b;
+    }
+  }
+
+  table_.resize(num_states * num_classes_);
+  for (std::size_t s = 0; s < num_states; ++s)
+  {
+    for (std::size_t c = 0; c < num_classes_; ++c)
+    {
+      table_[s * num_classes_ + c] = byte_table[s * kNumBytes + representatives[c]];
+    }
+  }
+}
+
+void CompiledDfa::FindAlphabet()
+{
+  symbols_are_bytes_ = ends_.empty();
+  for (std::size_t b = 0; b < kNumBytes; ++b)
+  {
+    const StateId target = flags_.empty() ? kInvalidSymbol : Target(start_, byte_classes_[b]);
+    alphabet_[b] = target != kInvalidSymbol && (target >= kFirstSentinel || (flags_[target] & PARTIAL) == 0);
+  }
+  alphabet_fits_ranges_ = alphabet_ranges_.Assign(alphabet_);
+}
+
+void CompiledDfa::AnalyzeSinks()
+{
+  const std::size_t num_states = flags_.size();
+
+  // Reverse edges over alphabet bytes, in compressed row form.
+  std::vector<std::size_t> reverse_begin(num_states + 1, 0);
+  for (std::size_t s = 0; s < num_states; ++s)
+  {
+    for (std::size_t c = 0; c < num_classes_; ++c)
+    {
+      const StateId t = Target(s, c);
+      if (t < kFirstSentinel)
+      {
+        ++reverse_begin[t + 1];
+      }
+    }
+  }
+  for (std::size_t s = 0; s < num_states; ++s)
+  {
+    reverse_begin[s + 1] += reverse_begin[s];
+  }
+  std::vector<StateId> reverse(reverse_begin.back());
+  {
+    std::vector<std::size_t> fill(reverse_begin.begin(), reverse_begin.end() - 1);
+    for (std::size_t s = 0; s < num_states; ++s)
+    {
+      for (std::size_t c = 0; c < num_classes_; ++c)
+      {
+        const StateId t = Target(s, c);
+        if (t < kFirstSentinel)
+        {
+          reverse[fill[t]++] = static_cast<StateId>(s);
+        }
+      }
+    }
+  }
+
+  // Computes the largest subset of the candidates that is closed under every alphabet byte, by repeatedly removing
+  // candidates that can leave the subset (or have no transition at all). Bytes that are invalid in a state don't
+  // count, since the bytes that a PARTIAL state accepts depend on the Symbol it is in.
+  const auto close = [&](std::vector<bool>& members) {
+    std::vector<StateId> removed;
+    for (std::size_t s = 0; s < num_states; ++s)
+    {
+      if (!members[s])
+      {
+        continue;
+      }
+      for (std::size_t c = 0; c < num_classes_; ++c)
+      {
+        const StateId t = Target(s, c);
+        if (t == kInvalidSymbol)
+        {
+          continue;
+        }
+        if (t == kNoTransition || !members[t])
+        {
+          members[s] = false;
+          removed.push_back(static_cast<StateId>(s));
+          break;
+        }
+      }
+    }
+    while (!removed.empty())
+    {
+      const StateId t = removed.back();
+      removed.pop_back();
+      for (std::size_t i = reverse_begin[t]; i < reverse_begin[t + 1]; ++i)
+      {
+        if (members[reverse[i]])
+        {
+          members[reverse[i]] = false;
+          removed.push_back(reverse[i]);
+        }
+      }
+    }
+  };
+
+  // Dead states: closed states from which no final state can be reached.
+  std::vector<bool> closed(num_states, true);
+  close(closed);
+
+  std::vector<bool> reaches_final(num_states, false);
+  std::vector<StateId> stack;
+  for (std::size_t s = 0; s < num_states; ++s)
+  {
+    if (IsAccepting(static_cast<StateId>(s)))
+    {
+      reaches_final[s] = true;
+      stack.push_back(static_cast<StateId>(s));
+    }
+  }
+  while (!stack.empty())
+  {
+    const StateId t = stack.back();
+    stack.pop_back();
+    for (std::size_t i = reverse_begin[t]; i < reverse_begin[t + 1]; ++i)
+    {
+      if (!reaches_final[reverse[i]])
+      {
+        reaches_final[reverse[i]] = true;
+        stack.push_back(reverse[i]);
+      }
+    }
+  }
+
+  // Absorbing states: closed subset of the final states.
+  std::vector<bool> absorbing(num_states);
+  for (std::size_t s = 0; s < num_states; ++s)
+  {
+    absorbing[s] = IsAccepting(static_cast<StateId>(s));
+  }
+  close(absorbing);
+
+  for (std::size_t s = 0; s < num_states; ++s)
+  {
+    if (closed[s] && !reaches_final[s])
+    {
+      flags_[s] |= DEAD;
+    }
+    if (absorbing[s])
+    {
+      flags_[s] |= ABSORBING;
+    }
+  }
+}
+
+void CompiledDfa::AnalyzeSelfLoops()
+{
+  const std::size_t num_states = flags_.size();
+  loop_index_.assign(num_states, 0);
+  loops_.clear();
+
+  for (std::size_t s = 0; s < num_states; ++s)
+  {
+    // Matching stops at DEAD and ABSORBING states, unless their input still has to be checked for whole Symbols.
+    if (symbols_are_bytes_ && (flags_[s] & (DEAD | ABSORBING)) != 0)
+    {
+      continue;
+    }
+
+    std::array<bool, 256> loop_bytes{};
+    bool any = false;
+    for (std::size_t b = 0; b < kNumBytes; ++b)
+    {
+      loop_bytes[b] = Target(s, byte_classes_[b]) == s;
+      any = any || loop_bytes[b];
+    }
+
+    ByteRanges ranges;
+    if (any && ranges.Assign(loop_bytes))
+    {
+      flags_[s] |= SELF_LOOP;
+      loop_index_[s] = static_cast<std::uint32_t>(loops_.size());
+      loops_.push_back(ranges);
+    }
+  }
+}
+
+void CompiledDfa::SetFormat(Format format)
+{
+  if (format == format_)
+  {
+    return;
+  }
+
+  if (format == COMB)
+  {
+    Pack(ChooseFallbacks());
+    format_ = COMB;
+    TableVector<StateId>().swap(table_);
+    return;
+  }
+
+  TableVector<StateId> table(flags_.size() * num_classes_);
+  for (std::size_t s = 0; s < flags_.size(); ++s)
+  {
+    for (std::size_t c = 0; c < num_classes_; ++c)
+    {
+      table[s * num_classes_ + c] = Target(s, c);
+    }
+  }
+  table_.swap(table);
+  format_ = DENSE;
+  TableVector<CombRow>().swap(comb_rows_);
+  TableVector<CombEntry>().swap(comb_);
+}
+
+std::size_t CompiledDfa::TableBytes() const noexcept
+{
+  return format_ == DENSE ? table_.size() * sizeof(StateId)
+                          : comb_rows_.size() * sizeof(CombRow) + comb_.size() * sizeof(CombEntry);
+}
+
+std::size_t CompiledDfa::StateBytes() const noexcept
+{
+  return flags_.capacity() * sizeof(std::uint8_t) + ends_.capacity() * sizeof(StateId) +
+         loops_.capacity() * sizeof(ByteRanges) + loop_index_.capacity() * sizeof(std::uint32_t);
+}
+
+std::size_t CompiledDfa::NameBytes() const noexcept
+{
+  const std::size_t inline_capacity = std::string().capacity();
+  std::size_t bytes = names_.capacity() * sizeof(std::string);
+  for (const auto& name : names_)
+  {
+    bytes += name.capacity() > inline_capacity ? name.capacity() + 1 : 0;
+  }
+  return bytes;
+}
+
+void CompiledDfa::ChooseFormat()
+{
+  // Bases are 32-bit. A comb never has more slots than the dense table has targets, plus one row.
+  if (table_.size() >= std::numeric_limits<std::uint32_t>::max() - kNumBytes)
+  {
+    return;
+  }
+
+  // A comb takes at least one slot per entry, and at least one row, however well they are packed.
+  const auto columns = ChooseFallbacks();
+  std::size_t entries = 0;
+  for (const auto& row_columns : columns)
+  {
+    entries += row_columns.size();
+  }
+  const std::size_t dense_bytes = table_.size() * sizeof(StateId);
+  if (2 * (comb_rows_.size() * sizeof(CombRow) + std::max(entries, num_classes_) * sizeof(CombEntry)) >= dense_bytes)
+  {
+    TableVector<CombRow>().swap(comb_rows_);
+    return;
+  }
+
+  Pack(columns);
+  const std::size_t comb_bytes = comb_rows_.size() * sizeof(CombRow) + comb_.size() * sizeof(CombEntry);
+  if (2 * comb_bytes < dense_bytes)
+  {
+    format_ = COMB;
+    TableVector<StateId>().swap(table_);
+  }
+  else
+  {
+    TableVector<CombRow>().swap(comb_rows_);
+    TableVector<CombEntry>().swap(comb_);
+  }
+}
+
+std::vector<std::vector<std::uint16_t>> CompiledDfa::ChooseFallbacks()
+{
+  const std::size_t num_states = flags_.size();
+  if (table_.size() >= std::numeric_limits<std::uint32_t>::max() - kNumBytes)
+  {
+    throw std::length_error("Table is too large to be comb-packed.");
+  }
+
+  // Each row falls back to its most common target, which is usually a dead state or kNoTransition, and only keeps the
+  // classes that lead elsewhere.
+  comb_rows_.assign(num_states, CombRow{0, kNoTransition});
+  std::vector<std::vector<std::uint16_t>> columns(num_states);
+  std::vector<StateId> sorted;
+  for (std::size_t s = 0; s < num_states; ++s)
+  {
+    const StateId* row = &table_[s * num_classes_];
+    sorted.assign(row, row + num_classes_);
+    std::sort(sorted.begin(), sorted.end());
+    std::size_t most = 0;
+    for (std::size_t i = 0, j = 0; i < sorted.size(); i = j)
+    {
+      while (j < sorted.size() && sorted[j] == sorted[i])
+      {
+        ++j;
+      }
+      if (j - i > most)
+      {
+        most = j - i;
+        comb_rows_[s].fallback = sorted[i];
+      }
+    }
+
+    for (std::size_t c = 0; c < num_classes_; ++c)
+    {
+      if (row[c] != comb_rows_[s].fallback)
+      {
+        columns[s].push_back(static_cast<std::uint16_t>(c));
+      }
+    }
+  }
+  return columns;
+}
+
+void CompiledDfa::Pack(const std::vector<std::vector<std::uint16_t>>& columns)
+{
+  constexpr std::size_t kWordBits = 64;
+  const std::size_t num_states = flags_.size();
+
+  // First fit, fullest rows first, since they are the hardest to place once the comb fills up. Taken slots are kept
+  // in a bitmap, so that only bases where the row's first class lands on a free slot are tried, and runs of taken
+  // slots are skipped a word at a time. Every slot before first_free is taken.
+  std::vector<StateId> order(num_states);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&columns](StateId a, StateId b) { return columns[a].size() > columns[b].size(); });
+
+  std::vector<std::uint64_t> taken;
+  const auto is_taken = [&taken](std::size_t slot) {
+    return slot / kWordBits < taken.size() && ((taken[slot / kWordBits] >> (slot % kWordBits)) & 1U) != 0;
+  };
+  const auto next_free = [&taken](std::size_t slot) {
+    for (std::size_t word = slot / kWordBits; word < taken.size(); ++word)
+    {
+      std::uint64_t free = ~taken[word];
+      if (word == slot / kWordBits)
+      {
+        free &= ~std::uint64_t{0} << (slot % kWordBits);
+      }
+      if (free != 0)
+      {
+        return word * kWordBits + static_cast<std::size_t>(__builtin_ctzll(free));
+      }
+    }
+    return std::max(slot, taken.size() * kWordBits);
+  };
+
+  comb_.assign(num_classes_, CombEntry{kNoTransition, kNoTransition});
+  std::size_t first_free = 0;
+  for (const auto s : order)
+  {
+    const auto& row_columns = columns[s];
+    if (row_columns.empty())
+    {
+      continue;
+    }
+
+    const std::size_t front = row_columns.front();
+    std::size_t slot = next_free(std::max(first_free, front));
+    while (std::any_of(row_columns.begin() + 1, row_columns.end(),
+                       [&](std::uint16_t c) { return is_taken(slot - front + c); }))
+    {
+      slot = next_free(slot + 1);
+    }
+    const std::size_t base = slot - front;
+
+    comb_.resize(std::max(comb_.size(), base + num_classes_), CombEntry{kNoTransition, kNoTransition});
+    taken.resize((comb_.size() + kWordBits - 1) / kWordBits);
+    for (const auto c : row_columns)
+    {
+      comb_[base + c] = CombEntry{s, table_[s * num_classes_ + c]};
+      taken[(base + c) / kWordBits] |= std::uint64_t{1} << ((base + c) % kWordBits);
+    }
+    comb_rows_[s].base = static_cast<std::uint32_t>(base);
+    first_free = next_free(first_free);
+  }
+}
+
+const char* CompiledDfa::SkipRanges(const ByteRanges& ranges, const char* begin, const char* end) noexcept
+{
+  const char* it = begin;
+
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i low[kMaxLoopRanges];
+  __m128i width[kMaxLoopRanges];
+  for (std::uint8_t i = 0; i < ranges.count; ++i)
+  {
+    low[i] = _mm_set1_epi8(static_cast<char>(ranges.low[i]));
+    width[i] = _mm_set1_epi8(static_cast<char>(ranges.width[i]));
+  }
+
+  // A byte is in a range if (byte - low) <= width as unsigned, which is when the saturating subtraction is zero.
+  constexpr int kBlock = 16;
+  constexpr int kAllInside = 0xFFFF;
+  while (end - it >= kBlock)
+  {
+    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+    __m128i inside = zero;
+    for (std::uint8_t i = 0; i < ranges.count; ++i)
+    {
+      const __m128i offset = _mm_sub_epi8(bytes, low[i]);
+      inside = _mm_or_si128(inside, _mm_cmpeq_epi8(_mm_subs_epu8(offset, width[i]), zero));
+    }
+
+    const int mask = _mm_movemask_epi8(inside);
+    if (mask != kAllInside)
+    {
+      return it + __builtin_ctz(static_cast<unsigned>(~mask));
+    }
+    it += kBlock;
+  }
+#endif
+
+  while (it != end && InRanges(ranges.count, ranges.low, ranges.width, static_cast<unsigned char>(*it)))
+  {
+    ++it;
+  }
+  return it;
+}
+
+const char* CompiledDfa::SkipLoop(StateId state, const char* begin, const char* end) const noexcept
+{
+  return SkipRanges(loops_[loop_index_[state]], begin, end);
+}
+
+const char* CompiledDfa::SkipAlphabet(const char* begin, const char* end) const noexcept
+{
+  if (alphabet_fits_ranges_)
+  {
+    return SkipRanges(alphabet_ranges_, begin, end);
+  }
+
+  const char* it = begin;
+  while (it != end && alphabet_[static_cast<unsigned char>(*it)])
+  {
+    ++it;
+  }
+  return it;
+}
+
+bool CompiledDfa::Equivalent(const CompiledDfa& other, std::string* counterexample) const
+{
+  // Union-find over the states of both tables, with one shared node for kSink.
+  const auto sink = static_cast<std::uint32_t>(NumStates() + other.NumStates());
+  const auto node_of_this = [&](StateId state) { return state == kSink ? sink : state; };
+  const auto node_of_other = [&](StateId state) {
+    return state == kSink ? sink : static_cast<std::uint32_t>(NumStates()) + state;
+  };
+  std::vector<std::uint32_t> parent(sink + 1);
+  std::iota(parent.begin(), parent.end(), 0);
+  std::vector<std::uint8_t> rank(sink + 1);
+  const auto find = [&parent](std::uint32_t node) {
+    while (parent[node] != node)
+    {
+      parent[node] = parent[parent[node]];
+      node = parent[node];
+    }
+    return node;
+  };
+
+  // Pairs of states are assumed equivalent as soon as they are merged. Every merge joins two classes, so at most
+  // NumStates() + other.NumStates() pairs are ever expanded.
+  std::vector<std::pair<StateId, StateId>> pending;
+  const auto merge = [&](StateId state, StateId other_state) {
+    auto root = find(node_of_this(state));
+    auto other_root = find(node_of_other(other_state));
+    if (root == other_root)
+    {
+      return;
+    }
+    if (rank[root] < rank[other_root])
+    {
+      std::swap(root, other_root);
+    }
+    parent[other_root] = root;
+    rank[root] += rank[root] == rank[other_root] ? 1 : 0;
+    pending.emplace_back(state, other_state);
+  };
+
+  const auto bytes = JointBytes(*this, other);
+  merge(start_, other.start_);
+  bool equivalent = true;
+  while (!pending.empty())
+  {
+    const auto [state, other_state] = pending.back();
+    pending.pop_back();
+    if (Accepting(*this, state) != Accepting(other, other_state))
+    {
+      equivalent = false;
+      break;
+    }
+    for (const auto byte : bytes)
+    {
+      merge(Step(*this, state, byte), Step(other, other_state, byte));
+    }
+  }
+
+  if (!equivalent && counterexample != nullptr)
+  {
+    *counterexample = FindDifference(
+                          *this, other, [](bool accepts, bool other_accepts) { return accepts != other_accepts; },
+                          [&](StateId state, StateId other_state) {
+                            return Dead(*this, state) && Dead(other, other_state);
+                          })
+                          .value();
+  }
+  return equivalent;
+}
+
+bool CompiledDfa::Includes(const CompiledDfa& other, std::string* counterexample) const
+{
+  const auto difference = FindDifference(
+      *this, other, [](bool accepts, bool other_accepts) { return other_accepts && !accepts; },
+      [&other](StateId, StateId other_state) { return Dead(other, other_state); });
+  if (difference && counterexample != nullptr)
+  {
+    *counterexample = *difference;
+  }
+  return !difference;
+}
+
+CompiledDfa CompiledDfa::Renumbered(const std::vector<StateId>& order) const
+{
+  const std::size_t num_states = flags_.size();
+  std::vector<StateId> new_ids(num_states, kNoTransition);
+  if (order.size() != num_states)
+  {
+    throw std::invalid_argument("State order is not a permutation.");
+  }
+  for (std::size_t i = 0; i < order.size(); ++i)
+  {
+    if (order[i] >= num_states || new_ids[order[i]] != kNoTransition)
+    {
+      throw std::invalid_argument("State order is not a permutation.");
+    }
+    new_ids[order[i]] = static_cast<StateId>(i);
+  }
+
+  // Every flag and self-loop depends on a state's row only, so they are moved along with it.
+  CompiledDfa renumbered(*this);
+  renumbered.format_ = DENSE;
+  renumbered.table_.resize(num_states * num_classes_);
+  renumbered.start_ = num_states == 0 ? 0 : new_ids[start_];
+  for (std::size_t i = 0; i < num_states; ++i)
+  {
+    const StateId old = order[i];
+    for (std::size_t c = 0; c < num_classes_; ++c)
+    {
+      const StateId target = Target(old, c);
+      renumbered.table_[i * num_classes_ + c] = target < kFirstSentinel ? new_ids[target] : target;
+    }
+    renumbered.flags_[i] = flags_[old];
+    if (!ends_.empty())
+    {
+      renumbered.ends_[i] = ends_[old] < kFirstSentinel ? new_ids[ends_[old]] : ends_[old];
+    }
+    renumbered.names_[i] = names_[old];
+    renumbered.loop_index_[i] = loop_index_[old];
+  }
+  renumbered.SetFormat(format_);
+  return renumbered;
+}
+
+void CompiledDfa::Save(std::ostream& out) const
+{
+  SaveHeader(out, start_, flags_.size(), num_classes_, byte_classes_);
+  std::vector<StateId> row(num_classes_);
+  for (std::size_t s = 0; s < flags_.size(); ++s)
+  {
+    for (std::size_t c = 0; c < num_classes_; ++c)
+    {
+      row[c] = Target(s, c);
+    }
+    WriteRaw(out, row.data(), row.size());
+  }
+
+  std::vector<std::uint8_t> accepting(flags_.size());
+  for (std::size_t s = 0; s < flags_.size(); ++s)
+  {
+    accepting[s] = flags_[s] & (ACCEPTING | PARTIAL);
+  }
+  WriteRaw(out, accepting.data(), accepting.size());
+  for (std::size_t s = 0; s < flags_.size(); ++s)
+  {
+    const StateId end = End(static_cast<StateId>(s));
+    WriteRaw(out, &end, 1);
+  }
+
+  for (const auto& name : names_)
+  {
+    const auto size = static_cast<std::uint32_t>(name.size());
+    WriteRaw(out, &size, 1);
+    out.write(name.data(), static_cast<std::streamsize>(name.size()));
+  }
+}
+
+void CompiledDfa::SaveHeader(std::ostream& out, StateId start, std::uint64_t num_states, std::size_t num_classes,
+                             const std::array<std::uint8_t, 256>& byte_classes)
+{
+  FileHeader header{};
+  std::memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+  header.version = kFileVersion;
+  header.start = start;
+  header.num_states = num_states;
+  header.num_classes = static_cast<std::uint32_t>(num_classes);
+  WriteRaw(out, &header, 1);
+  WriteRaw(out, byte_classes.data(), byte_classes.size());
+}
+
+CompiledDfa CompiledDfa::Load(std::istream& in)
+{
+  constexpr auto kInvalid = "Invalid compiled DFA file.";
+
+  FileHeader header{};
+  ReadRaw(in, &header, 1);
+  if (std::memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0 || header.version == 0 ||
+      header.version > kFileVersion)
+  {
+    throw std::runtime_error("Not a compiled DFA file, or one of an unsupported version.");
+  }
+  if (header.num_classes > kNumBytes || header.num_states >= kFirstSentinel ||
+      (header.num_states != 0 && (header.start >= header.num_states || header.num_classes == 0)))
+  {
+    throw std::runtime_error(kInvalid);
+  }
+
+  CompiledDfa dfa;
+  dfa.start_ = header.start;
+  dfa.num_classes_ = header.num_classes;
+  const auto num_states = static_cast<std::size_t>(header.num_states);
+  ReadRaw(in, dfa.byte_classes_.data(), dfa.byte_classes_.size());
+  for (const auto byte_class : dfa.byte_classes_)
+  {
+    if (num_states != 0 && byte_class >= dfa.num_classes_)
+    {
+      throw std::runtime_error(kInvalid);
+    }
+  }
+
+  dfa.table_.resize(num_states * dfa.num_classes_);
+  ReadRaw(in, dfa.table_.data(), dfa.table_.size());
+
+  dfa.flags_.resize(num_states);
+  ReadRaw(in, dfa.flags_.data(), dfa.flags_.size());
+  for (auto& flags : dfa.flags_)
+  {
+    flags &= ACCEPTING | PARTIAL;
+  }
+  if (header.version >= 2)
+  {
+    dfa.ends_.resize(num_states);
+    ReadRaw(in, dfa.ends_.data(), dfa.ends_.size());
+  }
+  for (std::size_t s = 0; s < dfa.ends_.size(); ++s)
+  {
+    // Ends of PARTIAL states are whole states or sentinels, and decide whether they accept.
+    const StateId end = dfa.ends_[s];
+    const bool partial = (dfa.flags_[s] & PARTIAL) != 0;
+    if (partial ? (end < kFirstSentinel && (end >= num_states || (dfa.flags_[end] & PARTIAL) != 0 ||
+                                            (dfa.flags_[end] & ACCEPTING) != (dfa.flags_[s] & ACCEPTING)))
+                : end != s)
+    {
+      throw std::runtime_error(kInvalid);
+    }
+  }
+  if (std::any_of(dfa.flags_.begin(), dfa.flags_.end(), [](std::uint8_t flags) { return (flags & PARTIAL) != 0; }))
+  {
+    if (dfa.ends_.empty() || (dfa.flags_[dfa.start_] & PARTIAL) != 0)
+    {
+      throw std::runtime_error(kInvalid);
+    }
+  }
+  else
+  {
+    dfa.ends_.clear();
+  }
+
+  // Whether a byte is part of the alphabet is the same in every row, except in the middle of a Symbol.
+  const auto first_whole =
+      std::find_if(dfa.flags_.begin(), dfa.flags_.end(), [](std::uint8_t flags) { return (flags & PARTIAL) == 0; });
+  const std::size_t reference = static_cast<std::size_t>(first_whole - dfa.flags_.begin()) * dfa.num_classes_;
+  for (std::size_t i = 0; i < dfa.table_.size(); ++i)
+  {
+    const StateId target = dfa.table_[i];
+    if ((target < kFirstSentinel && target >= num_states) ||
+        ((dfa.flags_[i / dfa.num_classes_] & PARTIAL) == 0 &&
+         (target == kInvalidSymbol) != (dfa.table_[reference + i % dfa.num_classes_] == kInvalidSymbol)))
+    {
+      throw std::runtime_error(kInvalid);
+    }
+  }
+
+  dfa.names_.resize(num_states);
+  for (auto& name : dfa.names_)
+  {
+    std::uint32_t size;
+    ReadRaw(in, &size, 1);
+    name.resize(size);
+    ReadRaw(in, name.data(), size);
+  }
+
+  dfa.FindAlphabet();
+  dfa.AnalyzeSinks();
+  dfa.AnalyzeSelfLoops();
+  dfa.ChooseFormat();
+  return dfa;
+}
+
+}  // namespace dfa
@@ -0,0 +1,372 @@
+/**
+ * @file compiled_dfa.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "dfa/huge_pages.h"
+
+namespace dfa
+{
+/**
+ * Dense, integer-indexed form of a DFA that is used for matching.
+ *
+ * Input bytes are mapped onto equivalence classes (bytes that behave identically in every state), and each state owns
+ * one row of targets indexed by class. The constructor also analyzes the table for states whose verdict can be decided
+ * without reading every remaining byte, and for states that loop to themselves on a few byte ranges.
+ *
+ * Rows are stored in one of two Formats, whichever suits the table: a dense array, or comb-packed rows that only keep
+ * the targets that differ from their row's default target.
+ */
+class CompiledDfa
+{
+ public:
+  using StateId = std::uint32_t;
+
+  /**
+   * Target of a byte that is part of the alphabet, but has no transition from the current state.
+   */
+  static constexpr StateId kNoTransition = 0xFFFFFFFF;
+
+  /**
+   * Target of a byte that is not part of the alphabet.
+   */
+  static constexpr StateId kInvalidSymbol = 0xFFFFFFFE;
+
+  /**
+   * Targets greater than or equal to this value are not states.
+   */
+  static constexpr StateId kFirstSentinel = kInvalidSymbol;
+
+  /**
+   * The maximum number of byte ranges that a self-loop can be made of and still be scanned with vector instructions.
+   */
+  static constexpr std::size_t kMaxLoopRanges = 4;
+
+  /**
+   * Per-state flags.
+   */
+  enum Flag : std::uint8_t
+  {
+    /**
+     * The state is a final state.
+     */
+    ACCEPTING = 1U << 0U,
+    /**
+     * Every alphabet byte leads to another DEAD state: the input can only be rejected or contain an invalid symbol.
+     */
+    DEAD = 1U << 1U,
+    /**
+     * Every alphabet byte leads to another ABSORBING state: the input can only be accepted or contain an invalid
+     * symbol.
+     */
+    ABSORBING = 1U << 2U,
+    /**
+     * The state loops to itself on at most kMaxLoopRanges byte ranges, so runs of those bytes can be skipped at once.
+     */
+    SELF_LOOP = 1U << 3U,
+    /**
+     * The state is inside a Symbol of several bytes, such as a UTF-8 encoded character or the "GET" of "GET" and
+     * "GETS". Input that ends there amounts to another state; see End. A PARTIAL state is ACCEPTING if that state is.
+     */
+    PARTIAL = 1U << 4U,
+  };
+
+  /**
+   * How the rows of the table are stored.
+   */
+  enum Format : std::uint8_t
+  {
+    /**
+     * NumStates() x NumClasses() targets, one lookup per byte.
+     */
+    DENSE,
+    /**
+     * Row displacement: each row keeps a default target, and only the targets that differ from it are stored, in a
+     * shared array where rows are shifted so that their entries interleave. Each entry records the row that owns it,
+     * which tells apart a stored target from a slot of another row. Takes two dependent lookups per byte, but little
+     * memory for sparse rows.
+     */
+    COMB
+  };
+
+  CompiledDfa() = default;
+
+  /**
+   * Compiles a byte-level transition table.
+   * @param byte_table row-major table of num_states x 256 targets, where each target is either a state or one of
+   * kNoTransition and kInvalidSymbol
+   * @param accepting whether each state is a final state; its size is num_states
+   * @param start the start state
+   * @param names printable name of each state
+   * @param ends the End of each state, or empty if every state is its own; states whose End is another are PARTIAL,
+   * and their accepting entry is ignored
+   */
+  CompiledDfa(const StateId* byte_table, const std::vector<bool>& accepting, StateId start,
+              std::vector<std::string> names, const std::vector<StateId>& ends = {});
+
+  inline StateId Start() const noexcept { return start_; }
+
+  inline std::size_t NumStates() const noexcept { return flags_.size(); }
+
+  inline std::size_t NumClasses() const noexcept { return num_classes_; }
+
+  inline std::uint8_t ByteClass(unsigned char byte) const noexcept { return byte_classes_[byte]; }
+
+  inline StateId Next(StateId state, unsigned char byte) const noexcept { return Target(state, byte_classes_[byte]); }
+
+  inline std::uint8_t Flags(StateId state) const noexcept { return flags_[state]; }
+
+  inline bool IsAccepting(StateId state) const noexcept { return (flags_[state] & ACCEPTING) != 0; }
+
+  /**
+   * The state that input ending in a state amounts to: the state itself, unless it is PARTIAL. Then it is the state
+   * after the Symbols that the remaining bytes split into, or kInvalidSymbol if they don't, or kNoTransition if one
+   * of those Symbols has no transition.
+   */
+  inline StateId End(StateId state) const noexcept { return ends_.empty() ? state : ends_[state]; }
+
+  inline const std::string& Name(StateId state) const noexcept { return names_[state]; }
+
+  /**
+   * Whether a byte is a Symbol by itself. Lead bytes of longer Symbols are not.
+   */
+  inline bool InAlphabet(unsigned char byte) const noexcept { return alphabet_[byte]; }
+
+  /**
+   * Whether every Symbol is a single byte, which is when no state is PARTIAL. Otherwise, DEAD and ABSORBING states
+   * still have to read the rest of the input byte by byte, to check that it is made of Symbols.
+   */
+  inline bool SymbolsAreBytes() const noexcept { return symbols_are_bytes_; }
+
+  inline Format GetFormat() const noexcept { return format_; }
+
+  /**
+   * Stores the rows in another Format. Matching is unaffected.
+   */
+  void SetFormat(Format format);
+
+  /**
+   * Memory taken by the rows in their current Format.
+   */
+  std::size_t TableBytes() const noexcept;
+
+  /**
+   * Memory taken by per-state data other than rows and names: flags, Ends and self-loops.
+   */
+  std::size_t StateBytes() const noexcept;
+
+  /**
+   * Memory taken by state names, including the characters that don't fit in the strings themselves.
+   */
+  std::size_t NameBytes() const noexcept;
+
+  /**
+   * Skips the run of bytes that keep a SELF_LOOP state in place.
+   * @return pointer to the first byte in [begin, end) that leaves the state, or end
+   */
+  const char* SkipLoop(StateId state, const char* begin, const char* end) const noexcept;
+
+  /**
+   * Skips the run of bytes that are part of the alphabet.
+   * @return pointer to the first byte in [begin, end) that is not part of the alphabet, or end
+   */
+  const char* SkipAlphabet(const char* begin, const char* end) const noexcept;
+
+  /**
+   * Checks whether both tables accept the same byte strings.
+   *
+   * Runs Hopcroft and Karp's union-find algorithm, which is near-linear in the number of states. Only if the
+   * languages differ, the product of both tables is searched breadth-first for a shortest counterexample.
+   * @param other the table to compare with
+   * @param counterexample if not null and the languages differ, receives a shortest string that exactly one of the
+   * tables accepts
+   */
+  bool Equivalent(const CompiledDfa& other, std::string* counterexample = nullptr) const;
+
+  /**
+   * Checks whether this table accepts every byte string that other accepts, by searching their product
+   * breadth-first.
+   * @param other the table whose language should be a subset
+   * @param counterexample if not null and the check fails, receives a shortest string that other accepts and this
+   * table doesn't
+   */
+  bool Includes(const CompiledDfa& other, std::string* counterexample = nullptr) const;
+
+  /**
+   * Renumbers states, for instance so that states that are visited together sit in adjacent rows.
+   * @param order the current ID of each new state; a permutation of all states
+   * @return a table that matches exactly like this one
+   * @throws std::invalid_argument if order isn't a permutation
+   */
+  CompiledDfa Renumbered(const std::vector<StateId>& order) const;
+
+  /**
+   * Writes the table in the compiled DFA file format, which keeps its state numbering.
+   *
+   * The format is a header, the byte classes, the table, the flags and the state names, in host byte order. See
+   * compiled_dfa.cc for the details.
+   */
+  void Save(std::ostream& out) const;
+
+  /**
+   * Writes the header and byte classes of a compiled DFA file, for writers that produce the rest of it themselves,
+   * such as DeterminizeOutOfCore. Save follows them with the rows of each state in order, NumClasses() targets each,
+   * then the ACCEPTING and PARTIAL flags of each state as one byte, then the End of each state, then each name as a
+   * 32-bit length followed by its bytes.
+   */
+  static void SaveHeader(std::ostream& out, StateId start, std::uint64_t num_states, std::size_t num_classes,
+                         const std::array<std::uint8_t, 256>& byte_classes);
+
+  /**
+   * Reads a table that Save wrote.
+   * @throws std::runtime_error if the input is not a valid compiled DFA file
+   */
+  static CompiledDfa Load(std::istream& in);
+
+ private:
+  /**
+   * A set of at most kMaxLoopRanges inclusive byte ranges, stored as lower bound and width.
+   */
+  struct ByteRanges
+  {
+    std::uint8_t count = 0;
+    std::array<std::uint8_t, kMaxLoopRanges> low{};
+    std::array<std::uint8_t, kMaxLoopRanges> width{};
+
+    /**
+     * Builds ranges out of a byte set, if it fits.
+     * @return false if the set is made of more than kMaxLoopRanges ranges
+     */
+    bool Assign(const std::array<bool, 256>& bytes);
+  };
+
+  /**
+   * A row of a COMB table.
+   */
+  struct CombRow
+  {
+    /**
+     * Offset of the row into comb_.
+     */
+    std::uint32_t base;
+    /**
+     * Target of every class that has no entry of this row.
+     */
+    StateId fallback;
+  };
+
+  /**
+   * A slot of a COMB table.
+   */
+  struct CombEntry
+  {
+    /**
+     * The state whose row the slot belongs to, or kNoTransition if it is free.
+     */
+    StateId owner;
+    StateId target;
+  };
+
+  inline StateId Target(std::size_t state, std::size_t byte_class) const noexcept
+  {
+    if (format_ == DENSE)
+    {
+      return table_[state * num_classes_ + byte_class];
+    }
+    const CombRow& row = comb_rows_[state];
+    const CombEntry& entry = comb_[row.base + byte_class];
+    return entry.owner == state ? entry.target : row.fallback;
+  }
+
+  static const char* SkipRanges(const ByteRanges& ranges, const char* begin, const char* end) noexcept;
+
+  /**
+   * Picks the COMB Format if it takes less than half the memory of the DENSE one. Tables whose comb can't be that
+   * small, even if it were packed without gaps, aren't packed at all.
+   */
+  void ChooseFormat();
+
+  /**
+   * Sets the fallback of each of comb_rows_ to the most common target of its row in the DENSE table.
+   * @return the classes of each row that don't lead to its fallback, and so need a slot of the comb
+   */
+  std::vector<std::vector<std::uint16_t>> ChooseFallbacks();
+
+  /**
+   * Packs the DENSE table into comb_rows_ and comb_, without releasing it.
+   * @param columns the classes of each row that need a slot, as ChooseFallbacks returns them
+   */
+  void Pack(const std::vector<std::vector<std::uint16_t>>& columns);
+
+  void ComputeByteClasses(const StateId* byte_table);
+
+  void AnalyzeSinks();
+
+  void AnalyzeSelfLoops();
+
+  /**
+   * Derives alphabet_ and symbols_are_bytes_ from the table and the PARTIAL flags.
+   */
+  void FindAlphabet();
+
+  StateId start_ = 0;
+
+  std::size_t num_classes_ = 0;
+
+  std::array<std::uint8_t, 256> byte_classes_{};
+
+  Format format_ = DENSE;
+
+  /**
+   * Row-major table of NumStates() x NumClasses() targets, in the DENSE Format. Tables are allocated with huge pages
+   * if they are large enough; see SetHugePages.
+   */
+  TableVector<StateId> table_;
+
+  /**
+   * Rows and slots of the table in the COMB Format. comb_ extends NumClasses() past the last base, so that every
+   * lookup stays inside.
+   */
+  TableVector<CombRow> comb_rows_;
+
+  TableVector<CombEntry> comb_;
+
+  std::vector<std::uint8_t> flags_;
+
+  /**
+   * End of each state, or empty if no state is PARTIAL.
+   */
+  std::vector<StateId> ends_;
+
+  std::vector<std::string> names_;
+
+  /**
+   * Bytes that are part of the alphabet.
+   */
+  std::array<bool, 256> alphabet_{};
+
+  bool symbols_are_bytes_ = true;
+
+  ByteRanges alphabet_ranges_;
+
+  bool alphabet_fits_ranges_ = false;
+
+  /**
+   * Loop bytes of every SELF_LOOP state, and the index of each state into it.
+   */
+  std::vector<ByteRanges> loops_;
+
+  std::vector<std::uint32_t> loop_index_;
+};
+
+}  // namespace dfa
@@ -6,17 +6,309 @@
 
 #include "dfa.h"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
 #include <iostream>
 #include <iterator>
+#include <memory_resource>
+#include <numeric>
+#include <optional>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "nfa.h"
+#include "numa.h"
+#include "regex.h"
+#include "tokenizer.h"
+#include "utf8.h"
+
 namespace dfa
 {
 namespace
 {
 const Dfa::Symbol kEpsilon = "epsilon";
+
+/**
+ * Splits a string on whitespace, the same way as reading it with std::istream_iterator<std::string>.
+ */
+void SplitTokens(std::string_view str, std::pmr::vector<std::string_view>& tokens)
+{
+  constexpr std::string_view kWhitespace = " \t\n\v\f\r";
+  tokens.clear();
+  for (std::size_t begin = str.find_first_not_of(kWhitespace); begin != std::string_view::npos;)
+  {
+    const std::size_t end = std::min(str.find_first_of(kWhitespace, begin), str.size());
+    tokens.push_back(str.substr(begin, end - begin));
+    begin = str.find_first_not_of(kWhitespace, end);
+  }
+}
+
+constexpr std::size_t kNumBytes = 256;
+
+/**
+ * Hashes States by value, for maps that refer to States owned by a Dfa instead of copying them.
+ */
+struct StatePointerHasher
+{
+  std::size_t operator()(const State* state) const { return StateHasher()(*state); }
+};
+
+/**
+ * Estimated overhead of each element of a hash container: a pointer to the next node, and the cached hash.
+ */
+constexpr std::size_t kNodeBytes = 2 * sizeof(void*);
+
+std::size_t Bytes(const std::string& str);
+
+std::size_t Bytes(const State& state);
+
+std::size_t Bytes(const Dfa::Transitions& transitions);
+
+template <typename Key, typename Value>
+std::size_t Bytes(const std::pair<Key, Value>& element)
+{
+  return Bytes(element.first) + Bytes(element.second);
+}
+
+/**
+ * Estimated memory taken by the buckets and elements of a hash container, but not the container itself.
+ */
+template <typename Container>
+std::size_t HashBytes(const Container& container)
+{
+  std::size_t bytes = container.bucket_count() * sizeof(void*);
+  for (const auto& element : container)
+  {
+    bytes += kNodeBytes + Bytes(element);
+  }
+  return bytes;
+}
+
+std::size_t Bytes(const std::string& str)
+{
+  // Short strings are stored inside the string itself.
+  return sizeof(std::string) + (str.capacity() > std::string().capacity() ? str.capacity() + 1 : 0);
+}
+
+std::size_t Bytes(const State& state) { return sizeof(State) + HashBytes(state); }
+
+std::size_t Bytes(const Dfa::Transitions& transitions) { return sizeof(Dfa::Transitions) + HashBytes(transitions); }
+
+struct StatePointerEqual
+{
+  bool operator()(const State* lhs, const State* rhs) const { return *lhs == *rhs; }
+};
+
+/**
+ * Runs a phase of construction, and adds how long it took to a member of BuildTimes.
+ */
+template <typename Phase>
+void Timed(std::chrono::nanoseconds& total, Phase&& phase)
+{
+  const auto start = std::chrono::steady_clock::now();
+  phase();
+  total += std::chrono::steady_clock::now() - start;
+}
+
+/**
+ * Whether two labels of a State's transitions overlap, like a-z and m. Reading a Symbol in both then leads to two
+ * States, so the State is nondeterministic.
+ * @param ranges scratch space
+ */
+bool HasOverlappingLabels(const Dfa::Transitions& transitions, std::vector<std::pair<char32_t, char32_t>>& ranges)
+{
+  ranges.clear();
+  bool has_wide_labels = false;
+  for (const auto& [label, _] : transitions)
+  {
+    if (const auto range = LabelRange(label))
+    {
+      ranges.emplace_back(range->low, range->high);
+      has_wide_labels = has_wide_labels || label.size() > 1;
+    }
+  }
+  // Labels of one byte each are distinct bytes.
+  if (!has_wide_labels)
+  {
+    return false;
+  }
+  std::sort(ranges.begin(), ranges.end());
+  return std::adjacent_find(ranges.begin(), ranges.end(),
+                            [](const auto& lhs, const auto& rhs) { return rhs.first <= lhs.second; }) != ranges.end();
+}
+
+/**
+ * Splits transition labels into pieces that don't overlap, which become the Symbols of subset construction. A range is
+ * only split where another label starts or ends inside it, so it usually stays one piece, rather than one Symbol for
+ * every byte or character in it. Labels that aren't ranges, like "GET", are pieces of their own.
+ * @param labels distinct labels
+ * @param pieces the labels of the pieces, which don't overlap
+ * @param runs the pieces of each label, as [first, last) indexes into pieces
+ * @throws std::runtime_error if a range is malformed, or if single bytes above 0x7f are mixed with UTF-8 characters
+ */
+void SplitLabels(const std::pmr::vector<std::string_view>& labels, std::pmr::vector<std::pmr::string>& pieces,
+                 std::pmr::vector<std::pair<std::size_t, std::size_t>>& runs)
+{
+  std::pmr::memory_resource* resource = pieces.get_allocator().resource();
+  std::pmr::vector<std::optional<SymbolRange>> ranges(resource);
+  std::pmr::vector<char32_t> cuts(resource);
+  bool has_ranges = false;
+  bool utf8 = false;
+  bool high_bytes = false;
+  for (const auto label : labels)
+  {
+    const auto range = LabelRange(label);
+    if (range)
+    {
+      // Single bytes and characters are distinct Symbols, but ranges may overlap them and each other.
+      has_ranges = has_ranges || label != RangeSymbol(range->low, range->bytes);
+      utf8 = utf8 || !range->bytes;
+      high_bytes = high_bytes || (range->bytes && range->high >= kFirstMultiByte);
+      cuts.push_back(range->low);
+      cuts.push_back(range->high + 1);
+    }
+    ranges.push_back(range);
+  }
+
+  runs.clear();
+  if (!has_ranges)
+  {
+    for (const auto label : labels)
+    {
+      runs.emplace_back(pieces.size(), pieces.size() + 1);
+      pieces.emplace_back(label);
+    }
+    return;
+  }
+  if (utf8 && high_bytes)
+  {
+    throw std::runtime_error("Parsing error: single byte Symbols above 0x7f can't be mixed with UTF-8 Symbols");
+  }
+
+  std::sort(cuts.begin(), cuts.end());
+  cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+  const auto cut_index = [&cuts](char32_t value) {
+    return static_cast<std::size_t>(std::lower_bound(cuts.begin(), cuts.end(), value) - cuts.begin());
+  };
+
+  // The number of labels that cover the stretch from each cut to the next changes by this much at the cut.
+  std::pmr::vector<int> cover_change(cuts.size(), 0, resource);
+  for (const auto& range : ranges)
+  {
+    if (range)
+    {
+      ++cover_change[cut_index(range->low)];
+      --cover_change[cut_index(range->high + 1)];
+    }
+  }
+
+  // Stretches that some label covers are pieces. This is the index of the first piece from each cut on.
+  std::pmr::vector<std::size_t> first_piece(cuts.size(), resource);
+  int cover = 0;
+  for (std::size_t c = 0; c + 1 < cuts.size(); ++c)
+  {
+    first_piece[c] = pieces.size();
+    cover += cover_change[c];
+    if (cover == 0)
+    {
+      continue;
+    }
+    SymbolRange piece{cuts[c], cuts[c + 1] - 1, !utf8};
+    if (utf8)
+    {
+      // Surrogates aren't scalar values, so they can't be the ends of a range.
+      piece.low = IsSurrogate(piece.low) ? kLastSurrogate + 1 : piece.low;
+      piece.high = IsSurrogate(piece.high) ? kFirstSurrogate - 1 : piece.high;
+    }
+    if (piece.low <= piece.high)
+    {
+      pieces.emplace_back(RangeLabel(piece));
+    }
+  }
+  first_piece.back() = pieces.size();
+
+  for (std::size_t i = 0; i < labels.size(); ++i)
+  {
+    if (ranges[i])
+    {
+      runs.emplace_back(first_piece[cut_index(ranges[i]->low)], first_piece[cut_index(ranges[i]->high + 1)]);
+    }
+    else
+    {
+      runs.emplace_back(pieces.size(), pieces.size() + 1);
+      pieces.emplace_back(labels[i]);
+    }
+  }
+}
+
+void RequireDeterminized(const Dfa& dfa)
+{
+  if (dfa.IsSimulated())
+  {
+    throw std::logic_error("A DFA that is matched by simulating its NFA has no table");
+  }
+}
+
+/**
+ * Matches the rest of input, past the prefix that path was walked along, extending path by the state after every byte.
+ * Stops extending it where the verdict is decided, so a path can end short of its input.
+ * @param path the states after each of the first path.size() - 1 bytes of input; never empty
+ * @param transitions incremented by every table lookup
+ */
+Dfa::Acceptance ResumeWalk(const CompiledDfa& compiled, std::string_view input, std::vector<CompiledDfa::StateId>& path,
+                           std::size_t& transitions)
+{
+  using StateId = CompiledDfa::StateId;
+
+  const char* it = input.data() + path.size() - 1;
+  const char* const end = input.data() + input.size();
+  StateId current_state_id = path.back();
+  while (it != end)
+  {
+    // The same shortcuts as AcceptsString, which inputs that share the prefix up to here take as well.
+    const auto flags = compiled.Flags(current_state_id);
+    if ((flags & (CompiledDfa::DEAD | CompiledDfa::ABSORBING)) != 0 && compiled.SymbolsAreBytes())
+    {
+      if (compiled.SkipAlphabet(it, end) != end)
+      {
+        return Dfa::INVALID_ALPHABET;
+      }
+      return (flags & CompiledDfa::ABSORBING) != 0 ? Dfa::ACCEPTS : Dfa::REJECTS;
+    }
+
+    const StateId new_state_id = compiled.Next(current_state_id, static_cast<unsigned char>(*it));
+    ++transitions;
+    if (new_state_id >= CompiledDfa::kFirstSentinel)
+    {
+      return new_state_id == CompiledDfa::kInvalidSymbol ? Dfa::INVALID_ALPHABET : Dfa::NO_TRANSITION;
+    }
+
+    ++it;
+    path.push_back(new_state_id);
+    if (new_state_id == current_state_id && (flags & CompiledDfa::SELF_LOOP) != 0)
+    {
+      const char* const loop_end = compiled.SkipLoop(current_state_id, it, end);
+      path.resize(path.size() + static_cast<std::size_t>(loop_end - it), current_state_id);
+      it = loop_end;
+    }
+    current_state_id = new_state_id;
+  }
+
+  const StateId end_state_id = compiled.End(current_state_id);
+  if (end_state_id >= CompiledDfa::kFirstSentinel)
+  {
+    return end_state_id == CompiledDfa::kInvalidSymbol ? Dfa::INVALID_ALPHABET : Dfa::NO_TRANSITION;
+  }
+  return compiled.IsAccepting(end_state_id) ? Dfa::ACCEPTS : Dfa::REJECTS;
+}
 }  // namespace
 
 std::ostream& operator<<(std::ostream& os, const State& state)
@@ -51,48 +343,77 @@ std::ostream& operator<<(std::ostream& os, const State& state)
 std::size_t StateHasher::operator()(const State& state) const
 {
   // I was getting wayyy too many collisions using boost::hash_combine, so this is a workaround.
-  // This is probably really slow...
+  // Hash the sorted, concatenated names. Scratch space comes from the stack unless the State is very large.
+  std::array<std::byte, 1024> buffer;
+  std::pmr::monotonic_buffer_resource scratch(buffer.data(), buffer.size());
 
-  std::vector<std::string> strings(state.begin(), state.end());
+  std::pmr::vector<std::string_view> strings(state.begin(), state.end(), &scratch);
   std::sort(strings.begin(), strings.end());
-  std::string str;
-  for (auto& s : strings)
+  std::pmr::string str(&scratch);
+  for (const auto& s : strings)
   {
-    str.append(std::move(s));
+    str.append(s);
   }
 
-  return std::hash<std::string>()(str);
+  return std::hash<std::string_view>()(str);
 }
 
-Dfa::Dfa(const std::string& dfa_file_contents)
+Dfa::Dfa(const std::string& dfa_file_contents, const Options& options)
 {
-  std::istringstream sstr(dfa_file_contents);
+  // Construction temporaries are allocated from this arena, and released all at once when construction is done.
+  MemoryBudget budget(options.max_bytes);
+  std::pmr::monotonic_buffer_resource arena(&budget);
+  Timed(build_times_.parse, [&] { Parse(dfa_file_contents, arena); });
+  Timed(build_times_.determinize, [&] { ExpandNfaIfNeeded(options, budget, arena); });
+  Timed(build_times_.compile, [&] {
+    Compile(options, budget, arena);
+    Replicate(options.numa_replicas);
+  });
+}
+
+Dfa::Dfa(const Dfa::Json& dfa_file_contents, const Options& options)
+{
+  Timed(build_times_.parse, [&] { Parse(dfa_file_contents); });
+
+  MemoryBudget budget(options.max_bytes);
+  std::pmr::monotonic_buffer_resource arena(&budget);
+  Timed(build_times_.determinize, [&] { ExpandNfaIfNeeded(options, budget, arena); });
+  Timed(build_times_.compile, [&] {
+    Compile(options, budget, arena);
+    Replicate(options.numa_replicas);
+  });
+}
+
+void Dfa::Parse(std::string_view contents, std::pmr::memory_resource& arena)
+{
+  constexpr std::string_view states_str = "states: ";
+  constexpr std::string_view alphabet_str = "alphabet: ";
+  constexpr std::string_view start_state_str = "startstate: ";
+  constexpr std::string_view final_state_str = "finalstate: ";
+  constexpr std::string_view transition_str = "transition: ";
 
-  const std::string states_str = "states: ";
-  const std::string alphabet_str = "alphabet: ";
-  const std::string start_state_str = "startstate: ";
-  const std::string final_state_str = "finalstate: ";
-  const std::string transition_str = "transition: ";
-  for (std::string line; std::getline(sstr, line);)
+  std::pmr::vector<std::string_view> tokens(&arena);
+  for (std::size_t line_begin = 0; line_begin < contents.size();)
   {
+    const std::size_t newline_idx = contents.find('\n', line_begin);
+    const std::size_t line_end = newline_idx == std::string_view::npos ? contents.size() : newline_idx;
+    const std::string_view line = contents.substr(line_begin, line_end - line_begin);
+    line_begin = line_end + 1;
+
     if (line.empty())
     {
       break;
     }
 
     const std::size_t first_space_idx = line.find(' ');
-    if (first_space_idx == std::string::npos)
+    if (first_space_idx == std::string_view::npos)
     {
       // Parsing failure
       throw std::runtime_error("Parsing error: could not find first space after colon");
     }
 
     const auto tokens_begin_idx = first_space_idx + 1;
-    std::istringstream tokens_sstr(line.substr(tokens_begin_idx));
-
-    const auto tokens_begin = std::istream_iterator<std::string>(tokens_sstr);
-    const auto tokens_end = std::istream_iterator<std::string>();
-    std::vector<std::string> tokens(tokens_begin, tokens_end);
+    SplitTokens(line.substr(tokens_begin_idx), tokens);
 
     if (tokens.empty())
     {
@@ -104,32 +425,32 @@ Dfa::Dfa(const std::string& dfa_file_contents)
     {
       for (const auto& token : tokens)
       {
-        states_.insert({token});
+        states_.insert(State(std::string(token)));
       }
     }
     else if (section_str == alphabet_str)
     {
-      alphabet_.insert(std::make_move_iterator(tokens.begin()), std::make_move_iterator(tokens.end()));
+      for (const auto& token : tokens)
+      {
+        alphabet_.emplace(token);
+      }
     }
     else if (section_str == start_state_str)
     {
-      if (!tokens.empty())
-      {
-        start_state_.emplace(std::move(tokens[0]));
-      }
+      start_state_.emplace(tokens[0]);
     }
     else if (section_str == final_state_str)
     {
       for (const auto& token : tokens)
       {
-        final_states_.insert({token});
+        final_states_.insert(State(std::string(token)));
       }
     }
     else if (section_str == transition_str)
     {
       if (tokens.size() == 3)
       {
-        transitions_[State{tokens[0]}][tokens[1]].emplace(tokens[2]);
+        transitions_[State(std::string(tokens[0]))][std::string(tokens[1])].emplace(tokens[2]);
       }
     }
     else
@@ -137,15 +458,13 @@ Dfa::Dfa(const std::string& dfa_file_contents)
       throw std::runtime_error("Parsing error: invalid section");
     }
   }
-
-  ExpandNfaIfNeeded();
 }
 
-Dfa::Dfa(const Dfa::Json& dfa_file_contents)
+void Dfa::Parse(const Json& contents)
 {
   try
   {
-    for (const auto& element : dfa_file_contents.items())
+    for (const auto& element : contents.items())
     {
       if (element.key() == "states")
       {
@@ -163,7 +482,23 @@ Dfa::Dfa(const Dfa::Json& dfa_file_contents)
         const auto& arr = element.value();
         for (const auto& tr : arr)
         {
-          transitions_[State{tr["s1"]}][tr["symbol"]].emplace(tr["s2"]);
+          // A range is given by its ends, like {"range": ["a", "z"]}, and becomes the label "a-z".
+          const auto range = tr.find("range");
+          if (range == tr.end())
+          {
+            transitions_[State{tr["s1"]}][tr["symbol"]].emplace(tr["s2"]);
+            continue;
+          }
+          if (!range->is_array() || range->size() != 2)
+          {
+            throw std::runtime_error("a range needs two ends");
+          }
+          const Symbol label = (*range)[0].get<Symbol>() + '-' + (*range)[1].get<Symbol>();
+          if (!ParseRange(label))
+          {
+            throw std::runtime_error("the ends of a range have to be single bytes or characters: " + label);
+          }
+          transitions_[State{tr["s1"]}][label].emplace(tr["s2"]);
         }
       }
       else if (element.key() == "start_state")
@@ -183,205 +518,727 @@ Dfa::Dfa(const Dfa::Json& dfa_file_contents)
   {
     throw std::runtime_error(std::string("Failed to parse JSON: ") + e.what());
   }
-
-  ExpandNfaIfNeeded();
 }
 
-Dfa::Acceptance Dfa::AcceptsString(const Language& input, bool verbose) const
+Dfa::Acceptance Dfa::AcceptsString(std::string_view input, bool verbose) const
 {
-  State current_state_id = start_state_;
+  using StateId = CompiledDfa::StateId;
+
+  if (simulated_)
+  {
+    switch (simulated_->Match(input != kEpsilon ? input : std::string_view(), verbose ? &std::cout : nullptr))
+    {
+      case BitParallelNfa::ACCEPTED:
+        return ACCEPTS;
+      case BitParallelNfa::INVALID_SYMBOL:
+        return INVALID_ALPHABET;
+      case BitParallelNfa::NO_TRANSITION:
+        return NO_TRANSITION;
+      case BitParallelNfa::REJECTED:
+      default:
+        return REJECTS;
+    }
+  }
+
+  const CompiledDfa& compiled = LocalTable();
+  StateId current_state_id = compiled.Start();
   if (verbose)
   {
-    std::cout << "Starting State: " << current_state_id << std::endl;
+    std::cout << "Starting State: " << compiled.Name(current_state_id) << std::endl;
   }
 
   if (input != kEpsilon)
   {
-    Symbol current_symbol;
-    for (const auto& c : input)
+    const char* it = input.data();
+    const char* const end = it + input.size();
+    while (it != end)
     {
-      current_symbol = c;
-      if (alphabet_.find(current_symbol) == alphabet_.end())
+      // Verbose mode prints every transition, so it always takes the byte-by-byte path.
+      const auto flags = compiled.Flags(current_state_id);
+      if (!verbose && (flags & (CompiledDfa::DEAD | CompiledDfa::ABSORBING)) != 0 && compiled.SymbolsAreBytes())
       {
-        return INVALID_ALPHABET;
+        // The verdict can no longer change, unless a Symbol outside of the Alphabet follows.
+        if (compiled.SkipAlphabet(it, end) != end)
+        {
+          return INVALID_ALPHABET;
+        }
+        return (flags & CompiledDfa::ABSORBING) != 0 ? ACCEPTS : REJECTS;
       }
 
-      const auto current_state_transitions = transitions_.find(current_state_id);
-      if (current_state_transitions == transitions_.end())
+      const StateId new_state_id = compiled.Next(current_state_id, static_cast<unsigned char>(*it));
+      if (new_state_id >= CompiledDfa::kFirstSentinel)
       {
-        return NO_TRANSITION;
+        return new_state_id == CompiledDfa::kInvalidSymbol ? INVALID_ALPHABET : NO_TRANSITION;
       }
 
-      const auto current_state_transition_for_symbol = current_state_transitions->second.find(current_symbol);
-      if (current_state_transition_for_symbol == current_state_transitions->second.end())
+      if (verbose)
       {
-        return NO_TRANSITION;
+        std::cout << "Current State: " << compiled.Name(current_state_id) << " Symbol: " << *it
+                  << " -> New State: " << compiled.Name(new_state_id) << std::endl;
       }
 
-      if (verbose)
+      ++it;
+      if (new_state_id == current_state_id && (flags & CompiledDfa::SELF_LOOP) != 0 && !verbose)
       {
-        std::cout << "Current State: " << current_state_id << " Symbol: " << current_symbol
-                  << " -> New State: " << current_state_transition_for_symbol->second << std::endl;
+        // Only scan once the state has looped, so that runs of length one don't pay for the scan.
+        it = compiled.SkipLoop(current_state_id, it, end);
       }
+      current_state_id = new_state_id;
+    }
+  }
+
+  // Input that ends in the middle of a Symbol may still split into Symbols.
+  const StateId end_state_id = compiled.End(current_state_id);
+  if (end_state_id >= CompiledDfa::kFirstSentinel)
+  {
+    return end_state_id == CompiledDfa::kInvalidSymbol ? INVALID_ALPHABET : NO_TRANSITION;
+  }
+  return compiled.IsAccepting(end_state_id) ? ACCEPTS : REJECTS;
+}
 
-      current_state_id = current_state_transition_for_symbol->second;
+std::size_t Dfa::AcceptsBatch(const std::vector<std::string_view>& inputs, std::vector<Acceptance>& verdicts) const
+{
+  verdicts.resize(inputs.size());
+  std::size_t transitions = 0;
+  if (simulated_)
+  {
+    for (std::size_t i = 0; i < inputs.size(); ++i)
+    {
+      verdicts[i] = AcceptsString(inputs[i]);
+      transitions += inputs[i].size();
     }
+    return transitions;
   }
 
-  return final_states_.find(current_state_id) != final_states_.end() ? ACCEPTS : REJECTS;
+  std::vector<std::size_t> order(inputs.size());
+  std::iota(order.begin(), order.end(), 0);
+  const auto language = [&inputs](std::size_t i) { return inputs[i] != kEpsilon ? inputs[i] : std::string_view(); };
+  std::sort(order.begin(), order.end(), [&language](std::size_t lhs, std::size_t rhs) {
+    return language(lhs) < language(rhs);
+  });
+
+  // In sorted order, the prefix that an input shares with any earlier one is at most what it shares with the one
+  // right before it. So keeping the states along that one suffices.
+  const CompiledDfa& compiled = LocalTable();
+  std::vector<CompiledDfa::StateId> path{compiled.Start()};
+  std::string_view previous;
+  for (const auto i : order)
+  {
+    const std::string_view input = language(i);
+    const std::size_t shared = static_cast<std::size_t>(
+        std::mismatch(input.begin(), input.end(), previous.begin(), previous.end()).first - input.begin());
+    path.resize(std::min(path.size(), shared + 1));
+    verdicts[i] = ResumeWalk(compiled, input, path, transitions);
+    previous = input;
+  }
+  return transitions;
 }
 
-void Dfa::AggregateEpsilonClosure(State& total_state, const State& current_state) const
+Dfa Dfa::FromRegex(std::string_view pattern, const Options& options)
 {
-  const auto current_state_transitions = transitions_.find(current_state);
-  if (current_state_transitions != transitions_.end())
+  MemoryBudget budget(options.max_bytes);
+  std::pmr::monotonic_buffer_resource arena(&budget);
+  Nfa nfa(&arena);
+  Dfa dfa;
+  Timed(dfa.build_times_.parse, [&] { ParseRegex(pattern, nfa); });
+
+  for (const auto& symbol : nfa.symbols)
   {
-    const auto current_state_epsilon_transitions = current_state_transitions->second.find(kEpsilon);
-    if (current_state_epsilon_transitions != current_state_transitions->second.end())
+    dfa.alphabet_.emplace(symbol);
+  }
+  Timed(dfa.build_times_.determinize, [&] { dfa.DeterminizeOrSimulate(nfa, options, false, budget, arena); });
+  Timed(dfa.build_times_.compile, [&] {
+    dfa.Compile(options, budget, arena);
+    dfa.Replicate(options.numa_replicas);
+  });
+  return dfa;
+}
+
+OutOfCoreStats Dfa::CompileOutOfCore(const std::string& dfa_file_contents, std::ostream& out,
+                                     const OutOfCoreOptions& options)
+{
+  std::pmr::monotonic_buffer_resource arena;
+  Dfa definition;
+  definition.Parse(dfa_file_contents, arena);
+  return definition.WriteOutOfCore(out, options);
+}
+
+OutOfCoreStats Dfa::CompileOutOfCore(const Json& dfa_file_contents, std::ostream& out, const OutOfCoreOptions& options)
+{
+  Dfa definition;
+  definition.Parse(dfa_file_contents);
+  return definition.WriteOutOfCore(out, options);
+}
+
+OutOfCoreStats Dfa::CompileRegexOutOfCore(std::string_view pattern, std::ostream& out, const OutOfCoreOptions& options)
+{
+  std::pmr::monotonic_buffer_resource arena;
+  Nfa nfa(&arena);
+  ParseRegex(pattern, nfa);
+  return DeterminizeOutOfCore(nfa, out, options);
+}
+
+Dfa Dfa::Load(std::istream& in, const Options& options)
+{
+  Dfa dfa;
+  Timed(dfa.build_times_.parse, [&] {
+    dfa.compiled_ = CompiledDfa::Load(in);
+    for (unsigned b = 0; b < kNumBytes; ++b)
     {
-      for (const auto& epsilon_transition_state : current_state_epsilon_transitions->second)
+      if (dfa.compiled_.InAlphabet(static_cast<unsigned char>(b)))
       {
-        // If state has not already been added to total_states, insert it and recurse on that state.
-        if (total_state.find(epsilon_transition_state) == total_state.end())
-        {
-          total_state.insert(epsilon_transition_state);
-          AggregateEpsilonClosure(total_state, {epsilon_transition_state});
-        }
+        dfa.alphabet_.emplace(1, static_cast<char>(b));
       }
     }
+  });
+  Timed(dfa.build_times_.compile, [&] { dfa.Replicate(options.numa_replicas); });
+  return dfa;
+}
+
+void Dfa::Save(std::ostream& out) const
+{
+  RequireDeterminized(*this);
+  compiled_.Save(out);
+}
+
+void Dfa::Relayout(Layout layout)
+{
+  RequireDeterminized(*this);
+  compiled_ = compiled_.Renumbered(layout == DEPTH_FIRST ? DepthFirstLayout(compiled_) : BreadthFirstLayout(compiled_));
+  if (!replicas_.empty())
+  {
+    Replicate(replicas_.size());
+  }
+}
+
+void Dfa::Relayout(const VisitProfile& profile)
+{
+  RequireDeterminized(*this);
+  compiled_ = compiled_.Renumbered(ProfileLayout(compiled_, profile));
+  if (!replicas_.empty())
+  {
+    Replicate(replicas_.size());
   }
 }
 
-void Dfa::AggregateTransitions(StateMap<Transitions>& all_transitions, const State& current_state) const
+void Dfa::RecordVisits(std::string_view input, VisitProfile& profile) const
+{
+  RequireDeterminized(*this);
+  dfa::RecordVisits(compiled_, input != kEpsilon ? input : std::string_view(), profile);
+}
+
+bool Dfa::Equivalent(const Dfa& other, Language* counterexample) const
+{
+  RequireDeterminized(*this);
+  RequireDeterminized(other);
+  return compiled_.Equivalent(other.compiled_, counterexample);
+}
+
+bool Dfa::Includes(const Dfa& other, Language* counterexample) const
+{
+  RequireDeterminized(*this);
+  RequireDeterminized(other);
+  return compiled_.Includes(other.compiled_, counterexample);
+}
+
+void Dfa::ExpandNfaIfNeeded(const Options& options, MemoryBudget& budget, std::pmr::memory_resource& arena)
 {
-  // Check if there is at least one transition for the current state.
-  bool at_least_once_transition = false;
-  for (const auto& st : current_state)
+  bool is_nfa = false;
+
+  std::vector<std::pair<char32_t, char32_t>> ranges;
+  for (const auto& [_, transitions] : transitions_)
   {
-    if (transitions_.find({st}) != transitions_.end())
+    for (const auto& [symbol, transition] : transitions)
     {
-      at_least_once_transition = true;
+      if (symbol == kEpsilon || transition.size() > 1)
+      {
+        is_nfa = true;
+        break;
+      }
+    }
+    if (is_nfa || HasOverlappingLabels(transitions, ranges))
+    {
+      is_nfa = true;
       break;
     }
   }
 
-  if (!at_least_once_transition)
+  if (!is_nfa)
   {
     return;
   }
 
-  // Get epsilon closure before finding reachable states.
-  State aggregated_current_state = current_state;
-  for (const auto& state : current_state)
+  Nfa nfa(&arena);
+  ToNfa(nfa, arena);
+  DeterminizeOrSimulate(nfa, options, true, budget, arena);
+}
+
+void Dfa::ToNfa(Nfa& nfa, std::pmr::memory_resource& arena) const
+{
+  // Names are looked up by views of the strings in this Dfa, which outlive the conversion.
+  std::pmr::unordered_map<std::string_view, Nfa::StateId> state_ids(&arena);
+  const auto state_id = [&](const std::string& name) {
+    const auto [iter, inserted] =
+        state_ids.emplace(std::string_view(name), static_cast<Nfa::StateId>(nfa.state_names.size()));
+    if (inserted)
+    {
+      nfa.state_names.emplace_back(name);
+      nfa.transitions.emplace_back();
+      nfa.epsilon_transitions.emplace_back();
+      nfa.final_states.push_back(false);
+    }
+    return iter->second;
+  };
+
+  std::pmr::vector<std::string_view> labels(&arena);
+  for (const auto& [_, transitions] : transitions_)
   {
-    AggregateEpsilonClosure(aggregated_current_state, {state});
+    for (const auto& transition : transitions)
+    {
+      if (transition.first != kEpsilon)
+      {
+        labels.emplace_back(transition.first);
+      }
+    }
+  }
+  std::sort(labels.begin(), labels.end());
+  labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+
+  std::pmr::vector<std::pmr::string> pieces(&arena);
+  std::pmr::vector<std::pair<std::size_t, std::size_t>> runs(&arena);
+  SplitLabels(labels, pieces, runs);
+  nfa.symbols.assign(pieces.begin(), pieces.end());
+  std::sort(nfa.symbols.begin(), nfa.symbols.end());
+  std::pmr::vector<Nfa::SymbolId> piece_ids(&arena);
+  for (const auto& piece : pieces)
+  {
+    piece_ids.push_back(static_cast<Nfa::SymbolId>(
+        std::lower_bound(nfa.symbols.begin(), nfa.symbols.end(), piece) - nfa.symbols.begin()));
   }
 
-  // If current_state hasn't been aggregated yet, do so.
-  if (all_transitions.find(aggregated_current_state) == all_transitions.end())
+  for (const auto& [state, transitions] : transitions_)
   {
-    // Get transitions for all reachable states.
-    Transitions aggregated_current_state_transitions;
-    for (const auto& reachable_state : aggregated_current_state)
+    const auto from = state_id(*state.begin());
+    for (const auto& [symbol, targets] : transitions)
     {
-      auto reachable_state_transitions_pair = transitions_.find({reachable_state});
-      if (reachable_state_transitions_pair != transitions_.end())
+      // A transition on a label is one on each of its pieces.
+      const auto [first, last] =
+          symbol == kEpsilon
+              ? std::pair<std::size_t, std::size_t>()
+              : runs[static_cast<std::size_t>(std::lower_bound(labels.begin(), labels.end(), symbol) - labels.begin())];
+      for (const auto& target : targets)
       {
-        for (const auto& [symbol, reachable_state_transitions] : reachable_state_transitions_pair->second)
+        const auto to = state_id(target);
+        if (symbol == kEpsilon)
         {
-          if (symbol != kEpsilon)
-          {
-            // Aggregate epsilon closure for each reachable transition.
-            auto reachable_states_with_epsilon_closure = reachable_state_transitions;
-            for (const auto& state : reachable_state_transitions)
-            {
-              AggregateEpsilonClosure(reachable_states_with_epsilon_closure, {state});
-            }
-
-            aggregated_current_state_transitions[symbol].insert(reachable_states_with_epsilon_closure.begin(),
-                                                                reachable_states_with_epsilon_closure.end());
-          }
+          nfa.epsilon_transitions[from].push_back(to);
+          continue;
+        }
+        for (std::size_t piece = first; piece < last; ++piece)
+        {
+          nfa.transitions[from].emplace_back(piece_ids[piece], to);
         }
       }
     }
+  }
 
-    // Add transitions for current state to all_transitions so they aren't duplicated when we recurse.
-    all_transitions.emplace(aggregated_current_state, aggregated_current_state_transitions);
+  for (const auto& state : start_state_)
+  {
+    nfa.start.push_back(state_id(state));
+  }
+
+  for (const auto& final_state : final_states_)
+  {
+    nfa.final_states[state_id(*final_state.begin())] = true;
+  }
+}
 
-    // Get set of unique reachable states.
-    StateSet reachable_states;
-    for (const auto& [symbol, states] : aggregated_current_state_transitions)
+OutOfCoreStats Dfa::WriteOutOfCore(std::ostream& out, const OutOfCoreOptions& options) const
+{
+  std::pmr::monotonic_buffer_resource arena;
+  Nfa nfa(&arena);
+  ToNfa(nfa, arena);
+
+  // Symbols without transitions are still part of the Alphabet. Appending them keeps the IDs of the others.
+  const std::size_t num_symbols = nfa.symbols.size();
+  for (const auto& symbol : alphabet_)
+  {
+    if (!std::binary_search(nfa.symbols.begin(), nfa.symbols.begin() + static_cast<std::ptrdiff_t>(num_symbols),
+                            std::string_view(symbol)))
     {
-      reachable_states.emplace(states);
+      nfa.symbols.emplace_back(symbol);
     }
+  }
+  return DeterminizeOutOfCore(nfa, out, options);
+}
+
+void Dfa::DeterminizeOrSimulate(const Nfa& nfa, const Options& options, bool name_by_subset, MemoryBudget& budget,
+                                std::pmr::memory_resource& arena)
+{
+  // Simulation reads single bytes, so Alphabets with scalar values or tokens are always converted.
+  SymbolSet symbols = CollectSymbols(alphabet_);
+  symbols.tokens.erase(std::remove(symbols.tokens.begin(), symbols.tokens.end(), kEpsilon), symbols.tokens.end());
+  const bool simulatable = (options.simulate || options.max_dfa_states != 0) && symbols.scalars.empty() &&
+                           symbols.tokens.empty() &&
+                           BitParallelNfa::CountPositions(nfa) <= BitParallelNfa::kMaxPositions;
+  const auto simulate = [&] {
+    simulated_.emplace(nfa, symbols.bytes);
+    budget.Charge(simulated_->TableBytes());
+  };
+  if (simulatable && options.simulate)
+  {
+    simulate();
+    return;
+  }
+
+  // Limiting construction only pays off if the NFA can be simulated when the limit is hit. The hard limit applies
+  // either way, and wins if it is lower.
+  const std::size_t soft_limit = simulatable ? options.max_dfa_states : 0;
+  const bool simulate_past_limit =
+      soft_limit != 0 && (options.max_states == 0 || soft_limit <= options.max_states);
+  const std::size_t max_states = simulate_past_limit ? soft_limit : options.max_states;
 
-    // Recurse on reachable states
-    for (const auto& state : reachable_states)
+  try
+  {
+    AdoptSubsetDfa(nfa, Determinize(nfa, options.threads, &arena, max_states, &budget), name_by_subset, budget,
+                   arena);
+  }
+  catch (const StateLimitError&)
+  {
+    if (!simulate_past_limit)
     {
-      AggregateTransitions(all_transitions, state);
+      throw BudgetExceededError(std::to_string(max_states) + " states", max_states, budget.Used());
     }
+    simulate();
   }
 }
 
-void Dfa::ExpandNfaIfNeeded()
+void Dfa::AdoptSubsetDfa(const Nfa& nfa, const SubsetDfa& dfa, bool name_by_subset, MemoryBudget& budget,
+                         std::pmr::memory_resource& arena)
 {
-  bool is_nfa = false;
+  std::pmr::vector<State> dfa_states(&arena);
+  dfa_states.reserve(dfa.subsets.size());
+  states_.clear();
+  final_states_.clear();
+  transitions_.clear();
 
-  for (const auto& [_, transitions] : transitions_)
+  // The members don't allocate from the arena, so their estimated size is charged to the budget as they grow.
+  try
   {
-    for (const auto& [symbol, transition] : transitions)
+    for (std::size_t i = 0; i < dfa.subsets.size(); ++i)
     {
-      if (symbol == kEpsilon || transition.size() > 1)
+      State state;
+      bool is_final = false;
+      for (const auto id : dfa.subsets[i])
       {
-        is_nfa = true;
-        break;
+        if (name_by_subset)
+        {
+          state.emplace(nfa.state_names[id]);
+        }
+        is_final = is_final || nfa.final_states[id];
+      }
+      if (!name_by_subset)
+      {
+        state.emplace("q" + std::to_string(i));
+      }
+
+      const std::size_t state_bytes = kNodeBytes + Bytes(state);
+      budget.Charge(is_final ? 2 * state_bytes : state_bytes);
+      states_.insert(state);
+      if (is_final)
+      {
+        final_states_.insert(state);
       }
+      dfa_states.push_back(std::move(state));
     }
-    if (is_nfa)
+
+    // Pieces of ranges that SplitLabels made are joined again where they lead to the same State, so that a range is
+    // only split in the States that tell its pieces apart.
+    std::pmr::vector<std::optional<SymbolRange>> piece_ranges(&arena);
+    if (std::any_of(nfa.symbols.begin(), nfa.symbols.end(), [](const auto& symbol) {
+          return symbol.size() > 1 && !DecodeScalar(symbol) && ParseRange(symbol);
+        }))
     {
-      break;
+      for (const auto& symbol : nfa.symbols)
+      {
+        piece_ranges.push_back(LabelRange(symbol));
+      }
     }
-  }
+    std::pmr::vector<std::pair<SymbolRange, SubsetDfa::StateId>> pieces(&arena);
 
-  if (!is_nfa)
+    for (std::size_t i = 0; i < dfa.transitions.size(); ++i)
+    {
+      budget.Charge(kNodeBytes + Bytes(dfa_states[i]) + sizeof(Transitions));
+      auto& transitions = transitions_[dfa_states[i]];
+      const auto add = [&](std::string label, SubsetDfa::StateId target) {
+        const auto [iter, inserted] = transitions.emplace(std::move(label), dfa_states[target]);
+        budget.Charge(kNodeBytes + Bytes(*iter));
+      };
+
+      pieces.clear();
+      for (const auto& [symbol, target] : dfa.transitions[i])
+      {
+        if (!piece_ranges.empty() && piece_ranges[symbol])
+        {
+          pieces.emplace_back(*piece_ranges[symbol], target);
+        }
+        else
+        {
+          add(std::string(nfa.symbols[symbol]), target);
+        }
+      }
+
+      std::sort(pieces.begin(), pieces.end(),
+                [](const auto& lhs, const auto& rhs) { return lhs.first.low < rhs.first.low; });
+      for (std::size_t begin = 0; begin < pieces.size();)
+      {
+        SymbolRange joined = pieces[begin].first;
+        std::size_t end = begin + 1;
+        for (; end < pieces.size() && pieces[end].second == pieces[begin].second; ++end)
+        {
+          // Surrogates aren't scalar values, so the characters on either side of them are adjacent.
+          const char32_t next = joined.bytes ? joined.high + 1 : NextScalar(joined.high);
+          if (pieces[end].first.low != next)
+          {
+            break;
+          }
+          joined.high = pieces[end].first.high;
+          joined.bytes = joined.bytes && pieces[end].first.bytes;
+        }
+        add(RangeLabel(joined), pieces[begin].second);
+        begin = end;
+      }
+    }
+  }
+  catch (const BudgetExceededError& e)
   {
-    return;
+    throw e.AfterStates(dfa.subsets.size());
   }
 
-  StateMap<Transitions> all_transitions;
-
-  // First, find all states reachable by epsilon closure from the start state.
-  State epsilon_reachable_state{start_state_};
-  AggregateEpsilonClosure(epsilon_reachable_state, start_state_);
+  start_state_ = dfa_states.front();
+}
 
-  // Recursively find all states reachable by reading input from the start state.
-  AggregateTransitions(all_transitions, start_state_);
-  transitions_ = std::move(all_transitions);
+void Dfa::Compile(const Options& options, MemoryBudget& budget, std::pmr::memory_resource& arena)
+{
+  using StateId = CompiledDfa::StateId;
 
-  // Update members.
-  if (epsilon_reachable_state != start_state_)
+  if (simulated_)
   {
-    start_state_ = std::move(epsilon_reachable_state);
+    return;
   }
+  SymbolSet symbols = CollectSymbols(alphabet_);
+  symbols.tokens.erase(std::remove(symbols.tokens.begin(), symbols.tokens.end(), kEpsilon), symbols.tokens.end());
+  const auto& in_alphabet = symbols.bytes;
 
-  states_.clear();
-  for (const auto& transition : transitions_)
+  // Symbols of several bytes that aren't scalar values are tokens, which the input is split into by longest match.
+  const bool tokenized = !symbols.tokens.empty();
+  std::pmr::unordered_map<std::string_view, std::uint32_t> token_ids(&arena);
+  for (std::size_t t = 0; t < symbols.tokens.size(); ++t)
   {
-    states_.insert(transition.first);
+    token_ids.emplace(symbols.tokens[t], static_cast<std::uint32_t>(t));
   }
 
-  StateSet final_states;
-  for (const auto& state : states_)
+  // Number states in breadth-first order from the start state, following bytes, scalar values and then tokens in
+  // ascending order, so that the layout of the table doesn't depend on hashing. Unreachable states are left out.
+  std::pmr::unordered_map<const State*, StateId, StatePointerHasher, StatePointerEqual> ids(&arena);
+  std::pmr::vector<const State*> order(&arena);
+  const auto id_of = [&](const State& state) {
+    const auto [iter, inserted] = ids.emplace(&state, static_cast<StateId>(order.size()));
+    if (inserted)
+    {
+      order.push_back(&state);
+    }
+    return iter->second;
+  };
+  id_of(start_state_);
+
+  // Tables are allocated from the budget or charged to it as they grow, so it may run out anywhere below.
+  try
   {
-    for (const auto& final_state : final_states_)
+    std::pmr::vector<StateId> byte_table(&arena);
+    std::pmr::vector<std::tuple<unsigned char, unsigned char, const State*>> row_targets(&arena);
+    std::pmr::vector<std::tuple<char32_t, char32_t, const State*>> scalar_targets(&arena);
+    std::pmr::vector<std::pmr::vector<Utf8Compiler::Transition>> scalar_transitions(&arena);
+    std::pmr::vector<std::pair<std::uint32_t, const State*>> token_targets(&arena);
+    std::pmr::vector<TokenCompiler::Transitions> token_transitions(&arena);
+    for (std::size_t i = 0; i < order.size(); ++i)
     {
-      if (state.find(*final_state.begin()) != state.end())
+      byte_table.resize((i + 1) * kNumBytes);
+      for (std::size_t b = 0; b < kNumBytes; ++b)
       {
-        final_states.insert(state);
+        byte_table[i * kNumBytes + b] = in_alphabet[b] ? CompiledDfa::kNoTransition : CompiledDfa::kInvalidSymbol;
       }
+
+      scalar_transitions.emplace_back();
+      if (tokenized)
+      {
+        token_transitions.emplace_back();
+      }
+      const auto state_transitions = transitions_.find(*order[i]);
+      if (state_transitions == transitions_.end())
+      {
+        continue;
+      }
+
+      // Ranges fill a stretch of the row, and stay ranges of scalar values for Utf8Compiler.
+      row_targets.clear();
+      scalar_targets.clear();
+      token_targets.clear();
+      for (const auto& [symbol, state] : state_transitions->second)
+      {
+        if (const auto token = token_ids.find(symbol); token != token_ids.end())
+        {
+          token_targets.emplace_back(token->second, &state);
+          continue;
+        }
+        const auto range = LabelRange(symbol);
+        if (!range)
+        {
+          continue;
+        }
+        if (const auto bytes = RangeBytes(*range))
+        {
+          row_targets.push_back({bytes->first, bytes->second, &state});
+        }
+        if (!range->bytes && range->high >= kFirstMultiByte && !symbols.scalars.empty())
+        {
+          scalar_targets.push_back({std::max(range->low, kFirstMultiByte), range->high, &state});
+        }
+      }
+      std::sort(row_targets.begin(), row_targets.end());
+      std::sort(scalar_targets.begin(), scalar_targets.end());
+      std::sort(token_targets.begin(), token_targets.end());
+
+      for (const auto& [low, high, state] : row_targets)
+      {
+        const StateId target = id_of(*state);
+        for (unsigned b = low; b <= high; ++b)
+        {
+          if (in_alphabet[b])
+          {
+            byte_table[i * kNumBytes + b] = target;
+          }
+        }
+      }
+      for (const auto& [low, high, state] : scalar_targets)
+      {
+        // Utf8Compiler takes the scalar values of the Alphabet only.
+        const StateId target = id_of(*state);
+        auto range = std::upper_bound(symbols.scalars.begin(), symbols.scalars.end(), low,
+                                      [](char32_t value, const auto& r) { return value < r.first; });
+        if (range != symbols.scalars.begin() && low <= std::prev(range)->second)
+        {
+          --range;
+        }
+        for (; range != symbols.scalars.end() && range->first <= high; ++range)
+        {
+          scalar_transitions.back().push_back({std::max(low, range->first), std::min(high, range->second), target});
+        }
+      }
+      for (const auto& [token, state] : token_targets)
+      {
+        token_transitions.back().emplace_back(token, id_of(*state));
+      }
+    }
+
+    const std::size_t num_states = order.size();
+    if (options.max_states != 0 && num_states > options.max_states)
+    {
+      throw BudgetExceededError(std::to_string(options.max_states) + " states", num_states, budget.Used());
+    }
+
+    // Scalar values and then tokens are read byte by byte, through intermediate states that follow all DFA states.
+    std::vector<StateId> ends;
+    if (!symbols.scalars.empty())
+    {
+      Utf8Compiler utf8(symbols.scalars, static_cast<StateId>(num_states), &budget);
+      for (std::size_t i = 0; i < num_states; ++i)
+      {
+        utf8.CompileRow(scalar_transitions[i], &byte_table[i * kNumBytes]);
+      }
+      byte_table.insert(byte_table.end(), utf8.Rows().begin(), utf8.Rows().end());
+
+      // Input can't end in the middle of a scalar value.
+      ends.assign(byte_table.size() / kNumBytes, CompiledDfa::kInvalidSymbol);
+      std::iota(ends.begin(), ends.begin() + static_cast<std::ptrdiff_t>(num_states), 0);
+    }
+    if (tokenized)
+    {
+      TokenCompiler(symbols, &budget).Compile(token_transitions, byte_table, ends);
+    }
+    const StateId* table = byte_table.data();
+    const std::size_t num_rows = byte_table.size() / kNumBytes;
+
+    // CompiledDfa doesn't allocate through the budget, so what it takes is charged up front: the names as they are
+    // made, and at most a dense row, flags and an end for each row. Once it is built, that is replaced with its size.
+    std::size_t charged = num_rows * (kNumBytes * sizeof(StateId) + sizeof(std::uint8_t) + sizeof(StateId));
+    budget.Charge(charged);
+    std::vector<bool> accepting(num_rows);
+    std::vector<std::string> names(num_rows);
+    for (std::size_t i = 0; i < num_rows; ++i)
+    {
+      if (i < num_states)
+      {
+        accepting[i] = final_states_.find(*order[i]) != final_states_.end();
+        std::ostringstream name;
+        name << *order[i];
+        names[i] = name.str();
+      }
+      else
+      {
+        names[i] = "(partial " + std::to_string(i - num_states) + ")";
+      }
+      budget.Charge(Bytes(names[i]));
+      charged += Bytes(names[i]);
     }
+
+    CompiledDfa compiled(table, accepting, 0, std::move(names), ends);
+    budget.Release(charged);
+    budget.Charge(compiled.TableBytes() + compiled.StateBytes() + compiled.NameBytes());
+    compiled_ = std::move(compiled);
   }
+  catch (const BudgetExceededError& e)
+  {
+    throw e.AfterStates(order.size());
+  }
+}
 
-  final_states_ = std::move(final_states);
+MemoryBreakdown Dfa::MemoryUsage() const
+{
+  MemoryBreakdown usage;
+  usage.tables = compiled_.TableBytes() + compiled_.StateBytes();
+  usage.names = compiled_.NameBytes();
+  usage.definition = HashBytes(states_) + HashBytes(alphabet_) + HashBytes(transitions_) + Bytes(start_state_) +
+                     HashBytes(final_states_);
+  for (const auto& replica : replicas_)
+  {
+    usage.caches += replica->TableBytes() + replica->StateBytes() + replica->NameBytes();
+  }
+  if (simulated_)
+  {
+    usage.caches += simulated_->TableBytes();
+  }
+  return usage;
+}
+
+void Dfa::Replicate(std::size_t replicas)
+{
+  replicas_.clear();
+  const std::size_t count = std::min(replicas == 0 ? NumaNodes() : replicas, NumaNodes());
+  if (count <= 1 || simulated_)
+  {
+    return;
+  }
+
+  // Each copy is made by a thread on its node, so that its pages are first touched, and thus allocated, there.
+  for (std::size_t node = 0; node < count; ++node)
+  {
+    RunOnNumaNode(node, [&] { replicas_.push_back(std::make_shared<const CompiledDfa>(compiled_)); });
+  }
+}
+
+const CompiledDfa& Dfa::LocalTable() const
+{
+  return replicas_.empty() ? compiled_ : *replicas_[CurrentNumaNode() % replicas_.size()];
 }
 }  // namespace dfa
\ No newline at end of file
@@ -6,16 +6,33 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
 #include <nlohmann/json.hpp>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
+
+#include "dfa/bit_parallel_nfa.h"
+#include "dfa/compiled_dfa.h"
+#include "dfa/layout.h"
+#include "dfa/memory_budget.h"
+#include "dfa/out_of_core.h"
 
 /**
  * Contains definitions necessary for creating and checking languages against a DFA.
  */
 namespace dfa
 {
+struct Nfa;
+struct SubsetDfa;
+class DfaBuilder;
+
 /**
  * Represents a DFA State.
  *
@@ -56,6 +73,101 @@ using StateSet = std::unordered_set<State, StateHasher>;
 template <typename T>
 using StateMap = std::unordered_map<State, T, StateHasher>;
 
+/**
+ * Settings for constructing a Dfa.
+ */
+struct Options
+{
+  /**
+   * Number of threads used to convert an NFA to a DFA. Zero uses one thread per hardware thread.
+   */
+  unsigned threads = 1;
+
+  /**
+   * Most states that converting an NFA to a DFA may produce. Past it, the NFA is matched by bit-parallel simulation
+   * instead, if it has at most BitParallelNfa::kMaxPositions positions and its Symbols are single bytes; other NFAs
+   * are always converted. Zero means no limit.
+   */
+  std::size_t max_dfa_states = 0;
+
+  /**
+   * Whether to match an NFA by bit-parallel simulation without converting it at all, if it has at most
+   * BitParallelNfa::kMaxPositions positions and its Symbols are single bytes. Other NFAs are converted as usual,
+   * subject to max_dfa_states.
+   */
+  bool simulate = false;
+
+  /**
+   * Copies of the table that AcceptsString runs on, each allocated on its own NUMA node, so that threads read the copy
+   * of their node instead of crossing the interconnect on every byte. Threads on node n use copy n modulo the count.
+   * Zero keeps one copy per node, and one, the default, keeps just the table. The count is capped by the number of
+   * nodes, so this has no effect on a single node or without libnuma.
+   */
+  std::size_t numa_replicas = 1;
+
+  /**
+   * Most States the DFA may have. Unlike max_dfa_states, this is a hard limit: past it, construction throws a
+   * BudgetExceededError. Zero means no limit.
+   */
+  std::size_t max_states = 0;
+
+  /**
+   * Most bytes that construction may have in use at once, throwing a BudgetExceededError past it. Counts construction
+   * temporaries, the States and transitions of a converted NFA, and the compiled table, but not parsing the input.
+   * Zero means no limit.
+   */
+  std::size_t max_bytes = 0;
+};
+
+/**
+ * How long constructing a Dfa took, by phase.
+ */
+struct BuildTimes
+{
+  /**
+   * Reading the DFA file or regular expression, or loading the compiled file.
+   */
+  std::chrono::nanoseconds parse{0};
+
+  /**
+   * Converting an NFA to a DFA, or preparing to simulate it. Zero if the input was already a DFA.
+   */
+  std::chrono::nanoseconds determinize{0};
+
+  /**
+   * Building the table that AcceptsString runs on, and its NUMA replicas.
+   */
+  std::chrono::nanoseconds compile{0};
+};
+
+/**
+ * Memory taken by a Dfa, in bytes. Sizes of standard containers are estimated from their contents.
+ */
+struct MemoryBreakdown
+{
+  /**
+   * The table that AcceptsString runs on, with its per-state flags.
+   */
+  std::size_t tables = 0;
+
+  /**
+   * Names of the states of the table.
+   */
+  std::size_t names = 0;
+
+  /**
+   * The States, Alphabet, transitions, start State and final States.
+   */
+  std::size_t definition = 0;
+
+  /**
+   * Copies and alternatives of the table: NUMA replicas, or the tables of bit-parallel simulation.
+   */
+  std::size_t caches = 0;
+
+  inline std::size_t Total() const noexcept { return tables + names + definition + caches; }
+};
+
 class Dfa
 {
  public:
@@ -68,11 +180,15 @@ class Dfa
 
   /**
    * The set of Symbols that are recognized by the DFA.
+   *
+   * Symbols that match input are single bytes, UTF-8 encoded characters, "lo-hi" ranges of either, and longer strings,
+   * which input is split into by longest match; see CollectSymbols in utf8.h and TokenCompiler in tokenizer.h.
    */
   using Alphabet = std::unordered_set<Symbol>;
 
   /**
-   * Represents all transitions from a State to other States, with Symbols as the key.
+   * Represents all transitions from a State to other States, with Symbols as the key. A key can also be a range of
+   * Symbols, like "a-z", which is a transition on each of them; a State whose keys overlap is nondeterministic.
    */
   using Transitions = std::unordered_map<Symbol, State>;
 
@@ -80,6 +196,21 @@ class Dfa
 
   using Json = nlohmann::json;
 
+  /**
+   * Static orders of the states of the table that AcceptsString runs on.
+   */
+  enum Layout
+  {
+    /**
+     * Breadth-first from the start state, which is the order a DFA is compiled in.
+     */
+    BREADTH_FIRST,
+    /**
+     * Depth-first from the start state, which keeps long paths in adjacent rows.
+     */
+    DEPTH_FIRST
+  };
+
   /**
    * Defines whether a given language was accepted by the DFA.
    */
@@ -108,26 +239,161 @@ class Dfa
    *
    * If the input is an NFA, it will be converted to a DFA automatically.
    * @param dfa_file_contents DFA file contents as a string
+   * @param options construction settings
+   * @throws BudgetExceededError if construction exceeds Options::max_states or Options::max_bytes
    * @see https://github.com/aokellermann/dfa for file format
    */
-  explicit Dfa(const std::string& dfa_file_contents);
+  explicit Dfa(const std::string& dfa_file_contents, const Options& options = Options());
 
   /**
    * Constructs a DFA from the input JSON file.
    *
    * If the input is an NFA, it will be converted to a DFA automatically.
    * @param dfa_file_contents JSON file contents
+   * @param options construction settings
+   * @throws BudgetExceededError if construction exceeds Options::max_states or Options::max_bytes
    * @see https://github.com/aokellermann/dfa for file format
    */
-  explicit Dfa(const Json& dfa_file_contents);
+  explicit Dfa(const Json& dfa_file_contents, const Options& options = Options());
+
+  /**
+   * Constructs a DFA that accepts the Languages matching a regular expression.
+   *
+   * The expression is compiled straight to an NFA in integer form and determinized, without writing a DFA file. The
+   * Alphabet is made of the single byte Symbols that the expression can match, and States are named q0, q1, ... in
+   * breadth-first order.
+   * @param pattern the regular expression; see ParseRegex in regex.h for the syntax
+   * @param options construction settings
+   * @throws std::invalid_argument with the position of the error if pattern is malformed
+   * @throws BudgetExceededError if construction exceeds Options::max_states or Options::max_bytes
+   */
+  static Dfa FromRegex(std::string_view pattern, const Options& options = Options());
+
+  /**
+   * Converts the NFA of a DFA file to the compiled file format without building the DFA in memory, for DFAs that
+   * don't fit. Temporary files take what doesn't fit in the budget; see DeterminizeOutOfCore.
+   * @param dfa_file_contents DFA file contents as a string; its Symbols have to be single bytes or ranges of them
+   * @param out where the compiled file is written; has to be seekable
+   * @param options the memory budget and the directory for temporary files
+   * @throws std::runtime_error if the file can't be parsed or written
+   * @throws std::invalid_argument if a Symbol is neither a byte nor a range of bytes
+   */
+  static OutOfCoreStats CompileOutOfCore(const std::string& dfa_file_contents, std::ostream& out,
+                                         const OutOfCoreOptions& options = OutOfCoreOptions());
+
+  /**
+   * Converts the NFA of a JSON file to the compiled file format without building the DFA in memory.
+   * @see CompileOutOfCore
+   */
+  static OutOfCoreStats CompileOutOfCore(const Json& dfa_file_contents, std::ostream& out,
+                                         const OutOfCoreOptions& options = OutOfCoreOptions());
+
+  /**
+   * Converts a regular expression to the compiled file format without building the DFA in memory. States are named
+   * like those of FromRegex, but numbered as described by DeterminizeOutOfCore.
+   * @throws std::invalid_argument with the position of the error if pattern is malformed
+   * @see CompileOutOfCore
+   */
+  static OutOfCoreStats CompileRegexOutOfCore(std::string_view pattern, std::ostream& out,
+                                              const OutOfCoreOptions& options = OutOfCoreOptions());
 
   /**
    * Determines whether the input language is accepted by the DFA.
-   * @param input the input Language
+   * @param input the input Language; taken as a view, so records of a larger buffer can be matched without copying
    * @param verbose prints debug information to stdout if true
    * @return Acceptance of input Language
    */
-  Acceptance AcceptsString(const Language& input, bool verbose = false) const;
+  Acceptance AcceptsString(std::string_view input, bool verbose = false) const;
+
+  /**
+   * Determines whether each input of a batch is accepted, reading the prefixes that inputs share only once.
+   *
+   * The inputs are matched in sorted order, keeping the state after every byte of the previous one, so that each input
+   * resumes from the end of its longest common prefix with the previous one. Batches of paths or URLs, which share
+   * long prefixes, take a fraction of the transitions that matching every input by AcceptsString would.
+   * @param inputs the input Languages
+   * @param verdicts receives the Acceptance of each input, in the order of inputs
+   * @return number of transitions taken; without sharing, it would be up to the total size of inputs
+   */
+  std::size_t AcceptsBatch(const std::vector<std::string_view>& inputs, std::vector<Acceptance>& verdicts) const;
+
+  /**
+   * Loads a DFA from the compiled file format that Save writes, without parsing or compiling anything.
+   *
+   * Only the Alphabet and the table that AcceptsString runs on are loaded: GetStates, GetTransitions, GetStartState and
+   * GetFinalStates are empty, although verbose matching still prints State names. The Alphabet only lists single byte
+   * Symbols that don't start longer ones, but all Symbols still match.
+   * @param in the compiled file
+   * @param options construction settings; only numa_replicas applies
+   * @throws std::runtime_error if the input is not a valid compiled DFA file
+   */
+  static Dfa Load(std::istream& in, const Options& options = Options());
+
+  /**
+   * Writes the table that AcceptsString runs on in the compiled file format, including its state order.
+   * @throws std::logic_error if this DFA IsSimulated
+   */
+  void Save(std::ostream& out) const;
+
+  /**
+   * Renumbers the states of the table that AcceptsString runs on, for cache locality. Matching results don't change.
+   * @throws std::logic_error if this DFA IsSimulated
+   */
+  void Relayout(Layout layout);
+
+  /**
+   * Renumbers the states of the table that AcceptsString runs on by a profile, so that states that are visited
+   * together sit in adjacent rows; see ProfileLayout.
+   * @param profile recorded by RecordVisits with the current state order
+   * @throws std::logic_error if this DFA IsSimulated
+   */
+  void Relayout(const VisitProfile& profile);
+
+  /**
+   * Records which states matching input visits, to Relayout by.
+   * @throws std::logic_error if this DFA IsSimulated
+   */
+  void RecordVisits(std::string_view input, VisitProfile& profile) const;
+
+  /**
+   * Whether the NFA this was constructed from is matched by bit-parallel simulation, because its DFA would have had
+   * more than Options::max_dfa_states states. If so, the States, transitions, start State and final States remain
+   * those of the NFA, and neither comparisons nor layouts nor compiled files are available.
+   */
+  inline bool IsSimulated() const noexcept { return simulated_.has_value(); }
+
+  /**
+   * Number of per-node copies of the table that AcceptsString runs on; zero if it isn't replicated.
+   * @see Options::numa_replicas
+   */
+  inline std::size_t NumaReplicas() const noexcept { return replicas_.size(); }
+
+  /**
+   * Memory this DFA takes, by what it is used for.
+   */
+  MemoryBreakdown MemoryUsage() const;
+
+  inline const BuildTimes& GetBuildTimes() const noexcept { return build_times_; }
+
+  /**
+   * Determines whether both DFAs accept the same Languages.
+   * @param other the DFA to compare with
+   * @param counterexample if not null and the DFAs differ, receives a shortest Language that exactly one of them
+   * accepts; the empty Language is returned as an empty string
+   * @return whether the DFAs are equivalent
+   * @throws std::logic_error if either DFA IsSimulated
+   */
+  bool Equivalent(const Dfa& other, Language* counterexample = nullptr) const;
+
+  /**
+   * Determines whether this DFA accepts every Language that other accepts.
+   * @param other the DFA whose accepted Languages should be a subset
+   * @param counterexample if not null and the check fails, receives a shortest Language that other accepts and this
+   * DFA doesn't
+   * @return whether the Languages accepted by other are a subset
+   * @throws std::logic_error if either DFA IsSimulated
+   */
+  bool Includes(const Dfa& other, Language* counterexample = nullptr) const;
 
   constexpr const StateSet& GetStates() const noexcept { return states_; }
 
@@ -140,11 +406,85 @@ class Dfa
   constexpr const StateSet& GetFinalStates() const noexcept { return final_states_; }
 
  private:
-  void ExpandNfaIfNeeded();
+  friend class DfaBuilder;
+
+  Dfa() = default;
 
-  void AggregateEpsilonClosure(State& total_state, const State& current_state) const;
+  /**
+   * Reads the States, Alphabet, transitions, start State and final States of a DFA file, without converting an NFA.
+   * @param arena where parsing temporaries are allocated
+   * @throws std::runtime_error if the file can't be parsed
+   */
+  void Parse(std::string_view contents, std::pmr::memory_resource& arena);
+
+  /**
+   * Reads the States, Alphabet, transitions, start State and final States of a JSON file, without converting an NFA.
+   * @throws std::runtime_error if the file can't be parsed
+   */
+  void Parse(const Json& contents);
+
+  /**
+   * Converts the States, transitions, start State and final States to integer form.
+   * @param nfa an empty Nfa, which refers to the names of the States of this Dfa
+   * @param arena where temporaries are allocated
+   */
+  void ToNfa(Nfa& nfa, std::pmr::memory_resource& arena) const;
+
+  /**
+   * Writes the compiled file of the DFA of these States and transitions by DeterminizeOutOfCore.
+   */
+  OutOfCoreStats WriteOutOfCore(std::ostream& out, const OutOfCoreOptions& options) const;
+
+  /**
+   * Replaces the NFA with an equivalent DFA if needed.
+   * @param options construction settings
+   * @param budget what construction is charged to
+   * @param arena where construction temporaries are allocated, from the budget
+   */
+  void ExpandNfaIfNeeded(const Options& options, MemoryBudget& budget, std::pmr::memory_resource& arena);
+
+  /**
+   * Determinizes an NFA and adopts the result, or prepares to simulate the NFA if its DFA would be too large.
+   * @param nfa the NFA
+   * @param options construction settings
+   * @param name_by_subset whether States are named by the NFA states they are made of, or q0, q1, ... by index
+   * @param budget what construction is charged to
+   * @param arena where construction temporaries are allocated, from the budget
+   * @throws BudgetExceededError if the DFA would have more than Options::max_states States
+   */
+  void DeterminizeOrSimulate(const Nfa& nfa, const Options& options, bool name_by_subset, MemoryBudget& budget,
+                             std::pmr::memory_resource& arena);
+
+  /**
+   * Replaces the States, transitions, start State and final States with those of a determinized NFA.
+   * @param nfa the NFA that was determinized
+   * @param dfa the result of determinizing it
+   * @param name_by_subset whether States are named by the NFA states they are made of, or q0, q1, ... by index
+   * @param budget what the new States and transitions are charged to
+   * @param arena where construction temporaries are allocated
+   */
+  void AdoptSubsetDfa(const Nfa& nfa, const SubsetDfa& dfa, bool name_by_subset, MemoryBudget& budget,
+                      std::pmr::memory_resource& arena);
+
+  /**
+   * Builds compiled_ from the members below.
+   * @param options construction settings
+   * @param budget what the table is charged to
+   * @param arena where construction temporaries are allocated, from the budget
+   * @throws BudgetExceededError if there are more than Options::max_states reachable States
+   */
+  void Compile(const Options& options, MemoryBudget& budget, std::pmr::memory_resource& arena);
+
+  /**
+   * Rebuilds replicas_ from compiled_.
+   * @param replicas as in Options::numa_replicas
+   */
+  void Replicate(std::size_t replicas);
 
-  void AggregateTransitions(StateMap<Transitions>& all_transitions, const State& current_state) const;
+  /**
+   * The copy of compiled_ that the calling thread should read.
+   */
+  const CompiledDfa& LocalTable() const;
 
   /**
    * Q: all possible states.
@@ -170,6 +510,23 @@ class Dfa
    * F: subset of Q.
    */
   StateSet final_states_;
+
+  /**
+   * The table that AcceptsString runs on.
+   */
+  CompiledDfa compiled_;
+
+  /**
+   * Copies of compiled_ by NUMA node, if it is replicated. Copies of a Dfa share them, since they are never modified.
+   */
+  std::vector<std::shared_ptr<const CompiledDfa>> replicas_;
+
+  /**
+   * What AcceptsString runs on instead of compiled_, if the NFA wasn't determinized.
+   */
+  std::optional<BitParallelNfa> simulated_;
+
+  BuildTimes build_times_;
 };
 
 }  // namespace dfa
\ No newline at end of file
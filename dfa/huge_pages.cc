@@ -0,0 +1,195 @@
+/**
+ * @file huge_pages.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "huge_pages.h"
+
+#include <sys/mman.h>
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+
+namespace dfa
+{
+namespace
+{
+/**
+ * Size of transparent huge pages, which is the page middle directory size on x86-64 and on arm64 with 4 KiB pages.
+ */
+constexpr std::size_t kTransparentHugePageSize = std::size_t{2} << 20U;
+
+constexpr std::size_t kSmallPageSize = 4096;
+
+std::atomic<HugePages> huge_pages{TRANSPARENT_HUGE_PAGES};
+
+/**
+ * The default huge page size of MAP_HUGETLB, from /proc/meminfo.
+ */
+std::size_t HugetlbPageSize()
+{
+  static const std::size_t size = [] {
+    std::ifstream meminfo("/proc/meminfo");
+    std::string key;
+    std::size_t kilobytes = 0;
+    while (meminfo >> key)
+    {
+      if (key == "Hugepagesize:" && meminfo >> kilobytes)
+      {
+        return kilobytes * 1024;
+      }
+      meminfo.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    return kTransparentHugePageSize;
+  }();
+  return size;
+}
+
+inline std::size_t RoundUp(std::size_t bytes, std::size_t multiple)
+{
+  return (bytes + multiple - 1) / multiple * multiple;
+}
+
+/**
+ * A table that was mapped rather than allocated on the heap.
+ */
+struct Mapping
+{
+  std::size_t length;
+  HugePages pages;
+};
+
+/**
+ * Mapped tables by address, since the policy may have changed since they were allocated. Tables are allocated rarely,
+ * so a lock is fine.
+ */
+struct Mappings
+{
+  std::mutex mutex;
+  std::unordered_map<void*, Mapping> by_address;
+  PageUsage usage;
+};
+
+Mappings& GetMappings()
+{
+  static Mappings mappings;
+  return mappings;
+}
+
+/**
+ * Maps length bytes aligned to alignment, by mapping more and trimming both ends.
+ */
+void* MapAligned(std::size_t length, std::size_t alignment)
+{
+  void* mapped = mmap(nullptr, length + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED)
+  {
+    return nullptr;
+  }
+
+  const auto begin = reinterpret_cast<std::uintptr_t>(mapped);
+  const std::uintptr_t aligned = RoundUp(begin, alignment);
+  if (aligned != begin)
+  {
+    munmap(mapped, aligned - begin);
+  }
+  if (alignment - (aligned - begin) != 0)
+  {
+    munmap(reinterpret_cast<void*>(aligned + length), alignment - (aligned - begin));
+  }
+  return reinterpret_cast<void*>(aligned);
+}
+
+/**
+ * Maps a table as pages says, falling back to smaller pages.
+ * @return the table, or nullptr if it should come from the heap
+ */
+void* Map(std::size_t bytes, HugePages pages, Mapping& mapping)
+{
+  if (pages == HUGETLB_PAGES && bytes >= HugetlbPageSize())
+  {
+#if defined(MAP_HUGETLB)
+    mapping = {RoundUp(bytes, HugetlbPageSize()), HUGETLB_PAGES};
+    void* table =
+        mmap(nullptr, mapping.length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (table != MAP_FAILED)
+    {
+      return table;
+    }
+#endif
+    pages = TRANSPARENT_HUGE_PAGES;
+  }
+
+  if (pages == TRANSPARENT_HUGE_PAGES && bytes >= kTransparentHugePageSize)
+  {
+    // Only the whole huge pages of the table can be backed by huge pages; its tail uses regular pages.
+    mapping = {RoundUp(bytes, kSmallPageSize), TRANSPARENT_HUGE_PAGES};
+    void* table = MapAligned(mapping.length, kTransparentHugePageSize);
+    if (table != nullptr)
+    {
+#if defined(MADV_HUGEPAGE)
+      madvise(table, mapping.length, MADV_HUGEPAGE);
+#endif
+      return table;
+    }
+  }
+  return nullptr;
+}
+}  // namespace
+
+void SetHugePages(HugePages pages) noexcept { huge_pages.store(pages, std::memory_order_relaxed); }
+
+HugePages GetHugePages() noexcept { return huge_pages.load(std::memory_order_relaxed); }
+
+PageUsage GetPageUsage()
+{
+  auto& mappings = GetMappings();
+  std::lock_guard<std::mutex> lock(mappings.mutex);
+  return mappings.usage;
+}
+
+void* AllocateTable(std::size_t bytes)
+{
+  auto& mappings = GetMappings();
+  Mapping mapping{};
+  void* table = Map(bytes, GetHugePages(), mapping);
+
+  std::lock_guard<std::mutex> lock(mappings.mutex);
+  if (table == nullptr)
+  {
+    table = ::operator new(bytes);
+    mappings.usage.small_bytes += bytes;
+    return table;
+  }
+
+  mappings.by_address.emplace(table, mapping);
+  (mapping.pages == HUGETLB_PAGES ? mappings.usage.hugetlb_bytes : mappings.usage.transparent_bytes) += mapping.length;
+  return table;
+}
+
+void DeallocateTable(void* table, std::size_t bytes) noexcept
+{
+  auto& mappings = GetMappings();
+  std::lock_guard<std::mutex> lock(mappings.mutex);
+  const auto mapped = mappings.by_address.find(table);
+  if (mapped == mappings.by_address.end())
+  {
+    mappings.usage.small_bytes -= bytes;
+    ::operator delete(table);
+    return;
+  }
+
+  const Mapping mapping = mapped->second;
+  mappings.by_address.erase(mapped);
+  (mapping.pages == HUGETLB_PAGES ? mappings.usage.hugetlb_bytes : mappings.usage.transparent_bytes) -= mapping.length;
+  munmap(table, mapping.length);
+}
+
+}  // namespace dfa
@@ -0,0 +1,114 @@
+/**
+ * @file huge_pages.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace dfa
+{
+/**
+ * Page sizes that large transition tables can be allocated with. Tables that are walked at random take a TLB miss on
+ * almost every step once they span more pages than the TLB covers, which huge pages make far less likely.
+ */
+enum HugePages
+{
+  /**
+   * Regular pages only.
+   */
+  SMALL_PAGES,
+  /**
+   * Tables are aligned to 2 MiB and advised for transparent huge pages, which the kernel backs with huge pages when
+   * transparent huge pages are enabled and memory isn't too fragmented, and with regular pages otherwise.
+   */
+  TRANSPARENT_HUGE_PAGES,
+  /**
+   * Tables are allocated from the reserved huge page pool (MAP_HUGETLB), rounded up to whole huge pages. If the pool
+   * is empty, they fall back to TRANSPARENT_HUGE_PAGES.
+   */
+  HUGETLB_PAGES
+};
+
+/**
+ * Bytes of the tables that are currently allocated, by how they are backed.
+ */
+struct PageUsage
+{
+  /**
+   * Mapped from the huge page pool, including the rounding.
+   */
+  std::size_t hugetlb_bytes = 0;
+
+  /**
+   * Mapped and advised for transparent huge pages.
+   */
+  std::size_t transparent_bytes = 0;
+
+  /**
+   * Allocated on the heap, either because they are smaller than a huge page or because of SMALL_PAGES.
+   */
+  std::size_t small_bytes = 0;
+};
+
+/**
+ * Sets how tables are allocated from now on, for the whole process. Tables that are already allocated keep their
+ * pages. The default is TRANSPARENT_HUGE_PAGES.
+ */
+void SetHugePages(HugePages pages) noexcept;
+
+HugePages GetHugePages() noexcept;
+
+PageUsage GetPageUsage();
+
+/**
+ * Allocates memory for a table. Allocations of at least one huge page are mapped as GetHugePages says, smaller ones
+ * come from the heap.
+ * @throws std::bad_alloc if no memory is left
+ */
+void* AllocateTable(std::size_t bytes);
+
+/**
+ * Frees memory from AllocateTable.
+ */
+void DeallocateTable(void* table, std::size_t bytes) noexcept;
+
+/**
+ * Allocator for the vectors that hold transition tables.
+ */
+template <typename T>
+struct HugePageAllocator
+{
+  using value_type = T;
+
+  HugePageAllocator() noexcept = default;
+
+  template <typename U>
+  inline HugePageAllocator(const HugePageAllocator<U>&) noexcept
+  {
+  }
+
+  inline T* allocate(std::size_t n) { return static_cast<T*>(AllocateTable(n * sizeof(T))); }
+
+  inline void deallocate(T* p, std::size_t n) noexcept { DeallocateTable(p, n * sizeof(T)); }
+
+  template <typename U>
+  inline bool operator==(const HugePageAllocator<U>&) const noexcept
+  {
+    return true;
+  }
+
+  template <typename U>
+  inline bool operator!=(const HugePageAllocator<U>&) const noexcept
+  {
+    return false;
+  }
+};
+
+template <typename T>
+using TableVector = std::vector<T, HugePageAllocator<T>>;
+
+}  // namespace dfa
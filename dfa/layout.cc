@@ -0,0 +1,217 @@
+/**
+ * @file layout.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "layout.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace dfa
+{
+namespace
+{
+using StateId = CompiledDfa::StateId;
+
+/**
+ * Any byte of each class, to step through the table by class.
+ */
+std::vector<unsigned char> Representatives(const CompiledDfa& dfa)
+{
+  std::vector<unsigned char> representatives(dfa.NumClasses());
+  for (unsigned b = 256; b-- > 0;)
+  {
+    representatives[dfa.ByteClass(static_cast<unsigned char>(b))] = static_cast<unsigned char>(b);
+  }
+  return representatives;
+}
+
+/**
+ * Appends the states that order doesn't contain yet, in ID order.
+ */
+void AppendRemaining(std::size_t num_states, std::vector<bool>& placed, std::vector<StateId>& order)
+{
+  for (std::size_t s = 0; s < num_states; ++s)
+  {
+    if (!placed[s])
+    {
+      placed[s] = true;
+      order.push_back(static_cast<StateId>(s));
+    }
+  }
+}
+}  // namespace
+
+void RecordVisits(const CompiledDfa& dfa, std::string_view input, VisitProfile& profile)
+{
+  if (dfa.NumStates() == 0)
+  {
+    return;
+  }
+  if (profile.visits.size() < dfa.NumStates())
+  {
+    profile.visits.resize(dfa.NumStates());
+  }
+
+  StateId state = dfa.Start();
+  ++profile.visits[state];
+  for (const char symbol : input)
+  {
+    // Unless every Symbol is a byte, the rest of the input still goes through the states that read multi-byte Symbols.
+    if (dfa.SymbolsAreBytes() && (dfa.Flags(state) & (CompiledDfa::DEAD | CompiledDfa::ABSORBING)) != 0)
+    {
+      break;
+    }
+    const StateId next = dfa.Next(state, static_cast<unsigned char>(symbol));
+    if (next >= CompiledDfa::kFirstSentinel)
+    {
+      break;
+    }
+    if (next != state)
+    {
+      ++profile.visits[next];
+      ++profile.transitions[(static_cast<std::uint64_t>(state) << 32U) | next];
+    }
+    state = next;
+  }
+}
+
+std::vector<StateId> BreadthFirstLayout(const CompiledDfa& dfa)
+{
+  const std::size_t num_states = dfa.NumStates();
+  std::vector<StateId> order;
+  order.reserve(num_states);
+  std::vector<bool> placed(num_states);
+  if (num_states == 0)
+  {
+    return order;
+  }
+
+  const auto representatives = Representatives(dfa);
+  placed[dfa.Start()] = true;
+  order.push_back(dfa.Start());
+  for (std::size_t i = 0; i < order.size(); ++i)
+  {
+    for (const auto representative : representatives)
+    {
+      const StateId target = dfa.Next(order[i], representative);
+      if (target < CompiledDfa::kFirstSentinel && !placed[target])
+      {
+        placed[target] = true;
+        order.push_back(target);
+      }
+    }
+  }
+
+  AppendRemaining(num_states, placed, order);
+  return order;
+}
+
+std::vector<StateId> DepthFirstLayout(const CompiledDfa& dfa)
+{
+  const std::size_t num_states = dfa.NumStates();
+  std::vector<StateId> order;
+  order.reserve(num_states);
+  std::vector<bool> placed(num_states);
+  if (num_states == 0)
+  {
+    return order;
+  }
+
+  // Successors are pushed in descending class order, so that the lowest class is explored first.
+  const auto representatives = Representatives(dfa);
+  std::vector<StateId> stack = {dfa.Start()};
+  while (!stack.empty())
+  {
+    const StateId state = stack.back();
+    stack.pop_back();
+    if (placed[state])
+    {
+      continue;
+    }
+    placed[state] = true;
+    order.push_back(state);
+
+    for (auto representative = representatives.rbegin(); representative != representatives.rend(); ++representative)
+    {
+      const StateId target = dfa.Next(state, *representative);
+      if (target < CompiledDfa::kFirstSentinel && !placed[target])
+      {
+        stack.push_back(target);
+      }
+    }
+  }
+
+  AppendRemaining(num_states, placed, order);
+  return order;
+}
+
+std::vector<StateId> ProfileLayout(const CompiledDfa& dfa, const VisitProfile& profile)
+{
+  const std::size_t num_states = dfa.NumStates();
+  const auto visits = [&](std::size_t state) {
+    return state < profile.visits.size() ? profile.visits[state] : std::uint64_t{0};
+  };
+
+  // Successors of each state, most taken first.
+  std::vector<std::vector<std::pair<std::uint64_t, StateId>>> successors(num_states);
+  for (const auto& [key, count] : profile.transitions)
+  {
+    const auto from = static_cast<std::size_t>(key >> 32U);
+    const auto to = static_cast<StateId>(key);
+    if (from < num_states && to < num_states)
+    {
+      successors[from].emplace_back(count, to);
+    }
+  }
+  for (auto& list : successors)
+  {
+    std::sort(list.begin(), list.end(), [](const auto& a, const auto& b) {
+      return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+  }
+
+  std::vector<StateId> seeds;
+  for (std::size_t s = 0; s < num_states; ++s)
+  {
+    if (visits(s) != 0)
+    {
+      seeds.push_back(static_cast<StateId>(s));
+    }
+  }
+  std::stable_sort(seeds.begin(), seeds.end(), [&](StateId a, StateId b) { return visits(a) > visits(b); });
+
+  std::vector<StateId> order;
+  order.reserve(num_states);
+  std::vector<bool> placed(num_states);
+  for (const auto seed : seeds)
+  {
+    for (StateId state = seed; !placed[state];)
+    {
+      placed[state] = true;
+      order.push_back(state);
+      for (const auto& [count, target] : successors[state])
+      {
+        if (!placed[target])
+        {
+          state = target;
+          break;
+        }
+      }
+    }
+  }
+
+  for (const auto state : BreadthFirstLayout(dfa))
+  {
+    if (!placed[state])
+    {
+      placed[state] = true;
+      order.push_back(state);
+    }
+  }
+  return order;
+}
+
+}  // namespace dfa
@@ -0,0 +1,63 @@
+/**
+ * @file layout.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "dfa/compiled_dfa.h"
+
+namespace dfa
+{
+/**
+ * How often states and transitions of a CompiledDfa were used while matching sample inputs.
+ *
+ * A profile refers to state IDs, so it is only valid for the numbering it was recorded with.
+ */
+struct VisitProfile
+{
+  /**
+   * How often each state was entered, indexed by state ID.
+   */
+  std::vector<std::uint64_t> visits;
+
+  /**
+   * How often each transition between two different states was taken, keyed by (from << 32) | to.
+   */
+  std::unordered_map<std::uint64_t, std::uint64_t> transitions;
+};
+
+/**
+ * Adds the states and transitions that matching input goes through to profile. Like matching, this stops where the
+ * verdict is decided, and doesn't count self-loops, which don't touch other rows.
+ */
+void RecordVisits(const CompiledDfa& dfa, std::string_view input, VisitProfile& profile);
+
+/**
+ * Orders states breadth-first from the start state, following byte classes in ascending order, including those of
+ * lead bytes and tokens that lead to the states which read the rest of multi-byte Symbols. States that can't be
+ * reached follow in ID order.
+ * @return the current ID of each state in the new order, for CompiledDfa::Renumbered
+ */
+std::vector<CompiledDfa::StateId> BreadthFirstLayout(const CompiledDfa& dfa);
+
+/**
+ * Orders states depth-first from the start state, in preorder, following byte classes in ascending order. Paths
+ * through the DFA then mostly run through adjacent rows. States that can't be reached follow in ID order.
+ */
+std::vector<CompiledDfa::StateId> DepthFirstLayout(const CompiledDfa& dfa);
+
+/**
+ * Orders states by a recorded profile: starting from the most visited state that isn't placed yet, each state is
+ * followed by its successor on the most taken transition, until that successor has been placed. Hot paths thus end
+ * up in adjacent rows at the front of the table. States that were never visited follow in breadth-first order.
+ */
+std::vector<CompiledDfa::StateId> ProfileLayout(const CompiledDfa& dfa, const VisitProfile& profile);
+
+}  // namespace dfa
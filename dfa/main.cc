@@ -4,40 +4,812 @@
  * @copyright 2020 Antony Kellermann
  */
 
+#include <fcntl.h>
+#include <getopt.h>
 #include <unistd.h>
 
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <csignal>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <memory>
-#include <nlohmann/json.hpp>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
 
+#include "dfa/bench.h"
+#include "dfa/client.h"
 #include "dfa/dfa.h"
+#include "dfa/huge_pages.h"
+#include "dfa/records.h"
+#include "dfa/scan.h"
+#include "dfa/server.h"
+#include "dfa/snapshot.h"
+#include "dfa/verdict_cache.h"
 
 namespace fs = std::filesystem;
-using Json = nlohmann::json;
+
+namespace
+{
+/**
+ * Options that only have a long form.
+ */
+enum LongOption
+{
+  SERVE = 256,
+  WORKERS,
+  CONNECT,
+  AUTOMATON,
+  IO_DEPTH,
+  NO_IO_URING,
+  MAX_DFA_STATES,
+  COMPILE,
+  LAYOUT,
+  PROFILE,
+  HUGE_PAGES,
+  NUMA_REPLICAS,
+  MAX_MEM,
+  CACHE,
+  OUT_OF_CORE,
+  BENCH,
+  RUNS,
+  WARMUP,
+  ENGINE
+};
+
+/**
+ * Number of records the client sends per batch.
+ */
+constexpr std::size_t kClientBatchSize = 4096;
+
+/**
+ * Records matched per Dfa::AcceptsBatch call by the batch engine of --bench.
+ */
+constexpr std::size_t kBenchBatchSize = 4096;
+
+/**
+ * The server that SIGINT and SIGTERM stop, if --serve was given.
+ */
+dfa::Server* running_server = nullptr;
+
+void HandleSighup(int /*signal*/) { dfa::SnapshotReloader::RequestAllReloads(); }
+
+void HandleStop(int /*signal*/)
+{
+  if (running_server != nullptr)
+  {
+    running_server->Stop();
+  }
+}
+
+/**
+ * Prints the definition of a DFA to stdout.
+ */
+void PrintDefinition(const dfa::Dfa& dfa)
+{
+  std::cout << "---BEGIN DFA DEFINITION---" << std::endl;
+
+  std::cout << "States:" << std::endl << '\t';
+  for (const auto& state : dfa.GetStates())
+  {
+    std::cout << state << ' ';
+  }
+
+  std::cout << std::endl;
+
+  std::cout << "Alphabet:" << std::endl << '\t';
+  for (const auto& symbol : dfa.GetAlphabet())
+  {
+    std::cout << symbol << ' ';
+  }
+
+  std::cout << std::endl;
+
+  std::cout << "Start State:" << std::endl << '\t';
+  std::cout << dfa.GetStartState();
+
+  std::cout << std::endl;
+
+  std::cout << "Final States:" << std::endl << '\t';
+  for (const auto& state : dfa.GetFinalStates())
+  {
+    std::cout << state << ' ';
+  }
+
+  std::cout << std::endl;
+
+  std::cout << "Transitions:" << std::endl;
+  for (const auto& [state, transitions] : dfa.GetTransitions())
+  {
+    std::cout << state << std::endl;
+    for (const auto& [symbol, transition_state] : transitions)
+    {
+      std::cout << '\t' << symbol << " -> " << transition_state << std::endl;
+    }
+  }
+
+  const auto usage = dfa.MemoryUsage();
+  std::cout << "Memory:" << std::endl << '\t' << usage.Total() << " bytes: " << usage.tables << " tables, "
+            << usage.names << " names, " << usage.definition << " definition, " << usage.caches << " caches"
+            << std::endl;
+}
+
+/**
+ * Parses a number of bytes, optionally followed by a K, M or G suffix for binary multiples.
+ * @throws std::invalid_argument if size is not such a number, or doesn't fit in a std::size_t
+ */
+std::size_t ParseBytes(std::string_view size)
+{
+  std::size_t bytes = 0;
+  const auto [end, error] = std::from_chars(size.data(), size.data() + size.size(), bytes);
+  std::size_t digits = error == std::errc() ? static_cast<std::size_t>(end - size.data()) : 0;
+
+  const std::string_view suffix = size.substr(digits);
+  unsigned shift = 0;
+  if (suffix == "K" || suffix == "k")
+  {
+    shift = 10;
+  }
+  else if (suffix == "M" || suffix == "m")
+  {
+    shift = 20;
+  }
+  else if (suffix == "G" || suffix == "g")
+  {
+    shift = 30;
+  }
+  else if (!suffix.empty())
+  {
+    digits = 0;
+  }
+  if (digits == 0 || bytes > (std::numeric_limits<std::size_t>::max() >> shift))
+  {
+    throw std::invalid_argument("Invalid memory size: " + std::string(size));
+  }
+  return bytes << shift;
+}
+
+/**
+ * Parses the decimal value of a numeric option, and prints a usage error if it isn't one or doesn't fit.
+ * @param option the option, to print
+ * @return whether number was set
+ */
+template <typename Number>
+bool ParseNumber(std::string_view option, std::string_view value, Number& number)
+{
+  Number parsed = 0;
+  const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), parsed);
+  if (value.empty() || error != std::errc() || end != value.data() + value.size())
+  {
+    std::cout << "Invalid number for " << option << ": " << value << std::endl;
+    return false;
+  }
+  number = parsed;
+  return true;
+}
+
+/**
+ * Prints the counters of a verdict cache to stderr, so that they don't mix with verdicts.
+ */
+void PrintCacheStats(const dfa::VerdictCacheStats& stats)
+{
+  std::cerr << "Verdict cache: " << stats.hits << " hits, " << stats.misses << " misses ("
+            << 100 * stats.HitRate() << "% hit rate), " << stats.evictions << " evictions, " << stats.invalidations
+            << " invalidations, " << stats.bypassed << " bypassed" << std::endl;
+}
+
+/**
+ * Sends stdin to a server in batches, and prints the verdicts like local matching does.
+ */
+int RunClient(const fs::path& socket_path, std::uint32_t automaton, dfa::VerdictWriter::Format format)
+{
+  try
+  {
+    dfa::Client client(socket_path);
+    dfa::VerdictWriter writer(std::cout, format);
+    std::vector<std::string> batch;
+    std::vector<std::uint64_t> offsets;
+    const auto send = [&] {
+      if (batch.empty())
+      {
+        return;
+      }
+      const auto verdicts = client.Classify(batch, automaton);
+      for (std::size_t i = 0; i < batch.size(); ++i)
+      {
+        writer.Write(batch[i], offsets[i], verdicts[i]);
+      }
+      batch.clear();
+      offsets.clear();
+    };
+
+    // A partial batch is sent whenever stdin has nothing more buffered, so interactive input isn't held back.
+    dfa::RecordReader reader(STDIN_FILENO, [&] {
+      send();
+      writer.Flush();
+    });
+    std::string_view record;
+    std::uint64_t offset;
+    while (reader.Next(record, offset))
+    {
+      batch.emplace_back(record);
+      offsets.push_back(offset);
+      if (batch.size() == kClientBatchSize)
+      {
+        send();
+      }
+    }
+    send();
+  }
+  catch (std::exception& e)
+  {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Writes a DFA in the compiled format, with its states renumbered by a layout or a profile first.
+ * @param layout "bfs" or "dfs"; ignored if there is a profile
+ * @param profile_path file whose records are matched to record a visit profile, if not empty
+ */
+int RunCompile(const dfa::Dfa& source, const fs::path& output_path, const std::string& layout,
+               const fs::path& profile_path)
+{
+  try
+  {
+    dfa::Dfa dfa = source;
+    if (!profile_path.empty())
+    {
+      const int fd = open(profile_path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+      {
+        throw std::system_error(errno, std::generic_category(), "Failed to open " + profile_path.string());
+      }
+      dfa::VisitProfile profile;
+      try
+      {
+        dfa::RecordReader reader(fd);
+        std::string_view record;
+        std::uint64_t offset;
+        while (reader.Next(record, offset))
+        {
+          dfa.RecordVisits(record, profile);
+        }
+      }
+      catch (...)
+      {
+        close(fd);
+        throw;
+      }
+      close(fd);
+      dfa.Relayout(profile);
+    }
+    else
+    {
+      dfa.Relayout(layout == "dfs" ? dfa::Dfa::DEPTH_FIRST : dfa::Dfa::BREADTH_FIRST);
+    }
+
+    std::ofstream out(output_path, std::ios::binary | std::ios::trunc);
+    dfa.Save(out);
+    out.close();
+    if (!out)
+    {
+      throw std::runtime_error("Failed to write " + output_path.string());
+    }
+  }
+  catch (std::exception& e)
+  {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Writes the DFA of a regular expression or DFA file in the compiled format, determinizing it out of core, and prints
+ * what that took to stderr. The file is written next to output_path first, and only takes its place once complete.
+ * @param max_bytes memory budget; 0 keeps that of OutOfCoreOptions
+ */
+int RunCompileOutOfCore(const std::optional<std::string>& regex, const fs::path& dfa_file_path,
+                        const fs::path& output_path, std::size_t max_bytes)
+{
+  fs::path partial_path = output_path;
+  partial_path += "." + std::to_string(getpid()) + ".tmp";
+  try
+  {
+    dfa::OutOfCoreOptions options;
+    if (max_bytes != 0)
+    {
+      options.max_bytes = max_bytes;
+    }
+
+    std::ofstream out(partial_path, std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+      throw std::runtime_error("Failed to create " + partial_path.string());
+    }
+    dfa::OutOfCoreStats stats;
+    if (regex)
+    {
+      stats = dfa::Dfa::CompileRegexOutOfCore(*regex, out, options);
+    }
+    else
+    {
+      const bool is_json_file = dfa_file_path.extension() == ".json";
+      if (!is_json_file && dfa_file_path.extension() != ".dfa")
+      {
+        throw std::runtime_error("--out-of-core needs a .dfa or .json file.");
+      }
+      std::ifstream in(dfa_file_path);
+      if (!in)
+      {
+        throw std::runtime_error("Failed to read file: " + dfa_file_path.string());
+      }
+      std::stringstream contents;
+      contents << in.rdbuf();
+      stats = is_json_file ? dfa::Dfa::CompileOutOfCore(dfa::Dfa::Json::parse(contents.str()), out, options)
+                           : dfa::Dfa::CompileOutOfCore(contents.str(), out, options);
+    }
+    out.close();
+    if (!out)
+    {
+      throw std::runtime_error("Failed to write " + partial_path.string());
+    }
+    fs::rename(partial_path, output_path);
+    std::cerr << "Compiled " << stats.states << " states in " << stats.levels << " levels, spilling "
+              << stats.spilled_bytes << " bytes in " << stats.runs << " runs" << std::endl;
+  }
+  catch (std::exception& e)
+  {
+    std::error_code error;
+    fs::remove(partial_path, error);
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+double Milliseconds(std::chrono::nanoseconds duration)
+{
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+/**
+ * Matches the lines of the given files, directories and globs, or of stdin, repeatedly, and prints how long building
+ * the DFA took, how much memory it takes, and the throughput and latencies of matching.
+ * @param engine how to match, which the DFA has to have been built for: "bit-parallel" by simulation, and the others
+ * by the table
+ * @param json whether to print JSON instead of text
+ */
+int RunBench(const dfa::Dfa& dfa, const std::string& engine, const std::vector<std::string>& targets,
+             const dfa::BenchOptions& bench_options, bool json)
+{
+  if (engine == "bit-parallel" && !dfa.IsSimulated())
+  {
+    std::cout << "The bit-parallel engine needs an NFA with at most 256 positions and single byte Symbols."
+              << std::endl;
+    return 1;
+  }
+  if (engine != "bit-parallel" && dfa.IsSimulated())
+  {
+    std::cout << "The DFA is matched by bit-parallel simulation; use --engine bit-parallel." << std::endl;
+    return 1;
+  }
+
+  try
+  {
+    const auto corpus = targets.empty() ? std::make_unique<dfa::Corpus>(STDIN_FILENO)
+                                        : std::make_unique<dfa::Corpus>(dfa::ExpandScanTargets(targets));
+    const auto result = dfa::Bench(dfa, *corpus, bench_options);
+    const auto& times = dfa.GetBuildTimes();
+    const auto memory = dfa.MemoryUsage();
+    const auto pages = dfa::GetPageUsage();
+    const char* huge_pages = dfa::GetHugePages() == dfa::SMALL_PAGES            ? "off"
+                             : dfa::GetHugePages() == dfa::TRANSPARENT_HUGE_PAGES ? "thp"
+                                                                                  : "hugetlb";
+    const std::pair<const char*, double> percentiles[] = {{"p50", 0.5}, {"p99", 0.99}, {"p99.9", 0.999}};
+
+    if (json)
+    {
+      dfa::Dfa::Json out;
+      out["engine"] = engine;
+      out["build_ms"] = {{"parse", Milliseconds(times.parse)},
+                         {"determinize", Milliseconds(times.determinize)},
+                         {"compile", Milliseconds(times.compile)}};
+      out["memory_bytes"] = {{"tables", memory.tables}, {"caches", memory.caches}};
+      out["numa_replicas"] = dfa.NumaReplicas();
+      out["huge_pages"] = huge_pages;
+      out["page_bytes"] = {
+          {"hugetlb", pages.hugetlb_bytes}, {"transparent", pages.transparent_bytes}, {"small", pages.small_bytes}};
+      out["records"] = result.records;
+      out["bytes"] = result.bytes;
+      out["warmup_runs"] = bench_options.warmup_runs;
+      out["runs"] = result.runs;
+      out["records_per_second"] = result.RecordsPerSecond();
+      out["megabytes_per_second"] = result.MegabytesPerSecond();
+      out["fastest_run_ms"] = Milliseconds(result.fastest);
+      for (const auto& [name, share] : percentiles)
+      {
+        out["latency_ns"][name] = result.latencies.Percentile(share);
+      }
+      out["latency_ns"]["max"] = result.latencies.Max();
+      for (int verdict = dfa::Dfa::ACCEPTS; verdict <= dfa::Dfa::NO_TRANSITION; ++verdict)
+      {
+        out["verdicts"][dfa::VerdictName(static_cast<dfa::Dfa::Acceptance>(verdict))] = result.verdicts[verdict];
+      }
+      std::cout << out.dump(2) << std::endl;
+      return 0;
+    }
+
+    std::cout << "Engine: " << engine << '\n'
+              << "Build: parse " << Milliseconds(times.parse) << " ms, determinize " << Milliseconds(times.determinize)
+              << " ms, compile " << Milliseconds(times.compile) << " ms\n"
+              << "Memory: " << memory.tables << " bytes of tables, " << memory.caches << " bytes of caches, "
+              << dfa.NumaReplicas() << " NUMA replicas\n"
+              << "Pages: " << huge_pages << ", " << pages.hugetlb_bytes << " bytes hugetlb, " << pages.transparent_bytes
+              << " bytes transparent, " << pages.small_bytes << " bytes small\n"
+              << "Corpus: " << result.records << " records, " << result.bytes << " bytes, "
+              << bench_options.warmup_runs << " warmup runs, " << result.runs << " runs\n"
+              << "Throughput: " << result.RecordsPerSecond() << " records/s, " << result.MegabytesPerSecond()
+              << " MB/s, fastest run " << Milliseconds(result.fastest) << " ms\n"
+              << "Latency:";
+    for (const auto& [name, share] : percentiles)
+    {
+      std::cout << ' ' << name << ' ' << result.latencies.Percentile(share) << " ns,";
+    }
+    std::cout << " max " << result.latencies.Max() << " ns\nVerdicts:";
+    for (int verdict = dfa::Dfa::ACCEPTS; verdict <= dfa::Dfa::NO_TRANSITION; ++verdict)
+    {
+      std::cout << (verdict == dfa::Dfa::ACCEPTS ? " " : ", ") << result.verdicts[verdict] << ' '
+                << dfa::VerdictName(static_cast<dfa::Dfa::Acceptance>(verdict));
+    }
+    std::cout << std::endl;
+  }
+  catch (std::exception& e)
+  {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Prints the verdict counts of a scan result.
+ */
+void PrintCounts(const dfa::ScanResult& result)
+{
+  std::cout << result.Records() << " records";
+  for (std::size_t i = 0; i < result.verdicts.size(); ++i)
+  {
+    std::cout << ", " << result.verdicts[i] << ' ' << dfa::VerdictName(static_cast<dfa::Dfa::Acceptance>(i));
+  }
+}
+
+/**
+ * Matches every line of the given files, directories and globs, and prints counts per file and in total.
+ */
+int RunScan(const dfa::Dfa& dfa, const std::vector<std::string>& targets, const dfa::ScanOptions& scan_options)
+{
+  std::vector<fs::path> files;
+  try
+  {
+    files = dfa::ExpandScanTargets(targets);
+  }
+  catch (std::exception& e)
+  {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+
+  std::size_t failed = 0;
+  const auto total = dfa::Scan(dfa, files, scan_options, [&failed](const dfa::ScanResult& result) {
+    std::cout << result.path.native() << ": ";
+    if (result.error.empty())
+    {
+      PrintCounts(result);
+    }
+    else
+    {
+      std::cout << result.error;
+      ++failed;
+    }
+    std::cout << '\n';
+  });
+
+  std::cout << "Total: " << files.size() << " files, " << failed << " failed, ";
+  PrintCounts(total);
+  std::cout << std::endl;
+  return failed == 0 ? 0 : 1;
+}
+}  // namespace
 
 int main(int argc, char** argv)
 {
   bool verbose = false;
-  fs::path dfa_file_path;
+  bool watch = false;
+  std::vector<fs::path> dfa_file_paths;
+  std::optional<std::string> regex;
+  dfa::Options options;
+  fs::path serve_path;
+  unsigned workers = 0;
+  fs::path connect_path;
+  std::uint32_t automaton = 0;
+  dfa::ScanOptions scan_options;
+  dfa::VerdictWriter::Format format = dfa::VerdictWriter::TEXT;
+  fs::path compile_path;
+  std::string layout = "bfs";
+  fs::path profile_path;
+  std::size_t cache_capacity = 0;
+  bool out_of_core = false;
+  std::optional<std::string> bench;
+  dfa::BenchOptions bench_options;
+  std::string engine = "table";
+
+  const option long_options[] = {
+      {"help", no_argument, nullptr, 'h'},
+      {"regex", required_argument, nullptr, 'e'},
+      {"watch", no_argument, nullptr, 'w'},
+      {"output", required_argument, nullptr, 'o'},
+      {"serve", required_argument, nullptr, SERVE},
+      {"workers", required_argument, nullptr, WORKERS},
+      {"connect", required_argument, nullptr, CONNECT},
+      {"automaton", required_argument, nullptr, AUTOMATON},
+      {"io-depth", required_argument, nullptr, IO_DEPTH},
+      {"no-io-uring", no_argument, nullptr, NO_IO_URING},
+      {"max-dfa-states", required_argument, nullptr, MAX_DFA_STATES},
+      {"compile", required_argument, nullptr, COMPILE},
+      {"layout", required_argument, nullptr, LAYOUT},
+      {"profile", required_argument, nullptr, PROFILE},
+      {"huge-pages", required_argument, nullptr, HUGE_PAGES},
+      {"numa-replicas", required_argument, nullptr, NUMA_REPLICAS},
+      {"max-mem", required_argument, nullptr, MAX_MEM},
+      {"cache", required_argument, nullptr, CACHE},
+      {"out-of-core", no_argument, nullptr, OUT_OF_CORE},
+      {"bench", optional_argument, nullptr, BENCH},
+      {"runs", required_argument, nullptr, RUNS},
+      {"warmup", required_argument, nullptr, WARMUP},
+      {"engine", required_argument, nullptr, ENGINE},
+      {nullptr, 0, nullptr, 0},
+  };
 
   for (;;)
   {
-    switch (getopt(argc, argv, "vd:h"))  // note the colon (:) to indicate that 'b' has a parameter and is not a switch
+    switch (getopt_long(argc, argv, "vd:e:j:wo:h", long_options, nullptr))
     {
       case 'v':
         verbose = true;
         continue;
 
       case 'd':
-        dfa_file_path = optarg;
+        dfa_file_paths.emplace_back(optarg);
+        continue;
+
+      case 'e':
+        regex = optarg;
+        continue;
+
+      case 'j':
+        if (!ParseNumber("-j", optarg, options.threads))
+        {
+          return 1;
+        }
+        continue;
+
+      case 'w':
+        watch = true;
+        continue;
+
+      case 'o':
+        try
+        {
+          format = dfa::VerdictWriter::ParseFormat(optarg);
+        }
+        catch (std::exception& e)
+        {
+          std::cout << e.what() << std::endl;
+          return 1;
+        }
+        continue;
+
+      case SERVE:
+        serve_path = optarg;
+        continue;
+
+      case WORKERS:
+        if (!ParseNumber("--workers", optarg, workers))
+        {
+          return 1;
+        }
+        continue;
+
+      case CONNECT:
+        connect_path = optarg;
+        continue;
+
+      case AUTOMATON:
+        if (!ParseNumber("--automaton", optarg, automaton))
+        {
+          return 1;
+        }
+        continue;
+
+      case IO_DEPTH:
+        if (!ParseNumber("--io-depth", optarg, scan_options.queue_depth))
+        {
+          return 1;
+        }
+        continue;
+
+      case NO_IO_URING:
+        scan_options.io_uring = false;
+        continue;
+
+      case MAX_DFA_STATES:
+        if (!ParseNumber("--max-dfa-states", optarg, options.max_dfa_states))
+        {
+          return 1;
+        }
+        continue;
+
+      case COMPILE:
+        compile_path = optarg;
+        continue;
+
+      case LAYOUT:
+        layout = optarg;
+        if (layout != "bfs" && layout != "dfs")
+        {
+          std::cout << "Unknown layout: " << layout << std::endl;
+          return 1;
+        }
+        continue;
+
+      case PROFILE:
+        profile_path = optarg;
+        continue;
+
+      case HUGE_PAGES:
+        if (std::string_view(optarg) == "off")
+        {
+          dfa::SetHugePages(dfa::SMALL_PAGES);
+        }
+        else if (std::string_view(optarg) == "thp")
+        {
+          dfa::SetHugePages(dfa::TRANSPARENT_HUGE_PAGES);
+        }
+        else if (std::string_view(optarg) == "hugetlb")
+        {
+          dfa::SetHugePages(dfa::HUGETLB_PAGES);
+        }
+        else
+        {
+          std::cout << "Unknown huge page setting: " << optarg << std::endl;
+          return 1;
+        }
+        continue;
+
+      case NUMA_REPLICAS:
+        if (!ParseNumber("--numa-replicas", optarg, options.numa_replicas))
+        {
+          return 1;
+        }
+        continue;
+
+      case CACHE:
+        if (!ParseNumber("--cache", optarg, cache_capacity))
+        {
+          return 1;
+        }
+        continue;
+
+      case OUT_OF_CORE:
+        out_of_core = true;
+        continue;
+
+      case BENCH:
+        bench = optarg == nullptr ? "text" : optarg;
+        if (*bench != "text" && *bench != "json")
+        {
+          std::cout << "Unknown bench format: " << *bench << std::endl;
+          return 1;
+        }
+        continue;
+
+      case RUNS:
+        if (!ParseNumber("--runs", optarg, bench_options.runs))
+        {
+          return 1;
+        }
+        continue;
+
+      case WARMUP:
+        if (!ParseNumber("--warmup", optarg, bench_options.warmup_runs))
+        {
+          return 1;
+        }
+        continue;
+
+      case ENGINE:
+        engine = optarg;
+        if (engine == "batch")
+        {
+          bench_options.batch_size = kBenchBatchSize;
+        }
+        else if (engine == "bit-parallel")
+        {
+          options.simulate = true;
+        }
+        else if (engine != "table")
+        {
+          std::cout << "Unknown engine: " << engine << std::endl;
+          return 1;
+        }
+        continue;
+
+      case MAX_MEM:
+        try
+        {
+          options.max_bytes = ParseBytes(optarg);
+        }
+        catch (std::exception& e)
+        {
+          std::cout << e.what() << std::endl;
+          return 1;
+        }
         continue;
 
       case 'h':
       default:
-        std::cout << "-h\n\tprint usage\n-d <dfafile>\n\tDFA definition file\n-v\n\t verbose mode; display machine "
-                     "definition, transitions, etc."
+        std::cout << "-h, --help\n\tprint usage\n-d <dfafile>\n\tDFA definition file (.dfa, .json or compiled .dfac); "
+                     "may be given several times with --serve\n-e, --regex <pattern>\n\tmatch against a regular "
+                     "expression instead of a DFA file: literals, ., [classes], \\d \\w \\s, (groups), |, *, +, ?, "
+                     "{n}, {n,} and {n,m}; the whole input has to match\n[file|directory|glob]...\n\tmatch every line "
+                     "of these files instead of stdin, and print verdict counts per file and in total\n-j "
+                     "<threads>\n\tthreads used to convert an NFA to a DFA; 0 uses all hardware "
+                     "threads\n--max-dfa-states <states>\n\tmatch an NFA by bit-parallel simulation instead of "
+                     "converting it, if its DFA would have more states than this and the NFA is small "
+                     "enough\n--max-mem <bytes>\n\tstop building the DFA with an error if it would need more memory "
+                     "than this; takes a K, M or G suffix\n--huge-pages <off|thp|hugetlb>\n\tpages that large tables "
+                     "are allocated with: regular pages, transparent huge pages (default), or the reserved huge page "
+                     "pool, falling back to transparent huge pages if it is empty\n--numa-replicas <copies>\n\tkeep "
+                     "this many copies of each table, one per NUMA node, so that threads read the copy on their node; "
+                     "0 keeps one per node (default 1)\n-w, --watch\n\trebuild the DFA in the background when its file "
+                     "changes or on SIGHUP, and switch to it between inputs\n-o, --output <format>\n\thow verdicts are "
+                     "printed: text (default), codes (one Acceptance digit per line), accepted (accepted inputs only), "
+                     "jsonl (JSON Lines with byte offsets) or binary (one Acceptance byte per input)\n--serve "
+                     "<socket>\n\tserve batches from clients on a Unix domain socket until SIGINT or SIGTERM, instead "
+                     "of reading stdin\n--workers <threads>\n\tthreads that match batches in --serve mode, or files "
+                     "when scanning; 0 (default) uses all hardware threads\n--io-depth <reads>\n\treads kept in flight "
+                     "when scanning files (default 64)\n--cache <entries>\n\tcache the verdicts of up to this many "
+                     "distinct records when reading stdin, scanning or serving, and print hit rates to stderr at exit; "
+                     "reloads invalidate the cache\n--no-io-uring\n\tread files with a pread thread pool even where "
+                     "io_uring is available\n--connect <socket>\n\tsend stdin to a --serve instance instead of loading "
+                     "a DFA file\n--automaton <index>\n\twhich of the server's DFA files to match against with "
+                     "--connect, in the order they were given (default 0)\n--compile <file.dfac>\n\twrite the DFA in "
+                     "the compiled format, which loads without parsing, and exit\n--layout <bfs|dfs>\n\tstate order of "
+                     "the compiled table: breadth-first (default) or depth-first from the start state\n--profile "
+                     "<file>\n\torder the compiled table by the states that matching the lines of this file visits, so "
+                     "that hot states share cache lines\n--bench[=text|json]\n\tmatch the lines of the given files, or "
+                     "of stdin, repeatedly instead of printing verdicts, and print build times, memory, throughput and "
+                     "p50/p99/p99.9 latencies as text (default) or JSON\n--runs <n>\n\tmeasured passes over the lines "
+                     "with --bench (default 5)\n--warmup <n>\n\tpasses before measuring with --bench (default "
+                     "1)\n--engine <table|batch|bit-parallel>\n\thow --bench matches: one line at a time by the table "
+                     "(default), batches that share prefixes, or bit-parallel simulation of the "
+                     "NFA\n--out-of-core\n\twith --compile, convert the NFA in breadth-first levels that are sorted "
+                     "and deduplicated in temporary files, so that DFAs larger than memory can be compiled; --max-mem "
+                     "sets the budget (default 256M), and TMPDIR where the files go\n-v\n\t verbose mode; display "
+                     "machine definition, transitions, etc."
                   << std::endl;
         return 0;
 
@@ -47,141 +819,208 @@ int main(int argc, char** argv)
     break;
   }
 
-  if (dfa_file_path.empty())
+  const std::vector<std::string> scan_targets(argv + optind, argv + argc);
+  scan_options.threads = workers;
+  std::unique_ptr<dfa::VerdictCache> cache;
+  if (cache_capacity != 0 && serve_path.empty())
   {
-    std::cout << "No DFA file path specified." << std::endl;
-    return 1;
+    cache = std::make_unique<dfa::VerdictCache>(cache_capacity);
+    scan_options.cache = cache.get();
   }
 
-  if (!fs::exists(dfa_file_path))
+  if (!connect_path.empty())
   {
-    std::cout << "Specified DFA file path doesn't exist." << std::endl;
-    return 1;
+    return RunClient(connect_path, automaton, format);
   }
 
-  bool is_dfa_file = dfa_file_path.extension() == ".dfa";
-  bool is_json_file = dfa_file_path.extension() == ".json";
-
-  if (!is_dfa_file && !is_json_file)
+  if (regex && !dfa_file_paths.empty())
   {
-    std::cout << "Only .dfa and .json files are valid." << std::endl;
+    std::cout << "A regular expression can't be given with DFA files." << std::endl;
     return 1;
   }
-
-  std::string input;
-  try
+  if (regex && watch)
   {
-    std::ifstream fstream(dfa_file_path);
-    std::stringstream sstr;
-    sstr << fstream.rdbuf();
-
-    input = sstr.str();
+    std::cout << "--watch needs a DFA file." << std::endl;
+    return 1;
   }
-  catch (std::exception& e)
+  if (dfa_file_paths.empty() && !regex)
   {
-    std::cout << "Failed to read file: " << e.what() << std::endl;
+    std::cout << "No DFA file path specified." << std::endl;
+    return 1;
+  }
+  if (dfa_file_paths.size() > 1 && (serve_path.empty() || !compile_path.empty()))
+  {
+    std::cout << "Several DFA files can only be given with --serve." << std::endl;
+    return 1;
+  }
+  if (!scan_targets.empty() && !serve_path.empty())
+  {
+    std::cout << "Files to scan can't be given with --serve." << std::endl;
     return 1;
   }
 
-  if (input.empty())
+  if (bench && !serve_path.empty())
   {
-    std::cout << "Input file empty." << std::endl;
+    std::cout << "--bench can't be given with --serve." << std::endl;
     return 1;
   }
 
-  Json j_input;
-  if (is_json_file)
+  if (out_of_core)
+  {
+    if (compile_path.empty())
+    {
+      std::cout << "--out-of-core needs --compile." << std::endl;
+      return 1;
+    }
+    return RunCompileOutOfCore(regex, dfa_file_paths.empty() ? fs::path() : dfa_file_paths.front(), compile_path,
+                               options.max_bytes);
+  }
+
+  // Inputs are matched against whichever Snapshot was current when they were read. A rebuild in progress never
+  // affects them: it only becomes visible once it is complete and stored.
+  std::vector<std::unique_ptr<dfa::AtomicSnapshot>> automata;
+  if (regex)
   {
     try
     {
-      j_input = Json::parse(input);
+      automata.push_back(std::make_unique<dfa::AtomicSnapshot>(
+          std::make_shared<const dfa::Dfa>(dfa::Dfa::FromRegex(*regex, options))));
     }
     catch (std::exception& e)
     {
-      std::cout << "Failed to parse JSON: " << e.what() << std::endl;
+      std::cout << e.what() << std::endl;
       return 1;
     }
-  }
 
-  std::unique_ptr<dfa::Dfa> dfa;
-  try
-  {
-    dfa = std::make_unique<dfa::Dfa>(is_json_file ? dfa::Dfa(j_input) : dfa::Dfa(input));
-  }
-  catch (std::exception& e)
-  {
-    std::cout << "Failed to parse input file: " << e.what() << std::endl;
-    return 1;
+    if (verbose)
+    {
+      PrintDefinition(*automata.back()->Load());
+    }
   }
-
-  if (verbose)
+  // Modification times are taken before loading, so that a reloader picks up a change made while the file loads.
+  std::vector<fs::file_time_type> loaded_times;
+  for (const auto& dfa_file_path : dfa_file_paths)
   {
-    std::cout << "---BEGIN DFA DEFINITION---" << std::endl;
-
-    std::cout << "States:" << std::endl << '\t';
-    for (const auto& state : dfa->GetStates())
+    loaded_times.push_back(dfa::SnapshotReloader::ModificationTime(dfa_file_path));
+    try
     {
-      std::cout << state << ' ';
+      automata.push_back(std::make_unique<dfa::AtomicSnapshot>(dfa::LoadSnapshot(dfa_file_path, options)));
     }
-
-    std::cout << std::endl;
-
-    std::cout << "Alphabet:" << std::endl << '\t';
-    for (const auto& symbol : dfa->GetAlphabet())
+    catch (std::exception& e)
     {
-      std::cout << symbol << ' ';
+      std::cout << e.what() << std::endl;
+      return 1;
     }
 
-    std::cout << std::endl;
+    if (verbose)
+    {
+      PrintDefinition(*automata.back()->Load());
+    }
+  }
 
-    std::cout << "Start State:" << std::endl << '\t';
-    std::cout << dfa->GetStartState();
+  if (!compile_path.empty())
+  {
+    return RunCompile(*automata.front()->Load(), compile_path, layout, profile_path);
+  }
 
-    std::cout << std::endl;
+  if (bench)
+  {
+    return RunBench(*automata.front()->Load(), engine, scan_targets, bench_options, *bench == "json");
+  }
 
-    std::cout << "Final States:" << std::endl << '\t';
-    for (const auto& state : dfa->GetFinalStates())
+  std::vector<std::unique_ptr<dfa::SnapshotReloader>> reloaders;
+  if (watch)
+  {
+    for (std::size_t i = 0; i < automata.size(); ++i)
     {
-      std::cout << state << ' ';
+      reloaders.push_back(std::make_unique<dfa::SnapshotReloader>(
+          dfa_file_paths[i], options, *automata[i], loaded_times[i], [](const std::string& error) {
+            std::cerr << "Failed to reload DFA file: " << error << std::endl;
+          }));
     }
+    std::signal(SIGHUP, HandleSighup);
+  }
 
-    std::cout << std::endl;
-
-    std::cout << "Transitions:" << std::endl;
-    for (const auto& [state, transitions] : dfa->GetTransitions())
+  int status = 0;
+  if (!serve_path.empty())
+  {
+    try
     {
-      std::cout << state << std::endl;
-      for (const auto& [symbol, transition_state] : transitions)
+      std::vector<const dfa::AtomicSnapshot*> served;
+      for (const auto& snapshot : automata)
       {
-        std::cout << '\t' << symbol << " -> " << transition_state << std::endl;
+        served.push_back(snapshot.get());
       }
+      dfa::Server server(serve_path, std::move(served), workers, cache_capacity);
+      running_server = &server;
+      std::signal(SIGINT, HandleStop);
+      std::signal(SIGTERM, HandleStop);
+      server.Run();
+      std::signal(SIGINT, SIG_DFL);
+      std::signal(SIGTERM, SIG_DFL);
+      running_server = nullptr;
+      if (cache_capacity != 0)
+      {
+        PrintCacheStats(server.CacheStats());
+      }
+    }
+    catch (std::exception& e)
+    {
+      std::cout << e.what() << std::endl;
+      status = 1;
     }
   }
-
-  std::string language;
-  while (std::getline(std::cin, language) && !language.empty())
+  else if (!scan_targets.empty())
+  {
+    status = RunScan(*automata.front()->Load(), scan_targets, scan_options);
+  }
+  else
   {
-    std::cout << language << " -> ";
-    switch (dfa->AcceptsString(language, verbose))
+    try
     {
-      case dfa::Dfa::ACCEPTS:
-        std::cout << "ACCEPT";
-        break;
-      case dfa::Dfa::REJECTS:
-        std::cout << "NOT ACCEPT";
-        break;
-      case dfa::Dfa::INVALID_ALPHABET:
-        std::cout << "INVALID ALPHABET";
-        break;
-      case dfa::Dfa::NO_TRANSITION:
-        std::cout << "NO TRANSITION";
-        break;
-      default:
-        break;
+      // Output is flushed whenever stdin has nothing more buffered, rather than per record.
+      dfa::VerdictWriter writer(std::cout, format);
+      dfa::RecordReader reader(STDIN_FILENO, [&writer] { writer.Flush(); });
+      dfa::AtomicSnapshot& current = *automata.front();
+      dfa::Snapshot dfa = current.Load();
+      std::uint64_t generation = current.Generation();
+      std::string_view language;
+      std::uint64_t offset;
+      while (reader.Next(language, offset))
+      {
+        if (current.Generation() != generation)
+        {
+          generation = current.Generation();
+          dfa = current.Load();
+        }
+
+        // Verbose matching prints every step, so it isn't cached.
+        const auto verdict =
+            cache && !verbose ? cache->Match(*dfa, generation, language) : dfa->AcceptsString(language, verbose);
+        writer.Write(language, offset, verdict);
+        if (verbose)
+        {
+          writer.Flush();
+        }
+      }
     }
+    catch (std::exception& e)
+    {
+      std::cout << e.what() << std::endl;
+      status = 1;
+    }
+  }
 
-    std::cout << std::endl;
+  if (cache)
+  {
+    PrintCacheStats(cache->Stats());
   }
 
-  return 0;
-}
\ No newline at end of file
+  if (watch)
+  {
+    std::signal(SIGHUP, SIG_DFL);
+    reloaders.clear();
+  }
+
+  return status;
+}
@@ -0,0 +1,64 @@
+/**
+ * @file memory_budget.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "memory_budget.h"
+
+namespace dfa
+{
+BudgetExceededError::BudgetExceededError(const std::string& budget, std::size_t states, std::size_t bytes)
+    : std::runtime_error("Building the DFA exceeded its budget of " + budget + " after " + std::to_string(states) +
+                         " states, with " + std::to_string(bytes) + " bytes in use"),
+      budget_(budget),
+      states_(states),
+      bytes_(bytes)
+{
+}
+
+BudgetExceededError BudgetExceededError::AfterStates(std::size_t states) const
+{
+  return BudgetExceededError(budget_, states, bytes_);
+}
+
+MemoryBudget::MemoryBudget(std::size_t max_bytes, std::pmr::memory_resource* upstream) noexcept
+    : max_bytes_(max_bytes), upstream_(upstream)
+{
+}
+
+void MemoryBudget::Charge(std::size_t bytes)
+{
+  const std::size_t used = used_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  if (max_bytes_ != 0 && used > max_bytes_)
+  {
+    used_.fetch_sub(bytes, std::memory_order_relaxed);
+    throw BudgetExceededError(std::to_string(max_bytes_) + " bytes", 0, used - bytes);
+  }
+}
+
+void MemoryBudget::Release(std::size_t bytes) noexcept { used_.fetch_sub(bytes, std::memory_order_relaxed); }
+
+void* MemoryBudget::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+  Charge(bytes);
+  try
+  {
+    return upstream_->allocate(bytes, alignment);
+  }
+  catch (...)
+  {
+    Release(bytes);
+    throw;
+  }
+}
+
+void MemoryBudget::do_deallocate(void* p, std::size_t bytes, std::size_t alignment)
+{
+  upstream_->deallocate(p, bytes, alignment);
+  Release(bytes);
+}
+
+bool MemoryBudget::do_is_equal(const std::pmr::memory_resource& other) const noexcept { return this == &other; }
+
+}  // namespace dfa
@@ -0,0 +1,92 @@
+/**
+ * @file memory_budget.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+
+namespace dfa
+{
+/**
+ * Thrown when building a Dfa would take more states or memory than Options::max_states and Options::max_bytes allow.
+ * Construction stops cleanly: everything it allocated is released.
+ */
+class BudgetExceededError : public std::runtime_error
+{
+ public:
+  /**
+   * @param budget the budget that was exceeded, like "1000 states" or "1048576 bytes"
+   * @param states DFA states built when construction stopped
+   * @param bytes bytes in use when construction stopped
+   */
+  BudgetExceededError(const std::string& budget, std::size_t states, std::size_t bytes);
+
+  /**
+   * The same error, for a construction that had built states when it stopped.
+   */
+  BudgetExceededError AfterStates(std::size_t states) const;
+
+  inline const std::string& Budget() const noexcept { return budget_; }
+
+  inline std::size_t States() const noexcept { return states_; }
+
+  inline std::size_t Bytes() const noexcept { return bytes_; }
+
+ private:
+  std::string budget_;
+
+  std::size_t states_;
+
+  std::size_t bytes_;
+};
+
+/**
+ * Limits the memory that building a Dfa has in use at once.
+ *
+ * Memory allocated through the budget, as a memory resource, is counted against it, and so are the estimated sizes of
+ * containers that don't take a memory resource, through Charge. It is thread-safe as long as its upstream resource is.
+ */
+class MemoryBudget : public std::pmr::memory_resource
+{
+ public:
+  /**
+   * @param max_bytes most bytes in use at once; zero for no limit
+   * @param upstream where memory is allocated from
+   */
+  explicit MemoryBudget(std::size_t max_bytes,
+                        std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()) noexcept;
+
+  /**
+   * Counts bytes that were allocated elsewhere.
+   * @throws BudgetExceededError if they don't fit in the budget, in which case they aren't counted
+   */
+  void Charge(std::size_t bytes);
+
+  void Release(std::size_t bytes) noexcept;
+
+  inline std::size_t Used() const noexcept { return used_.load(std::memory_order_relaxed); }
+
+  inline std::size_t MaxBytes() const noexcept { return max_bytes_; }
+
+ private:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+
+  void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+  std::size_t max_bytes_;
+
+  std::pmr::memory_resource* upstream_;
+
+  std::atomic<std::size_t> used_{0};
+};
+
+}  // namespace dfa
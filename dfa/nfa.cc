@@ -0,0 +1,702 @@
+/**
+ * @file nfa.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "nfa.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace dfa
+{
+std::size_t SubsetHasher::operator()(const Nfa::Subset& subset) const
+{
+  std::uint64_t hash = 0xCBF29CE484222325ULL;
+  for (const auto state : subset)
+  {
+    hash = (hash ^ state) * 0x100000001B3ULL;
+  }
+  return static_cast<std::size_t>(hash ^ (hash >> 32U));
+}
+
+namespace
+{
+using Row = SubsetDfa::Row;
+
+using Successors = std::pmr::vector<std::pair<Nfa::SymbolId, Nfa::Subset>>;
+
+/**
+ * Computes epsilon closures and successor subsets. Not thread-safe: each thread needs its own.
+ */
+class SubsetExpander
+{
+ public:
+  SubsetExpander(const Nfa& nfa, std::pmr::memory_resource* resource)
+      : nfa_(nfa),
+        resource_(resource),
+        visited_(nfa.state_names.size(), 0, resource),
+        stack_(resource),
+        moves_(resource)
+  {
+  }
+
+  /**
+   * Replaces states with their epsilon closure, sorted in ascending order.
+   */
+  void Close(Nfa::Subset& states)
+  {
+    ++stamp_;
+    stack_.clear();
+    for (const auto state : states)
+    {
+      if (visited_[state] != stamp_)
+      {
+        visited_[state] = stamp_;
+        stack_.push_back(state);
+      }
+    }
+
+    states.clear();
+    while (!stack_.empty())
+    {
+      const auto state = stack_.back();
+      stack_.pop_back();
+      states.push_back(state);
+      for (const auto next : nfa_.epsilon_transitions[state])
+      {
+        if (visited_[next] != stamp_)
+        {
+          visited_[next] = stamp_;
+          stack_.push_back(next);
+        }
+      }
+    }
+    std::sort(states.begin(), states.end());
+  }
+
+  /**
+   * Computes the closed successor subset of a closed subset for each Symbol, in ascending Symbol order.
+   */
+  void Expand(const Nfa::Subset& subset, Successors& successors)
+  {
+    moves_.clear();
+    for (const auto state : subset)
+    {
+      moves_.insert(moves_.end(), nfa_.transitions[state].begin(), nfa_.transitions[state].end());
+    }
+    std::sort(moves_.begin(), moves_.end());
+
+    successors.clear();
+    for (std::size_t i = 0; i < moves_.size();)
+    {
+      const auto symbol = moves_[i].first;
+      Nfa::Subset targets(resource_);
+      for (; i < moves_.size() && moves_[i].first == symbol; ++i)
+      {
+        targets.push_back(moves_[i].second);
+      }
+      Close(targets);
+      successors.emplace_back(symbol, std::move(targets));
+    }
+  }
+
+ private:
+  const Nfa& nfa_;
+
+  std::pmr::memory_resource* resource_;
+
+  std::pmr::vector<std::uint32_t> visited_;
+
+  std::uint32_t stamp_ = 0;
+
+  std::pmr::vector<Nfa::StateId> stack_;
+
+  std::pmr::vector<std::pair<Nfa::SymbolId, Nfa::StateId>> moves_;
+};
+
+[[noreturn]] void ThrowStateLimitError(std::size_t max_states)
+{
+  throw StateLimitError("The DFA has more than " + std::to_string(max_states) + " states");
+}
+
+/**
+ * Estimated memory taken by a subset of IncrementalDeterminizer: the subset, its copy as a key of the index, and its
+ * entries in the index of containing states.
+ */
+std::size_t SubsetBytes(const Nfa::Subset& subset)
+{
+  return 2 * sizeof(Nfa::Subset) + 3 * subset.size() * sizeof(Nfa::StateId);
+}
+
+/**
+ * Estimated memory taken by a row of IncrementalDeterminizer, with the predecessor entries it adds.
+ */
+std::size_t RowBytes(const Row& row)
+{
+  return sizeof(Row) + row.size() * (sizeof(Row::value_type) + sizeof(SubsetDfa::StateId));
+}
+
+SubsetDfa DeterminizeSerial(const Nfa& nfa, std::pmr::memory_resource* resource, std::size_t max_states)
+{
+  SubsetExpander expander(nfa, resource);
+  SubsetDfa dfa(resource);
+  std::pmr::unordered_map<Nfa::Subset, SubsetDfa::StateId, SubsetHasher> ids(resource);
+
+  Nfa::Subset start(nfa.start, resource);
+  expander.Close(start);
+  ids.emplace(start, 0);
+  dfa.subsets.push_back(std::move(start));
+
+  // States are expanded in the order they were found, so numbering is breadth-first.
+  Successors successors(resource);
+  try
+  {
+    for (std::size_t i = 0; i < dfa.subsets.size(); ++i)
+    {
+      expander.Expand(dfa.subsets[i], successors);
+
+      Row row(resource);
+      row.reserve(successors.size());
+      for (auto& [symbol, subset] : successors)
+      {
+        const auto [iter, inserted] = ids.emplace(subset, static_cast<SubsetDfa::StateId>(dfa.subsets.size()));
+        if (inserted)
+        {
+          if (dfa.subsets.size() == max_states)
+          {
+            ThrowStateLimitError(max_states);
+          }
+          dfa.subsets.push_back(std::move(subset));
+        }
+        row.emplace_back(symbol, iter->second);
+      }
+      dfa.transitions.push_back(std::move(row));
+    }
+  }
+  catch (const BudgetExceededError& e)
+  {
+    throw e.AfterStates(dfa.subsets.size());
+  }
+
+  return dfa;
+}
+
+/**
+ * A double-ended queue of tasks. Its owner pushes and pops at the back; other workers steal from the front.
+ *
+ * Items are handed out by move construction, so that they keep the memory resource they were allocated from.
+ */
+template <typename T>
+class StealingDeque
+{
+ public:
+  void Push(T item)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    items_.push_back(std::move(item));
+  }
+
+  std::optional<T> Pop()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (items_.empty())
+    {
+      return std::nullopt;
+    }
+    std::optional<T> item(std::move(items_.back()));
+    items_.pop_back();
+    return item;
+  }
+
+  std::optional<T> Steal()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (items_.empty())
+    {
+      return std::nullopt;
+    }
+    std::optional<T> item(std::move(items_.front()));
+    items_.pop_front();
+    return item;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::deque<T> items_;
+};
+
+/**
+ * Subset to ID map, split into independently locked shards.
+ */
+class ShardedSubsetMap
+{
+ public:
+  static constexpr std::size_t kNumShards = 64;
+
+  /**
+   * @param upstream where the shards get their memory from; must be thread-safe
+   */
+  explicit ShardedSubsetMap(std::pmr::memory_resource* upstream)
+  {
+    for (auto& shard : shards_)
+    {
+      shard = std::make_unique<Shard>(upstream);
+    }
+  }
+
+  /**
+   * Finds the ID of a subset, or assigns the next free ID to it.
+   * @return the ID, and whether it was newly assigned
+   */
+  std::pair<SubsetDfa::StateId, bool> Insert(const Nfa::Subset& subset)
+  {
+    const std::size_t hash = SubsetHasher()(subset);
+    auto& shard = *shards_[hash % kNumShards];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    const auto iter = shard.ids.find(subset);
+    if (iter != shard.ids.end())
+    {
+      return {iter->second, false};
+    }
+
+    const auto id = next_id_.fetch_add(1, std::memory_order_relaxed);
+    shard.ids.emplace(subset, id);
+    return {id, true};
+  }
+
+  std::size_t Size() const { return next_id_.load(); }
+
+  /**
+   * Moves every subset into its slot of subsets, which must have Size() elements.
+   */
+  void Extract(std::pmr::vector<Nfa::Subset>& subsets)
+  {
+    for (auto& shard : shards_)
+    {
+      while (!shard->ids.empty())
+      {
+        auto node = shard->ids.extract(shard->ids.begin());
+        subsets[node.mapped()] = std::move(node.key());
+      }
+    }
+  }
+
+ private:
+  struct Shard
+  {
+    explicit Shard(std::pmr::memory_resource* upstream) : arena(upstream) {}
+
+    std::mutex mutex;
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::unordered_map<Nfa::Subset, SubsetDfa::StateId, SubsetHasher> ids{&arena};
+  };
+
+  std::array<std::unique_ptr<Shard>, kNumShards> shards_;
+
+  std::atomic<SubsetDfa::StateId> next_id_{0};
+};
+
+SubsetDfa DeterminizeParallel(const Nfa& nfa, unsigned threads, std::pmr::memory_resource* resource,
+                              std::size_t max_states, MemoryBudget* budget)
+{
+  using Task = std::pair<SubsetDfa::StateId, Nfa::Subset>;
+
+  // Each worker allocates from its own arena. Subsets may be stolen and freed by another worker, which is fine since
+  // monotonic arenas ignore deallocation, and all of them outlive the workers. The arenas get their memory from the
+  // heap or the budget, since the caller's resource doesn't have to be thread-safe.
+  std::pmr::memory_resource* upstream = budget != nullptr ? budget : std::pmr::new_delete_resource();
+  std::vector<std::unique_ptr<std::pmr::monotonic_buffer_resource>> arenas;
+  arenas.reserve(threads);
+  for (unsigned i = 0; i < threads; ++i)
+  {
+    arenas.push_back(std::make_unique<std::pmr::monotonic_buffer_resource>(upstream));
+  }
+  ShardedSubsetMap ids(upstream);
+  std::vector<StealingDeque<Task>> deques(threads);
+  std::vector<std::pmr::vector<std::pair<SubsetDfa::StateId, Row>>> worker_rows;
+  worker_rows.reserve(threads);
+  for (auto& arena : arenas)
+  {
+    worker_rows.emplace_back(arena.get());
+  }
+
+  // Tasks that were pushed but not fully expanded yet. Workers stop once it drops to zero, or once the limit is hit.
+  std::atomic<std::size_t> pending{1};
+  std::atomic<bool> exceeded{false};
+  std::mutex error_mutex;
+  std::optional<BudgetExceededError> error;
+
+  {
+    SubsetExpander expander(nfa, arenas[0].get());
+    Nfa::Subset start(nfa.start, arenas[0].get());
+    expander.Close(start);
+    const auto start_id = ids.Insert(start).first;
+    deques[0].Push({start_id, std::move(start)});
+  }
+
+  const auto expand = [&](unsigned self) {
+    SubsetExpander expander(nfa, arenas[self].get());
+    Successors successors(arenas[self].get());
+    while (!exceeded.load(std::memory_order_relaxed))
+    {
+      std::optional<Task> task = deques[self].Pop();
+      for (unsigned i = 1; !task && i < threads; ++i)
+      {
+        task = deques[(self + i) % threads].Steal();
+      }
+
+      if (!task)
+      {
+        if (pending.load() == 0)
+        {
+          return;
+        }
+        std::this_thread::yield();
+        continue;
+      }
+
+      expander.Expand(task->second, successors);
+      Row row(arenas[self].get());
+      row.reserve(successors.size());
+      for (auto& [symbol, subset] : successors)
+      {
+        const auto [id, inserted] = ids.Insert(subset);
+        if (inserted && max_states != 0 && id >= max_states)
+        {
+          exceeded.store(true, std::memory_order_relaxed);
+          return;
+        }
+        if (inserted)
+        {
+          pending.fetch_add(1);
+          deques[self].Push({id, std::move(subset)});
+        }
+        row.emplace_back(symbol, id);
+      }
+      worker_rows[self].emplace_back(task->first, std::move(row));
+      pending.fetch_sub(1);
+    }
+  };
+  const auto work = [&](unsigned self) {
+    try
+    {
+      expand(self);
+    }
+    catch (const BudgetExceededError& e)
+    {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error)
+      {
+        error = e;
+      }
+      exceeded.store(true, std::memory_order_relaxed);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  workers.reserve(threads);
+  for (unsigned i = 0; i < threads; ++i)
+  {
+    workers.emplace_back(work, i);
+  }
+  for (auto& worker : workers)
+  {
+    worker.join();
+  }
+  if (error)
+  {
+    throw error->AfterStates(ids.Size());
+  }
+  if (exceeded.load())
+  {
+    ThrowStateLimitError(max_states);
+  }
+
+  // Gather rows by the IDs that the workers assigned, whose order depends on scheduling.
+  const std::size_t num_states = ids.Size();
+  std::pmr::vector<Nfa::Subset> subsets(num_states, resource);
+  ids.Extract(subsets);
+  std::pmr::vector<Row> rows(num_states, resource);
+  for (auto& rows_of_worker : worker_rows)
+  {
+    for (auto& [id, row] : rows_of_worker)
+    {
+      rows[id] = std::move(row);
+    }
+  }
+
+  // Renumber canonically, in the same breadth-first order as the serial construction.
+  constexpr auto kUnnumbered = static_cast<SubsetDfa::StateId>(-1);
+  std::pmr::vector<SubsetDfa::StateId> canonical(num_states, kUnnumbered, resource);
+  std::pmr::vector<SubsetDfa::StateId> order(resource);
+  order.reserve(num_states);
+  canonical[0] = 0;
+  order.push_back(0);
+  for (std::size_t i = 0; i < order.size(); ++i)
+  {
+    for (const auto& transition : rows[order[i]])
+    {
+      if (canonical[transition.second] == kUnnumbered)
+      {
+        canonical[transition.second] = static_cast<SubsetDfa::StateId>(order.size());
+        order.push_back(transition.second);
+      }
+    }
+  }
+
+  SubsetDfa dfa(resource);
+  dfa.subsets.reserve(num_states);
+  dfa.transitions.reserve(num_states);
+  for (const auto id : order)
+  {
+    dfa.subsets.push_back(std::move(subsets[id]));
+    for (auto& transition : rows[id])
+    {
+      transition.second = canonical[transition.second];
+    }
+    dfa.transitions.push_back(std::move(rows[id]));
+  }
+
+  return dfa;
+}
+}  // namespace
+
+SubsetDfa Determinize(const Nfa& nfa, unsigned threads, std::pmr::memory_resource* resource, std::size_t max_states,
+                      MemoryBudget* budget)
+{
+  if (threads == 0)
+  {
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  return threads == 1 ? DeterminizeSerial(nfa, resource, max_states)
+                      : DeterminizeParallel(nfa, threads, resource, max_states, budget);
+}
+
+std::size_t IncrementalDeterminizer::Update(std::size_t max_states, MemoryBudget* budget)
+{
+  using StateId = SubsetDfa::StateId;
+
+  const auto charge = [budget](std::size_t bytes) {
+    if (budget != nullptr)
+    {
+      budget->Charge(bytes);
+    }
+  };
+  const auto release = [budget](std::size_t bytes) {
+    if (budget != nullptr)
+    {
+      budget->Release(bytes);
+    }
+  };
+  // States that epsilon transitions changed stay behind until the end, but no longer count.
+  std::size_t num_stale = 0;
+  try
+  {
+    // What the construction already takes counts against the budget as well.
+    std::size_t bytes = 0;
+    for (std::size_t id = 0; id < dfa_.subsets.size(); ++id)
+    {
+      bytes += SubsetBytes(dfa_.subsets[id]) + RowBytes(dfa_.transitions[id]);
+    }
+    charge(bytes);
+
+    SubsetExpander expander(nfa_, std::pmr::get_default_resource());
+    containing_.resize(nfa_.state_names.size());
+    std::vector<bool> stale(dfa_.subsets.size());
+    std::vector<bool> queued(dfa_.subsets.size());
+    std::vector<StateId> pending;
+    const auto queue = [&](StateId id) {
+      if (!queued[id])
+      {
+        queued[id] = true;
+        pending.push_back(id);
+      }
+    };
+
+    // Subsets that contain a state whose closure changed may no longer be closed, or may have been reached through
+    // epsilon transitions that are gone. Their predecessors find out what they turned into.
+    for (const auto state : closure_changed_)
+    {
+      for (const auto id : containing_[state])
+      {
+        if (!stale[id])
+        {
+          stale[id] = true;
+          ++num_stale;
+          ids_.erase(dfa_.subsets[id]);
+          for (const auto predecessor : predecessors_[id])
+          {
+            queue(predecessor);
+          }
+        }
+      }
+    }
+    for (const auto state : changed_)
+    {
+      for (const auto id : containing_[state])
+      {
+        queue(id);
+      }
+    }
+    changed_.clear();
+    closure_changed_.clear();
+
+    const auto intern = [&](Nfa::Subset&& subset) {
+      const auto [iter, inserted] = ids_.emplace(subset, static_cast<StateId>(dfa_.subsets.size()));
+      if (inserted)
+      {
+        if (max_states != 0 && dfa_.subsets.size() - num_stale == max_states)
+        {
+          ThrowStateLimitError(max_states);
+        }
+        charge(SubsetBytes(subset));
+        for (const auto state : subset)
+        {
+          containing_[state].push_back(iter->second);
+        }
+        dfa_.subsets.push_back(std::move(subset));
+        dfa_.transitions.emplace_back();
+        predecessors_.emplace_back();
+        stale.push_back(false);
+        queued.push_back(false);
+        queue(iter->second);
+      }
+      return iter->second;
+    };
+
+    Nfa::Subset start(nfa_.start.begin(), nfa_.start.end());
+    expander.Close(start);
+    const StateId start_id = intern(std::move(start));
+
+    std::size_t expanded = 0;
+    Successors successors;
+    for (std::size_t i = 0; i < pending.size(); ++i)
+    {
+      const StateId id = pending[i];
+      if (stale[id])
+      {
+        continue;
+      }
+      expander.Expand(dfa_.subsets[id], successors);
+      Row row;
+      row.reserve(successors.size());
+      for (auto& [symbol, subset] : successors)
+      {
+        const StateId target = intern(std::move(subset));
+        row.emplace_back(symbol, target);
+        predecessors_[target].push_back(id);
+      }
+      charge(RowBytes(row));
+      release(RowBytes(dfa_.transitions[id]));
+      dfa_.transitions[id] = std::move(row);
+      ++expanded;
+    }
+
+    Renumber(start_id);
+    return expanded;
+  }
+  catch (const BudgetExceededError& e)
+  {
+    const std::size_t states = dfa_.subsets.size() - num_stale;
+    Reset();
+    throw e.AfterStates(states);
+  }
+  catch (...)
+  {
+    Reset();
+    throw;
+  }
+}
+
+void IncrementalDeterminizer::Renumber(SubsetDfa::StateId start)
+{
+  using StateId = SubsetDfa::StateId;
+
+  // The same breadth-first numbering as Determinize. Stale states are left behind, since nothing leads to them anymore.
+  constexpr auto kUnnumbered = static_cast<StateId>(-1);
+  std::vector<StateId> canonical(dfa_.subsets.size(), kUnnumbered);
+  std::vector<StateId> order;
+  canonical[start] = 0;
+  order.push_back(start);
+  for (std::size_t i = 0; i < order.size(); ++i)
+  {
+    for (const auto& transition : dfa_.transitions[order[i]])
+    {
+      if (canonical[transition.second] == kUnnumbered)
+      {
+        canonical[transition.second] = static_cast<StateId>(order.size());
+        order.push_back(transition.second);
+      }
+    }
+  }
+
+  SubsetDfa dfa;
+  dfa.subsets.reserve(order.size());
+  dfa.transitions.reserve(order.size());
+  for (const auto id : order)
+  {
+    dfa.subsets.push_back(std::move(dfa_.subsets[id]));
+    for (auto& transition : dfa_.transitions[id])
+    {
+      transition.second = canonical[transition.second];
+    }
+    dfa.transitions.push_back(std::move(dfa_.transitions[id]));
+  }
+  dfa_ = std::move(dfa);
+
+  for (auto iter = ids_.begin(); iter != ids_.end();)
+  {
+    if (canonical[iter->second] == kUnnumbered)
+    {
+      iter = ids_.erase(iter);
+    }
+    else
+    {
+      iter->second = canonical[iter->second];
+      ++iter;
+    }
+  }
+
+  for (auto& ids : containing_)
+  {
+    ids.clear();
+  }
+  predecessors_.assign(order.size(), {});
+  for (std::size_t id = 0; id < order.size(); ++id)
+  {
+    for (const auto state : dfa_.subsets[id])
+    {
+      containing_[state].push_back(static_cast<StateId>(id));
+    }
+    for (const auto& transition : dfa_.transitions[id])
+    {
+      predecessors_[transition.second].push_back(static_cast<StateId>(id));
+    }
+  }
+}
+
+void IncrementalDeterminizer::Reset() noexcept
+{
+  dfa_.subsets.clear();
+  dfa_.transitions.clear();
+  ids_.clear();
+  for (auto& ids : containing_)
+  {
+    ids.clear();
+  }
+  predecessors_.clear();
+  changed_.clear();
+  closure_changed_.clear();
+}
+
+}  // namespace dfa
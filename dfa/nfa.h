@@ -0,0 +1,215 @@
+/**
+ * @file nfa.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dfa/memory_budget.h"
+
+namespace dfa
+{
+/**
+ * Integer form of an NFA, used for subset construction.
+ *
+ * States and Symbols are indexes into state_names and symbols. Epsilon transitions are kept apart from the others.
+ * Everything is allocated from one memory resource, since an Nfa usually only lives while a Dfa is being built.
+ */
+struct Nfa
+{
+  using StateId = std::uint32_t;
+  using SymbolId = std::uint32_t;
+
+  /**
+   * A set of NFA states, sorted in ascending order.
+   */
+  using Subset = std::pmr::vector<StateId>;
+
+  explicit Nfa(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+      : state_names(resource),
+        symbols(resource),
+        transitions(resource),
+        epsilon_transitions(resource),
+        final_states(resource),
+        start(resource)
+  {
+  }
+
+  std::pmr::vector<std::pmr::string> state_names;
+
+  /**
+   * Non-epsilon Symbols, in the order that Determinize follows them. Sorted in ascending order, unless the Nfa is
+   * edited by a DfaBuilder, which appends new Symbols.
+   */
+  std::pmr::vector<std::pmr::string> symbols;
+
+  /**
+   * Non-epsilon transitions of each state, as (symbol, target) pairs.
+   */
+  std::pmr::vector<std::pmr::vector<std::pair<SymbolId, StateId>>> transitions;
+
+  /**
+   * Epsilon transitions of each state.
+   */
+  std::pmr::vector<std::pmr::vector<StateId>> epsilon_transitions;
+
+  std::pmr::vector<bool> final_states;
+
+  /**
+   * The start states, before epsilon closure.
+   */
+  Subset start;
+};
+
+/**
+ * Hashes subsets of NFA states by value.
+ */
+struct SubsetHasher
+{
+  std::size_t operator()(const Nfa::Subset& subset) const;
+};
+
+/**
+ * Result of subset construction.
+ *
+ * State 0 is the start state, and states are numbered in breadth-first order, following Symbols in ascending order.
+ * This numbering doesn't depend on how many threads were used.
+ */
+struct SubsetDfa
+{
+  using StateId = std::uint32_t;
+
+  using Row = std::pmr::vector<std::pair<Nfa::SymbolId, StateId>>;
+
+  explicit SubsetDfa(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+      : subsets(resource), transitions(resource)
+  {
+  }
+
+  /**
+   * The NFA states that make up each DFA state, closed under epsilon transitions.
+   */
+  std::pmr::vector<Nfa::Subset> subsets;
+
+  /**
+   * Transitions of each DFA state, as (symbol, target) pairs sorted by symbol.
+   */
+  std::pmr::vector<Row> transitions;
+};
+
+/**
+ * Thrown by Determinize when the DFA would have more states than it may.
+ */
+class StateLimitError : public std::runtime_error
+{
+ public:
+  using std::runtime_error::runtime_error;
+};
+
+/**
+ * Converts an NFA to a DFA.
+ * @param nfa the NFA
+ * @param threads number of worker threads; values greater than one run the parallel construction, where workers
+ * steal unexplored states from each other and deduplicate subsets through a sharded hash table
+ * @param resource where the result and the serial construction's temporaries are allocated; parallel workers use
+ * arenas of their own
+ * @param max_states most states the DFA may have; zero for no limit
+ * @param budget if not null, where the arenas of parallel workers get their memory from
+ * @return the DFA, identical regardless of threads
+ * @throws StateLimitError if the DFA has more than max_states states; construction stops as soon as that is known
+ * @throws BudgetExceededError if an allocation exceeds a MemoryBudget; the error reports the states built so far
+ */
+SubsetDfa Determinize(const Nfa& nfa, unsigned threads = 1,
+                      std::pmr::memory_resource* resource = std::pmr::get_default_resource(),
+                      std::size_t max_states = 0, MemoryBudget* budget = nullptr);
+
+/**
+ * Keeps the subset construction of an NFA up to date while the NFA is edited.
+ *
+ * After editing the NFA, the caller reports each NFA state whose transitions changed. Update then expands only the DFA
+ * states whose subsets contain those NFA states, and the states that become reachable from them; the rows of all other
+ * states are reused. Epsilon transitions change the subsets themselves, so the DFA states that contain an NFA state
+ * whose epsilon transitions changed are dropped, and their predecessors are expanded instead.
+ */
+class IncrementalDeterminizer
+{
+ public:
+  /**
+   * @param nfa the NFA, which has to outlive the determinizer; states and Symbols may be appended to it between
+   * updates, but existing IDs have to keep their meaning, unless every state with a transition on a changed Symbol
+   * is reported with TransitionsChanged
+   */
+  explicit IncrementalDeterminizer(const Nfa& nfa) : nfa_(nfa) {}
+
+  /**
+   * Reports that the non-epsilon transitions of an NFA state changed.
+   */
+  void TransitionsChanged(Nfa::StateId state) { changed_.push_back(state); }
+
+  /**
+   * Reports that the epsilon transitions of an NFA state changed.
+   */
+  void EpsilonTransitionsChanged(Nfa::StateId state) { closure_changed_.push_back(state); }
+
+  /**
+   * Brings the result up to date with the NFA. The start states are always closed again, which is cheap. Finality
+   * isn't part of subset construction, so changing it needs neither a report nor an update. If the update throws, the
+   * result is dropped, and the next one builds it again from scratch.
+   * @param max_states most states the DFA may have; zero for no limit. States that the edits left unreachable count
+   * until the update is done.
+   * @param budget if not null, what the estimated size of the whole construction is charged to
+   * @return the number of DFA states that were expanded
+   * @throws StateLimitError if the DFA has more than max_states states; the update stops as soon as that is known
+   * @throws BudgetExceededError if the construction doesn't fit in the budget; the error reports the states so far
+   */
+  std::size_t Update(std::size_t max_states = 0, MemoryBudget* budget = nullptr);
+
+  /**
+   * The DFA as of the last Update, numbered exactly like Determinize would number it.
+   */
+  inline const SubsetDfa& Result() const noexcept { return dfa_; }
+
+ private:
+  /**
+   * Numbers the states reachable from start canonically, drops the others, and rebuilds the indexes below.
+   */
+  void Renumber(SubsetDfa::StateId start);
+
+  /**
+   * Drops the result, so that the next update expands every state.
+   */
+  void Reset() noexcept;
+
+  const Nfa& nfa_;
+
+  SubsetDfa dfa_;
+
+  std::unordered_map<Nfa::Subset, SubsetDfa::StateId, SubsetHasher> ids_;
+
+  /**
+   * The DFA states whose subsets contain each NFA state.
+   */
+  std::vector<std::vector<SubsetDfa::StateId>> containing_;
+
+  /**
+   * The DFA states with a transition to each DFA state. Between updates, this may also list states that no longer have
+   * one, which costs an extra expansion at most.
+   */
+  std::vector<std::vector<SubsetDfa::StateId>> predecessors_;
+
+  std::vector<Nfa::StateId> changed_;
+
+  std::vector<Nfa::StateId> closure_changed_;
+};
+
+}  // namespace dfa
@@ -0,0 +1,74 @@
+/**
+ * @file numa.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "numa.h"
+
+#if defined(DFA_HAVE_LIBNUMA)
+#include <numa.h>
+#include <sched.h>
+#endif
+
+#include <exception>
+#include <thread>
+
+namespace dfa
+{
+std::size_t NumaNodes()
+{
+#if defined(DFA_HAVE_LIBNUMA)
+  static const std::size_t nodes = numa_available() < 0 ? 1 : static_cast<std::size_t>(numa_num_configured_nodes());
+  return nodes == 0 ? 1 : nodes;
+#else
+  return 1;
+#endif
+}
+
+std::size_t CurrentNumaNode()
+{
+#if defined(DFA_HAVE_LIBNUMA)
+  thread_local const std::size_t node = [] {
+    const int cpu = NumaNodes() > 1 ? sched_getcpu() : -1;
+    const int found = cpu < 0 ? -1 : numa_node_of_cpu(cpu);
+    return found < 0 ? std::size_t{0} : static_cast<std::size_t>(found);
+  }();
+  return node;
+#else
+  return 0;
+#endif
+}
+
+bool RunOnNumaNode(std::size_t node, const std::function<void()>& task)
+{
+  bool bound = false;
+  std::exception_ptr error;
+  std::thread thread([&] {
+    // With a single node, every thread runs on it already.
+    bound = NumaNodes() == 1 && node == 0;
+#if defined(DFA_HAVE_LIBNUMA)
+    if (NumaNodes() > 1 && node < NumaNodes())
+    {
+      bound = numa_run_on_node(static_cast<int>(node)) == 0;
+      numa_set_localalloc();
+    }
+#endif
+    try
+    {
+      task();
+    }
+    catch (...)
+    {
+      error = std::current_exception();
+    }
+  });
+  thread.join();
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
+  return bound;
+}
+
+}  // namespace dfa
@@ -0,0 +1,34 @@
+/**
+ * @file numa.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace dfa
+{
+/**
+ * Number of NUMA nodes that threads can run on. One if the library was built without libnuma, or if the kernel
+ * doesn't support NUMA.
+ */
+std::size_t NumaNodes();
+
+/**
+ * The NUMA node that the calling thread runs on. It is looked up once per thread, on the assumption that threads
+ * mostly stay where they were first scheduled.
+ */
+std::size_t CurrentNumaNode();
+
+/**
+ * Runs a task on a thread that is bound to a NUMA node and waits for it, so that memory which the task touches first
+ * is allocated on that node.
+ * @return whether the task ran on the node; if not, because the node doesn't exist or the thread couldn't be bound,
+ * the task still ran, but anywhere
+ */
+bool RunOnNumaNode(std::size_t node, const std::function<void()>& task);
+
+}  // namespace dfa
@@ -0,0 +1,747 @@
+/**
+ * @file out_of_core.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "out_of_core.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "compiled_dfa.h"
+#include "utf8.h"
+
+namespace dfa
+{
+namespace
+{
+namespace fs = std::filesystem;
+
+using StateId = CompiledDfa::StateId;
+
+constexpr std::size_t kNumBytes = 256;
+
+/**
+ * Size of the buffer of each temporary file that is open.
+ */
+constexpr std::size_t kFileBufferBytes = std::size_t{64} << 10U;
+
+/**
+ * Most temporary files open at once, whatever the budget, which keeps well below the limit on open files.
+ */
+constexpr std::size_t kMaxOpenFiles = 64;
+
+/**
+ * The Symbol of the byte class of bytes that are not part of the alphabet.
+ */
+constexpr Nfa::SymbolId kNoSymbol = std::numeric_limits<Nfa::SymbolId>::max();
+
+/**
+ * Temporary files hold records, which are sequences of 32-bit words that sort lexicographically. Records of subsets
+ * start with their size, so that they sort by subset first:
+ *  - candidate: size, subset..., source state, byte class
+ *  - dictionary entry: size, subset..., state
+ *  - transition: source state, byte class, target state
+ */
+using Record = std::vector<std::uint32_t>;
+
+/**
+ * Number of words that the subset of a candidate or dictionary entry takes, including its size.
+ */
+inline std::size_t SubsetWords(const std::uint32_t* record) { return std::size_t{record[0]} + 1; }
+
+inline bool SubsetLess(const std::uint32_t* lhs, const std::uint32_t* rhs)
+{
+  return std::lexicographical_compare(lhs, lhs + SubsetWords(lhs), rhs, rhs + SubsetWords(rhs));
+}
+
+inline bool SubsetEqual(const std::uint32_t* lhs, const std::uint32_t* rhs)
+{
+  return std::equal(lhs, lhs + SubsetWords(lhs), rhs, rhs + SubsetWords(rhs));
+}
+
+/**
+ * A directory of temporary files, removed with everything in it on destruction.
+ */
+class TempDirectory
+{
+ public:
+  explicit TempDirectory(const fs::path& parent)
+  {
+    std::string path = ((parent.empty() ? fs::temp_directory_path() : parent) / "dfash-XXXXXX").string();
+    if (mkdtemp(path.data()) == nullptr)
+    {
+      throw std::system_error(errno, std::generic_category(), "Failed to create a temporary directory in " + path);
+    }
+    path_ = path;
+  }
+
+  TempDirectory(const TempDirectory&) = delete;
+
+  TempDirectory& operator=(const TempDirectory&) = delete;
+
+  ~TempDirectory()
+  {
+    std::error_code error;
+    fs::remove_all(path_, error);
+  }
+
+  inline fs::path NewPath() { return path_ / std::to_string(next_file_++); }
+
+ private:
+  fs::path path_;
+
+  std::size_t next_file_ = 0;
+};
+
+/**
+ * Writes records to a temporary file.
+ */
+class RunWriter
+{
+ public:
+  RunWriter(fs::path path, OutOfCoreStats& stats) : path_(std::move(path)), stats_(stats), buffer_(kFileBufferBytes)
+  {
+    out_.rdbuf()->pubsetbuf(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    out_.open(path_, std::ios::binary | std::ios::trunc);
+    if (!out_)
+    {
+      throw std::runtime_error("Failed to create temporary file " + path_.string());
+    }
+  }
+
+  void Write(const std::uint32_t* words, std::size_t count)
+  {
+    const auto size = static_cast<std::uint32_t>(count);
+    out_.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    out_.write(reinterpret_cast<const char*>(words), static_cast<std::streamsize>(count * sizeof(std::uint32_t)));
+    bytes_ += (count + 1) * sizeof(std::uint32_t);
+  }
+
+  inline void Write(const Record& record) { Write(record.data(), record.size()); }
+
+  void Close()
+  {
+    out_.close();
+    if (!out_)
+    {
+      throw std::runtime_error("Failed to write temporary file " + path_.string());
+    }
+    stats_.spilled_bytes += bytes_;
+  }
+
+  inline const fs::path& Path() const noexcept { return path_; }
+
+ private:
+  fs::path path_;
+
+  OutOfCoreStats& stats_;
+
+  std::vector<char> buffer_;
+
+  std::ofstream out_;
+
+  std::uint64_t bytes_ = 0;
+};
+
+/**
+ * Reads the records of a temporary file one at a time.
+ */
+class RunReader
+{
+ public:
+  explicit RunReader(const fs::path& path) : path_(path), buffer_(kFileBufferBytes)
+  {
+    in_.rdbuf()->pubsetbuf(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    in_.open(path_, std::ios::binary);
+    if (!in_)
+    {
+      throw std::runtime_error("Failed to open temporary file " + path_.string());
+    }
+    Advance();
+  }
+
+  inline bool Done() const noexcept { return done_; }
+
+  /**
+   * The current record, unless Done.
+   */
+  inline const Record& Get() const noexcept { return record_; }
+
+  void Advance()
+  {
+    std::uint32_t size;
+    if (!in_.read(reinterpret_cast<char*>(&size), sizeof(size)))
+    {
+      done_ = true;
+      return;
+    }
+    record_.resize(size);
+    if (!in_.read(reinterpret_cast<char*>(record_.data()), static_cast<std::streamsize>(size * sizeof(std::uint32_t))))
+    {
+      throw std::runtime_error("Temporary file is truncated: " + path_.string());
+    }
+  }
+
+ private:
+  fs::path path_;
+
+  std::vector<char> buffer_;
+
+  std::ifstream in_;
+
+  Record record_;
+
+  bool done_ = false;
+};
+
+/**
+ * Merges sorted runs into one, fan_in at a time, and removes them.
+ * @param runs at least one run
+ * @return the merged run
+ */
+fs::path MergeRuns(std::vector<fs::path> runs, TempDirectory& directory, std::size_t fan_in, OutOfCoreStats& stats)
+{
+  while (runs.size() > 1)
+  {
+    const std::size_t count = std::min(fan_in, runs.size());
+    std::vector<std::unique_ptr<RunReader>> readers;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      readers.push_back(std::make_unique<RunReader>(runs[i]));
+    }
+    const auto greater = [&readers](std::size_t lhs, std::size_t rhs) {
+      return readers[rhs]->Get() < readers[lhs]->Get();
+    };
+    std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(greater)> queue(greater);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      if (!readers[i]->Done())
+      {
+        queue.push(i);
+      }
+    }
+
+    RunWriter writer(directory.NewPath(), stats);
+    while (!queue.empty())
+    {
+      const std::size_t i = queue.top();
+      queue.pop();
+      writer.Write(readers[i]->Get());
+      readers[i]->Advance();
+      if (!readers[i]->Done())
+      {
+        queue.push(i);
+      }
+    }
+    writer.Close();
+    ++stats.runs;
+
+    readers.clear();
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      fs::remove(runs[i]);
+    }
+    runs.erase(runs.begin(), runs.begin() + static_cast<std::ptrdiff_t>(count));
+    runs.push_back(writer.Path());
+  }
+  return runs.front();
+}
+
+/**
+ * Sorts records that may not fit in memory: they are buffered up to a size, and each full buffer is sorted and
+ * written as a run.
+ */
+class RunSorter
+{
+ public:
+  /**
+   * @param max_bytes most memory the buffer takes, unless a single record is larger
+   * @param fan_in most runs merged at once
+   */
+  RunSorter(TempDirectory& directory, std::size_t max_bytes, std::size_t fan_in, OutOfCoreStats& stats)
+      : directory_(directory), fan_in_(fan_in), stats_(stats)
+  {
+    // Records are mostly short, so the words get most of the buffer.
+    max_words_ = max_bytes / 4 * 3 / sizeof(std::uint32_t);
+    max_records_ = max_bytes / 4 / sizeof(std::size_t);
+  }
+
+  void Add(const std::uint32_t* words, std::size_t count)
+  {
+    if (!offsets_.empty() && (words_.size() + count + 1 > max_words_ || offsets_.size() == max_records_))
+    {
+      Spill();
+    }
+    offsets_.push_back(words_.size());
+    words_.push_back(static_cast<std::uint32_t>(count));
+    words_.insert(words_.end(), words, words + count);
+  }
+
+  /**
+   * Writes what is buffered as a last run, and merges all runs.
+   * @return the sorted run of all records
+   */
+  fs::path Finish()
+  {
+    Spill();
+    return MergeRuns(std::move(runs_), directory_, fan_in_, stats_);
+  }
+
+ private:
+  void Spill()
+  {
+    std::sort(offsets_.begin(), offsets_.end(), [this](std::size_t lhs, std::size_t rhs) {
+      const std::uint32_t* a = &words_[lhs];
+      const std::uint32_t* b = &words_[rhs];
+      return std::lexicographical_compare(a + 1, a + 1 + a[0], b + 1, b + 1 + b[0]);
+    });
+    RunWriter writer(directory_.NewPath(), stats_);
+    for (const auto offset : offsets_)
+    {
+      writer.Write(&words_[offset + 1], words_[offset]);
+    }
+    writer.Close();
+    ++stats_.runs;
+    runs_.push_back(writer.Path());
+    words_.clear();
+    offsets_.clear();
+  }
+
+  TempDirectory& directory_;
+
+  std::size_t fan_in_;
+
+  OutOfCoreStats& stats_;
+
+  std::size_t max_words_;
+
+  std::size_t max_records_;
+
+  /**
+   * Buffered records, each preceded by its size.
+   */
+  std::vector<std::uint32_t> words_;
+
+  std::vector<std::size_t> offsets_;
+
+  std::vector<fs::path> runs_;
+};
+
+/**
+ * Byte classes of the DFA of an NFA whose Symbols are single bytes or ranges of them.
+ *
+ * Bytes that lead to the same NFA states from every NFA state lead to the same DFA state from every DFA state, so
+ * they can share a class. These classes may be finer than those CompiledDfa finds, which only makes rows wider. Bytes
+ * outside the alphabet share one class, whose target is always kInvalidSymbol.
+ */
+struct ByteClasses
+{
+  std::array<std::uint8_t, kNumBytes> of_byte{};
+
+  /**
+   * The Symbol that stands for each class, or kNoSymbol for the class of bytes outside the alphabet.
+   */
+  std::vector<Nfa::SymbolId> symbols;
+};
+
+ByteClasses ClassifyBytes(const Nfa& nfa)
+{
+  std::array<Nfa::SymbolId, kNumBytes> symbol_of_byte;
+  symbol_of_byte.fill(kNoSymbol);
+  for (std::size_t i = 0; i < nfa.symbols.size(); ++i)
+  {
+    const auto& symbol = nfa.symbols[i];
+    const auto range = LabelRange(symbol);
+    const auto bytes = range ? RangeBytes(*range) : std::nullopt;
+    if (!bytes || (!range->bytes && range->high >= kFirstMultiByte))
+    {
+      throw std::invalid_argument("Out-of-core construction needs single byte Symbols: " + std::string(symbol));
+    }
+    // Dfa::WriteOutOfCore appends the Symbols of the Alphabet that have no transitions, which may overlap ranges
+    // that do. The first Symbol of a byte is the one that counts.
+    for (unsigned b = bytes->first; b <= bytes->second; ++b)
+    {
+      if (symbol_of_byte[b] == kNoSymbol)
+      {
+        symbol_of_byte[b] = static_cast<Nfa::SymbolId>(i);
+      }
+    }
+  }
+
+  // The (from, to) pairs of the transitions on each Symbol.
+  std::vector<std::vector<std::pair<Nfa::StateId, Nfa::StateId>>> moves(nfa.symbols.size());
+  for (std::size_t from = 0; from < nfa.transitions.size(); ++from)
+  {
+    for (const auto& [symbol, to] : nfa.transitions[from])
+    {
+      moves[symbol].emplace_back(static_cast<Nfa::StateId>(from), to);
+    }
+  }
+  for (auto& pairs : moves)
+  {
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+  }
+
+  const auto moves_less = [&moves](Nfa::SymbolId lhs, Nfa::SymbolId rhs) { return moves[lhs] < moves[rhs]; };
+  std::map<Nfa::SymbolId, std::uint8_t, decltype(moves_less)> class_of_moves(moves_less);
+  std::optional<std::uint8_t> invalid_class;
+  ByteClasses classes;
+  for (std::size_t b = 0; b < kNumBytes; ++b)
+  {
+    const Nfa::SymbolId symbol = symbol_of_byte[b];
+    const auto next_class = static_cast<std::uint8_t>(classes.symbols.size());
+    if (symbol == kNoSymbol)
+    {
+      if (!invalid_class)
+      {
+        invalid_class = next_class;
+        classes.symbols.push_back(kNoSymbol);
+      }
+      classes.of_byte[b] = *invalid_class;
+      continue;
+    }
+    const auto [iter, inserted] = class_of_moves.emplace(symbol, next_class);
+    if (inserted)
+    {
+      classes.symbols.push_back(symbol);
+    }
+    classes.of_byte[b] = iter->second;
+  }
+  return classes;
+}
+
+/**
+ * Expands one DFA state at a time, reusing its scratch space.
+ */
+class Expander
+{
+ public:
+  Expander(const Nfa& nfa, const ByteClasses& classes)
+      : nfa_(nfa), class_of_symbol_(nfa.symbols.size(), kNoClass), targets_(classes.symbols.size())
+  {
+    // The other Symbols of a class have the same transitions, so those of the Symbol that stands for it suffice.
+    for (std::size_t c = 0; c < classes.symbols.size(); ++c)
+    {
+      if (classes.symbols[c] != kNoSymbol)
+      {
+        class_of_symbol_[classes.symbols[c]] = c;
+      }
+    }
+    marks_.resize(nfa.state_names.size());
+  }
+
+  /**
+   * Sorts a set of NFA states and closes it under epsilon transitions.
+   */
+  void Close(std::vector<Nfa::StateId>& states)
+  {
+    if (++stamp_ == 0)
+    {
+      std::fill(marks_.begin(), marks_.end(), 0);
+      stamp_ = 1;
+    }
+    std::size_t kept = 0;
+    stack_.clear();
+    for (const auto state : states)
+    {
+      if (marks_[state] != stamp_)
+      {
+        marks_[state] = stamp_;
+        states[kept++] = state;
+        stack_.push_back(state);
+      }
+    }
+    states.resize(kept);
+    while (!stack_.empty())
+    {
+      const auto state = stack_.back();
+      stack_.pop_back();
+      for (const auto target : nfa_.epsilon_transitions[state])
+      {
+        if (marks_[target] != stamp_)
+        {
+          marks_[target] = stamp_;
+          states.push_back(target);
+          stack_.push_back(target);
+        }
+      }
+    }
+    std::sort(states.begin(), states.end());
+  }
+
+  /**
+   * The subset that each byte class leads to from a subset, closed; empty if there is no transition.
+   */
+  const std::vector<std::vector<Nfa::StateId>>& Expand(const std::uint32_t* subset, std::size_t size)
+  {
+    for (auto& target : targets_)
+    {
+      target.clear();
+    }
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      for (const auto& [symbol, to] : nfa_.transitions[subset[i]])
+      {
+        if (class_of_symbol_[symbol] != kNoClass)
+        {
+          targets_[class_of_symbol_[symbol]].push_back(to);
+        }
+      }
+    }
+    for (auto& target : targets_)
+    {
+      if (!target.empty())
+      {
+        Close(target);
+      }
+    }
+    return targets_;
+  }
+
+  bool Accepting(const std::uint32_t* subset, std::size_t size) const
+  {
+    return std::any_of(subset, subset + size, [this](Nfa::StateId state) { return nfa_.final_states[state]; });
+  }
+
+ private:
+  static constexpr std::size_t kNoClass = kNumBytes;
+
+  const Nfa& nfa_;
+
+  std::vector<std::size_t> class_of_symbol_;
+
+  std::vector<std::vector<Nfa::StateId>> targets_;
+
+  std::vector<std::uint32_t> marks_;
+
+  std::uint32_t stamp_ = 0;
+
+  std::vector<Nfa::StateId> stack_;
+};
+
+template <typename T>
+void WriteRaw(std::ostream& out, const T* data, std::size_t count)
+{
+  out.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(sizeof(T) * count));
+}
+}  // namespace
+
+OutOfCoreStats DeterminizeOutOfCore(const Nfa& nfa, std::ostream& out, const OutOfCoreOptions& options)
+{
+  const ByteClasses classes = ClassifyBytes(nfa);
+  const std::size_t num_classes = classes.symbols.size();
+  Expander expander(nfa, classes);
+  OutOfCoreStats stats;
+  TempDirectory directory(options.temp_directory);
+
+  // Half of the budget is for the sort buffer that is being filled, and half for the buffers of open files. A lookup
+  // reads the merged candidates and every dictionary run, and writes the run of new subsets.
+  const std::size_t sort_bytes = options.max_bytes / 2;
+  const std::size_t open_files = std::clamp<std::size_t>(options.max_bytes / 2 / kFileBufferBytes, 4, kMaxOpenFiles);
+  const std::size_t fan_in = open_files - 1;
+  const std::size_t max_dictionary_runs = open_files - 2;
+
+  const auto begin = out.tellp();
+  CompiledDfa::SaveHeader(out, 0, 0, num_classes, classes.of_byte);
+  const fs::path flags_path = directory.NewPath();
+  std::ofstream flags(flags_path, std::ios::binary | std::ios::trunc);
+
+  // The first level is the start state.
+  std::vector<Nfa::StateId> start(nfa.start.begin(), nfa.start.end());
+  expander.Close(start);
+  Record record{static_cast<std::uint32_t>(start.size())};
+  record.insert(record.end(), start.begin(), start.end());
+  record.push_back(0);
+  RunWriter first(directory.NewPath(), stats);
+  first.Write(record);
+  first.Close();
+  ++stats.runs;
+  std::vector<fs::path> dictionary{first.Path()};
+
+  StateId next_state = 1;
+  StateId level_begin = 0;
+  std::vector<StateId> row(num_classes);
+  for (;;)
+  {
+    ++stats.levels;
+    const StateId level_end = next_state;
+
+    // Expand the states of the level, whose subsets are the newest dictionary run, in order.
+    RunSorter candidates(directory, sort_bytes, fan_in, stats);
+    for (RunReader frontier(dictionary.back()); !frontier.Done(); frontier.Advance())
+    {
+      const Record& entry = frontier.Get();
+      const std::uint32_t* subset = entry.data() + 1;
+      flags.put(static_cast<char>(expander.Accepting(subset, entry[0]) ? CompiledDfa::ACCEPTING : 0));
+      const auto& targets = expander.Expand(subset, entry[0]);
+      for (std::size_t c = 0; c < num_classes; ++c)
+      {
+        if (!targets[c].empty())
+        {
+          record.assign(1, static_cast<std::uint32_t>(targets[c].size()));
+          record.insert(record.end(), targets[c].begin(), targets[c].end());
+          record.push_back(entry.back());
+          record.push_back(static_cast<std::uint32_t>(c));
+          candidates.Add(record.data(), record.size());
+        }
+      }
+    }
+
+    // Number the subsets that are new, in sorted order. The candidates and every dictionary run are sorted by subset,
+    // so one pass over each finds all known subsets.
+    const fs::path candidates_run = candidates.Finish();
+    RunSorter transitions(directory, sort_bytes, fan_in, stats);
+    RunWriter level(directory.NewPath(), stats);
+    {
+      std::vector<std::unique_ptr<RunReader>> known;
+      for (const auto& path : dictionary)
+      {
+        known.push_back(std::make_unique<RunReader>(path));
+      }
+      Record subset;
+      StateId target = 0;
+      for (RunReader candidate(candidates_run); !candidate.Done(); candidate.Advance())
+      {
+        const Record& transition = candidate.Get();
+        const std::size_t words = SubsetWords(transition.data());
+        if (subset.empty() || !SubsetEqual(transition.data(), subset.data()))
+        {
+          subset.assign(transition.begin(), transition.begin() + static_cast<std::ptrdiff_t>(words));
+          std::optional<StateId> found;
+          for (auto& run : known)
+          {
+            while (!run->Done() && SubsetLess(run->Get().data(), subset.data()))
+            {
+              run->Advance();
+            }
+            if (!run->Done() && SubsetEqual(run->Get().data(), subset.data()))
+            {
+              found = run->Get().back();
+            }
+          }
+          if (!found)
+          {
+            if (next_state == CompiledDfa::kFirstSentinel)
+            {
+              throw std::runtime_error("The DFA has more states than a compiled file can hold.");
+            }
+            found = next_state++;
+            subset.push_back(*found);
+            level.Write(subset);
+            subset.pop_back();
+          }
+          target = *found;
+        }
+        const std::array<std::uint32_t, 3> edge{transition[words], transition[words + 1], target};
+        transitions.Add(edge.data(), edge.size());
+      }
+    }
+    fs::remove(candidates_run);
+    level.Close();
+    ++stats.runs;
+
+    // Append the rows of the level, whose transitions are now sorted by state and class.
+    const fs::path transitions_run = transitions.Finish();
+    {
+      RunReader transition(transitions_run);
+      for (StateId state = level_begin; state < level_end; ++state)
+      {
+        for (std::size_t c = 0; c < num_classes; ++c)
+        {
+          row[c] = classes.symbols[c] == kNoSymbol ? CompiledDfa::kInvalidSymbol : CompiledDfa::kNoTransition;
+        }
+        for (; !transition.Done() && transition.Get()[0] == state; transition.Advance())
+        {
+          row[transition.Get()[1]] = transition.Get()[2];
+        }
+        WriteRaw(out, row.data(), row.size());
+      }
+    }
+    fs::remove(transitions_run);
+    level_begin = level_end;
+
+    if (next_state == level_end)
+    {
+      break;
+    }
+    // The newest run is the next level, which is read by itself, so it stays apart. The runs before it are merged
+    // from the newest while the one before them isn't twice their size, so sizes shrink geometrically, there are only
+    // logarithmically many runs, and each subset is merged a logarithmic number of times. Past the limit on runs, all
+    // of them are merged.
+    std::size_t merge_from = dictionary.size();
+    if (dictionary.size() + 1 > max_dictionary_runs)
+    {
+      merge_from = 0;
+    }
+    else
+    {
+      for (std::uintmax_t newer = 0; merge_from > 0; --merge_from)
+      {
+        const std::uintmax_t size = fs::file_size(dictionary[merge_from - 1]);
+        if (newer != 0 && size >= 2 * newer)
+        {
+          break;
+        }
+        newer += size;
+      }
+    }
+    if (dictionary.size() - merge_from > 1)
+    {
+      std::vector<fs::path> runs(dictionary.begin() + static_cast<std::ptrdiff_t>(merge_from), dictionary.end());
+      const fs::path merged = MergeRuns(std::move(runs), directory, fan_in, stats);
+      dictionary.resize(merge_from);
+      dictionary.push_back(merged);
+    }
+    dictionary.push_back(level.Path());
+  }
+
+  flags.close();
+  if (!flags)
+  {
+    throw std::runtime_error("Failed to write temporary file " + flags_path.string());
+  }
+  stats.spilled_bytes += next_state;
+  stats.states = next_state;
+
+  std::ifstream flags_in(flags_path, std::ios::binary);
+  out << flags_in.rdbuf();
+  for (StateId state = 0; state < next_state; ++state)
+  {
+    WriteRaw(out, &state, 1);
+  }
+  for (StateId state = 0; state < next_state; ++state)
+  {
+    const std::string name = "q" + std::to_string(state);
+    const auto size = static_cast<std::uint32_t>(name.size());
+    WriteRaw(out, &size, 1);
+    out.write(name.data(), static_cast<std::streamsize>(name.size()));
+  }
+
+  const auto end = out.tellp();
+  out.seekp(begin);
+  CompiledDfa::SaveHeader(out, 0, next_state, num_classes, classes.of_byte);
+  out.seekp(end);
+  if (!out)
+  {
+    throw std::runtime_error("Failed to write the compiled DFA.");
+  }
+  return stats;
+}
+
+}  // namespace dfa
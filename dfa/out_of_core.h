@@ -0,0 +1,82 @@
+/**
+ * @file out_of_core.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+
+#include "dfa/nfa.h"
+
+namespace dfa
+{
+/**
+ * Settings for DeterminizeOutOfCore.
+ */
+struct OutOfCoreOptions
+{
+  /**
+   * Memory that sort buffers and file buffers may take. The NFA, and scratch space the size of the NFA for expanding
+   * one DFA state at a time, come on top.
+   */
+  std::size_t max_bytes = std::size_t{256} << 20U;
+
+  /**
+   * Where temporary files are written; empty uses std::filesystem::temp_directory_path, which honors TMPDIR. They are
+   * kept in a directory of their own, which is removed when construction ends.
+   */
+  std::filesystem::path temp_directory;
+};
+
+/**
+ * What DeterminizeOutOfCore did.
+ */
+struct OutOfCoreStats
+{
+  std::uint64_t states = 0;
+
+  /**
+   * Breadth-first levels, each of which took one pass over the new subsets and the dictionary.
+   */
+  std::uint64_t levels = 0;
+
+  /**
+   * Sorted runs that were written, including those that merges wrote.
+   */
+  std::uint64_t runs = 0;
+
+  /**
+   * Bytes written to temporary files.
+   */
+  std::uint64_t spilled_bytes = 0;
+};
+
+/**
+ * Converts an NFA whose DFA may not fit in memory, writing the DFA straight to the compiled file format that
+ * Dfa::Load reads.
+ *
+ * Construction is breadth-first, one level at a time. The subsets that the states of a level lead to are sorted in
+ * runs that fit the budget and spilled to disk, then merged, which brings duplicates together. The merged subsets are
+ * looked up in the dictionary of known subsets, which is itself a few sorted runs on disk: one per level, merged into
+ * one when there are too many to read at once. Subsets that are new get the next IDs and form the next level, so the
+ * only copy of the frontier is the newest dictionary run. The transitions of a level are sorted by state and appended
+ * to the table of the output as rows, which is possible because the byte classes are derived from the NFA up front.
+ *
+ * States are numbered level by level, and by subset within a level; state 0 is the start state. States are named q0,
+ * q1, ... by number, like those of Dfa::FromRegex.
+ * @param nfa an NFA whose Symbols are all single bytes or ranges of them, like "a-z"
+ * @param out where the compiled file is written; it has to be seekable, since the number of states in its header is
+ * only known at the end
+ * @param options the memory budget and the directory for temporary files
+ * @throws std::invalid_argument if a Symbol is neither a byte nor a range of bytes
+ * @throws std::runtime_error if a temporary file or out can't be written, or if the DFA has more states than a
+ * compiled file holds
+ */
+OutOfCoreStats DeterminizeOutOfCore(const Nfa& nfa, std::ostream& out, const OutOfCoreOptions& options = {});
+
+}  // namespace dfa
@@ -0,0 +1,144 @@
+/**
+ * @file protocol.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "protocol.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace dfa
+{
+namespace
+{
+void AppendUint32(std::uint32_t value, std::string& out)
+{
+  char bytes[sizeof(value)];
+  std::memcpy(bytes, &value, sizeof(value));
+  out.append(bytes, sizeof(value));
+}
+
+/**
+ * Consumes a uint32 from the front of input.
+ * @return false if input is too short
+ */
+bool ReadUint32(std::string_view& input, std::uint32_t& value)
+{
+  if (input.size() < sizeof(value))
+  {
+    return false;
+  }
+  std::memcpy(&value, input.data(), sizeof(value));
+  input.remove_prefix(sizeof(value));
+  return true;
+}
+
+/**
+ * Appends a placeholder frame header, to be filled in by EndFrame.
+ * @return position of the header
+ */
+std::size_t BeginFrame(std::string& frame)
+{
+  const std::size_t header = frame.size();
+  AppendUint32(0, frame);
+  return header;
+}
+
+void EndFrame(std::size_t header, std::string& frame)
+{
+  const auto size = static_cast<std::uint32_t>(frame.size() - header - kFrameHeaderSize);
+  std::memcpy(&frame[header], &size, sizeof(size));
+}
+}  // namespace
+
+std::uint32_t FrameSize(const char* header)
+{
+  std::uint32_t size;
+  std::memcpy(&size, header, sizeof(size));
+  return size;
+}
+
+void AppendRequest(std::uint32_t automaton, const std::vector<std::string>& records, std::string& frame)
+{
+  std::size_t size = 2 * sizeof(std::uint32_t);
+  for (const auto& record : records)
+  {
+    size += sizeof(std::uint32_t) + record.size();
+  }
+  frame.reserve(frame.size() + kFrameHeaderSize + size);
+
+  const std::size_t header = BeginFrame(frame);
+  AppendUint32(automaton, frame);
+  AppendUint32(static_cast<std::uint32_t>(records.size()), frame);
+  for (const auto& record : records)
+  {
+    AppendUint32(static_cast<std::uint32_t>(record.size()), frame);
+    frame += record;
+  }
+  EndFrame(header, frame);
+}
+
+bool ParseRequest(std::string_view payload, std::uint32_t& automaton, std::vector<std::string_view>& records)
+{
+  std::uint32_t count;
+  if (!ReadUint32(payload, automaton) || !ReadUint32(payload, count))
+  {
+    return false;
+  }
+
+  // Every record takes at least its size prefix, which bounds count before anything is reserved for it.
+  if (count > payload.size() / sizeof(std::uint32_t))
+  {
+    return false;
+  }
+
+  records.clear();
+  records.reserve(count);
+  for (std::uint32_t i = 0; i < count; ++i)
+  {
+    std::uint32_t size;
+    if (!ReadUint32(payload, size) || size > payload.size())
+    {
+      return false;
+    }
+    records.push_back(payload.substr(0, size));
+    payload.remove_prefix(size);
+  }
+  return payload.empty();
+}
+
+void AppendResponse(BatchStatus status, const std::vector<Dfa::Acceptance>& verdicts, std::string& frame)
+{
+  frame.reserve(frame.size() + kFrameHeaderSize + 2 * sizeof(std::uint32_t) + verdicts.size());
+
+  const std::size_t header = BeginFrame(frame);
+  AppendUint32(status, frame);
+  AppendUint32(static_cast<std::uint32_t>(verdicts.size()), frame);
+  for (const auto verdict : verdicts)
+  {
+    frame += static_cast<char>(verdict);
+  }
+  EndFrame(header, frame);
+}
+
+BatchStatus ParseResponse(std::string_view payload, std::vector<Dfa::Acceptance>& verdicts)
+{
+  std::uint32_t status;
+  std::uint32_t count;
+  if (!ReadUint32(payload, status) || !ReadUint32(payload, count) || payload.size() != count)
+  {
+    throw std::runtime_error("Malformed response from server.");
+  }
+
+  verdicts.clear();
+  verdicts.reserve(count);
+  for (const char verdict : payload)
+  {
+    verdicts.push_back(static_cast<Dfa::Acceptance>(verdict));
+  }
+  return static_cast<BatchStatus>(status);
+}
+
+}  // namespace dfa
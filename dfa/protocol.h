@@ -0,0 +1,89 @@
+/**
+ * @file protocol.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dfa/dfa.h"
+
+namespace dfa
+{
+/**
+ * Wire format spoken between a Server and its Clients.
+ *
+ * Every message is a frame: a uint32 payload size, followed by the payload. Integers are in host byte order, since
+ * Unix domain sockets only connect processes on the same host.
+ *
+ * A request payload is the index of the automaton to match against (uint32), the number of records (uint32), and
+ * each record as its size (uint32) followed by its bytes.
+ *
+ * A response payload is a BatchStatus (uint32), the number of verdicts (uint32), and one Dfa::Acceptance byte per
+ * record, in request order. Only BATCH_OK responses carry verdicts.
+ */
+enum BatchStatus : std::uint32_t
+{
+  /**
+   * Every record was matched.
+   */
+  BATCH_OK,
+  /**
+   * The requested automaton index is out of range.
+   */
+  UNKNOWN_AUTOMATON,
+  /**
+   * The request payload was truncated or had trailing bytes.
+   */
+  MALFORMED_BATCH
+};
+
+/**
+ * Size of the length prefix of a frame.
+ */
+constexpr std::size_t kFrameHeaderSize = sizeof(std::uint32_t);
+
+/**
+ * Largest payload a Server accepts. Larger frames close the connection.
+ */
+constexpr std::uint32_t kMaxFrameSize = 64U << 20U;
+
+/**
+ * Reads the payload size of a frame.
+ * @param header at least kFrameHeaderSize bytes
+ */
+std::uint32_t FrameSize(const char* header);
+
+/**
+ * Appends a request frame to frame.
+ */
+void AppendRequest(std::uint32_t automaton, const std::vector<std::string>& records, std::string& frame);
+
+/**
+ * Parses a request payload.
+ * @param records receives views into payload
+ * @return false if the payload is malformed
+ */
+bool ParseRequest(std::string_view payload, std::uint32_t& automaton, std::vector<std::string_view>& records);
+
+/**
+ * Appends a response frame to frame.
+ * @param verdicts empty unless status is BATCH_OK
+ */
+void AppendResponse(BatchStatus status, const std::vector<Dfa::Acceptance>& verdicts, std::string& frame);
+
+/**
+ * Parses a response payload.
+ * @param verdicts receives the verdicts, if status is BATCH_OK
+ * @return the status
+ * @throws std::runtime_error if the payload is malformed
+ */
+BatchStatus ParseResponse(std::string_view payload, std::vector<Dfa::Acceptance>& verdicts);
+
+}  // namespace dfa
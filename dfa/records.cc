@@ -0,0 +1,240 @@
+/**
+ * @file records.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "records.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include "utf8.h"
+
+namespace dfa
+{
+namespace
+{
+/**
+ * Appends a JSON string. JSON text has to be UTF-8, so each byte that isn't part of a valid UTF-8 sequence is replaced
+ * by U+FFFD; the record's offset still locates the original bytes in the input.
+ */
+void AppendJsonString(std::string_view value, std::string& out)
+{
+  constexpr char kHex[] = "0123456789abcdef";
+  out += '"';
+  for (std::size_t i = 0; i < value.size(); ++i)
+  {
+    const char c = value[i];
+    const auto byte = static_cast<unsigned char>(c);
+    if (c == '"' || c == '\\')
+    {
+      out += '\\';
+      out += c;
+    }
+    else if (byte < 0x20)
+    {
+      out += "\\u00";
+      out += kHex[byte >> 4U];
+      out += kHex[byte & 0xFU];
+    }
+    else if (byte < 0x80)
+    {
+      out += c;
+    }
+    else if (const std::size_t length = SequenceLength(byte); DecodeScalar(value.substr(i, length)).has_value())
+    {
+      out.append(value, i, length);
+      i += length - 1;
+    }
+    else
+    {
+      out += "\xef\xbf\xbd";
+    }
+  }
+  out += '"';
+}
+}  // namespace
+
+const char* VerdictName(Dfa::Acceptance verdict)
+{
+  switch (verdict)
+  {
+    case Dfa::ACCEPTS:
+      return "ACCEPT";
+    case Dfa::REJECTS:
+      return "NOT ACCEPT";
+    case Dfa::INVALID_ALPHABET:
+      return "INVALID ALPHABET";
+    case Dfa::NO_TRANSITION:
+      return "NO TRANSITION";
+    default:
+      return "";
+  }
+}
+
+RecordReader::RecordReader(int fd, std::function<void()> before_read, std::size_t block_size)
+    : fd_(fd), before_read_(std::move(before_read)), block_size_(block_size)
+{
+}
+
+bool RecordReader::Next(std::string_view& record, std::uint64_t& offset)
+{
+  for (;;)
+  {
+    const char* const begin = buffer_.data() + begin_;
+    const std::size_t available = buffer_.size() - begin_;
+    const auto* newline = static_cast<const char*>(std::memchr(begin, '\n', available));
+    if (newline != nullptr || (eof_ && available != 0))
+    {
+      record = std::string_view(begin, newline != nullptr ? static_cast<std::size_t>(newline - begin) : available);
+      offset = buffer_offset_ + begin_;
+      begin_ += record.size() + (newline != nullptr ? 1 : 0);
+      if (record.empty())
+      {
+        // An empty line ends the input, like it does for std::getline based readers.
+        eof_ = true;
+        begin_ = buffer_.size();
+        return false;
+      }
+      return true;
+    }
+    if (eof_)
+    {
+      return false;
+    }
+
+    // Keep the unterminated record, and read more after it.
+    buffer_offset_ += begin_;
+    buffer_.erase(0, begin_);
+    begin_ = 0;
+    if (before_read_)
+    {
+      before_read_();
+    }
+
+    const std::size_t size = buffer_.size();
+    buffer_.resize(size + block_size_);
+    ssize_t received;
+    do
+    {
+      received = read(fd_, &buffer_[size], block_size_);
+    } while (received < 0 && errno == EINTR);
+    if (received < 0)
+    {
+      const int error = errno;
+      buffer_.resize(size);
+      throw std::system_error(error, std::generic_category(), "read");
+    }
+    buffer_.resize(size + static_cast<std::size_t>(received));
+    eof_ = received == 0;
+  }
+}
+
+VerdictWriter::Format VerdictWriter::ParseFormat(std::string_view name)
+{
+  if (name == "text")
+  {
+    return TEXT;
+  }
+  if (name == "codes")
+  {
+    return CODES;
+  }
+  if (name == "accepted")
+  {
+    return ACCEPTED;
+  }
+  if (name == "jsonl")
+  {
+    return JSON_LINES;
+  }
+  if (name == "binary")
+  {
+    return BINARY;
+  }
+  throw std::invalid_argument("Unknown output format: " + std::string(name));
+}
+
+VerdictWriter::VerdictWriter(std::ostream& out, Format format, std::size_t block_size)
+    : out_(out), format_(format), block_size_(block_size)
+{
+  buffer_.reserve(block_size_ + block_size_ / 4);
+}
+
+VerdictWriter::~VerdictWriter()
+{
+  try
+  {
+    Flush();
+  }
+  catch (...)
+  {
+  }
+}
+
+void VerdictWriter::Write(std::string_view record, std::uint64_t offset, Dfa::Acceptance verdict)
+{
+  switch (format_)
+  {
+    case TEXT:
+      buffer_ += record;
+      buffer_ += " -> ";
+      buffer_ += VerdictName(verdict);
+      buffer_ += '\n';
+      break;
+
+    case CODES:
+      buffer_ += static_cast<char>('0' + verdict);
+      buffer_ += '\n';
+      break;
+
+    case ACCEPTED:
+      if (verdict == Dfa::ACCEPTS)
+      {
+        buffer_ += record;
+        buffer_ += '\n';
+      }
+      break;
+
+    case JSON_LINES:
+    {
+      char digits[24];
+      const auto end = std::to_chars(digits, digits + sizeof(digits), offset).ptr;
+      buffer_ += "{\"offset\":";
+      buffer_.append(digits, end);
+      buffer_ += ",\"record\":";
+      AppendJsonString(record, buffer_);
+      buffer_ += ",\"verdict\":\"";
+      buffer_ += VerdictName(verdict);
+      buffer_ += "\"}\n";
+      break;
+    }
+
+    case BINARY:
+    default:
+      buffer_ += static_cast<char>(verdict);
+      break;
+  }
+
+  if (buffer_.size() >= block_size_)
+  {
+    out_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    buffer_.clear();
+  }
+}
+
+void VerdictWriter::Flush()
+{
+  out_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+  buffer_.clear();
+  out_.flush();
+}
+
+}  // namespace dfa
@@ -0,0 +1,138 @@
+/**
+ * @file records.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "dfa/dfa.h"
+
+namespace dfa
+{
+/**
+ * The text dfash prints for an Acceptance, such as "NOT ACCEPT".
+ */
+const char* VerdictName(Dfa::Acceptance verdict);
+
+/**
+ * Splits a file descriptor into newline-separated records, reading it in large blocks.
+ */
+class RecordReader
+{
+ public:
+  /**
+   * @param fd the descriptor to read; not closed
+   * @param before_read called before every read that may block, so that pending output can be flushed first
+   * @param block_size how much is read at once
+   */
+  explicit RecordReader(int fd, std::function<void()> before_read = nullptr, std::size_t block_size = 256 * 1024);
+
+  /**
+   * Reads the next record.
+   * @param record receives the record without its newline; valid until the next call
+   * @param offset receives the record's byte offset in the input
+   * @return false at the end of input, or at the first empty line
+   * @throws std::system_error if reading fails
+   */
+  bool Next(std::string_view& record, std::uint64_t& offset);
+
+ private:
+  int fd_;
+
+  std::function<void()> before_read_;
+
+  std::size_t block_size_;
+
+  /**
+   * Unread input is buffer_[begin_, buffer_.size()).
+   */
+  std::string buffer_;
+
+  std::size_t begin_ = 0;
+
+  /**
+   * Offset of buffer_[0] in the input.
+   */
+  std::uint64_t buffer_offset_ = 0;
+
+  bool eof_ = false;
+};
+
+/**
+ * Formats verdicts into a buffer, and writes it out in blocks rather than per record.
+ */
+class VerdictWriter
+{
+ public:
+  enum Format
+  {
+    /**
+     * "<record> -> <verdict name>" lines.
+     */
+    TEXT,
+    /**
+     * One line per record with its Acceptance as a digit.
+     */
+    CODES,
+    /**
+     * Accepted records only, like grep.
+     */
+    ACCEPTED,
+    /**
+     * One JSON object per line, with the record's byte offset in the input, the record and its verdict. Bytes of the
+     * record that aren't valid UTF-8 are replaced by U+FFFD, so the original bytes have to be read at the offset.
+     */
+    JSON_LINES,
+    /**
+     * One Acceptance byte per record, without separators.
+     */
+    BINARY
+  };
+
+  /**
+   * Parses a format name: text, codes, accepted, jsonl or binary.
+   * @throws std::invalid_argument if name isn't one of them
+   */
+  static Format ParseFormat(std::string_view name);
+
+  /**
+   * @param out where to write
+   * @param format how to format verdicts
+   * @param block_size buffered bytes at which Write flushes on its own
+   */
+  VerdictWriter(std::ostream& out, Format format, std::size_t block_size = 256 * 1024);
+
+  /**
+   * Flushes what is left.
+   */
+  ~VerdictWriter();
+
+  VerdictWriter(const VerdictWriter&) = delete;
+  VerdictWriter& operator=(const VerdictWriter&) = delete;
+
+  void Write(std::string_view record, std::uint64_t offset, Dfa::Acceptance verdict);
+
+  /**
+   * Writes the buffer to the stream, and flushes the stream.
+   */
+  void Flush();
+
+ private:
+  std::ostream& out_;
+
+  Format format_;
+
+  std::size_t block_size_;
+
+  std::string buffer_;
+};
+
+}  // namespace dfa
@@ -0,0 +1,684 @@
+/**
+ * @file regex.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "regex.h"
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dfa
+{
+namespace
+{
+constexpr std::size_t kNumBytes = 256;
+
+/**
+ * Largest count of a bounded repetition, as in most regex engines.
+ */
+constexpr unsigned kMaxCount = 1000;
+
+constexpr unsigned kUnbounded = std::numeric_limits<unsigned>::max();
+
+/**
+ * Deepest nesting of groups and repetitions, so that neither parsing nor building can overflow the stack.
+ */
+constexpr unsigned kMaxDepth = 1000;
+
+/**
+ * Most NFA states an expression may expand to, since bounded repetitions copy their operand.
+ */
+constexpr std::size_t kMaxStates = std::size_t{1} << 24U;
+
+using ByteSet = std::bitset<kNumBytes>;
+
+/**
+ * A node of the syntax tree. Nodes refer to their children by index.
+ */
+struct Node
+{
+  enum Kind
+  {
+    /**
+     * Matches the empty string.
+     */
+    EMPTY,
+    /**
+     * Matches one byte of bytes.
+     */
+    BYTES,
+    CONCATENATION,
+    ALTERNATION,
+    /**
+     * Matches min to max repetitions of its only child.
+     */
+    REPETITION
+  };
+
+  Kind kind = EMPTY;
+
+  ByteSet bytes;
+
+  std::vector<std::size_t> children;
+
+  unsigned min = 0;
+
+  unsigned max = 0;
+};
+
+ByteSet Range(unsigned char lo, unsigned char hi)
+{
+  ByteSet set;
+  for (unsigned b = lo; b <= hi; ++b)
+  {
+    set.set(b);
+  }
+  return set;
+}
+
+/**
+ * Recursive descent parser that builds the syntax tree of a pattern.
+ */
+class Parser
+{
+ public:
+  explicit Parser(std::string_view pattern) : pattern_(pattern) {}
+
+  /**
+   * @return the index of the root node
+   */
+  std::size_t Parse()
+  {
+    if (!pattern_.empty() && pattern_[0] == '^')
+    {
+      ++pos_;
+    }
+    const std::size_t root = ParseAlternation();
+    if (pos_ != pattern_.size())
+    {
+      // Only an unbalanced parenthesis stops the top level alternation early.
+      Fail("Unmatched ')'");
+    }
+    return root;
+  }
+
+  std::vector<Node>& Nodes() { return nodes_; }
+
+ private:
+  [[noreturn]] void Fail(const std::string& message) const
+  {
+    throw std::invalid_argument("Regex error at position " + std::to_string(pos_) + ": " + message);
+  }
+
+  bool AtEnd() const { return pos_ == pattern_.size(); }
+
+  char Peek() const { return pattern_[pos_]; }
+
+  std::size_t Add(Node node)
+  {
+    nodes_.push_back(std::move(node));
+    return nodes_.size() - 1;
+  }
+
+  std::size_t AddBytes(const ByteSet& bytes)
+  {
+    Node node;
+    node.kind = Node::BYTES;
+    node.bytes = bytes;
+    return Add(std::move(node));
+  }
+
+  std::size_t ParseAlternation()
+  {
+    Node node;
+    node.kind = Node::ALTERNATION;
+    node.children.push_back(ParseConcatenation());
+    while (!AtEnd() && Peek() == '|')
+    {
+      ++pos_;
+      node.children.push_back(ParseConcatenation());
+    }
+    return node.children.size() == 1 ? node.children.front() : Add(std::move(node));
+  }
+
+  std::size_t ParseConcatenation()
+  {
+    Node node;
+    node.kind = Node::CONCATENATION;
+    while (!AtEnd() && Peek() != '|' && Peek() != ')')
+    {
+      node.children.push_back(ParseRepetition());
+    }
+    if (node.children.empty())
+    {
+      return Add(Node());
+    }
+    return node.children.size() == 1 ? node.children.front() : Add(std::move(node));
+  }
+
+  std::size_t ParseRepetition()
+  {
+    const unsigned depth = depth_;
+    std::size_t operand = ParseAtom();
+    while (!AtEnd())
+    {
+      unsigned min = 0;
+      unsigned max = kUnbounded;
+      const char c = Peek();
+      if (c == '*' || c == '+' || c == '?')
+      {
+        min = c == '+' ? 1 : 0;
+        max = c == '?' ? 1 : kUnbounded;
+        ++pos_;
+      }
+      else if (c == '{')
+      {
+        ParseCount(min, max);
+      }
+      else
+      {
+        break;
+      }
+
+      // Every operator nests the tree one level deeper.
+      if (++depth_ > kMaxDepth)
+      {
+        Fail("Too many nested operators");
+      }
+      Node node;
+      node.kind = Node::REPETITION;
+      node.children.push_back(operand);
+      node.min = min;
+      node.max = max;
+      operand = Add(std::move(node));
+    }
+    depth_ = depth;
+    return operand;
+  }
+
+  /**
+   * Parses {n}, {n,} or {n,m}, leaving pos_ after the closing brace.
+   */
+  void ParseCount(unsigned& min, unsigned& max)
+  {
+    const std::size_t begin = pos_++;
+    const auto parse_number = [this, begin](unsigned& value) {
+      if (AtEnd() || Peek() < '0' || Peek() > '9')
+      {
+        return false;
+      }
+      value = 0;
+      while (!AtEnd() && Peek() >= '0' && Peek() <= '9')
+      {
+        value = value * 10 + static_cast<unsigned>(Peek() - '0');
+        if (value > kMaxCount)
+        {
+          pos_ = begin;
+          Fail("Repetition count is larger than " + std::to_string(kMaxCount));
+        }
+        ++pos_;
+      }
+      return true;
+    };
+
+    if (!parse_number(min))
+    {
+      pos_ = begin;
+      Fail("Invalid repetition count");
+    }
+    max = min;
+    if (!AtEnd() && Peek() == ',')
+    {
+      ++pos_;
+      if (!parse_number(max))
+      {
+        max = kUnbounded;
+      }
+    }
+    if (AtEnd() || Peek() != '}')
+    {
+      pos_ = begin;
+      Fail("Invalid repetition count");
+    }
+    if (min > max)
+    {
+      pos_ = begin;
+      Fail("Repetition count range is out of order");
+    }
+    ++pos_;
+  }
+
+  std::size_t ParseAtom()
+  {
+    const char c = Peek();
+    switch (c)
+    {
+      case '(':
+      {
+        if (++depth_ > kMaxDepth)
+        {
+          Fail("Too many nested operators");
+        }
+        const std::size_t open = pos_++;
+        if (pattern_.substr(pos_, 2) == "?:")
+        {
+          pos_ += 2;
+        }
+        const std::size_t group = ParseAlternation();
+        if (AtEnd())
+        {
+          pos_ = open;
+          Fail("Unmatched '('");
+        }
+        ++pos_;
+        --depth_;
+        return group;
+      }
+
+      case '[':
+        return AddBytes(ParseClass());
+
+      case '.':
+      {
+        ++pos_;
+        ByteSet bytes;
+        bytes.set();
+        bytes.reset('\n');
+        return AddBytes(bytes);
+      }
+
+      case '\\':
+      {
+        ByteSet bytes;
+        ParseEscape(bytes);
+        return AddBytes(bytes);
+      }
+
+      case '*':
+      case '+':
+      case '?':
+      case '{':
+        Fail("Nothing to repeat");
+
+      case '^':
+        Fail("'^' is only supported at the start of the pattern");
+
+      case '$':
+        if (pos_ + 1 != pattern_.size())
+        {
+          Fail("'$' is only supported at the end of the pattern");
+        }
+        ++pos_;
+        return Add(Node());
+
+      default:
+      {
+        ++pos_;
+        ByteSet bytes;
+        bytes.set(static_cast<unsigned char>(c));
+        return AddBytes(bytes);
+      }
+    }
+  }
+
+  /**
+   * Parses an escape sequence starting at the backslash.
+   * @param bytes receives the bytes it matches
+   * @return whether it is a single byte, as opposed to a shorthand class
+   */
+  bool ParseEscape(ByteSet& bytes)
+  {
+    const std::size_t begin = pos_++;
+    if (AtEnd())
+    {
+      pos_ = begin;
+      Fail("Trailing '\\'");
+    }
+
+    const char c = pattern_[pos_++];
+    ByteSet shorthand;
+    switch (c)
+    {
+      case 'n':
+        bytes.set('\n');
+        return true;
+      case 'r':
+        bytes.set('\r');
+        return true;
+      case 't':
+        bytes.set('\t');
+        return true;
+      case 'f':
+        bytes.set('\f');
+        return true;
+      case 'v':
+        bytes.set('\v');
+        return true;
+      case '0':
+        bytes.set(0);
+        return true;
+
+      case 'x':
+      {
+        const auto hex_digit = [](char h) {
+          if (h >= '0' && h <= '9')
+          {
+            return h - '0';
+          }
+          if (h >= 'a' && h <= 'f')
+          {
+            return h - 'a' + 10;
+          }
+          if (h >= 'A' && h <= 'F')
+          {
+            return h - 'A' + 10;
+          }
+          return -1;
+        };
+        const int high = pos_ < pattern_.size() ? hex_digit(pattern_[pos_]) : -1;
+        const int low = pos_ + 1 < pattern_.size() ? hex_digit(pattern_[pos_ + 1]) : -1;
+        if (high < 0 || low < 0)
+        {
+          pos_ = begin;
+          Fail("Expected two hex digits after '\\x'");
+        }
+        pos_ += 2;
+        bytes.set(static_cast<std::size_t>(high * 16 + low));
+        return true;
+      }
+
+      case 'd':
+      case 'D':
+        shorthand = Range('0', '9');
+        break;
+
+      case 'w':
+      case 'W':
+        shorthand = Range('a', 'z') | Range('A', 'Z') | Range('0', '9');
+        shorthand.set('_');
+        break;
+
+      case 's':
+      case 'S':
+        for (const char space : {' ', '\t', '\n', '\r', '\f', '\v'})
+        {
+          shorthand.set(static_cast<unsigned char>(space));
+        }
+        break;
+
+      default:
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+        {
+          pos_ = begin;
+          Fail(std::string("Unknown escape '\\") + c + "'");
+        }
+        bytes.set(static_cast<unsigned char>(c));
+        return true;
+    }
+
+    bytes |= c == 'd' || c == 'w' || c == 's' ? shorthand : ~shorthand;
+    return false;
+  }
+
+  ByteSet ParseClass()
+  {
+    const std::size_t open = pos_++;
+    bool negated = false;
+    if (!AtEnd() && Peek() == '^')
+    {
+      negated = true;
+      ++pos_;
+    }
+
+    ByteSet bytes;
+    bool first = true;
+    for (;;)
+    {
+      if (AtEnd())
+      {
+        pos_ = open;
+        Fail("Unmatched '['");
+      }
+      // A ']' right after the opening bracket is a literal, as in POSIX.
+      if (Peek() == ']' && !first)
+      {
+        ++pos_;
+        break;
+      }
+      first = false;
+
+      const std::size_t element = pos_;
+      ByteSet lo;
+      if (Peek() == '\\')
+      {
+        if (!ParseEscape(lo))
+        {
+          bytes |= lo;
+          continue;
+        }
+      }
+      else
+      {
+        lo.set(static_cast<unsigned char>(pattern_[pos_++]));
+      }
+
+      // A '-' before the closing bracket is a literal.
+      if (pos_ + 1 < pattern_.size() && Peek() == '-' && pattern_[pos_ + 1] != ']')
+      {
+        ++pos_;
+        ByteSet hi;
+        if (Peek() == '\\')
+        {
+          if (!ParseEscape(hi))
+          {
+            pos_ = element;
+            Fail("Invalid class range");
+          }
+        }
+        else
+        {
+          hi.set(static_cast<unsigned char>(pattern_[pos_++]));
+        }
+
+        const auto byte_of = [](const ByteSet& set) {
+          unsigned b = 0;
+          while (!set.test(b))
+          {
+            ++b;
+          }
+          return static_cast<unsigned char>(b);
+        };
+        const unsigned char lo_byte = byte_of(lo);
+        const unsigned char hi_byte = byte_of(hi);
+        if (lo_byte > hi_byte)
+        {
+          pos_ = element;
+          Fail("Class range is out of order");
+        }
+        bytes |= Range(lo_byte, hi_byte);
+      }
+      else
+      {
+        bytes |= lo;
+      }
+    }
+
+    return negated ? ~bytes : bytes;
+  }
+
+  std::string_view pattern_;
+
+  std::size_t pos_ = 0;
+
+  unsigned depth_ = 0;
+
+  std::vector<Node> nodes_;
+};
+
+/**
+ * Emits Thompson fragments for syntax tree nodes. Every fragment has one entry and one exit state.
+ */
+class Builder
+{
+ public:
+  Builder(const std::vector<Node>& nodes, Nfa& nfa) : nodes_(nodes), nfa_(nfa) {}
+
+  void Build(std::size_t root)
+  {
+    // Symbols are the bytes that some node matches, in ascending order, which is also the order of the strings.
+    ByteSet used;
+    for (const auto& node : nodes_)
+    {
+      used |= node.bytes;
+    }
+    for (std::size_t b = 0; b < kNumBytes; ++b)
+    {
+      if (used.test(b))
+      {
+        symbol_ids_[b] = static_cast<Nfa::SymbolId>(nfa_.symbols.size());
+        nfa_.symbols.emplace_back(1, static_cast<char>(b));
+      }
+    }
+
+    const auto [entry, exit] = Emit(root);
+    nfa_.start.push_back(entry);
+    nfa_.final_states[exit] = true;
+  }
+
+ private:
+  using StateId = Nfa::StateId;
+
+  struct Fragment
+  {
+    StateId entry;
+    StateId exit;
+  };
+
+  StateId NewState()
+  {
+    if (nfa_.state_names.size() == kMaxStates)
+    {
+      throw std::invalid_argument("Regex error: the pattern is too large");
+    }
+    const auto id = static_cast<StateId>(nfa_.state_names.size());
+    nfa_.state_names.emplace_back(std::to_string(id));
+    nfa_.transitions.emplace_back();
+    nfa_.epsilon_transitions.emplace_back();
+    nfa_.final_states.push_back(false);
+    return id;
+  }
+
+  void Epsilon(StateId from, StateId to) { nfa_.epsilon_transitions[from].push_back(to); }
+
+  Fragment Emit(std::size_t index)
+  {
+    const Node& node = nodes_[index];
+    switch (node.kind)
+    {
+      case Node::BYTES:
+      {
+        const StateId entry = NewState();
+        const StateId exit = NewState();
+        for (std::size_t b = 0; b < kNumBytes; ++b)
+        {
+          if (node.bytes.test(b))
+          {
+            nfa_.transitions[entry].emplace_back(symbol_ids_[b], exit);
+          }
+        }
+        return {entry, exit};
+      }
+
+      case Node::CONCATENATION:
+      {
+        const Fragment first = Emit(node.children.front());
+        StateId exit = first.exit;
+        for (std::size_t i = 1; i < node.children.size(); ++i)
+        {
+          const Fragment next = Emit(node.children[i]);
+          Epsilon(exit, next.entry);
+          exit = next.exit;
+        }
+        return {first.entry, exit};
+      }
+
+      case Node::ALTERNATION:
+      {
+        const StateId entry = NewState();
+        const StateId exit = NewState();
+        for (const auto child : node.children)
+        {
+          const Fragment branch = Emit(child);
+          Epsilon(entry, branch.entry);
+          Epsilon(branch.exit, exit);
+        }
+        return {entry, exit};
+      }
+
+      case Node::REPETITION:
+      {
+        // The operand is copied min times, followed by a loop if unbounded, or by max - min optional copies.
+        const StateId entry = NewState();
+        StateId last = entry;
+        for (unsigned i = 0; i < node.min; ++i)
+        {
+          const Fragment copy = Emit(node.children.front());
+          Epsilon(last, copy.entry);
+          last = copy.exit;
+        }
+
+        if (node.max == kUnbounded)
+        {
+          const StateId loop = NewState();
+          const Fragment copy = Emit(node.children.front());
+          Epsilon(last, loop);
+          Epsilon(loop, copy.entry);
+          Epsilon(copy.exit, loop);
+          return {entry, loop};
+        }
+
+        const StateId exit = NewState();
+        for (unsigned i = node.min; i < node.max; ++i)
+        {
+          const Fragment copy = Emit(node.children.front());
+          Epsilon(last, exit);
+          Epsilon(last, copy.entry);
+          last = copy.exit;
+        }
+        Epsilon(last, exit);
+        return {entry, exit};
+      }
+
+      case Node::EMPTY:
+      default:
+      {
+        const StateId state = NewState();
+        return {state, state};
+      }
+    }
+  }
+
+  const std::vector<Node>& nodes_;
+
+  Nfa& nfa_;
+
+  std::array<Nfa::SymbolId, kNumBytes> symbol_ids_{};
+};
+}  // namespace
+
+void ParseRegex(std::string_view pattern, Nfa& nfa)
+{
+  Parser parser(pattern);
+  const std::size_t root = parser.Parse();
+  Builder(parser.Nodes(), nfa).Build(root);
+}
+
+}  // namespace dfa
@@ -0,0 +1,34 @@
+/**
+ * @file regex.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <string_view>
+
+#include "dfa/nfa.h"
+
+namespace dfa
+{
+/**
+ * Builds a Thompson NFA for a regular expression, directly in integer form.
+ *
+ * Symbols are single bytes, and the NFA's Symbols are the bytes that the expression can match. The syntax is:
+ *  - literal bytes, and `\` followed by any of `\.|*+?()[]{}^$-` for the byte itself
+ *  - `\n`, `\r`, `\t`, `\f`, `\v`, `\0` and `\xHH` escapes
+ *  - `.` for any byte but a newline
+ *  - classes such as `[a-z_]` and `[^0-9]`, and the `\d`, `\w`, `\s`, `\D`, `\W` and `\S` shorthands
+ *  - grouping with `(...)` or `(?:...)`, and alternation with `|`
+ *  - repetition with `*`, `+`, `?`, `{n}`, `{n,}` and `{n,m}`, where counts are at most 1000
+ *
+ * The expression always has to match the whole input, so `^` is only allowed at the start and `$` at the end, where
+ * they have no effect.
+ * @param pattern the regular expression
+ * @param nfa receives the NFA; it should be empty
+ * @throws std::invalid_argument with the position of the error if pattern is malformed
+ */
+void ParseRegex(std::string_view pattern, Nfa& nfa);
+
+}  // namespace dfa
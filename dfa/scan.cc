@@ -0,0 +1,662 @@
+/**
+ * @file scan.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "scan.h"
+
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define DFA_HAVE_IO_URING 1
+#else
+#define DFA_HAVE_IO_URING 0
+#endif
+
+namespace dfa
+{
+namespace fs = std::filesystem;
+
+namespace
+{
+/**
+ * A file being scanned: its descriptor, its read position, and the unterminated record at the end of the blocks read
+ * so far.
+ */
+class FileScan
+{
+ public:
+  FileScan(const Dfa& dfa, VerdictCache* cache, fs::path path, std::size_t block_size)
+      : dfa_(dfa), cache_(cache), block_size_(block_size), buffer_(new char[block_size])
+  {
+    result_.path = std::move(path);
+  }
+
+  ~FileScan()
+  {
+    if (fd_ >= 0)
+    {
+      close(fd_);
+    }
+  }
+
+  FileScan(const FileScan&) = delete;
+  FileScan& operator=(const FileScan&) = delete;
+
+  /**
+   * @return false if the file can't be opened, in which case the result carries the error
+   */
+  bool Open()
+  {
+    fd_ = open(result_.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0)
+    {
+      Fail(errno);
+      return false;
+    }
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return true;
+  }
+
+  /**
+   * Matches the records that the next size bytes of the buffer complete.
+   */
+  void Consume(std::size_t size)
+  {
+    const char* it = buffer_.get();
+    const char* const end = it + size;
+    offset_ += size;
+
+    if (!carry_.empty())
+    {
+      const auto* newline = static_cast<const char*>(std::memchr(it, '\n', size));
+      if (newline == nullptr)
+      {
+        carry_.append(it, end);
+        return;
+      }
+      carry_.append(it, newline);
+      Match(carry_);
+      carry_.clear();
+      it = newline + 1;
+    }
+
+    for (;;)
+    {
+      const auto* newline = static_cast<const char*>(std::memchr(it, '\n', static_cast<std::size_t>(end - it)));
+      if (newline == nullptr)
+      {
+        break;
+      }
+      Match(std::string_view(it, static_cast<std::size_t>(newline - it)));
+      it = newline + 1;
+    }
+    carry_.assign(it, end);
+  }
+
+  /**
+   * Matches the last record, if the file doesn't end with a newline.
+   */
+  void Finish() { Match(carry_); }
+
+  void Fail(int error) { result_.error = std::strerror(error); }
+
+  inline int Descriptor() const { return fd_; }
+
+  inline std::uint64_t Offset() const { return offset_; }
+
+  inline char* Buffer() { return buffer_.get(); }
+
+  inline std::size_t BlockSize() const { return block_size_; }
+
+  inline ScanResult& Result() { return result_; }
+
+ private:
+  inline void Match(std::string_view record)
+  {
+    if (!record.empty())
+    {
+      ++result_.verdicts[cache_ != nullptr ? cache_->Match(dfa_, 0, record) : dfa_.AcceptsString(record)];
+    }
+  }
+
+  const Dfa& dfa_;
+
+  VerdictCache* cache_;
+
+  std::size_t block_size_;
+
+  std::unique_ptr<char[]> buffer_;
+
+  int fd_ = -1;
+
+  std::uint64_t offset_ = 0;
+
+  std::string carry_;
+
+  ScanResult result_;
+};
+
+/**
+ * What the threads of one Scan share.
+ */
+class ScanContext
+{
+ public:
+  ScanContext(const Dfa& dfa, const std::vector<fs::path>& files, const ScanOptions& options,
+              const std::function<void(const ScanResult&)>& on_file)
+      : dfa_(dfa), files_(files), options_(options), on_file_(on_file)
+  {
+  }
+
+  /**
+   * Takes the next file that no thread has taken yet.
+   * @return the file, or nullptr if there are none left
+   */
+  std::unique_ptr<FileScan> Claim()
+  {
+    const std::size_t index = next_file_.fetch_add(1);
+    return index < files_.size()
+               ? std::make_unique<FileScan>(dfa_, options_.cache, files_[index], options_.block_size)
+               : nullptr;
+  }
+
+  void Report(FileScan& file)
+  {
+    const ScanResult& result = file.Result();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::size_t i = 0; i < result.verdicts.size(); ++i)
+    {
+      total_.verdicts[i] += result.verdicts[i];
+    }
+    if (on_file_)
+    {
+      on_file_(result);
+    }
+  }
+
+  inline ScanResult& Total() { return total_; }
+
+ private:
+  const Dfa& dfa_;
+
+  const std::vector<fs::path>& files_;
+
+  const ScanOptions& options_;
+
+  const std::function<void(const ScanResult&)>& on_file_;
+
+  std::atomic<std::size_t> next_file_{0};
+
+  std::mutex mutex_;
+
+  ScanResult total_;
+};
+
+/**
+ * Reads one file at a time with blocking preads.
+ */
+void ScanWithPread(ScanContext& context)
+{
+  while (auto file = context.Claim())
+  {
+    if (file->Open())
+    {
+      for (;;)
+      {
+        const ssize_t size =
+            pread(file->Descriptor(), file->Buffer(), file->BlockSize(), static_cast<off_t>(file->Offset()));
+        if (size < 0)
+        {
+          if (errno == EINTR)
+          {
+            continue;
+          }
+          file->Fail(errno);
+          break;
+        }
+        if (size == 0)
+        {
+          file->Finish();
+          break;
+        }
+        file->Consume(static_cast<std::size_t>(size));
+      }
+    }
+    context.Report(*file);
+  }
+}
+
+#if DFA_HAVE_IO_URING
+/**
+ * A minimal io_uring, driven through the raw system calls so that liburing isn't required.
+ */
+class IoUring
+{
+ public:
+  /**
+   * @throws std::system_error if the kernel doesn't support io_uring or doesn't allow it
+   */
+  explicit IoUring(unsigned entries)
+  {
+    io_uring_params params{};
+    fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd_ < 0)
+    {
+      throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+    }
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    single_mmap_ = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap_)
+    {
+      sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    }
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+
+    sq_ring_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    cq_ring_ = single_mmap_ ? sq_ring_
+                            : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                                   IORING_OFF_CQ_RING);
+    void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes == MAP_FAILED)
+    {
+      const int error = errno;
+      sqes_ = sqes == MAP_FAILED ? nullptr : static_cast<io_uring_sqe*>(sqes);
+      Release();
+      throw std::system_error(error, std::generic_category(), "mmap");
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    auto* sq = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+    auto* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  }
+
+  ~IoUring() { Release(); }
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  /**
+   * Queues a read of one iovec. The caller keeps no more reads in flight than the ring has entries.
+   */
+  void QueueRead(int fd, const iovec* iov, std::uint64_t offset, std::uint64_t user_data)
+  {
+    // Only this thread writes the tail, so it doesn't have to be loaded atomically.
+    const unsigned tail = *sq_tail_;
+    const unsigned index = tail & sq_mask_;
+    io_uring_sqe& sqe = sqes_[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READV;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<std::uint64_t>(iov);
+    sqe.len = 1;
+    sqe.off = offset;
+    sqe.user_data = user_data;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    ++unsubmitted_;
+  }
+
+  /**
+   * Submits the queued reads, and waits until at least one read completed.
+   */
+  void SubmitAndWait()
+  {
+    for (;;)
+    {
+      const long submitted = syscall(__NR_io_uring_enter, fd_, unsubmitted_, 1U, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (submitted >= 0)
+      {
+        unsubmitted_ -= static_cast<unsigned>(submitted);
+        return;
+      }
+      if (errno != EINTR)
+      {
+        throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+      }
+    }
+  }
+
+  /**
+   * Calls on_completion(user_data, result) for each completed read.
+   */
+  template <typename F>
+  void Reap(F&& on_completion)
+  {
+    unsigned head = *cq_head_;
+    const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+    {
+      const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+      on_completion(cqe.user_data, cqe.res);
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+
+  /**
+   * Waits for the reads that the kernel already took from the submission queue, without submitting any more, so that
+   * their buffers can be released. Their results are discarded.
+   * @param in_flight reads queued and not completed yet, whether they were submitted or not
+   * @return false if waiting failed, in which case some of them may still be in flight
+   */
+  bool Drain(unsigned in_flight) noexcept
+  {
+    // The kernel advances the head past each entry it takes. Entries between the head and the tail are never taken,
+    // since nothing is submitted any more.
+    unsigned pending = in_flight - (*sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE));
+    for (;;)
+    {
+      Reap([&pending](std::uint64_t /*user_data*/, int /*result*/) { --pending; });
+      if (pending == 0)
+      {
+        return true;
+      }
+      if (syscall(__NR_io_uring_enter, fd_, 0U, 1U, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+      {
+        return false;
+      }
+    }
+  }
+
+ private:
+  void Release() noexcept
+  {
+    if (sqes_ != nullptr)
+    {
+      munmap(sqes_, sqes_size_);
+    }
+    if (!single_mmap_ && cq_ring_ != MAP_FAILED && cq_ring_ != nullptr)
+    {
+      munmap(cq_ring_, cq_size_);
+    }
+    if (sq_ring_ != MAP_FAILED && sq_ring_ != nullptr)
+    {
+      munmap(sq_ring_, sq_size_);
+    }
+    close(fd_);
+  }
+
+  int fd_;
+
+  bool single_mmap_ = false;
+
+  std::size_t sq_size_ = 0;
+
+  std::size_t cq_size_ = 0;
+
+  std::size_t sqes_size_ = 0;
+
+  void* sq_ring_ = nullptr;
+
+  void* cq_ring_ = nullptr;
+
+  io_uring_sqe* sqes_ = nullptr;
+
+  unsigned* sq_head_ = nullptr;
+
+  unsigned* sq_tail_ = nullptr;
+
+  unsigned sq_mask_ = 0;
+
+  unsigned* sq_array_ = nullptr;
+
+  unsigned* cq_head_ = nullptr;
+
+  unsigned* cq_tail_ = nullptr;
+
+  unsigned cq_mask_ = 0;
+
+  io_uring_cqe* cqes_ = nullptr;
+
+  unsigned unsubmitted_ = 0;
+};
+
+/**
+ * Keeps one read in flight for each of up to depth files, and matches each block as soon as it completes, while the
+ * other reads are still in flight.
+ */
+void ScanWithIoUring(ScanContext& context, IoUring& ring, unsigned depth)
+{
+  struct Slot
+  {
+    std::unique_ptr<FileScan> file;
+    iovec iov;
+  };
+  std::vector<Slot> slots(depth);
+  unsigned in_flight = 0;
+  bool exhausted = false;
+
+  const auto queue_read = [&](std::uint64_t index) {
+    auto& slot = slots[index];
+    slot.iov.iov_base = slot.file->Buffer();
+    slot.iov.iov_len = slot.file->BlockSize();
+    ring.QueueRead(slot.file->Descriptor(), &slot.iov, slot.file->Offset(), index);
+    ++in_flight;
+  };
+
+  for (;;)
+  {
+    for (std::size_t i = 0; i < slots.size() && !exhausted; ++i)
+    {
+      while (!slots[i].file)
+      {
+        slots[i].file = context.Claim();
+        if (!slots[i].file)
+        {
+          exhausted = true;
+          break;
+        }
+        if (slots[i].file->Open())
+        {
+          queue_read(i);
+        }
+        else
+        {
+          context.Report(*slots[i].file);
+          slots[i].file.reset();
+        }
+      }
+    }
+
+    if (in_flight == 0)
+    {
+      return;
+    }
+
+    try
+    {
+      ring.SubmitAndWait();
+    }
+    catch (const std::system_error& e)
+    {
+      // The ring is unusable, so the files it had are given up on, and the rest are read with pread. Reads that were
+      // already submitted may still write into the files' buffers, so they are waited for before the buffers are
+      // released. If even that fails, the buffers are leaked rather than freed while the kernel may write into them.
+      const bool drained = ring.Drain(in_flight);
+      for (auto& slot : slots)
+      {
+        if (slot.file)
+        {
+          slot.file->Result().error = e.what();
+          context.Report(*slot.file);
+        }
+      }
+      if (!drained)
+      {
+        // Moving the vector keeps the slots, and so the iovecs and buffers, where they are.
+        static_cast<void>(new std::vector<Slot>(std::move(slots)));
+      }
+      slots.clear();
+      ScanWithPread(context);
+      return;
+    }
+    ring.Reap([&](std::uint64_t index, int result) {
+      --in_flight;
+      auto& file = *slots[index].file;
+      if (result > 0)
+      {
+        file.Consume(static_cast<std::size_t>(result));
+        queue_read(index);
+        return;
+      }
+      if (result == -EINTR || result == -EAGAIN)
+      {
+        queue_read(index);
+        return;
+      }
+
+      if (result == 0)
+      {
+        file.Finish();
+      }
+      else
+      {
+        file.Fail(-result);
+      }
+      context.Report(file);
+      slots[index].file.reset();
+    });
+  }
+}
+#endif
+}  // namespace
+
+std::vector<fs::path> ExpandScanTargets(const std::vector<std::string>& targets)
+{
+  std::vector<fs::path> files;
+  const auto add = [&files](const fs::path& path) {
+    std::error_code error;
+    if (!fs::is_directory(path, error))
+    {
+      files.push_back(path);
+      return;
+    }
+
+    // Sorted, so that the order doesn't depend on the file system.
+    std::vector<fs::path> found;
+    for (fs::recursive_directory_iterator it(path, fs::directory_options::skip_permission_denied, error), end;
+         !error && it != end; it.increment(error))
+    {
+      if (it->is_regular_file(error))
+      {
+        found.push_back(it->path());
+      }
+    }
+    std::sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+  };
+
+  for (const auto& target : targets)
+  {
+    std::error_code error;
+    if (fs::exists(target, error))
+    {
+      add(target);
+      continue;
+    }
+
+    glob_t matches;
+    if (glob(target.c_str(), 0, nullptr, &matches) != 0)
+    {
+      globfree(&matches);
+      throw std::runtime_error("No files match " + target + ".");
+    }
+    for (std::size_t i = 0; i < matches.gl_pathc; ++i)
+    {
+      add(matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+  }
+  return files;
+}
+
+ScanResult Scan(const Dfa& dfa, const std::vector<fs::path>& files, const ScanOptions& options,
+                const std::function<void(const ScanResult&)>& on_file)
+{
+  ScanContext context(dfa, files, options, on_file);
+  const unsigned threads = options.threads == 0 ? std::max(1U, std::thread::hardware_concurrency()) : options.threads;
+  const unsigned queue_depth = std::max(1U, options.queue_depth);
+  std::vector<std::thread> workers;
+
+#if DFA_HAVE_IO_URING
+  if (options.io_uring)
+  {
+    // Each thread has a ring of its own, so that it can match blocks without handing them to another thread. If the
+    // first ring can't be set up, io_uring isn't available at all, and every thread falls back to pread.
+    const unsigned depth = (queue_depth + threads - 1) / threads;
+    std::vector<std::unique_ptr<IoUring>> rings;
+    try
+    {
+      for (unsigned i = 0; i < threads; ++i)
+      {
+        rings.push_back(std::make_unique<IoUring>(depth));
+      }
+    }
+    catch (const std::system_error&)
+    {
+    }
+
+    if (!rings.empty())
+    {
+      for (unsigned i = 0; i < threads; ++i)
+      {
+        if (i < rings.size())
+        {
+          workers.emplace_back([&context, &ring = *rings[i], depth] { ScanWithIoUring(context, ring, depth); });
+        }
+        else
+        {
+          workers.emplace_back([&context] { ScanWithPread(context); });
+        }
+      }
+      for (auto& worker : workers)
+      {
+        worker.join();
+      }
+      return context.Total();
+    }
+  }
+#endif
+
+  // Blocking reads need a thread per read in flight.
+  for (unsigned i = 0; i < std::max(threads, queue_depth); ++i)
+  {
+    workers.emplace_back([&context] { ScanWithPread(context); });
+  }
+  for (auto& worker : workers)
+  {
+    worker.join();
+  }
+  return context.Total();
+}
+
+}  // namespace dfa
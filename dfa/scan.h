@@ -0,0 +1,94 @@
+/**
+ * @file scan.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "dfa/dfa.h"
+#include "dfa/verdict_cache.h"
+
+namespace dfa
+{
+/**
+ * Settings for Scan.
+ */
+struct ScanOptions
+{
+  /**
+   * Number of threads that match records; 0 uses all hardware threads.
+   */
+  unsigned threads = 0;
+
+  /**
+   * Number of reads kept in flight across all threads.
+   */
+  unsigned queue_depth = 64;
+
+  /**
+   * Size of each read.
+   */
+  std::size_t block_size = 256 * 1024;
+
+  /**
+   * Whether to read through io_uring where the kernel supports it. Otherwise, or if it doesn't, queue_depth threads
+   * read with pread.
+   */
+  bool io_uring = true;
+
+  /**
+   * If not null, caches the verdicts of records. Since a scan matches a single Dfa, they are cached with generation 0.
+   */
+  VerdictCache* cache = nullptr;
+};
+
+/**
+ * Verdict counts of a scanned file, or of all of them.
+ */
+struct ScanResult
+{
+  std::filesystem::path path;
+
+  /**
+   * Number of records with each Dfa::Acceptance, indexed by it.
+   */
+  std::array<std::uint64_t, 4> verdicts{};
+
+  /**
+   * Why the file couldn't be read completely, if it couldn't. Records before the failure are still counted.
+   */
+  std::string error;
+
+  inline std::uint64_t Records() const { return verdicts[0] + verdicts[1] + verdicts[2] + verdicts[3]; }
+};
+
+/**
+ * Resolves files, directories and glob patterns to the files they name. Directories are searched recursively for
+ * regular files.
+ * @throws std::runtime_error if a target names nothing
+ */
+std::vector<std::filesystem::path> ExpandScanTargets(const std::vector<std::string>& targets);
+
+/**
+ * Matches every line of every file. Files are read concurrently, and records are matched as their blocks arrive.
+ *
+ * Records are separated by newlines; empty lines are skipped, like the end of input is on stdin.
+ * @param dfa the DFA to match against
+ * @param files the files to scan
+ * @param options I/O and threading settings
+ * @param on_file called once per file as soon as it is done, in completion order; calls are serialized
+ * @return the sums over all files
+ */
+ScanResult Scan(const Dfa& dfa, const std::vector<std::filesystem::path>& files, const ScanOptions& options,
+                const std::function<void(const ScanResult&)>& on_file);
+
+}  // namespace dfa
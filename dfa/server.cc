@@ -0,0 +1,538 @@
+/**
+ * @file server.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "server.h"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <utility>
+
+namespace dfa
+{
+namespace fs = std::filesystem;
+
+namespace
+{
+/**
+ * epoll tokens of the listening socket and the eventfd. Connections use their IDs, which never get this large.
+ */
+constexpr std::uint64_t kListenToken = ~std::uint64_t{0};
+constexpr std::uint64_t kWakeToken = kListenToken - 1;
+
+constexpr int kMaxEvents = 64;
+
+constexpr std::size_t kReadSize = 64 * 1024;
+
+/**
+ * Reading stops while this much input is buffered, which is enough for the largest frame.
+ */
+constexpr std::size_t kMaxBufferedInput = kFrameHeaderSize + kMaxFrameSize;
+
+[[noreturn]] void ThrowSystemError(const char* what) { throw std::system_error(errno, std::generic_category(), what); }
+
+void AddToEpoll(int epoll_fd, int fd, std::uint32_t events, std::uint64_t token)
+{
+  epoll_event event{};
+  event.events = events;
+  event.data.u64 = token;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+  {
+    ThrowSystemError("epoll_ctl");
+  }
+}
+}  // namespace
+
+Server::Server(fs::path socket_path, std::vector<const AtomicSnapshot*> automata, unsigned workers,
+               std::size_t cache_capacity)
+    : socket_path_(std::move(socket_path)), automata_(std::move(automata))
+{
+  try
+  {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    const std::string& native_path = socket_path_.native();
+    if (native_path.size() >= sizeof(address.sun_path))
+    {
+      throw std::system_error(std::make_error_code(std::errc::filename_too_long), "Socket path too long");
+    }
+    std::memcpy(address.sun_path, native_path.c_str(), native_path.size() + 1);
+
+    // A socket file that is left over from a server that didn't shut down cleanly would make bind fail.
+    std::error_code error;
+    if (fs::is_socket(socket_path_, error))
+    {
+      fs::remove(socket_path_, error);
+    }
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0)
+    {
+      ThrowSystemError("socket");
+    }
+    if (bind(listen_fd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+      ThrowSystemError("bind");
+    }
+    if (listen(listen_fd_, SOMAXCONN) != 0)
+    {
+      ThrowSystemError("listen");
+    }
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0)
+    {
+      ThrowSystemError("epoll_create1");
+    }
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0)
+    {
+      ThrowSystemError("eventfd");
+    }
+    AddToEpoll(epoll_fd_, listen_fd_, EPOLLIN, kListenToken);
+    AddToEpoll(epoll_fd_, wake_fd_, EPOLLIN, kWakeToken);
+    spare_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  }
+  catch (...)
+  {
+    CloseDescriptors();
+    throw;
+  }
+
+  if (workers == 0)
+  {
+    workers = std::max(1U, std::thread::hardware_concurrency());
+  }
+  if (cache_capacity != 0)
+  {
+    for (std::size_t i = 0; i < automata_.size(); ++i)
+    {
+      caches_.push_back(std::make_unique<VerdictCache>(cache_capacity));
+    }
+  }
+  workers_.reserve(workers);
+  for (unsigned i = 0; i < workers; ++i)
+  {
+    workers_.emplace_back(&Server::Work, this);
+  }
+}
+
+Server::~Server()
+{
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex_);
+    workers_stopping_ = true;
+  }
+  jobs_condition_.notify_all();
+  for (auto& worker : workers_)
+  {
+    worker.join();
+  }
+
+  for (const auto& [id, connection] : connections_)
+  {
+    close(connection.fd);
+  }
+  CloseDescriptors();
+
+  std::error_code error;
+  fs::remove(socket_path_, error);
+}
+
+void Server::Run()
+{
+  epoll_event events[kMaxEvents];
+  while (!stopping_.load())
+  {
+    const int count = epoll_wait(epoll_fd_, events, kMaxEvents, -1);
+    if (count < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      ThrowSystemError("epoll_wait");
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+      const std::uint64_t token = events[i].data.u64;
+      if (token == kListenToken)
+      {
+        Accept();
+      }
+      else if (token == kWakeToken)
+      {
+        std::uint64_t wakeups;
+        [[maybe_unused]] const auto size = read(wake_fd_, &wakeups, sizeof(wakeups));
+        CollectResults();
+      }
+      else
+      {
+        // The connection may have been closed while handling an earlier event.
+        const auto iter = connections_.find(token);
+        if (iter == connections_.end())
+        {
+          continue;
+        }
+        if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0)
+        {
+          Read(token, iter->second);
+        }
+        else
+        {
+          Advance(token, iter->second);
+        }
+      }
+    }
+  }
+}
+
+void Server::Stop() noexcept
+{
+  stopping_.store(true);
+  Wake();
+}
+
+VerdictCacheStats Server::CacheStats() const
+{
+  VerdictCacheStats total;
+  for (const auto& cache : caches_)
+  {
+    const auto stats = cache->Stats();
+    total.hits += stats.hits;
+    total.misses += stats.misses;
+    total.evictions += stats.evictions;
+    total.invalidations += stats.invalidations;
+    total.bypassed += stats.bypassed;
+  }
+  return total;
+}
+
+void Server::Wake() noexcept
+{
+  const std::uint64_t one = 1;
+  [[maybe_unused]] const auto size = write(wake_fd_, &one, sizeof(one));
+}
+
+void Server::Work()
+{
+  std::vector<std::string_view> records;
+  std::vector<Dfa::Acceptance> verdicts;
+  for (;;)
+  {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(jobs_mutex_);
+      jobs_condition_.wait(lock, [this] { return workers_stopping_ || !jobs_.empty(); });
+      if (workers_stopping_)
+      {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+
+    BatchStatus status = BATCH_OK;
+    std::uint32_t automaton;
+    verdicts.clear();
+    if (!ParseRequest(job.payload, automaton, records))
+    {
+      status = MALFORMED_BATCH;
+    }
+    else if (automaton >= automata_.size())
+    {
+      status = UNKNOWN_AUTOMATON;
+    }
+    else
+    {
+      const std::uint64_t generation = automata_[automaton]->Generation();
+      const Snapshot snapshot = automata_[automaton]->Load();
+      VerdictCache* cache = caches_.empty() ? nullptr : caches_[automaton].get();
+      if (cache != nullptr)
+      {
+        verdicts.reserve(records.size());
+        for (const auto record : records)
+        {
+          verdicts.push_back(cache->Match(*snapshot, generation, record));
+        }
+      }
+      else
+      {
+        snapshot->AcceptsBatch(records, verdicts);
+      }
+    }
+
+    Result result{job.connection, {}};
+    AppendResponse(status, verdicts, result.frame);
+    {
+      std::lock_guard<std::mutex> lock(results_mutex_);
+      results_.push_back(std::move(result));
+    }
+    Wake();
+  }
+}
+
+void Server::Accept()
+{
+  for (;;)
+  {
+    const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      if (errno == EMFILE || errno == ENFILE)
+      {
+        RejectPending();
+        if (!accepting_)
+        {
+          return;
+        }
+        continue;
+      }
+      // A connection that was reset before it was accepted, or nothing left to accept.
+      return;
+    }
+
+    const std::uint64_t id = next_connection_++;
+    try
+    {
+      AddToEpoll(epoll_fd_, fd, EPOLLIN | EPOLLRDHUP, id);
+    }
+    catch (const std::system_error&)
+    {
+      close(fd);
+      continue;
+    }
+    auto& connection = connections_[id];
+    connection.fd = fd;
+    connection.events = EPOLLIN | EPOLLRDHUP;
+  }
+}
+
+void Server::RejectPending()
+{
+  // The listening socket stays readable while a connection is pending, so it has to be accepted to be dropped.
+  if (spare_fd_ >= 0)
+  {
+    close(spare_fd_);
+    const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    spare_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (spare_fd_ >= 0)
+    {
+      return;
+    }
+  }
+  SetAccepting(false);
+}
+
+void Server::SetAccepting(bool accepting)
+{
+  epoll_event event{};
+  event.events = accepting ? static_cast<std::uint32_t>(EPOLLIN) : 0U;
+  event.data.u64 = kListenToken;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, listen_fd_, &event) == 0)
+  {
+    accepting_ = accepting;
+  }
+}
+
+void Server::Read(std::uint64_t id, Connection& connection)
+{
+  connection.input.erase(0, connection.input_offset);
+  connection.input_offset = 0;
+
+  while (!connection.eof && connection.input.size() < kMaxBufferedInput)
+  {
+    const std::size_t size = connection.input.size();
+    connection.input.resize(size + kReadSize);
+    const ssize_t received = recv(connection.fd, &connection.input[size], kReadSize, 0);
+    connection.input.resize(size + static_cast<std::size_t>(std::max<ssize_t>(received, 0)));
+
+    if (received == 0)
+    {
+      connection.eof = true;
+    }
+    else if (received < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        break;
+      }
+      Close(id);
+      return;
+    }
+  }
+
+  Advance(id, connection);
+}
+
+void Server::CollectResults()
+{
+  std::vector<Result> results;
+  {
+    std::lock_guard<std::mutex> lock(results_mutex_);
+    results.swap(results_);
+  }
+
+  for (auto& result : results)
+  {
+    // Results of connections that were closed meanwhile are dropped.
+    const auto iter = connections_.find(result.connection);
+    if (iter == connections_.end())
+    {
+      continue;
+    }
+    auto& connection = iter->second;
+    connection.busy = false;
+    if (connection.output.empty())
+    {
+      connection.output = std::move(result.frame);
+    }
+    else
+    {
+      connection.output += result.frame;
+    }
+    Advance(iter->first, connection);
+  }
+}
+
+void Server::Advance(std::uint64_t id, Connection& connection)
+{
+  const std::size_t buffered = connection.input.size() - connection.input_offset;
+  if (!connection.busy && buffered >= kFrameHeaderSize)
+  {
+    const std::uint32_t size = FrameSize(connection.input.data() + connection.input_offset);
+    if (size > kMaxFrameSize)
+    {
+      Close(id);
+      return;
+    }
+    if (buffered >= kFrameHeaderSize + size)
+    {
+      Job job{id, connection.input.substr(connection.input_offset + kFrameHeaderSize, size)};
+      connection.input_offset += kFrameHeaderSize + size;
+      connection.busy = true;
+      {
+        std::lock_guard<std::mutex> lock(jobs_mutex_);
+        jobs_.push_back(std::move(job));
+      }
+      jobs_condition_.notify_one();
+    }
+  }
+
+  while (connection.output_offset < connection.output.size())
+  {
+    const ssize_t sent = send(connection.fd, connection.output.data() + connection.output_offset,
+                              connection.output.size() - connection.output_offset, MSG_NOSIGNAL);
+    if (sent >= 0)
+    {
+      connection.output_offset += static_cast<std::size_t>(sent);
+    }
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+      break;
+    }
+    else if (errno != EINTR)
+    {
+      Close(id);
+      return;
+    }
+  }
+  if (connection.output_offset == connection.output.size())
+  {
+    connection.output.clear();
+    connection.output_offset = 0;
+  }
+
+  // Once the peer is done sending, whatever is left over after its last complete request is a truncated frame.
+  if (connection.eof && !connection.busy && connection.output.empty())
+  {
+    Close(id);
+    return;
+  }
+
+  UpdateEvents(id, connection);
+}
+
+void Server::UpdateEvents(std::uint64_t id, Connection& connection)
+{
+  std::uint32_t events = 0;
+  if (!connection.eof && connection.input.size() - connection.input_offset < kMaxBufferedInput)
+  {
+    events |= EPOLLIN | EPOLLRDHUP;
+  }
+  if (!connection.output.empty())
+  {
+    events |= EPOLLOUT;
+  }
+  if (events == connection.events)
+  {
+    return;
+  }
+
+  // epoll reports hangups and errors even without events, which would wake the loop for nothing until the batch of a
+  // busy connection is done, so connections that wait for nothing are taken out.
+  epoll_event event{};
+  event.events = events;
+  event.data.u64 = id;
+  const int operation = connection.events == 0 ? EPOLL_CTL_ADD : events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+  if (epoll_ctl(epoll_fd_, operation, connection.fd, &event) != 0)
+  {
+    Close(id);
+    return;
+  }
+  connection.events = events;
+}
+
+void Server::Close(std::uint64_t id)
+{
+  const auto iter = connections_.find(id);
+  close(iter->second.fd);
+  connections_.erase(iter);
+
+  if (spare_fd_ < 0)
+  {
+    spare_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  }
+  if (!accepting_)
+  {
+    SetAccepting(true);
+  }
+}
+
+void Server::CloseDescriptors() noexcept
+{
+  for (int* fd : {&listen_fd_, &epoll_fd_, &wake_fd_, &spare_fd_})
+  {
+    if (*fd >= 0)
+    {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+}  // namespace dfa
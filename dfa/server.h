@@ -0,0 +1,217 @@
+/**
+ * @file server.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "dfa/protocol.h"
+#include "dfa/snapshot.h"
+#include "dfa/verdict_cache.h"
+
+namespace dfa
+{
+/**
+ * Serves batches of records over a Unix domain socket, so that many processes can share automata that were loaded
+ * and determinized once.
+ *
+ * One thread runs an epoll loop that accepts connections and reads and writes frames; a pool of workers matches the
+ * batches. Connections are served concurrently, and each connection's responses come back in the order its requests
+ * were sent. Every batch is matched against the Snapshot that was current when it started, so hot reloads apply
+ * between batches.
+ *
+ * @see protocol.h for the wire format
+ */
+class Server
+{
+ public:
+  /**
+   * Binds and listens on socket_path, replacing a stale socket file if there is one, and starts the workers.
+   * @param socket_path where to listen
+   * @param automata what requests may match against, by index; must outlive the Server
+   * @param workers number of worker threads; 0 uses all hardware threads
+   * @param cache_capacity if not zero, the verdicts of up to this many distinct records are cached per automaton
+   * @throws std::system_error if the socket can't be set up
+   */
+  Server(std::filesystem::path socket_path, std::vector<const AtomicSnapshot*> automata, unsigned workers = 0,
+         std::size_t cache_capacity = 0);
+
+  /**
+   * Stops the workers, closes all connections and removes the socket file.
+   */
+  ~Server();
+
+  Server(const Server&) = delete;
+  Server& operator=(const Server&) = delete;
+
+  /**
+   * Serves until Stop is called.
+   */
+  void Run();
+
+  /**
+   * Makes Run return. Thread-safe and async-signal-safe.
+   */
+  void Stop() noexcept;
+
+  /**
+   * Counters of the verdict caches of all automata; all zero if there are none.
+   */
+  VerdictCacheStats CacheStats() const;
+
+ private:
+  struct Connection
+  {
+    int fd;
+
+    /**
+     * Received bytes that weren't dispatched yet, starting at input_offset.
+     */
+    std::string input;
+
+    std::size_t input_offset = 0;
+
+    /**
+     * Responses that weren't written yet, starting at output_offset.
+     */
+    std::string output;
+
+    std::size_t output_offset = 0;
+
+    /**
+     * Whether a batch of this connection is with the workers. Only one is at a time, which keeps responses in order.
+     */
+    bool busy = false;
+
+    /**
+     * Whether the peer finished sending.
+     */
+    bool eof = false;
+
+    /**
+     * The epoll events this connection is registered for; 0 if it isn't registered.
+     */
+    std::uint32_t events = 0;
+  };
+
+  struct Job
+  {
+    std::uint64_t connection;
+    std::string payload;
+  };
+
+  struct Result
+  {
+    std::uint64_t connection;
+    std::string frame;
+  };
+
+  void Work();
+
+  void Accept();
+
+  /**
+   * Drops a pending connection when there is no descriptor to accept it with, by freeing the spare one for it. Stops
+   * accepting until a connection closes if that isn't possible.
+   */
+  void RejectPending();
+
+  /**
+   * Registers the listening socket for reading or not.
+   */
+  void SetAccepting(bool accepting);
+
+  void Read(std::uint64_t id, Connection& connection);
+
+  void CollectResults();
+
+  /**
+   * Dispatches the next complete request, writes what can be written, and closes the connection once it's finished.
+   */
+  void Advance(std::uint64_t id, Connection& connection);
+
+  /**
+   * Registers for reading while there is room to buffer input, and for writing while output is pending. A connection
+   * that waits for neither is removed from epoll until it does.
+   */
+  void UpdateEvents(std::uint64_t id, Connection& connection);
+
+  void Close(std::uint64_t id);
+
+  /**
+   * Wakes the epoll loop.
+   */
+  void Wake() noexcept;
+
+  /**
+   * Closes the sockets, epoll, eventfd and spare descriptors that are open.
+   */
+  void CloseDescriptors() noexcept;
+
+  std::filesystem::path socket_path_;
+
+  std::vector<const AtomicSnapshot*> automata_;
+
+  /**
+   * Verdict cache of each automaton, or empty if caching is off.
+   */
+  std::vector<std::unique_ptr<VerdictCache>> caches_;
+
+  int listen_fd_ = -1;
+
+  int epoll_fd_ = -1;
+
+  /**
+   * An eventfd that workers and Stop write to, to wake the epoll loop.
+   */
+  int wake_fd_ = -1;
+
+  /**
+   * A descriptor that is kept open to be closed when accept runs out of descriptors, so the pending connection can be
+   * accepted and closed instead of keeping the listening socket readable. -1 if it couldn't be reopened.
+   */
+  int spare_fd_ = -1;
+
+  /**
+   * Whether the listening socket is registered for reading.
+   */
+  bool accepting_ = true;
+
+  std::atomic<bool> stopping_{false};
+
+  std::unordered_map<std::uint64_t, Connection> connections_;
+
+  /**
+   * Connection IDs are never reused, so late Results of closed connections can be recognized and dropped.
+   */
+  std::uint64_t next_connection_ = 0;
+
+  std::mutex jobs_mutex_;
+
+  std::condition_variable jobs_condition_;
+
+  std::deque<Job> jobs_;
+
+  bool workers_stopping_ = false;
+
+  std::mutex results_mutex_;
+
+  std::vector<Result> results_;
+
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace dfa
@@ -0,0 +1,166 @@
+/**
+ * @file snapshot.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "snapshot.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+namespace dfa
+{
+namespace fs = std::filesystem;
+
+Snapshot LoadSnapshot(const fs::path& path, const Options& options)
+{
+  if (!fs::exists(path))
+  {
+    throw std::runtime_error("Specified DFA file path doesn't exist.");
+  }
+
+  const bool is_dfa_file = path.extension() == ".dfa";
+  const bool is_json_file = path.extension() == ".json";
+  const bool is_compiled_file = path.extension() == ".dfac";
+  if (!is_dfa_file && !is_json_file && !is_compiled_file)
+  {
+    throw std::runtime_error("Only .dfa, .json and .dfac files are valid.");
+  }
+
+  if (is_compiled_file)
+  {
+    std::ifstream fstream(path, std::ios::binary);
+    if (!fstream)
+    {
+      throw std::runtime_error("Failed to read file: " + path.string());
+    }
+    try
+    {
+      return std::make_shared<const Dfa>(Dfa::Load(fstream, options));
+    }
+    catch (const std::exception& e)
+    {
+      throw std::runtime_error(std::string("Failed to load compiled file: ") + e.what());
+    }
+  }
+
+  std::string input;
+  try
+  {
+    std::ifstream fstream(path);
+    fstream.exceptions(std::ifstream::badbit);
+    std::stringstream sstr;
+    sstr << fstream.rdbuf();
+
+    input = sstr.str();
+  }
+  catch (const std::exception& e)
+  {
+    throw std::runtime_error(std::string("Failed to read file: ") + e.what());
+  }
+
+  if (input.empty())
+  {
+    throw std::runtime_error("Input file empty.");
+  }
+
+  Dfa::Json j_input;
+  if (is_json_file)
+  {
+    try
+    {
+      j_input = Dfa::Json::parse(input);
+    }
+    catch (const std::exception& e)
+    {
+      throw std::runtime_error(std::string("Failed to parse JSON: ") + e.what());
+    }
+  }
+
+  try
+  {
+    return is_json_file ? std::make_shared<const Dfa>(j_input, options) : std::make_shared<const Dfa>(input, options);
+  }
+  catch (const std::exception& e)
+  {
+    throw std::runtime_error(std::string("Failed to parse input file: ") + e.what());
+  }
+}
+
+std::atomic<std::uint64_t> SnapshotReloader::all_reloads_requested_{0};
+
+SnapshotReloader::SnapshotReloader(fs::path path, Options options, AtomicSnapshot& target,
+                                   fs::file_time_type loaded_time, ErrorHandler on_error,
+                                   std::chrono::milliseconds poll_interval)
+    : path_(std::move(path)),
+      options_(options),
+      target_(target),
+      on_error_(std::move(on_error)),
+      poll_interval_(poll_interval),
+      loaded_time_(loaded_time),
+      seen_requests_(all_reloads_requested_.load(std::memory_order_relaxed)),
+      thread_(&SnapshotReloader::Run, this)
+{
+}
+
+SnapshotReloader::~SnapshotReloader()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_condition_.notify_all();
+  thread_.join();
+}
+
+fs::file_time_type SnapshotReloader::ModificationTime(const fs::path& path) noexcept
+{
+  std::error_code error;
+  const auto time = fs::last_write_time(path, error);
+  return error ? fs::file_time_type::min() : time;
+}
+
+void SnapshotReloader::Run()
+{
+  // A changed file is only reloaded once its modification time stayed the same for a whole poll interval, so that a
+  // file that is still being written isn't picked up halfway.
+  auto seen_time = loaded_time_;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_condition_.wait_for(lock, poll_interval_, [this] { return stop_; }))
+  {
+    lock.unlock();
+
+    const auto time = ModificationTime(path_);
+    const bool changed = time != loaded_time_ && time == seen_time;
+    seen_time = time;
+
+    const auto requests = all_reloads_requested_.load(std::memory_order_relaxed);
+    const bool requested = reload_requested_.exchange(false, std::memory_order_relaxed) || requests != seen_requests_;
+    seen_requests_ = requests;
+
+    if (requested || changed)
+    {
+      loaded_time_ = time;
+      try
+      {
+        target_.Store(LoadSnapshot(path_, options_));
+      }
+      catch (const std::exception& e)
+      {
+        if (on_error_)
+        {
+          on_error_(e.what());
+        }
+      }
+    }
+
+    lock.lock();
+  }
+}
+
+}  // namespace dfa
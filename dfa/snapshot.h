@@ -0,0 +1,152 @@
+/**
+ * @file snapshot.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "dfa/dfa.h"
+
+namespace dfa
+{
+/**
+ * An immutable, fully constructed Dfa. All of its member functions are const, so it may be matched against from any
+ * number of threads, and it stays alive for as long as any of them holds it.
+ */
+using Snapshot = std::shared_ptr<const Dfa>;
+
+/**
+ * Reads a .dfa or .json file and constructs a Dfa from it, or loads a compiled .dfac file that Dfa::Save wrote.
+ * @param path path of the file; its extension selects the format
+ * @param options construction settings
+ * @throws std::runtime_error if the file can't be read or doesn't contain a valid DFA
+ */
+Snapshot LoadSnapshot(const std::filesystem::path& path, const Options& options = Options());
+
+/**
+ * Publishes the current Snapshot to many reader threads, and lets one writer replace it atomically.
+ *
+ * Readers that already loaded a Snapshot keep using it until they load again, so a replacement never affects a match
+ * that is in progress.
+ */
+class AtomicSnapshot
+{
+ public:
+  explicit AtomicSnapshot(Snapshot snapshot) : snapshot_(std::move(snapshot)) {}
+
+  inline Snapshot Load() const { return std::atomic_load_explicit(&snapshot_, std::memory_order_acquire); }
+
+  inline void Store(Snapshot snapshot)
+  {
+    std::atomic_store_explicit(&snapshot_, std::move(snapshot), std::memory_order_release);
+    generation_.fetch_add(1, std::memory_order_release);
+  }
+
+  /**
+   * Incremented by every Store. Cheaper than Load, so readers can poll it and only Load when it changed.
+   */
+  inline std::uint64_t Generation() const { return generation_.load(std::memory_order_acquire); }
+
+ private:
+  Snapshot snapshot_;
+
+  std::atomic<std::uint64_t> generation_{0};
+};
+
+/**
+ * Rebuilds a Dfa in a background thread whenever its file changes or a reload is requested, and stores it into an
+ * AtomicSnapshot once it is complete. If a rebuild fails, the previous Snapshot stays in place.
+ */
+class SnapshotReloader
+{
+ public:
+  using ErrorHandler = std::function<void(const std::string&)>;
+
+  /**
+   * Starts watching.
+   * @param path the file that target was loaded from
+   * @param options construction settings
+   * @param target where rebuilt Snapshots are stored
+   * @param loaded_time ModificationTime of path, taken before target was loaded, so that a change made while it was
+   * loading is picked up
+   * @param on_error called from the background thread with a description of each failed rebuild
+   * @param poll_interval how often the file's modification time is checked
+   */
+  SnapshotReloader(std::filesystem::path path, Options options, AtomicSnapshot& target,
+                   std::filesystem::file_time_type loaded_time, ErrorHandler on_error,
+                   std::chrono::milliseconds poll_interval = std::chrono::milliseconds(250));
+
+  ~SnapshotReloader();
+
+  SnapshotReloader(const SnapshotReloader&) = delete;
+  SnapshotReloader& operator=(const SnapshotReloader&) = delete;
+
+  /**
+   * Asks the background thread to rebuild on its next poll, even if the file didn't change.
+   */
+  inline void RequestReload() noexcept { reload_requested_.store(true, std::memory_order_relaxed); }
+
+  /**
+   * Asks every SnapshotReloader, including ones constructed later, to rebuild on its next poll. Async-signal-safe: it
+   * only increments a lock-free counter that the background threads poll, so a signal handler may call it at any
+   * time, even while reloaders are being constructed or destroyed.
+   */
+  static inline void RequestAllReloads() noexcept { all_reloads_requested_.fetch_add(1, std::memory_order_relaxed); }
+
+  /**
+   * The modification time of a file, or file_time_type::min() if it can't be read.
+   */
+  static std::filesystem::file_time_type ModificationTime(const std::filesystem::path& path) noexcept;
+
+ private:
+  void Run();
+
+  static std::atomic<std::uint64_t> all_reloads_requested_;
+
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "RequestAllReloads has to be async-signal-safe");
+
+  std::filesystem::path path_;
+
+  Options options_;
+
+  AtomicSnapshot& target_;
+
+  ErrorHandler on_error_;
+
+  std::chrono::milliseconds poll_interval_;
+
+  /**
+   * Modification time of the file when the current Snapshot was loaded.
+   */
+  std::filesystem::file_time_type loaded_time_;
+
+  std::atomic<bool> reload_requested_{false};
+
+  /**
+   * Value of the RequestAllReloads counter that was last acted on. Requests made before construction were for
+   * Snapshots that were loaded after them, so they don't count.
+   */
+  std::uint64_t seen_requests_;
+
+  std::mutex mutex_;
+
+  std::condition_variable stop_condition_;
+
+  bool stop_ = false;
+
+  std::thread thread_;
+};
+
+}  // namespace dfa
@@ -0,0 +1,160 @@
+/**
+ * @file bench_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/bench.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+namespace fs = std::filesystem;
+
+TEST(LatencyHistogram, Empty)
+{
+  const dfa::LatencyHistogram histogram;
+  EXPECT_EQ(histogram.Count(), 0);
+  EXPECT_EQ(histogram.Percentile(0.5), 0);
+}
+
+TEST(LatencyHistogram, ExactBelowTwiceSubBuckets)
+{
+  dfa::LatencyHistogram histogram;
+  for (std::uint64_t value = 1; value <= 100; ++value)
+  {
+    histogram.Record(value);
+  }
+  EXPECT_EQ(histogram.Count(), 100);
+  EXPECT_EQ(histogram.Max(), 100);
+  EXPECT_EQ(histogram.Percentile(0), 1);
+  EXPECT_EQ(histogram.Percentile(0.5), 50);
+  EXPECT_EQ(histogram.Percentile(0.99), 99);
+  EXPECT_EQ(histogram.Percentile(0.999), 100);
+  EXPECT_EQ(histogram.Percentile(1), 100);
+}
+
+TEST(LatencyHistogram, RelativeErrorAboveSubBuckets)
+{
+  std::mt19937_64 random(46);
+  std::vector<std::uint64_t> values(10000);
+  dfa::LatencyHistogram histogram;
+  for (auto& value : values)
+  {
+    value = random() >> (random() % 64);
+    histogram.Record(value);
+  }
+  std::sort(values.begin(), values.end());
+  EXPECT_EQ(histogram.Max(), values.back());
+  for (const double share : {0.01, 0.25, 0.5, 0.9, 0.99, 0.999})
+  {
+    const auto exact = values[static_cast<std::size_t>(share * values.size()) - 1];
+    const auto percentile = histogram.Percentile(share);
+    EXPECT_GE(percentile, exact) << share;
+    EXPECT_LE(percentile - exact, exact / dfa::LatencyHistogram::kSubBuckets) << share;
+  }
+}
+
+TEST(Corpus, FromDescriptor)
+{
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  const std::string data = "ab\n\nabc\r\nlast";
+  ASSERT_EQ(write(fds[1], data.data(), data.size()), static_cast<ssize_t>(data.size()));
+  close(fds[1]);
+  const dfa::Corpus corpus(fds[0]);
+  close(fds[0]);
+
+  // Unlike RecordReader, empty lines are records too, and carriage returns are kept.
+  const std::vector<std::string_view> expected = {"ab", "", "abc\r", "last"};
+  EXPECT_EQ(corpus.Records(), expected);
+  EXPECT_EQ(corpus.Bytes(), 10);
+}
+
+TEST(Corpus, FromFiles)
+{
+  const auto directory = fs::temp_directory_path() / ("bench_test_" + std::to_string(getpid()));
+  fs::create_directories(directory);
+  std::ofstream(directory / "first") << "a\nb";
+  std::ofstream(directory / "second") << "c\n";
+  std::ofstream(directory / "empty");
+
+  const dfa::Corpus corpus(std::vector<fs::path>{directory / "first", directory / "empty", directory / "second"});
+  const std::vector<std::string_view> expected = {"a", "b", "c"};
+  EXPECT_EQ(corpus.Records(), expected);
+  EXPECT_EQ(corpus.Bytes(), 3);
+
+  EXPECT_THROW(dfa::Corpus(std::vector<fs::path>{directory / "missing"}), std::runtime_error);
+  fs::remove_all(directory);
+}
+
+/**
+ * Benchmarks random records, and checks that verdicts are counted like AcceptsString gives them.
+ */
+void ExpectBenchCounts(const dfa::Dfa& dfa, const dfa::BenchOptions& options)
+{
+  std::mt19937 random(46);
+  std::string data;
+  std::array<std::uint64_t, 4> expected{};
+  for (int record = 0; record < 1000; ++record)
+  {
+    std::string line;
+    for (auto length = random() % 12; length > 0; --length)
+    {
+      line += "abcd"[random() % 4];
+    }
+    ++expected[dfa.AcceptsString(line)];
+    data += line + '\n';
+  }
+
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  ASSERT_EQ(write(fds[1], data.data(), data.size()), static_cast<ssize_t>(data.size()));
+  close(fds[1]);
+  const dfa::Corpus corpus(fds[0]);
+  close(fds[0]);
+
+  const auto result = dfa::Bench(dfa, corpus, options);
+  EXPECT_EQ(result.records, 1000);
+  EXPECT_EQ(result.bytes, data.size() - 1000);
+  EXPECT_EQ(result.runs, options.runs);
+  EXPECT_EQ(result.verdicts, expected);
+  EXPECT_EQ(result.latencies.Count(), 1000 * options.runs);
+  EXPECT_GT(result.elapsed.count(), 0);
+  EXPECT_LE(result.fastest * options.runs, result.elapsed);
+  EXPECT_GT(result.RecordsPerSecond(), 0);
+}
+
+TEST(Bench, CountsVerdicts)
+{
+  const auto dfa = dfa::Dfa::FromRegex("(ab|b)*c?");
+  ExpectBenchCounts(dfa, dfa::BenchOptions());
+}
+
+TEST(Bench, CountsBatchVerdicts)
+{
+  const auto dfa = dfa::Dfa::FromRegex("(ab|b)*c?");
+  dfa::BenchOptions options;
+  options.runs = 2;
+  options.batch_size = 64;
+  ExpectBenchCounts(dfa, options);
+}
+
+TEST(Bench, BuildTimes)
+{
+  const auto dfa = dfa::Dfa::FromRegex("[ab]*a[ab]{8}");
+  EXPECT_GT(dfa.GetBuildTimes().parse.count(), 0);
+  EXPECT_GT(dfa.GetBuildTimes().determinize.count(), 0);
+  EXPECT_GT(dfa.GetBuildTimes().compile.count(), 0);
+}
+}  // namespace
@@ -0,0 +1,210 @@
+/**
+ * @file bit_parallel_nfa_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/bit_parallel_nfa.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dfa/dfa.h"
+#include "dfa/test/test_util.h"
+
+namespace
+{
+/**
+ * Writes a random NFA file with a few epsilon transitions, over the alphabet a, b, c.
+ */
+std::string RandomNfaFile(unsigned seed, std::size_t num_states)
+{
+  std::mt19937 random(seed);
+  std::uniform_int_distribution<std::size_t> state(0, num_states - 1);
+  std::uniform_int_distribution<int> symbol(0, 2);
+
+  std::string contents = "states:";
+  for (std::size_t i = 0; i < num_states; ++i)
+  {
+    contents += " q" + std::to_string(i);
+  }
+  // The start state is nondeterministic, so that the DFA has more than one state.
+  contents += "\nalphabet: a b c\nstartstate: q0\ntransition: q0 a q1\ntransition: q0 a q2\n";
+  for (std::size_t i = 0; i < num_states / 3 + 1; ++i)
+  {
+    contents += "finalstate: q" + std::to_string(state(random)) + "\n";
+  }
+  for (std::size_t i = 0; i < num_states * 3; ++i)
+  {
+    contents += "transition: q" + std::to_string(state(random)) + " " + static_cast<char>('a' + symbol(random)) + " q" +
+                std::to_string(state(random)) + "\n";
+  }
+  for (std::size_t i = 0; i < num_states / 4; ++i)
+  {
+    contents += "transition: q" + std::to_string(state(random)) + " epsilon q" + std::to_string(state(random)) + "\n";
+  }
+  return contents;
+}
+
+/**
+ * Options that make any NFA with more than one DFA state, and few enough positions, be simulated.
+ */
+dfa::Options SimulateOptions()
+{
+  dfa::Options options;
+  options.max_dfa_states = 1;
+  return options;
+}
+}  // namespace
+
+TEST(BitParallelNfa, MatchesDeterminizedNfa)
+{
+  const auto inputs = dfa::test::AllStrings("abcd", 6);
+  for (unsigned seed = 0; seed < 20; ++seed)
+  {
+    const auto contents = RandomNfaFile(seed, 12);
+    const dfa::Dfa determinized(contents);
+    const dfa::Dfa simulated(contents, SimulateOptions());
+    ASSERT_FALSE(determinized.IsSimulated());
+    ASSERT_TRUE(simulated.IsSimulated()) << contents;
+
+    EXPECT_EQ(simulated.AcceptsString("epsilon"), determinized.AcceptsString("epsilon")) << contents;
+    for (const auto& input : inputs)
+    {
+      EXPECT_EQ(simulated.AcceptsString(input), determinized.AcceptsString(input)) << contents << input;
+    }
+  }
+}
+
+TEST(BitParallelNfa, SimulatesExplodingRegex)
+{
+  // The DFA needs a state per possible suffix of n symbols, but the NFA has about n positions. Lengths of 60, 100
+  // and 200 use one, two and four words.
+  for (const std::size_t n : {60U, 100U, 200U})
+  {
+    dfa::Options options;
+    options.max_dfa_states = 1000;
+    const auto dfa = dfa::Dfa::FromRegex("[ab]*a[ab]{" + std::to_string(n) + "}", options);
+    ASSERT_TRUE(dfa.IsSimulated());
+
+    std::string input(3 * n, 'b');
+    EXPECT_EQ(dfa.AcceptsString(input), dfa::Dfa::REJECTS);
+    input[2 * n - 1] = 'a';
+    EXPECT_EQ(dfa.AcceptsString(input), dfa::Dfa::ACCEPTS);
+    input += 'a';
+    EXPECT_EQ(dfa.AcceptsString(input), dfa::Dfa::REJECTS);
+    input += 'c';
+    EXPECT_EQ(dfa.AcceptsString(input), dfa::Dfa::INVALID_ALPHABET);
+  }
+}
+
+TEST(BitParallelNfa, Ranges)
+{
+  const std::string contents =
+      "states: q0 q1 q2\n"
+      "alphabet: a-z\n"
+      "startstate: q0\n"
+      "finalstate: q2\n"
+      "transition: q0 a-z q0\n"
+      "transition: q0 m-p q1\n"
+      "transition: q1 a-f q2";
+  const dfa::Dfa determinized(contents);
+  const dfa::Dfa simulated(contents, SimulateOptions());
+  ASSERT_TRUE(simulated.IsSimulated());
+  for (const auto& input : dfa::test::AllStrings("afgmnqz", 4))
+  {
+    EXPECT_EQ(simulated.AcceptsString(input), determinized.AcceptsString(input)) << input;
+  }
+  EXPECT_EQ(simulated.AcceptsString("A"), dfa::Dfa::INVALID_ALPHABET);
+}
+
+TEST(BitParallelNfa, NoTransition)
+{
+  const auto dfa = dfa::Dfa::FromRegex("(ab|ac)*", SimulateOptions());
+  ASSERT_TRUE(dfa.IsSimulated());
+  EXPECT_EQ(dfa.AcceptsString(""), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("abac"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("aba"), dfa::Dfa::REJECTS);
+  EXPECT_EQ(dfa.AcceptsString("abb"), dfa::Dfa::NO_TRANSITION);
+}
+
+TEST(BitParallelNfa, LargeNfasAreDeterminized)
+{
+  // Every state enters another one on its own byte, so there are more positions than can be simulated.
+  std::string pattern;
+  for (int i = 0; i < 300; ++i)
+  {
+    pattern += "[ab]";
+  }
+  const auto dfa = dfa::Dfa::FromRegex(pattern, SimulateOptions());
+  EXPECT_FALSE(dfa.IsSimulated());
+  EXPECT_EQ(dfa.AcceptsString(std::string(300, 'a')), dfa::Dfa::ACCEPTS);
+}
+
+TEST(BitParallelNfa, SimulatesWhenAsked)
+{
+  // Even an NFA whose DFA is tiny is simulated, and one with too many positions is still converted.
+  dfa::Options options;
+  options.simulate = true;
+  const auto small = dfa::Dfa::FromRegex("a*b", options);
+  ASSERT_TRUE(small.IsSimulated());
+  EXPECT_EQ(small.AcceptsString("aab"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(small.AcceptsString("aba"), dfa::Dfa::NO_TRANSITION);
+
+  std::string pattern;
+  for (int i = 0; i < 300; ++i)
+  {
+    pattern += "[ab]";
+  }
+  options.max_states = 400;
+  const auto large = dfa::Dfa::FromRegex(pattern, options);
+  EXPECT_FALSE(large.IsSimulated());
+  EXPECT_EQ(large.AcceptsString(std::string(300, 'a')), dfa::Dfa::ACCEPTS);
+}
+
+TEST(BitParallelNfa, MultiByteSymbolsAreDeterminized)
+{
+  // Simulation reads single bytes, so scalar values and tokens would be taken for bytes outside the Alphabet.
+  const std::string scalars =
+      "states: q0 q1 q2\n"
+      "alphabet: a \xC3\xA9\n"
+      "startstate: q0\n"
+      "finalstate: q1\n"
+      "transition: q0 \xC3\xA9 q1\n"
+      "transition: q0 a q0\n"
+      "transition: q0 a q2";
+  const std::string tokens =
+      "states: q0 q1 q2\n"
+      "alphabet: a GET\n"
+      "startstate: q0\n"
+      "finalstate: q1\n"
+      "transition: q0 GET q1\n"
+      "transition: q0 a q0\n"
+      "transition: q0 a q2";
+  auto options = SimulateOptions();
+  for (const bool simulate : {false, true})
+  {
+    options.simulate = simulate;
+    const dfa::Dfa utf8(scalars, options);
+    EXPECT_FALSE(utf8.IsSimulated()) << simulate;
+    EXPECT_EQ(utf8.AcceptsString("a\xC3\xA9"), dfa::Dfa::ACCEPTS) << simulate;
+    EXPECT_EQ(utf8.AcceptsString("\xC3"), dfa::Dfa::INVALID_ALPHABET) << simulate;
+
+    const dfa::Dfa tokenized(tokens, options);
+    EXPECT_FALSE(tokenized.IsSimulated()) << simulate;
+    EXPECT_EQ(tokenized.AcceptsString("aGET"), dfa::Dfa::ACCEPTS) << simulate;
+    EXPECT_EQ(tokenized.AcceptsString("aGE"), dfa::Dfa::INVALID_ALPHABET) << simulate;
+  }
+}
+
+TEST(BitParallelNfa, CantBeCompared)
+{
+  const auto simulated = dfa::Dfa::FromRegex("a*b", SimulateOptions());
+  const auto determinized = dfa::Dfa::FromRegex("a*b");
+  EXPECT_THROW(simulated.Equivalent(determinized), std::logic_error);
+  EXPECT_THROW(determinized.Includes(simulated), std::logic_error);
+}
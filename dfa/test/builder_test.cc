@@ -0,0 +1,203 @@
+/**
+ * @file builder_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/builder.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace
+{
+/**
+ * Accepts inputs over a and b whose 8th symbol from the end is an a, so its DFA has 2^8 states.
+ */
+std::string NthFromEnd()
+{
+  std::string definition =
+      "states: q0 q1 q2 q3 q4 q5 q6 q7 q8\n"
+      "alphabet: a b\n"
+      "startstate: q0\n"
+      "finalstate: q8\n"
+      "transition: q0 a q0\n"
+      "transition: q0 b q0\n"
+      "transition: q0 a q1";
+  for (int i = 1; i < 8; ++i)
+  {
+    const auto from = "q" + std::to_string(i);
+    const auto to = "q" + std::to_string(i + 1);
+    definition += "\ntransition: " + from + " a " + to + "\ntransition: " + from + " b " + to;
+  }
+  return definition;
+}
+
+TEST(DfaBuilder, MatchesFullConstruction)
+{
+  dfa::DfaBuilder builder(NthFromEnd());
+  const auto built = builder.Build();
+  const dfa::Dfa expected(NthFromEnd());
+  EXPECT_EQ(built.GetStates().size(), expected.GetStates().size());
+  EXPECT_TRUE(built.Equivalent(expected));
+  EXPECT_EQ(builder.ExpandedStates(), built.GetStates().size());
+
+  EXPECT_EQ(built.AcceptsString("abbbbbbb"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(built.AcceptsString("abbbbbbbb"), dfa::Dfa::REJECTS);
+  EXPECT_EQ(built.AcceptsString("c"), dfa::Dfa::INVALID_ALPHABET);
+}
+
+TEST(DfaBuilder, RebuildsOnlyWhatChanged)
+{
+  dfa::DfaBuilder builder(NthFromEnd());
+  const auto size = builder.Build().GetStates().size();
+
+  // q8 is part of half of the subsets, the ones whose 8th symbol from the end is an a.
+  builder.AddTransition("q8", "c", "q9");
+  builder.AddFinalState("q9");
+  auto dfa = builder.Build();
+  EXPECT_LE(builder.ExpandedStates(), size / 2 + 1);
+  EXPECT_EQ(dfa.AcceptsString("abbbbbbbc"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("bbbbbbbbc"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_TRUE(dfa.Equivalent(dfa::Dfa(NthFromEnd() + "\nalphabet: c\ntransition: q8 c q9\nfinalstate: q9")));
+
+  EXPECT_TRUE(builder.RemoveTransition("q8", "c", "q9"));
+  EXPECT_FALSE(builder.RemoveTransition("q8", "c", "q9"));
+  EXPECT_FALSE(builder.RemoveTransition("q8", "d", "q9"));
+  EXPECT_FALSE(builder.RemoveTransition("q8", "c", "q10"));
+  dfa = builder.Build();
+  EXPECT_EQ(dfa.GetStates().size(), size);
+  EXPECT_EQ(dfa.AcceptsString("abbbbbbbc"), dfa::Dfa::NO_TRANSITION);
+
+  builder.AddFinalState("q7");
+  dfa = builder.Build();
+  EXPECT_EQ(builder.ExpandedStates(), 0);
+  EXPECT_EQ(dfa.AcceptsString("abbbbbb"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(builder.Build().GetStates().size(), size);
+  EXPECT_EQ(builder.ExpandedStates(), 0);
+}
+
+TEST(DfaBuilder, Ranges)
+{
+  const std::string definition =
+      "states: q0 q1\n"
+      "alphabet: a-z\n"
+      "startstate: q0\n"
+      "finalstate: q1\n"
+      "transition: q0 a-z q0\n"
+      "transition: q0 m-p q1";
+  dfa::DfaBuilder builder(definition);
+  auto dfa = builder.Build();
+  EXPECT_TRUE(dfa.Equivalent(dfa::Dfa(definition)));
+  EXPECT_EQ(dfa.AcceptsString("zn"), dfa::Dfa::ACCEPTS);
+
+  EXPECT_TRUE(builder.RemoveTransition("q0", "n-o", "q1"));
+  EXPECT_FALSE(builder.RemoveTransition("q0", "n-o", "q1"));
+  dfa = builder.Build();
+  EXPECT_EQ(dfa.AcceptsString("zn"), dfa::Dfa::REJECTS);
+  EXPECT_EQ(dfa.AcceptsString("zp"), dfa::Dfa::ACCEPTS);
+}
+
+TEST(DfaBuilder, WideRanges)
+{
+  // Ranges stay pieces, so this doesn't add a transition per scalar value.
+  const std::string definition =
+      "states: q0 q1 q2\n"
+      "alphabet: \u0080-\U0010FFFF\n"
+      "startstate: q0\n"
+      "finalstate: q2\n"
+      "transition: q0 \u0080-\U0010FFFF q1\n"
+      "transition: q1 \u00E9 q2\n"
+      "transition: q1 \u4E00-\U0001F600 q2";
+  dfa::DfaBuilder builder(definition);
+  auto dfa = builder.Build();
+  EXPECT_TRUE(dfa.Equivalent(dfa::Dfa(definition)));
+  EXPECT_EQ(dfa.AcceptsString("\U0010FFFF\u00E9"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("\u00E9\U0001F600"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("\u00E9\u00EA"), dfa::Dfa::NO_TRANSITION);
+
+  // Both ends cut through pieces that already have transitions.
+  builder.AddTransition("q1", "\u00E0-\uFFFF", "q1");
+  EXPECT_TRUE(builder.RemoveTransition("q0", "\u0100-\U0010FFFF", "q1"));
+  EXPECT_FALSE(builder.RemoveTransition("q0", "\u0100-\u0200", "q1"));
+  dfa = builder.Build();
+  const std::string edited =
+      "states: q0 q1 q2\n"
+      "alphabet: \u0080-\U0010FFFF\n"
+      "startstate: q0\n"
+      "finalstate: q2\n"
+      "transition: q0 \u0080-\u00FF q1\n"
+      "transition: q1 \u00E9 q2\n"
+      "transition: q1 \u4E00-\U0001F600 q2\n"
+      "transition: q1 \u00E0-\uFFFF q1";
+  EXPECT_TRUE(dfa.Equivalent(dfa::Dfa(edited)));
+  EXPECT_EQ(dfa.AcceptsString("\u00FF\uD7FF\uE000\u00E9"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("\u0100\u00E9"), dfa::Dfa::NO_TRANSITION);
+}
+
+TEST(DfaBuilder, EpsilonTransitions)
+{
+  dfa::DfaBuilder builder;
+  builder.AddStartState("s");
+  builder.AddTransition("s", "a", "t");
+  builder.AddTransition("t", "b", "u");
+  builder.AddFinalState("u");
+  auto dfa = builder.Build();
+  EXPECT_EQ(dfa.AcceptsString("ab"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("b"), dfa::Dfa::NO_TRANSITION);
+
+  builder.AddTransition("s", "epsilon", "t");
+  dfa = builder.Build();
+  EXPECT_EQ(dfa.AcceptsString("b"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("ab"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.GetAlphabet(), dfa::Dfa::Alphabet({"a", "b"}));
+
+  EXPECT_TRUE(builder.RemoveTransition("s", "epsilon", "t"));
+  dfa = builder.Build();
+  EXPECT_EQ(dfa.AcceptsString("b"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_EQ(dfa.AcceptsString("ab"), dfa::Dfa::ACCEPTS);
+}
+}  // namespace
+
+TEST(DfaBuilder, BudgetStopsUpdate)
+{
+  dfa::Options options;
+  options.max_states = 256;
+  dfa::DfaBuilder builder(NthFromEnd(), options);
+  const auto size = builder.Build().GetStates().size();
+
+  // The subsets with q8 lead to a new state, {q9}, which is one more than the limit.
+  builder.AddTransition("q8", "c", "q9");
+  try
+  {
+    builder.Build();
+    FAIL() << "The update should exceed the budget";
+  }
+  catch (const dfa::BudgetExceededError& e)
+  {
+    EXPECT_EQ(e.Budget(), "256 states");
+    EXPECT_EQ(e.States(), 256);
+  }
+
+  // The failed update is dropped, so the next one starts over.
+  EXPECT_TRUE(builder.RemoveTransition("q8", "c", "q9"));
+  const auto dfa = builder.Build();
+  EXPECT_EQ(builder.ExpandedStates(), size);
+  EXPECT_TRUE(dfa.Equivalent(dfa::Dfa(NthFromEnd())));
+
+  options = dfa::Options();
+  options.max_bytes = 16 * 1024;
+  dfa::DfaBuilder small(NthFromEnd(), options);
+  try
+  {
+    small.Build();
+    FAIL() << "The update should exceed the budget";
+  }
+  catch (const dfa::BudgetExceededError& e)
+  {
+    EXPECT_EQ(e.Budget(), "16384 bytes");
+    EXPECT_GT(e.States(), 0);
+    EXPECT_LT(e.States(), size);
+  }
+}
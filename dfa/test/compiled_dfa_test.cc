@@ -0,0 +1,453 @@
+/**
+ * @file compiled_dfa_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/compiled_dfa.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dfa/dfa.h"
+
+namespace
+{
+/**
+ * Accepts strings over {a, b, _} that start with "a", followed by underscores, followed by a "b".
+ *
+ * q0 -a-> q1, q1 -_-> q1, q1 -b-> q2 (final, loops on everything), q0 -b-> q3 (dead, loops on everything).
+ */
+const std::string kSinks =
+    "states: q0 q1 q2 q3\n"
+    "alphabet: a b _\n"
+    "startstate: q0\n"
+    "finalstate: q2\n"
+    "transition: q0 a q1\n"
+    "transition: q0 b q3\n"
+    "transition: q1 _ q1\n"
+    "transition: q1 b q2\n"
+    "transition: q2 a q2\n"
+    "transition: q2 b q2\n"
+    "transition: q2 _ q2\n"
+    "transition: q3 a q3\n"
+    "transition: q3 b q3\n"
+    "transition: q3 _ q3\n";
+
+/**
+ * Walks the string-keyed transition maps of a DFA, the same way AcceptsString did before it was compiled.
+ */
+dfa::Dfa::Acceptance ReferenceAccepts(const dfa::Dfa& dfa, const std::string& input)
+{
+  dfa::State state = dfa.GetStartState();
+  for (const char c : input)
+  {
+    const dfa::Dfa::Symbol symbol(1, c);
+    if (dfa.GetAlphabet().find(symbol) == dfa.GetAlphabet().end())
+    {
+      return dfa::Dfa::INVALID_ALPHABET;
+    }
+
+    const auto transitions = dfa.GetTransitions().find(state);
+    if (transitions == dfa.GetTransitions().end())
+    {
+      return dfa::Dfa::NO_TRANSITION;
+    }
+
+    const auto transition = transitions->second.find(symbol);
+    if (transition == transitions->second.end())
+    {
+      return dfa::Dfa::NO_TRANSITION;
+    }
+    state = transition->second;
+  }
+  return dfa.GetFinalStates().find(state) != dfa.GetFinalStates().end() ? dfa::Dfa::ACCEPTS : dfa::Dfa::REJECTS;
+}
+
+/**
+ * Builds a random DFA with three states, over {a, b} or just {a}, with some transitions missing.
+ */
+std::string RandomDfa(std::mt19937& random)
+{
+  std::bernoulli_distribution coin(0.5);
+  std::uniform_int_distribution<int> state(0, 3);
+  const bool has_b = coin(random);
+
+  std::string contents = std::string("states: q0 q1 q2\nalphabet: a") + (has_b ? " b" : "") + "\nstartstate: q0\n";
+  for (int i = 0; i < 3; ++i)
+  {
+    if (coin(random))
+    {
+      contents += "finalstate: q" + std::to_string(i) + "\n";
+    }
+    for (const char* symbol : {"a", "b"})
+    {
+      // Target 3 stands for a missing transition.
+      const int target = state(random);
+      if ((has_b || symbol[0] == 'a') && target != 3)
+      {
+        contents += "transition: q" + std::to_string(i) + ' ' + symbol + " q" + std::to_string(target) + "\n";
+      }
+    }
+  }
+  return contents;
+}
+
+/**
+ * Finds a shortest string over {a, b} that satisfies a predicate, by trying all of them in order of length.
+ */
+template <typename Predicate>
+std::size_t ShortestLength(Predicate predicate, std::size_t max_length)
+{
+  std::vector<std::string> strings = {""};
+  for (std::size_t length = 0; length <= max_length; ++length)
+  {
+    std::vector<std::string> longer;
+    for (const auto& string : strings)
+    {
+      if (predicate(string))
+      {
+        return length;
+      }
+      longer.push_back(string + 'a');
+      longer.push_back(string + 'b');
+    }
+    strings.swap(longer);
+  }
+  return max_length + 1;
+}
+}  // namespace
+
+TEST(CompiledDfa, ByteClasses)
+{
+  std::vector<dfa::CompiledDfa::StateId> byte_table(256, dfa::CompiledDfa::kInvalidSymbol);
+  byte_table['0'] = 0;
+  byte_table['1'] = 0;
+  byte_table['2'] = dfa::CompiledDfa::kNoTransition;
+
+  dfa::CompiledDfa compiled(byte_table.data(), {true}, 0, {"q0"});
+  EXPECT_EQ(compiled.NumClasses(), 3);
+  EXPECT_EQ(compiled.ByteClass('0'), compiled.ByteClass('1'));
+  EXPECT_NE(compiled.ByteClass('0'), compiled.ByteClass('2'));
+  EXPECT_EQ(compiled.ByteClass('a'), compiled.ByteClass('z'));
+  EXPECT_EQ(compiled.Next(0, '1'), 0);
+  EXPECT_EQ(compiled.Next(0, '2'), dfa::CompiledDfa::kNoTransition);
+  EXPECT_EQ(compiled.Next(0, 'a'), dfa::CompiledDfa::kInvalidSymbol);
+}
+
+TEST(CompiledDfa, SinkAnalysis)
+{
+  // q0 -0-> q1 (dead), q0 -1-> q2 (absorbing), q0 -2-> q3 (final, but can leave to q0).
+  std::vector<dfa::CompiledDfa::StateId> byte_table(4 * 256, dfa::CompiledDfa::kInvalidSymbol);
+  const auto set = [&](std::size_t from, char byte, dfa::CompiledDfa::StateId to) {
+    byte_table[from * 256 + static_cast<unsigned char>(byte)] = to;
+  };
+  set(0, '0', 1), set(0, '1', 2), set(0, '2', 3);
+  set(1, '0', 1), set(1, '1', 1), set(1, '2', 1);
+  set(2, '0', 2), set(2, '1', 2), set(2, '2', 2);
+  set(3, '0', 0), set(3, '1', 3), set(3, '2', 3);
+
+  dfa::CompiledDfa compiled(byte_table.data(), {false, false, true, true}, 0, {"q0", "q1", "q2", "q3"});
+  EXPECT_EQ(compiled.Flags(0) & (dfa::CompiledDfa::DEAD | dfa::CompiledDfa::ABSORBING), 0);
+  EXPECT_NE(compiled.Flags(1) & dfa::CompiledDfa::DEAD, 0);
+  EXPECT_NE(compiled.Flags(2) & dfa::CompiledDfa::ABSORBING, 0);
+  EXPECT_EQ(compiled.Flags(3) & (dfa::CompiledDfa::DEAD | dfa::CompiledDfa::ABSORBING), 0);
+  EXPECT_NE(compiled.Flags(3) & dfa::CompiledDfa::SELF_LOOP, 0);
+}
+
+TEST(CompiledDfa, Renumbered)
+{
+  // q0 -0-> q1 (dead), q0 -1-> q2 (absorbing, final), q2 -0-> q2 loops.
+  std::vector<dfa::CompiledDfa::StateId> byte_table(3 * 256, dfa::CompiledDfa::kInvalidSymbol);
+  byte_table['0'] = 1, byte_table['1'] = 2;
+  byte_table[256 + '0'] = 1, byte_table[256 + '1'] = 1;
+  byte_table[512 + '0'] = 2, byte_table[512 + '1'] = 2;
+  const dfa::CompiledDfa compiled(byte_table.data(), {false, false, true}, 0, {"q0", "q1", "q2"});
+
+  const auto renumbered = compiled.Renumbered({2, 0, 1});
+  EXPECT_EQ(renumbered.Start(), 1);
+  EXPECT_EQ(renumbered.Next(1, '0'), 2);
+  EXPECT_EQ(renumbered.Next(1, '1'), 0);
+  EXPECT_EQ(renumbered.Next(0, '0'), 0);
+  EXPECT_EQ(renumbered.Next(0, 'x'), dfa::CompiledDfa::kInvalidSymbol);
+  EXPECT_EQ(renumbered.Name(0), "q2");
+  EXPECT_TRUE(renumbered.IsAccepting(0));
+  EXPECT_NE(renumbered.Flags(0) & dfa::CompiledDfa::ABSORBING, 0);
+  EXPECT_NE(renumbered.Flags(2) & dfa::CompiledDfa::DEAD, 0);
+  EXPECT_TRUE(renumbered.Equivalent(compiled));
+
+  EXPECT_THROW(compiled.Renumbered({0, 1}), std::invalid_argument);
+  EXPECT_THROW(compiled.Renumbered({0, 1, 1}), std::invalid_argument);
+}
+
+TEST(CompiledDfa, SaveAndLoad)
+{
+  const dfa::Dfa dfa(kSinks);
+  std::stringstream file;
+  dfa.Save(file);
+  const std::string contents = file.str();
+
+  std::istringstream in(contents);
+  const auto loaded = dfa::Dfa::Load(in);
+  EXPECT_EQ(loaded.GetAlphabet(), dfa.GetAlphabet());
+  EXPECT_TRUE(loaded.GetStates().empty());
+  EXPECT_TRUE(loaded.Equivalent(dfa));
+  for (const auto* input : {"a_b", "a__b_ab", "ab_", "a__", "b", "c", "a_c"})
+  {
+    EXPECT_EQ(loaded.AcceptsString(input), dfa.AcceptsString(input)) << input;
+  }
+
+  std::istringstream truncated(contents.substr(0, contents.size() - 1));
+  EXPECT_THROW(dfa::Dfa::Load(truncated), std::runtime_error);
+  std::istringstream not_compiled(kSinks);
+  EXPECT_THROW(dfa::Dfa::Load(not_compiled), std::runtime_error);
+}
+
+TEST(CompiledDfa, CombFormatMatchesDense)
+{
+  // A keyword trie over the lowercase letters: most rows have one or two transitions, and no transition otherwise.
+  std::mt19937 random(7);
+  std::uniform_int_distribution<int> letter('a', 'z');
+  constexpr std::size_t kNumStates = 500;
+  std::vector<dfa::CompiledDfa::StateId> byte_table(kNumStates * 256, dfa::CompiledDfa::kInvalidSymbol);
+  for (std::size_t s = 0; s < kNumStates; ++s)
+  {
+    for (int b = 'a'; b <= 'z'; ++b)
+    {
+      byte_table[s * 256 + static_cast<std::size_t>(b)] = dfa::CompiledDfa::kNoTransition;
+    }
+  }
+  std::vector<bool> accepting(kNumStates);
+  for (std::size_t s = 1; s < kNumStates; ++s)
+  {
+    const std::size_t parent = std::uniform_int_distribution<std::size_t>(0, s - 1)(random);
+    byte_table[parent * 256 + static_cast<std::size_t>(letter(random))] = static_cast<dfa::CompiledDfa::StateId>(s);
+    accepting[s] = s % 3 == 0;
+  }
+
+  dfa::CompiledDfa comb(byte_table.data(), accepting, 0, std::vector<std::string>(kNumStates));
+  ASSERT_EQ(comb.GetFormat(), dfa::CompiledDfa::COMB);
+  auto dense = comb;
+  dense.SetFormat(dfa::CompiledDfa::DENSE);
+  EXPECT_EQ(dense.GetFormat(), dfa::CompiledDfa::DENSE);
+  EXPECT_LT(2 * comb.TableBytes(), dense.TableBytes());
+
+  for (dfa::CompiledDfa::StateId s = 0; s < kNumStates; ++s)
+  {
+    for (unsigned b = 0; b < 256; ++b)
+    {
+      const auto byte = static_cast<unsigned char>(b);
+      ASSERT_EQ(comb.Next(s, byte), byte_table[s * 256 + b]) << s << ' ' << b;
+      ASSERT_EQ(dense.Next(s, byte), byte_table[s * 256 + b]) << s << ' ' << b;
+    }
+    EXPECT_EQ(comb.Flags(s), dense.Flags(s));
+  }
+
+  // Renumbering and loading keep the format.
+  std::vector<dfa::CompiledDfa::StateId> reversed(kNumStates);
+  for (std::size_t s = 0; s < kNumStates; ++s)
+  {
+    reversed[s] = static_cast<dfa::CompiledDfa::StateId>(kNumStates - 1 - s);
+  }
+  const auto renumbered = comb.Renumbered(reversed);
+  EXPECT_EQ(renumbered.GetFormat(), dfa::CompiledDfa::COMB);
+  EXPECT_TRUE(renumbered.Equivalent(dense));
+
+  std::stringstream file;
+  comb.Save(file);
+  const auto loaded = dfa::CompiledDfa::Load(file);
+  EXPECT_EQ(loaded.GetFormat(), dfa::CompiledDfa::COMB);
+  EXPECT_TRUE(loaded.Equivalent(dense));
+}
+
+TEST(CompiledDfa, SmallTablesStayDense)
+{
+  const dfa::Dfa dfa(kSinks);
+  std::stringstream file;
+  dfa.Save(file);
+  EXPECT_EQ(dfa::CompiledDfa::Load(file).GetFormat(), dfa::CompiledDfa::DENSE);
+}
+
+TEST(CompiledDfa, FullRowsStayDense)
+{
+  // Every digit leads somewhere else from every state, so a comb can't be smaller than the dense table.
+  constexpr std::size_t kNumStates = 300;
+  std::vector<dfa::CompiledDfa::StateId> byte_table(kNumStates * 256, dfa::CompiledDfa::kInvalidSymbol);
+  for (std::size_t s = 0; s < kNumStates; ++s)
+  {
+    for (std::size_t d = 0; d < 10; ++d)
+    {
+      byte_table[s * 256 + '0' + d] = static_cast<dfa::CompiledDfa::StateId>((s * 7 + d * 31 + 1) % kNumStates);
+    }
+  }
+  const std::vector<bool> accepting(kNumStates, false);
+
+  dfa::CompiledDfa dense(byte_table.data(), accepting, 0, std::vector<std::string>(kNumStates));
+  EXPECT_EQ(dense.GetFormat(), dfa::CompiledDfa::DENSE);
+
+  // Packing full rows anyway still gives the same targets.
+  auto comb = dense;
+  comb.SetFormat(dfa::CompiledDfa::COMB);
+  EXPECT_EQ(comb.GetFormat(), dfa::CompiledDfa::COMB);
+  for (dfa::CompiledDfa::StateId s = 0; s < kNumStates; ++s)
+  {
+    for (unsigned b = 0; b < 256; ++b)
+    {
+      const auto byte = static_cast<unsigned char>(b);
+      ASSERT_EQ(comb.Next(s, byte), byte_table[s * 256 + b]) << s << ' ' << b;
+    }
+  }
+}
+
+TEST(CompiledDfa, SkipLoop)
+{
+  std::vector<dfa::CompiledDfa::StateId> byte_table(256, dfa::CompiledDfa::kNoTransition);
+  for (char c = 'a'; c <= 'z'; ++c)
+  {
+    byte_table[static_cast<unsigned char>(c)] = 0;
+  }
+  byte_table[' '] = 0;
+
+  dfa::CompiledDfa compiled(byte_table.data(), {false}, 0, {"q0"});
+  ASSERT_NE(compiled.Flags(0) & dfa::CompiledDfa::SELF_LOOP, 0);
+
+  for (std::size_t length = 0; length < 70; ++length)
+  {
+    const std::string input = std::string(length, 'q') + " x" + "A" + std::string(length, 'b');
+    const char* stop = compiled.SkipLoop(0, input.data(), input.data() + input.size());
+    EXPECT_EQ(stop - input.data(), length + 2);
+  }
+}
+
+TEST(DFA, SinkStatesEarlyExit)
+{
+  dfa::Dfa dfa(kSinks);
+
+  EXPECT_EQ(dfa.AcceptsString("ab"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("a" + std::string(1000, '_') + "b" + std::string(1000, 'a')), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("b" + std::string(1000, '_')), dfa::Dfa::REJECTS);
+  EXPECT_EQ(dfa.AcceptsString("a" + std::string(1000, '_')), dfa::Dfa::REJECTS);
+  EXPECT_EQ(dfa.AcceptsString("a" + std::string(1000, '_') + "a"), dfa::Dfa::NO_TRANSITION);
+
+  // Early exits must still report Symbols outside of the Alphabet.
+  EXPECT_EQ(dfa.AcceptsString("ab" + std::string(100, 'a') + "c"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("bb" + std::string(100, '_') + "c"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("a" + std::string(100, '_') + "c"), dfa::Dfa::INVALID_ALPHABET);
+}
+
+TEST(DFA, MatchesReferenceWalk)
+{
+  dfa::Dfa dfa(kSinks);
+
+  // Enumerate every string up to length 7 over the alphabet plus one invalid symbol.
+  const std::string symbols = "ab_c";
+  std::vector<std::string> inputs = {""};
+  for (std::size_t i = 0; i < inputs.size(); ++i)
+  {
+    if (inputs[i].size() < 7)
+    {
+      for (const char c : symbols)
+      {
+        inputs.push_back(inputs[i] + c);
+      }
+    }
+    EXPECT_EQ(dfa.AcceptsString(inputs[i]), ReferenceAccepts(dfa, inputs[i])) << inputs[i];
+  }
+}
+
+TEST(DFA, EquivalentToConvertedNfa)
+{
+  // Both accept strings over {a, b} that end in "ab".
+  const dfa::Dfa dfa(std::string(
+      "states: q0 q1 q2\n"
+      "alphabet: a b\n"
+      "startstate: q0\n"
+      "finalstate: q2\n"
+      "transition: q0 a q1\n"
+      "transition: q0 b q0\n"
+      "transition: q1 a q1\n"
+      "transition: q1 b q2\n"
+      "transition: q2 a q1\n"
+      "transition: q2 b q0"));
+  const dfa::Dfa nfa(std::string(
+      "states: p0 p1 p2\n"
+      "alphabet: a b\n"
+      "startstate: p0\n"
+      "finalstate: p2\n"
+      "transition: p0 a p0\n"
+      "transition: p0 b p0\n"
+      "transition: p0 a p1\n"
+      "transition: p1 b p2"));
+
+  std::string counterexample = "unchanged";
+  EXPECT_TRUE(dfa.Equivalent(nfa, &counterexample));
+  EXPECT_TRUE(nfa.Equivalent(dfa));
+  EXPECT_TRUE(dfa.Includes(nfa));
+  EXPECT_TRUE(nfa.Includes(dfa, &counterexample));
+  EXPECT_EQ(counterexample, "unchanged");
+}
+
+TEST(DFA, ShortestCounterexample)
+{
+  const dfa::Dfa sinks(kSinks);
+  // Also accepts "a_a...", which the other one rejects.
+  const dfa::Dfa superset(std::string(
+      "states: q0 q1 q2\n"
+      "alphabet: a b _\n"
+      "startstate: q0\n"
+      "finalstate: q2\n"
+      "transition: q0 a q1\n"
+      "transition: q1 _ q1\n"
+      "transition: q1 b q2\n"
+      "transition: q1 a q2\n"
+      "transition: q2 a q2\n"
+      "transition: q2 b q2\n"
+      "transition: q2 _ q2\n"));
+
+  std::string counterexample;
+  EXPECT_FALSE(sinks.Equivalent(superset, &counterexample));
+  EXPECT_EQ(counterexample, "aa");
+  EXPECT_TRUE(superset.Includes(sinks));
+  EXPECT_FALSE(sinks.Includes(superset, &counterexample));
+  EXPECT_EQ(counterexample, "aa");
+}
+
+TEST(DFA, EquivalenceMatchesBruteForce)
+{
+  std::mt19937 random(3);
+  for (int i = 0; i < 100; ++i)
+  {
+    const dfa::Dfa a(RandomDfa(random));
+    const dfa::Dfa b(RandomDfa(random));
+    const auto accepts = [](const dfa::Dfa& dfa, const std::string& input) {
+      return dfa.AcceptsString(input.empty() ? "epsilon" : input) == dfa::Dfa::ACCEPTS;
+    };
+
+    // Shortest counterexamples are shorter than the number of state pairs, including the implicit sinks.
+    constexpr std::size_t kMaxLength = 15;
+    const std::size_t differs = ShortestLength(
+        [&](const std::string& input) { return accepts(a, input) != accepts(b, input); }, kMaxLength);
+    const std::size_t not_included = ShortestLength(
+        [&](const std::string& input) { return accepts(b, input) && !accepts(a, input); }, kMaxLength);
+
+    std::string counterexample;
+    ASSERT_EQ(a.Equivalent(b, &counterexample), differs > kMaxLength) << i;
+    if (differs <= kMaxLength)
+    {
+      EXPECT_EQ(counterexample.size(), differs) << i;
+      EXPECT_NE(accepts(a, counterexample), accepts(b, counterexample)) << i;
+    }
+
+    ASSERT_EQ(a.Includes(b, &counterexample), not_included > kMaxLength) << i;
+    if (not_included <= kMaxLength)
+    {
+      EXPECT_EQ(counterexample.size(), not_included) << i;
+      EXPECT_TRUE(accepts(b, counterexample) && !accepts(a, counterexample)) << i;
+    }
+  }
+}
@@ -9,6 +9,10 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <vector>
 
 struct DfaTransition
@@ -169,6 +173,31 @@ TEST(DFA, ParseJSON)
   }
 }
 
+TEST(DFA, ParseDFAWhitespace)
+{
+  const std::string dfa_file_contents =
+      "states: q1\tq2  q3\r\n"
+      "alphabet: 0 1\r\n"
+      "startstate: q1\r\n"
+      "finalstate: q2\r\n"
+      "transition: q1\t0 q1\r\n"
+      "transition: q1 1\tq2\r\n"
+      "transition: q2 0 q3\n"
+      "transition: q2 1 q2\n"
+      "transition: q3 0 q2\n"
+      "transition: q3 1 q2\n"
+      "\n"
+      "transition: q3 1 q3";
+
+  dfa::Dfa dfa(dfa_file_contents);
+
+  EXPECT_EQ(dfa.GetStates().size(), 3);
+  EXPECT_NE(dfa.GetAlphabet().find("1"), dfa.GetAlphabet().end());
+  EXPECT_EQ(dfa.GetStartState(), dfa::State{"q1"});
+  EXPECT_EQ(dfa.AcceptsString("0010001"), dfa::Dfa::Acceptance::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("001000"), dfa::Dfa::Acceptance::REJECTS);
+}
+
 TEST(DFA, AcceptedInputs)
 {
   const std::string dfa_file_contents =
@@ -418,6 +447,188 @@ TEST(NFA, NoTransition)
   EXPECT_EQ(dfa.AcceptsString("bbaa"), dfa::Dfa::Acceptance::NO_TRANSITION);
 }
 
+/**
+ * Checks that AcceptsBatch gives the verdicts of AcceptsString, in the order of the inputs.
+ * @return number of transitions AcceptsBatch took
+ */
+std::size_t ExpectBatchMatches(const dfa::Dfa& dfa, const std::vector<std::string>& inputs)
+{
+  const std::vector<std::string_view> views(inputs.begin(), inputs.end());
+  std::vector<dfa::Dfa::Acceptance> verdicts;
+  const std::size_t transitions = dfa.AcceptsBatch(views, verdicts);
+  EXPECT_EQ(verdicts.size(), inputs.size());
+  for (std::size_t i = 0; i < inputs.size() && i < verdicts.size(); ++i)
+  {
+    EXPECT_EQ(verdicts[i], dfa.AcceptsString(inputs[i])) << inputs[i];
+  }
+  return transitions;
+}
+
+TEST(DFA, AcceptsBatch)
+{
+  const auto dfa = dfa::Dfa::FromRegex("/api/v[0-9]/(users|tenants)/[a-z]+(/[0-9]+)?");
+  const std::vector<std::string> inputs = {
+      "/api/v2/tenants/acme/17", "/api/v2/tenants/acme",   "/api/v2/users/bob",      "/api/v2/tenants/",
+      "/api/v2/tenants/acme",    "/api/v2/tenants/acme/x", "/api/v3/users/alice",    "/api/v2/tenants/a!",
+      "",                        "/api/v2/users/bob/2",    "/api/v2/tenants/acme/1", "/api/",
+      "epsilon",                 "/api/v2/tenants/acme/17"};
+  std::size_t total = 0;
+  for (const auto& input : inputs)
+  {
+    total += input.size();
+  }
+  EXPECT_LT(ExpectBatchMatches(dfa, inputs), total / 3);
+
+  std::vector<dfa::Dfa::Acceptance> verdicts{dfa::Dfa::ACCEPTS};
+  EXPECT_EQ(dfa.AcceptsBatch({}, verdicts), 0);
+  EXPECT_TRUE(verdicts.empty());
+}
+
+TEST(DFA, AcceptsBatchRandom)
+{
+  // Covers DEAD and ABSORBING states, self-loops, and Symbols of several bytes.
+  std::mt19937 random(7);
+  const std::vector<std::string> patterns = {"[ab]*a[ab]{3}", "ab.*", "a*b*c*", "(abc|abd|b)+"};
+  for (const auto& pattern : patterns)
+  {
+    const auto dfa = dfa::Dfa::FromRegex(pattern);
+    std::vector<std::string> inputs(200);
+    for (auto& input : inputs)
+    {
+      const std::size_t length = random() % 12;
+      for (std::size_t i = 0; i < length; ++i)
+      {
+        input += "abcd"[random() % 4];
+      }
+    }
+    ExpectBatchMatches(dfa, inputs);
+  }
+
+  const dfa::Dfa tokens(std::string(
+      "states: q0 q1 q2\n"
+      "alphabet: GET GETS / \xC3\xA9\n"
+      "startstate: q0\n"
+      "finalstate: q2\n"
+      "transition: q0 GET q1\n"
+      "transition: q0 GETS q1\n"
+      "transition: q1 / q2\n"
+      "transition: q2 \xC3\xA9 q2"));
+  ExpectBatchMatches(tokens, {"GET/", "GETS/", "GETS", "GET", "GE", "GET/\xC3\xA9\xC3\xA9", "GET/\xC3", "GETX/", "/"});
+}
+
+const std::string kIdentifiers =
+    "states: q0 q1\n"
+    "alphabet: a-z 0-9 _\n"
+    "startstate: q0\n"
+    "finalstate: q1\n"
+    "transition: q0 a-z q1\n"
+    "transition: q0 _ q1\n"
+    "transition: q1 a-z q1\n"
+    "transition: q1 0-9 q1\n"
+    "transition: q1 _ q1";
+
+/**
+ * Writes a transition line for each byte of a range, which is what a range label stands for.
+ */
+std::string ExpandedTransitions(const std::string& from, char low, char high, const std::string& to)
+{
+  std::string lines;
+  for (char c = low; c <= high; ++c)
+  {
+    lines += "\ntransition: " + from + ' ' + c + ' ' + to;
+  }
+  return lines;
+}
+
+TEST(DFA, RangeTransitions)
+{
+  const dfa::Dfa dfa(kIdentifiers);
+  EXPECT_EQ(dfa.AcceptsString("snake_case9"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("_"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("epsilon"), dfa::Dfa::REJECTS);
+  EXPECT_EQ(dfa.AcceptsString("9lives"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_EQ(dfa.AcceptsString("camelCase"), dfa::Dfa::INVALID_ALPHABET);
+
+  // Ranges that don't overlap are deterministic, so they are kept as they are.
+  EXPECT_EQ(dfa.GetTransitions().at({"q1"}).size(), 3);
+
+  const std::string expanded = "states: q0 q1\nalphabet: a-z 0-9 _\nstartstate: q0\nfinalstate: q1" +
+                               ExpandedTransitions("q0", 'a', 'z', "q1") + ExpandedTransitions("q0", '_', '_', "q1") +
+                               ExpandedTransitions("q1", 'a', 'z', "q1") + ExpandedTransitions("q1", '0', '9', "q1") +
+                               ExpandedTransitions("q1", '_', '_', "q1");
+  EXPECT_TRUE(dfa.Equivalent(dfa::Dfa(expanded)));
+}
+
+TEST(DFA, RangeTransitionsJSON)
+{
+  const auto json = dfa::Dfa::Json::parse(R"({
+    "states": ["q0", "q1"],
+    "alphabet": ["a-z", "0-9", "_"],
+    "start_state": "q0",
+    "final_states": ["q1"],
+    "transitions": [
+      {"s1": "q0", "range": ["a", "z"], "s2": "q1"},
+      {"s1": "q0", "symbol": "_", "s2": "q1"},
+      {"s1": "q1", "range": ["a", "z"], "s2": "q1"},
+      {"s1": "q1", "range": ["0", "9"], "s2": "q1"},
+      {"s1": "q1", "symbol": "_", "s2": "q1"}
+    ]
+  })");
+  const dfa::Dfa dfa(json);
+  EXPECT_TRUE(dfa.Equivalent(dfa::Dfa(kIdentifiers)));
+  EXPECT_EQ(dfa.AcceptsString("snake_case9"), dfa::Dfa::ACCEPTS);
+
+  for (const auto* range : {R"(["z", "a"])", R"(["a"])", R"(["ab", "c"])", R"("a-z")"})
+  {
+    auto invalid = json;
+    invalid["transitions"][0]["range"] = dfa::Dfa::Json::parse(range);
+    EXPECT_THROW(dfa::Dfa{invalid}, std::runtime_error) << range;
+  }
+}
+
+TEST(NFA, OverlappingRanges)
+{
+  const std::string nfa =
+      "states: q0 q1 q2\n"
+      "alphabet: a-z\n"
+      "startstate: q0\n"
+      "finalstate: q2\n"
+      "transition: q0 a-z q0\n"
+      "transition: q0 m-p q1\n"
+      "transition: q1 a-f q2";
+  const dfa::Dfa dfa(nfa);
+  EXPECT_EQ(dfa.AcceptsString("xyzna"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("xyzng"), dfa::Dfa::REJECTS);
+
+  // Ranges are only split in the States that tell their pieces apart: a-f only after m-p.
+  const dfa::Dfa::Transitions start = {{"a-l", {"q0"}}, {"m-p", {"q0", "q1"}}, {"q-z", {"q0"}}};
+  EXPECT_EQ(dfa.GetTransitions().at({"q0"}), start);
+  const dfa::Dfa::Transitions after_m = {
+      {"a-f", {"q0", "q2"}}, {"g-l", {"q0"}}, {"m-p", {"q0", "q1"}}, {"q-z", {"q0"}}};
+  EXPECT_EQ(dfa.GetTransitions().at({"q0", "q1"}), after_m);
+
+  const std::string expanded = "states: q0 q1 q2\nalphabet: a-z\nstartstate: q0\nfinalstate: q2" +
+                               ExpandedTransitions("q0", 'a', 'z', "q0") + ExpandedTransitions("q0", 'm', 'p', "q1") +
+                               ExpandedTransitions("q1", 'a', 'f', "q2");
+  EXPECT_TRUE(dfa.Equivalent(dfa::Dfa(expanded)));
+}
+
+TEST(DFA, RangeTransitionsWithTokens)
+{
+  const dfa::Dfa dfa(std::string(
+      "states: q0 q1\n"
+      "alphabet: GET / a-z\n"
+      "startstate: q0\n"
+      "finalstate: q1\n"
+      "transition: q0 GET q1\n"
+      "transition: q1 / q1\n"
+      "transition: q1 a-z q1"));
+  EXPECT_EQ(dfa.AcceptsString("GET/index"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("GET"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("get"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_EQ(dfa.AcceptsString("GET/A"), dfa::Dfa::INVALID_ALPHABET);
+}
+
 TEST(Hasher, NoCollisions)
 {
   dfa::State s1{"q0", "q1", "q2"};
@@ -0,0 +1,87 @@
+/**
+ * @file huge_pages_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/huge_pages.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+constexpr std::size_t kHugePage = std::size_t{2} << 20U;
+
+/**
+ * Restores the default setting when a test ends.
+ */
+class HugePagesTest : public ::testing::Test
+{
+ protected:
+  void TearDown() override { dfa::SetHugePages(dfa::TRANSPARENT_HUGE_PAGES); }
+};
+}  // namespace
+
+TEST_F(HugePagesTest, SmallTablesComeFromTheHeap)
+{
+  const auto before = dfa::GetPageUsage();
+  void* table = dfa::AllocateTable(1000);
+  EXPECT_EQ(dfa::GetPageUsage().small_bytes, before.small_bytes + 1000);
+  EXPECT_EQ(dfa::GetPageUsage().transparent_bytes, before.transparent_bytes);
+  dfa::DeallocateTable(table, 1000);
+  EXPECT_EQ(dfa::GetPageUsage().small_bytes, before.small_bytes);
+}
+
+TEST_F(HugePagesTest, LargeTablesAreAlignedForTransparentHugePages)
+{
+  const auto before = dfa::GetPageUsage();
+  const std::size_t bytes = 2 * kHugePage + 100;
+  auto* table = static_cast<char*>(dfa::AllocateTable(bytes));
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(table) % kHugePage, 0U);
+  EXPECT_GE(dfa::GetPageUsage().transparent_bytes, before.transparent_bytes + bytes);
+  std::memset(table, 1, bytes);
+  EXPECT_EQ(table[bytes - 1], 1);
+
+  // Tables are freed the way they were allocated, whatever the setting is by then.
+  dfa::SetHugePages(dfa::SMALL_PAGES);
+  dfa::DeallocateTable(table, bytes);
+  EXPECT_EQ(dfa::GetPageUsage().transparent_bytes, before.transparent_bytes);
+}
+
+TEST_F(HugePagesTest, SmallPagesAndFallbacks)
+{
+  const auto before = dfa::GetPageUsage();
+  const std::size_t bytes = 2 * kHugePage;
+  dfa::SetHugePages(dfa::SMALL_PAGES);
+  void* small = dfa::AllocateTable(bytes);
+  EXPECT_EQ(dfa::GetPageUsage().small_bytes, before.small_bytes + bytes);
+
+  // Without reserved huge pages, this falls back to transparent huge pages.
+  dfa::SetHugePages(dfa::HUGETLB_PAGES);
+  void* huge = dfa::AllocateTable(bytes);
+  const auto usage = dfa::GetPageUsage();
+  EXPECT_EQ(usage.hugetlb_bytes + usage.transparent_bytes,
+            before.hugetlb_bytes + before.transparent_bytes + bytes);
+
+  dfa::DeallocateTable(small, bytes);
+  dfa::DeallocateTable(huge, bytes);
+  EXPECT_EQ(dfa::GetPageUsage().small_bytes, before.small_bytes);
+  EXPECT_EQ(dfa::GetPageUsage().hugetlb_bytes, before.hugetlb_bytes);
+  EXPECT_EQ(dfa::GetPageUsage().transparent_bytes, before.transparent_bytes);
+}
+
+TEST_F(HugePagesTest, TableVector)
+{
+  const auto before = dfa::GetPageUsage();
+  {
+    dfa::TableVector<std::uint32_t> table(kHugePage, 7);
+    const auto copy = table;
+    EXPECT_EQ(copy[kHugePage - 1], 7U);
+    const std::size_t bytes = table.size() * sizeof(std::uint32_t);
+    EXPECT_GE(dfa::GetPageUsage().transparent_bytes, before.transparent_bytes + 2 * bytes);
+  }
+  EXPECT_EQ(dfa::GetPageUsage().transparent_bytes, before.transparent_bytes);
+}
@@ -0,0 +1,140 @@
+/**
+ * @file layout_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/layout.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "dfa/compiled_dfa.h"
+#include "dfa/dfa.h"
+#include "dfa/test/test_util.h"
+
+namespace
+{
+using StateId = dfa::CompiledDfa::StateId;
+
+/**
+ * q0 -a-> q1, q0 -b-> q2, q1 -a-> q3, where breadth-first and depth-first orders differ.
+ */
+dfa::CompiledDfa Tree()
+{
+  std::vector<StateId> byte_table(4 * 256, dfa::CompiledDfa::kInvalidSymbol);
+  for (std::size_t s = 0; s < 4; ++s)
+  {
+    byte_table[s * 256 + 'a'] = dfa::CompiledDfa::kNoTransition;
+    byte_table[s * 256 + 'b'] = dfa::CompiledDfa::kNoTransition;
+  }
+  byte_table['a'] = 1;
+  byte_table['b'] = 2;
+  byte_table[256 + 'a'] = 3;
+  return dfa::CompiledDfa(byte_table.data(), {false, false, true, true}, 0, {"q0", "q1", "q2", "q3"});
+}
+}  // namespace
+
+TEST(Layout, StaticOrders)
+{
+  const auto tree = Tree();
+  EXPECT_EQ(dfa::BreadthFirstLayout(tree), (std::vector<StateId>{0, 1, 2, 3}));
+  EXPECT_EQ(dfa::DepthFirstLayout(tree), (std::vector<StateId>{0, 1, 3, 2}));
+}
+
+TEST(Layout, ProfileOrder)
+{
+  const auto tree = Tree();
+  dfa::VisitProfile profile;
+  for (int i = 0; i < 10; ++i)
+  {
+    dfa::RecordVisits(tree, "b", profile);
+  }
+  dfa::RecordVisits(tree, "aa", profile);
+
+  EXPECT_EQ(profile.visits, (std::vector<std::uint64_t>{11, 1, 10, 1}));
+  EXPECT_EQ(profile.transitions.at(2), 10U);
+  EXPECT_EQ(dfa::ProfileLayout(tree, profile), (std::vector<StateId>{0, 2, 1, 3}));
+  EXPECT_EQ(dfa::ProfileLayout(tree, dfa::VisitProfile()), dfa::BreadthFirstLayout(tree));
+}
+
+TEST(Layout, MultiByteSymbols)
+{
+  // é is read through an intermediate state, which comes after q0 and q1 in ID order.
+  const dfa::Dfa definition(std::string(
+      "states: q0 q1\n"
+      "alphabet: a \u00E9\n"
+      "startstate: q0\n"
+      "finalstate: q1\n"
+      "transition: q0 \u00E9 q1\n"
+      "transition: q1 a q1\n"
+      "transition: q1 \u00E9 q1"));
+  std::stringstream file;
+  definition.Save(file);
+  const auto table = dfa::CompiledDfa::Load(file);
+  ASSERT_FALSE(table.SymbolsAreBytes());
+  ASSERT_GT(table.NumStates(), 2U);
+
+  // Each state is reached from one placed before it, so none is left over for ID order.
+  for (const auto& order : {dfa::BreadthFirstLayout(table), dfa::DepthFirstLayout(table)})
+  {
+    ASSERT_EQ(order.size(), table.NumStates());
+    EXPECT_EQ(order[0], table.Start());
+    for (std::size_t i = 1; i < order.size(); ++i)
+    {
+      bool reached = false;
+      for (std::size_t j = 0; j < i; ++j)
+      {
+        for (unsigned b = 0; b < 256; ++b)
+        {
+          reached = reached || table.Next(order[j], static_cast<unsigned char>(b)) == order[i];
+        }
+      }
+      EXPECT_TRUE(reached) << order[i];
+    }
+  }
+
+  // q1 is ABSORBING, but the rest of the input still goes through the intermediate state.
+  dfa::VisitProfile profile;
+  dfa::RecordVisits(table, "\u00E9a\u00E9\u00E9", profile);
+  std::uint64_t visits = 0;
+  for (const auto count : profile.visits)
+  {
+    visits += count;
+  }
+  EXPECT_EQ(visits, 7U);
+}
+
+TEST(Layout, RelayoutKeepsVerdicts)
+{
+  const auto original = dfa::Dfa::FromRegex("(ab|cd)*e[a-e]{2}|[ace]+");
+  const auto inputs = dfa::test::AllStrings("abcdex", 5);
+
+  dfa::VisitProfile profile;
+  for (const auto* sample : {"ababcdeaa", "cdcdcdebb", "aceace"})
+  {
+    original.RecordVisits(sample, profile);
+  }
+
+  auto depth_first = original;
+  depth_first.Relayout(dfa::Dfa::DEPTH_FIRST);
+  auto profiled = original;
+  profiled.Relayout(profile);
+
+  // The profiled order persists through the compiled format.
+  std::stringstream file;
+  profiled.Save(file);
+  const auto loaded = dfa::Dfa::Load(file);
+
+  for (const auto* dfa : std::vector<const dfa::Dfa*>{&depth_first, &profiled, &loaded})
+  {
+    EXPECT_TRUE(dfa->Equivalent(original));
+    for (const auto& input : inputs)
+    {
+      EXPECT_EQ(dfa->AcceptsString(input), original.AcceptsString(input)) << input;
+    }
+  }
+}
@@ -0,0 +1,168 @@
+/**
+ * @file memory_budget_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/memory_budget.h"
+
+#include <gtest/gtest.h>
+
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dfa/dfa.h"
+
+namespace
+{
+/**
+ * The DFA remembers the last 13 symbols, so it has 2^13 states, plus the start state.
+ */
+constexpr std::string_view kLarge = "[ab]*a[ab]{12}";
+
+const std::string kOnlyA =
+    "states: q0 q1\n"
+    "alphabet: a b\n"
+    "startstate: q0\n"
+    "finalstate: q1\n"
+    "transition: q0 a q1\n"
+    "transition: q0 b q0\n"
+    "transition: q1 a q1\n"
+    "transition: q1 b q0";
+
+TEST(MemoryBudget, CountsAllocations)
+{
+  dfa::MemoryBudget budget(1000);
+  {
+    std::pmr::vector<char> small(100, 'x', &budget);
+    EXPECT_EQ(budget.Used(), 100);
+
+    try
+    {
+      std::pmr::vector<char> large(1000, 'x', &budget);
+      FAIL() << "Allocation should exceed the budget";
+    }
+    catch (const dfa::BudgetExceededError& e)
+    {
+      EXPECT_EQ(e.Budget(), "1000 bytes");
+      EXPECT_EQ(e.Bytes(), 100);
+    }
+    EXPECT_EQ(budget.Used(), 100);
+
+    budget.Charge(900);
+    EXPECT_THROW(budget.Charge(1), dfa::BudgetExceededError);
+    budget.Release(900);
+  }
+  EXPECT_EQ(budget.Used(), 0);
+}
+
+TEST(MemoryBudget, UnlimitedBudget)
+{
+  dfa::MemoryBudget budget(0);
+  budget.Charge(std::size_t{1} << 40U);
+  EXPECT_EQ(budget.Used(), std::size_t{1} << 40U);
+}
+
+TEST(MemoryBudget, MaxBytesStopsConstruction)
+{
+  for (const unsigned threads : {1U, 4U})
+  {
+    dfa::Options options;
+    options.threads = threads;
+    options.max_bytes = 256 * 1024;
+    try
+    {
+      dfa::Dfa::FromRegex(kLarge, options);
+      FAIL() << "Construction should exceed the budget with " << threads << " threads";
+    }
+    catch (const dfa::BudgetExceededError& e)
+    {
+      EXPECT_GT(e.States(), 0) << threads;
+      EXPECT_LT(e.States(), 8192) << threads;
+      EXPECT_LE(e.Bytes(), options.max_bytes) << threads;
+      EXPECT_NE(std::string(e.what()).find("after " + std::to_string(e.States()) + " states"), std::string::npos);
+    }
+
+    options.max_bytes = 0;
+    EXPECT_EQ(dfa::Dfa::FromRegex(kLarge, options).GetStates().size(), 8193) << threads;
+  }
+}
+
+TEST(MemoryBudget, MaxBytesStopsCompilation)
+{
+  // Nothing is determinized, so the budget runs out while the tables are compiled, once the states are numbered.
+  const std::string unicode =
+      "states: q0 q1\n"
+      "alphabet: \xC2\x80-\xF4\x8F\xBF\xBF GET\n"
+      "startstate: q0\n"
+      "finalstate: q1\n"
+      "transition: q0 \xC2\x80-\xF4\x8F\xBF\xBF q1\n"
+      "transition: q1 GET q0";
+  dfa::Options options;
+  options.max_bytes = 8 * 1024;
+  try
+  {
+    dfa::Dfa dfa(unicode, options);
+    FAIL() << "Compilation should exceed the budget";
+  }
+  catch (const dfa::BudgetExceededError& e)
+  {
+    EXPECT_EQ(e.Budget(), "8192 bytes");
+    EXPECT_EQ(e.States(), 2);
+    EXPECT_NE(std::string(e.what()).find("after 2 states"), std::string::npos);
+  }
+
+  options.max_bytes = 0;
+  EXPECT_EQ(dfa::Dfa(unicode, options).AcceptsString("\xE4\xB8\x80GET\xF0\x9F\x98\x80"), dfa::Dfa::ACCEPTS);
+}
+
+TEST(MemoryBudget, MaxStates)
+{
+  dfa::Options options;
+  options.max_states = 100;
+  try
+  {
+    dfa::Dfa::FromRegex(kLarge, options);
+    FAIL() << "Construction should exceed the budget";
+  }
+  catch (const dfa::BudgetExceededError& e)
+  {
+    EXPECT_EQ(e.Budget(), "100 states");
+    EXPECT_EQ(e.States(), 100);
+  }
+
+  // A lower soft limit still simulates the NFA, while a higher one doesn't get the chance.
+  options.max_dfa_states = 50;
+  EXPECT_TRUE(dfa::Dfa::FromRegex(kLarge, options).IsSimulated());
+  options.max_dfa_states = 200;
+  EXPECT_THROW(dfa::Dfa::FromRegex(kLarge, options), dfa::BudgetExceededError);
+
+  options = dfa::Options();
+  options.max_states = 1;
+  EXPECT_THROW(dfa::Dfa(kOnlyA, options), dfa::BudgetExceededError);
+  options.max_states = 2;
+  EXPECT_EQ(dfa::Dfa(kOnlyA, options).AcceptsString("ba"), dfa::Dfa::ACCEPTS);
+}
+
+TEST(MemoryBudget, MemoryUsage)
+{
+  const dfa::Dfa dfa(kOnlyA);
+  const auto usage = dfa.MemoryUsage();
+  EXPECT_GT(usage.tables, 0);
+  EXPECT_GT(usage.definition, 0);
+  EXPECT_EQ(usage.caches, 0);
+  EXPECT_EQ(usage.Total(), usage.tables + usage.names + usage.definition + usage.caches);
+
+  const auto large = dfa::Dfa::FromRegex(kLarge).MemoryUsage();
+  EXPECT_GT(large.tables, usage.tables);
+  EXPECT_GT(large.names, usage.names);
+  EXPECT_GT(large.definition, usage.definition);
+
+  dfa::Options options;
+  options.max_dfa_states = 50;
+  const auto simulated = dfa::Dfa::FromRegex(kLarge, options).MemoryUsage();
+  EXPECT_GT(simulated.caches, 0);
+}
+}  // namespace
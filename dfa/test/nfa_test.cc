@@ -0,0 +1,239 @@
+/**
+ * @file nfa_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/nfa.h"
+
+#include <gtest/gtest.h>
+
+#include <memory_resource>
+#include <random>
+#include <string>
+
+#include "dfa/dfa.h"
+
+namespace
+{
+/**
+ * Builds a random NFA with a few epsilon transitions.
+ */
+dfa::Nfa RandomNfa(unsigned seed, std::size_t num_states, std::size_t num_symbols)
+{
+  std::mt19937 random(seed);
+  std::uniform_int_distribution<dfa::Nfa::StateId> state(0, static_cast<dfa::Nfa::StateId>(num_states - 1));
+  std::uniform_int_distribution<dfa::Nfa::SymbolId> symbol(0, static_cast<dfa::Nfa::SymbolId>(num_symbols - 1));
+
+  dfa::Nfa nfa;
+  for (std::size_t i = 0; i < num_states; ++i)
+  {
+    nfa.state_names.emplace_back("q" + std::to_string(i));
+  }
+  for (std::size_t i = 0; i < num_symbols; ++i)
+  {
+    nfa.symbols.emplace_back(1, static_cast<char>('a' + i));
+  }
+  nfa.transitions.resize(num_states);
+  nfa.epsilon_transitions.resize(num_states);
+  nfa.final_states.resize(num_states);
+
+  for (std::size_t i = 0; i < num_states * 3; ++i)
+  {
+    nfa.transitions[state(random)].emplace_back(symbol(random), state(random));
+  }
+  for (std::size_t i = 0; i < num_states / 4; ++i)
+  {
+    nfa.epsilon_transitions[state(random)].push_back(state(random));
+  }
+  for (std::size_t i = 0; i < num_states / 3; ++i)
+  {
+    nfa.final_states[state(random)] = true;
+  }
+  nfa.start = {0};
+  return nfa;
+}
+}  // namespace
+
+TEST(Determinize, ParallelMatchesSerial)
+{
+  for (unsigned seed = 0; seed < 10; ++seed)
+  {
+    const auto nfa = RandomNfa(seed, 14, 3);
+    const auto serial = dfa::Determinize(nfa, 1);
+    for (const unsigned threads : {2U, 4U, 8U})
+    {
+      const auto parallel = dfa::Determinize(nfa, threads);
+      EXPECT_EQ(parallel.subsets, serial.subsets) << "seed " << seed << ", threads " << threads;
+      EXPECT_EQ(parallel.transitions, serial.transitions) << "seed " << seed << ", threads " << threads;
+    }
+  }
+}
+
+TEST(Determinize, BreadthFirstNumbering)
+{
+  const auto nfa = RandomNfa(42, 20, 2);
+  const auto dfa = dfa::Determinize(nfa);
+
+  ASSERT_FALSE(dfa.subsets.empty());
+  EXPECT_EQ(dfa.subsets.size(), dfa.transitions.size());
+
+  // Every state's first appearance as a target is in increasing order.
+  dfa::SubsetDfa::StateId next = 1;
+  for (const auto& row : dfa.transitions)
+  {
+    for (const auto& [symbol, target] : row)
+    {
+      EXPECT_LE(target, next);
+      if (target == next)
+      {
+        ++next;
+      }
+    }
+  }
+  EXPECT_EQ(next, dfa.subsets.size());
+}
+
+TEST(NFA, ParallelConvertToDFA)
+{
+  const std::string dfa_file_contents =
+      "states: q0 q1 q2 q3\n"
+      "alphabet: a b\n"
+      "startstate: q0\n"
+      "finalstate: q0\n"
+      "transition: q0 epsilon q1\n"
+      "transition: q1 a q1\n"
+      "transition: q1 a q2\n"
+      "transition: q1 b q2\n"
+      "transition: q2 a q0\n"
+      "transition: q2 a q2\n"
+      "transition: q2 b q3\n"
+      "transition: q3 b q1";
+
+  dfa::Options options;
+  options.threads = 4;
+  const dfa::Dfa serial(dfa_file_contents);
+  const dfa::Dfa parallel(dfa_file_contents, options);
+
+  EXPECT_EQ(parallel.GetStates(), serial.GetStates());
+  EXPECT_EQ(parallel.GetStartState(), serial.GetStartState());
+  EXPECT_EQ(parallel.GetFinalStates(), serial.GetFinalStates());
+  EXPECT_EQ(parallel.GetTransitions(), serial.GetTransitions());
+}
+
+TEST(NFA, FinalStateWithoutTransitions)
+{
+  // {q1, q2} has no outgoing transitions, but contains the final state q1.
+  const std::string dfa_file_contents =
+      "states: q0 q1 q2\n"
+      "alphabet: a\n"
+      "startstate: q0\n"
+      "finalstate: q1\n"
+      "transition: q0 a q1\n"
+      "transition: q0 a q2";
+
+  dfa::Dfa dfa(dfa_file_contents);
+
+  EXPECT_NE(dfa.GetFinalStates().find(dfa::State{"q1", "q2"}), dfa.GetFinalStates().end());
+  EXPECT_EQ(dfa.AcceptsString("a"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("aa"), dfa::Dfa::NO_TRANSITION);
+}
+
+TEST(Determinize, AllocatesFromGivenResource)
+{
+  const auto nfa = RandomNfa(7, 16, 3);
+  const auto expected = dfa::Determinize(nfa);
+
+  // Anything that falls back to the default resource would throw std::bad_alloc.
+  std::pmr::monotonic_buffer_resource arena;
+  auto* const previous = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+  const auto serial = dfa::Determinize(nfa, 1, &arena);
+  const auto parallel = dfa::Determinize(nfa, 3, &arena);
+  std::pmr::set_default_resource(previous);
+
+  EXPECT_EQ(serial.subsets, expected.subsets);
+  EXPECT_EQ(serial.transitions, expected.transitions);
+  EXPECT_EQ(parallel.subsets, expected.subsets);
+  EXPECT_EQ(parallel.transitions, expected.transitions);
+}
+
+TEST(Determinize, StopsAtStateLimit)
+{
+  const auto nfa = RandomNfa(42, 20, 2);
+  const auto size = dfa::Determinize(nfa).subsets.size();
+  ASSERT_GT(size, 2U);
+
+  for (const unsigned threads : {1U, 4U})
+  {
+    EXPECT_EQ(dfa::Determinize(nfa, threads, std::pmr::get_default_resource(), size).subsets.size(), size);
+    EXPECT_THROW(dfa::Determinize(nfa, threads, std::pmr::get_default_resource(), size - 1), dfa::StateLimitError);
+  }
+}
+
+TEST(IncrementalDeterminizer, MatchesDeterminizeAfterEdits)
+{
+  for (unsigned seed = 0; seed < 10; ++seed)
+  {
+    auto nfa = RandomNfa(seed, 14, 3);
+    dfa::IncrementalDeterminizer determinizer(nfa);
+    determinizer.Update();
+
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<dfa::Nfa::StateId> state(0, 13);
+    std::uniform_int_distribution<dfa::Nfa::SymbolId> symbol(0, 2);
+    for (int edit = 0; edit < 30; ++edit)
+    {
+      const auto from = state(random);
+      switch (random() % 4)
+      {
+        case 0:
+          nfa.transitions[from].emplace_back(symbol(random), state(random));
+          determinizer.TransitionsChanged(from);
+          break;
+        case 1:
+          if (!nfa.transitions[from].empty())
+          {
+            nfa.transitions[from].erase(nfa.transitions[from].begin() + random() % nfa.transitions[from].size());
+            determinizer.TransitionsChanged(from);
+          }
+          break;
+        case 2:
+          nfa.epsilon_transitions[from].push_back(state(random));
+          determinizer.EpsilonTransitionsChanged(from);
+          break;
+        default:
+          if (!nfa.epsilon_transitions[from].empty())
+          {
+            nfa.epsilon_transitions[from].pop_back();
+            determinizer.EpsilonTransitionsChanged(from);
+          }
+          break;
+      }
+      determinizer.Update();
+
+      const auto expected = dfa::Determinize(nfa);
+      ASSERT_EQ(determinizer.Result().subsets, expected.subsets) << "seed " << seed << ", edit " << edit;
+      ASSERT_EQ(determinizer.Result().transitions, expected.transitions) << "seed " << seed << ", edit " << edit;
+    }
+  }
+}
+
+TEST(IncrementalDeterminizer, ExpandsOnlyChangedStates)
+{
+  auto nfa = RandomNfa(42, 20, 2);
+  dfa::IncrementalDeterminizer determinizer(nfa);
+  const auto size = determinizer.Update();
+  EXPECT_EQ(size, dfa::Determinize(nfa).subsets.size());
+  EXPECT_EQ(determinizer.Update(), 0U);
+
+  // A transition to a state that no other state leads to changes the rows of the states that contain its source.
+  nfa.state_names.emplace_back("new");
+  nfa.transitions.emplace_back();
+  nfa.epsilon_transitions.emplace_back();
+  nfa.final_states.push_back(true);
+  nfa.transitions[0].emplace_back(0, 20);
+  determinizer.TransitionsChanged(0);
+  const auto expanded = determinizer.Update();
+  EXPECT_LT(expanded, size);
+  EXPECT_EQ(determinizer.Result().subsets, dfa::Determinize(nfa).subsets);
+}
@@ -0,0 +1,49 @@
+/**
+ * @file numa_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/numa.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dfa/dfa.h"
+
+TEST(Numa, RunOnNumaNode)
+{
+  ASSERT_GE(dfa::NumaNodes(), 1U);
+  EXPECT_LT(dfa::CurrentNumaNode(), dfa::NumaNodes());
+
+  bool ran = false;
+  EXPECT_TRUE(dfa::RunOnNumaNode(0, [&] { ran = true; }));
+  EXPECT_TRUE(ran);
+
+  // Nodes that don't exist still run the task.
+  ran = false;
+  EXPECT_FALSE(dfa::RunOnNumaNode(dfa::NumaNodes(), [&] { ran = true; }));
+  EXPECT_TRUE(ran);
+
+  EXPECT_THROW(dfa::RunOnNumaNode(0, [] { throw std::runtime_error("task failed"); }), std::runtime_error);
+}
+
+TEST(Numa, ReplicatedTablesMatchAlike)
+{
+  dfa::Options options;
+  options.numa_replicas = 0;
+  auto replicated = dfa::Dfa::FromRegex("(ab|cd)*e", options);
+  const auto single = dfa::Dfa::FromRegex("(ab|cd)*e");
+  EXPECT_EQ(replicated.NumaReplicas(), dfa::NumaNodes() > 1 ? dfa::NumaNodes() : 0);
+  EXPECT_EQ(single.NumaReplicas(), 0U);
+
+  replicated.Relayout(dfa::Dfa::DEPTH_FIRST);
+  EXPECT_EQ(replicated.NumaReplicas(), dfa::NumaNodes() > 1 ? dfa::NumaNodes() : 0);
+  for (const std::string input : {"e", "abcde", "abe", "ab", "x"})
+  {
+    EXPECT_EQ(replicated.AcceptsString(input), single.AcceptsString(input)) << input;
+  }
+}
@@ -0,0 +1,150 @@
+/**
+ * @file out_of_core_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/out_of_core.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "dfa/dfa.h"
+
+namespace
+{
+namespace fs = std::filesystem;
+
+/**
+ * A budget small enough that every level is sorted in several runs, and merges take several passes.
+ */
+dfa::OutOfCoreOptions TinyBudget(const fs::path& temp_directory)
+{
+  dfa::OutOfCoreOptions options;
+  options.max_bytes = 16 << 10;
+  options.temp_directory = temp_directory;
+  return options;
+}
+
+class OutOfCore : public testing::Test
+{
+ protected:
+  void SetUp() override
+  {
+    temp_directory_ = fs::temp_directory_path() / ("out_of_core_test_" + std::to_string(getpid()));
+    fs::create_directories(temp_directory_);
+  }
+
+  void TearDown() override
+  {
+    // Temporary files are removed even when construction fails.
+    EXPECT_TRUE(fs::is_empty(temp_directory_));
+    fs::remove_all(temp_directory_);
+  }
+
+  fs::path temp_directory_;
+};
+
+TEST_F(OutOfCore, MatchesInMemoryConstruction)
+{
+  const std::string pattern = "[ab]*a[ab]{10}(c|d+)?";
+  std::stringstream compiled;
+  const auto stats = dfa::Dfa::CompileRegexOutOfCore(pattern, compiled, TinyBudget(temp_directory_));
+  const auto expected = dfa::Dfa::FromRegex(pattern);
+  EXPECT_EQ(stats.states, expected.GetStates().size());
+  EXPECT_GT(stats.runs, 2 * stats.levels);
+  EXPECT_GT(stats.spilled_bytes, 0);
+
+  const auto dfa = dfa::Dfa::Load(compiled);
+  EXPECT_TRUE(dfa.Equivalent(expected));
+  EXPECT_EQ(dfa.AcceptsString("abbbbbbbbbbd"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("bbbbbbbbbbbd"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_EQ(dfa.AcceptsString("abbbbbbbbbbe"), dfa::Dfa::INVALID_ALPHABET);
+}
+
+TEST_F(OutOfCore, MergesDictionaryRunsOfManyLevels)
+{
+  // A level for each b, more than the dictionary runs that may be open at once, which merges keep track of.
+  const std::string pattern = "[ab]*a[ab]{3}b{150}";
+  auto options = TinyBudget(temp_directory_);
+  options.max_bytes = 64 << 20;
+  std::stringstream compiled;
+  const auto stats = dfa::Dfa::CompileRegexOutOfCore(pattern, compiled, options);
+  const auto expected = dfa::Dfa::FromRegex(pattern);
+  EXPECT_EQ(stats.states, expected.GetStates().size());
+  EXPECT_GT(stats.levels, 150);
+
+  const auto dfa = dfa::Dfa::Load(compiled);
+  EXPECT_TRUE(dfa.Equivalent(expected));
+  EXPECT_EQ(dfa.AcceptsString("abaa" + std::string(150, 'b')), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("abaa" + std::string(149, 'b')), dfa::Dfa::REJECTS);
+}
+
+TEST_F(OutOfCore, ConvertsNfaFiles)
+{
+  // c is part of the Alphabet without any transition, and q2 is only reached by epsilon transitions.
+  const std::string nfa =
+      "states: q0 q1 q2 q3\n"
+      "alphabet: a b c\n"
+      "startstate: q0\n"
+      "finalstate: q3\n"
+      "transition: q0 a q0\n"
+      "transition: q0 a q1\n"
+      "transition: q0 b q0\n"
+      "transition: q1 epsilon q2\n"
+      "transition: q2 b q3\n"
+      "transition: q3 a q3";
+  std::stringstream compiled;
+  const auto stats = dfa::Dfa::CompileOutOfCore(nfa, compiled, TinyBudget(temp_directory_));
+  const dfa::Dfa expected(nfa);
+  EXPECT_EQ(stats.states, expected.GetStates().size());
+
+  const auto dfa = dfa::Dfa::Load(compiled);
+  EXPECT_TRUE(dfa.Equivalent(expected));
+  EXPECT_EQ(dfa.AcceptsString("babaa"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("ba"), dfa::Dfa::REJECTS);
+  EXPECT_EQ(dfa.AcceptsString("c"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_EQ(dfa.AcceptsString("d"), dfa::Dfa::INVALID_ALPHABET);
+}
+
+TEST_F(OutOfCore, ConvertsRanges)
+{
+  // 0-9 is part of the Alphabet without any transition.
+  const std::string nfa =
+      "states: q0 q1 q2\n"
+      "alphabet: a-z 0-9\n"
+      "startstate: q0\n"
+      "finalstate: q2\n"
+      "transition: q0 a-z q0\n"
+      "transition: q0 m-p q1\n"
+      "transition: q1 a-f q2";
+  std::stringstream compiled;
+  const auto stats = dfa::Dfa::CompileOutOfCore(nfa, compiled, TinyBudget(temp_directory_));
+  const dfa::Dfa expected(nfa);
+  EXPECT_EQ(stats.states, expected.GetStates().size());
+
+  const auto dfa = dfa::Dfa::Load(compiled);
+  EXPECT_TRUE(dfa.Equivalent(expected));
+  EXPECT_EQ(dfa.AcceptsString("xyzna"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("xyzng"), dfa::Dfa::REJECTS);
+  EXPECT_EQ(dfa.AcceptsString("n0"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_EQ(dfa.AcceptsString("A"), dfa::Dfa::INVALID_ALPHABET);
+}
+
+TEST_F(OutOfCore, NeedsSingleByteSymbols)
+{
+  const std::string dfa =
+      "states: q0 q1\n"
+      "alphabet: GET\n"
+      "startstate: q0\n"
+      "finalstate: q1\n"
+      "transition: q0 GET q1";
+  std::stringstream compiled;
+  EXPECT_THROW(dfa::Dfa::CompileOutOfCore(dfa, compiled, TinyBudget(temp_directory_)), std::invalid_argument);
+}
+}  // namespace
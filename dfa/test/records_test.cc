@@ -0,0 +1,129 @@
+/**
+ * @file records_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/records.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+/**
+ * Reads all records of input through a pipe.
+ */
+std::vector<std::pair<std::string, std::uint64_t>> ReadRecords(const std::string& input, std::size_t block_size,
+                                                               int* reads = nullptr)
+{
+  int fds[2];
+  EXPECT_EQ(pipe(fds), 0);
+  EXPECT_EQ(write(fds[1], input.data(), input.size()), static_cast<ssize_t>(input.size()));
+  close(fds[1]);
+
+  std::vector<std::pair<std::string, std::uint64_t>> records;
+  dfa::RecordReader reader(
+      fds[0],
+      [reads] {
+        if (reads != nullptr)
+        {
+          ++*reads;
+        }
+      },
+      block_size);
+  std::string_view record;
+  std::uint64_t offset;
+  while (reader.Next(record, offset))
+  {
+    records.emplace_back(record, offset);
+  }
+  close(fds[0]);
+  return records;
+}
+}  // namespace
+
+TEST(RecordReader, SplitsAcrossBlocks)
+{
+  const std::vector<std::pair<std::string, std::uint64_t>> expected = {
+      {"a", 0}, {"bbbbbbbbbbbb", 2}, {"cc", 15}, {"d", 18}};
+  for (const std::size_t block_size : {1U, 3U, 5U, 1024U})
+  {
+    EXPECT_EQ(ReadRecords("a\nbbbbbbbbbbbb\ncc\nd", block_size), expected) << block_size;
+    EXPECT_EQ(ReadRecords("a\nbbbbbbbbbbbb\ncc\nd\n", block_size), expected) << block_size;
+  }
+}
+
+TEST(RecordReader, StopsAtEmptyLine)
+{
+  EXPECT_EQ(ReadRecords("a\nb\n\nc\n", 2), (std::vector<std::pair<std::string, std::uint64_t>>{{"a", 0}, {"b", 2}}));
+  EXPECT_TRUE(ReadRecords("", 4).empty());
+}
+
+TEST(RecordReader, CallsBeforeEveryRead)
+{
+  int reads = 0;
+  ReadRecords(std::string(100, 'a'), 10, &reads);
+  // Ten blocks, and the read that finds the end.
+  EXPECT_EQ(reads, 11);
+}
+
+TEST(VerdictWriter, Formats)
+{
+  const auto write = [](dfa::VerdictWriter::Format format) {
+    std::ostringstream out;
+    {
+      dfa::VerdictWriter writer(out, format);
+      writer.Write("ab", 0, dfa::Dfa::ACCEPTS);
+      writer.Write("a\"\\\t", 3, dfa::Dfa::INVALID_ALPHABET);
+      writer.Write("b", 8, dfa::Dfa::NO_TRANSITION);
+    }
+    return out.str();
+  };
+
+  EXPECT_EQ(write(dfa::VerdictWriter::ParseFormat("text")),
+            "ab -> ACCEPT\na\"\\\t -> INVALID ALPHABET\nb -> NO TRANSITION\n");
+  EXPECT_EQ(write(dfa::VerdictWriter::ParseFormat("codes")), "0\n2\n3\n");
+  EXPECT_EQ(write(dfa::VerdictWriter::ParseFormat("accepted")), "ab\n");
+  EXPECT_EQ(write(dfa::VerdictWriter::ParseFormat("jsonl")),
+            "{\"offset\":0,\"record\":\"ab\",\"verdict\":\"ACCEPT\"}\n"
+            "{\"offset\":3,\"record\":\"a\\\"\\\\\\u0009\",\"verdict\":\"INVALID ALPHABET\"}\n"
+            "{\"offset\":8,\"record\":\"b\",\"verdict\":\"NO TRANSITION\"}\n");
+  EXPECT_EQ(write(dfa::VerdictWriter::ParseFormat("binary")), std::string("\0\2\3", 3));
+  EXPECT_THROW(dfa::VerdictWriter::ParseFormat("xml"), std::invalid_argument);
+}
+
+TEST(VerdictWriter, ReplacesInvalidUtf8InJson)
+{
+  std::ostringstream out;
+  {
+    dfa::VerdictWriter writer(out, dfa::VerdictWriter::JSON_LINES);
+    // A valid two byte sequence, a lone continuation byte, a truncated sequence and a surrogate.
+    writer.Write("\xc3\xa9\x80\xe4\xb8\xed\xa0\x80", 0, dfa::Dfa::REJECTS);
+  }
+  EXPECT_EQ(out.str(),
+            "{\"offset\":0,\"record\":\"\xc3\xa9\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd"
+            "\xef\xbf\xbd\",\"verdict\":\"NOT ACCEPT\"}\n");
+}
+
+TEST(VerdictWriter, WritesInBlocks)
+{
+  std::ostringstream out;
+  dfa::VerdictWriter writer(out, dfa::VerdictWriter::CODES, 8);
+  for (int i = 0; i < 3; ++i)
+  {
+    writer.Write("a", 0, dfa::Dfa::REJECTS);
+  }
+  EXPECT_EQ(out.str(), "");
+
+  writer.Write("a", 0, dfa::Dfa::REJECTS);
+  EXPECT_EQ(out.str(), "1\n1\n1\n1\n");
+
+  writer.Write("a", 0, dfa::Dfa::ACCEPTS);
+  writer.Flush();
+  EXPECT_EQ(out.str(), "1\n1\n1\n1\n0\n");
+}
@@ -0,0 +1,120 @@
+/**
+ * @file regex_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include <gtest/gtest.h>
+
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "dfa/dfa.h"
+#include "dfa/test/test_util.h"
+
+TEST(Regex, MatchesStdRegex)
+{
+  // 'd' is outside the alphabet of most of these, so those inputs check INVALID_ALPHABET as well.
+  const std::vector<std::string> patterns = {
+      "", "a", "abc", "a|b", "ab|cd", "a*", "(ab)*", "a+b+", "a?b?c?", "(a|b)*abb", "a{2}", "a{2,}", "a{1,3}",
+      "(a|bc){0,2}", "[a-c]+", "[^a]*", "[ab]*c", "\\w{2,3}", "(?:a|b)c", "()a", "a(|b)", "^ab*$", "a**", "(a*)*b",
+      "[a-]+", "[]a]*", "(a?){3}", "((a|b)(c|d))+",
+  };
+  const auto inputs = dfa::test::AllStrings("abcd", 5);
+
+  for (const auto& pattern : patterns)
+  {
+    const auto dfa = dfa::Dfa::FromRegex(pattern);
+    // std::regex treats [] as an empty class, unlike POSIX.
+    const std::regex reference(pattern == "[]a]*" ? std::string("[\\]a]*") : pattern);
+    for (const auto& input : inputs)
+    {
+      const bool matches = std::regex_match(input, reference);
+      EXPECT_EQ(dfa.AcceptsString(input) == dfa::Dfa::ACCEPTS, matches) << pattern << " on \"" << input << '"';
+    }
+  }
+}
+
+TEST(Regex, Alphabet)
+{
+  const auto dfa = dfa::Dfa::FromRegex("[a-c]x|\\x41");
+  const dfa::Dfa::Alphabet expected = {"a", "b", "c", "x", "A"};
+  EXPECT_EQ(dfa.GetAlphabet(), expected);
+  EXPECT_EQ(dfa.GetStartState(), dfa::State("q0"));
+  EXPECT_EQ(dfa.AcceptsString("bx"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("A"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("xb"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_EQ(dfa.AcceptsString("dx"), dfa::Dfa::INVALID_ALPHABET);
+
+  const auto any = dfa::Dfa::FromRegex(".");
+  EXPECT_EQ(any.GetAlphabet().size(), 255);
+  EXPECT_EQ(any.AcceptsString("\xff"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(any.AcceptsString("\n"), dfa::Dfa::INVALID_ALPHABET);
+}
+
+TEST(Regex, Escapes)
+{
+  const auto dfa = dfa::Dfa::FromRegex("\\d+\\.\\d*[\\s\\-]\\(\\)");
+  EXPECT_EQ(dfa.AcceptsString("12.5 ()"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("1.-()"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("1\t.5 ()"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_EQ(dfa.AcceptsString(".5 ()"), dfa::Dfa::NO_TRANSITION);
+}
+
+TEST(Regex, BoundedCountsAreEquivalentToExpansions)
+{
+  std::string counterexample;
+  EXPECT_TRUE(dfa::Dfa::FromRegex("(ab){2,4}").Equivalent(dfa::Dfa::FromRegex("abab|ababab|abababab")));
+  EXPECT_TRUE(dfa::Dfa::FromRegex("a{3,}").Equivalent(dfa::Dfa::FromRegex("aaaa*")));
+  EXPECT_FALSE(dfa::Dfa::FromRegex("a{3,5}").Equivalent(dfa::Dfa::FromRegex("a{3,6}"), &counterexample));
+  EXPECT_EQ(counterexample, "aaaaaa");
+}
+
+TEST(Regex, MatchesNfaFile)
+{
+  const std::string nfa_file_contents =
+      "states: q1 q2 q3\n"
+      "alphabet: a b\n"
+      "startstate: q1\n"
+      "finalstate: q3\n"
+      "transition: q1 a q1\n"
+      "transition: q1 b q1\n"
+      "transition: q1 a q2\n"
+      "transition: q2 b q3";
+  EXPECT_TRUE(dfa::Dfa::FromRegex("[ab]*ab").Equivalent(dfa::Dfa(nfa_file_contents)));
+}
+
+TEST(Regex, SyntaxErrors)
+{
+  const std::vector<std::pair<std::string, std::string>> cases = {
+      {"(a", "Regex error at position 0: Unmatched '('"},
+      {"a)", "Regex error at position 1: Unmatched ')'"},
+      {"*a", "Regex error at position 0: Nothing to repeat"},
+      {"a|+", "Regex error at position 2: Nothing to repeat"},
+      {"[ab", "Regex error at position 0: Unmatched '['"},
+      {"[b-a]", "Regex error at position 1: Class range is out of order"},
+      {"a{2,1}", "Regex error at position 1: Repetition count range is out of order"},
+      {"a{x}", "Regex error at position 1: Invalid repetition count"},
+      {"a{1001}", "Regex error at position 1: Repetition count is larger than 1000"},
+      {"\\q", "Regex error at position 0: Unknown escape '\\q'"},
+      {"a\\", "Regex error at position 1: Trailing '\\'"},
+      {"a^", "Regex error at position 1: '^' is only supported at the start of the pattern"},
+      {"a$b", "Regex error at position 1: '$' is only supported at the end of the pattern"},
+      {std::string(2000, '('), "Regex error at position 1000: Too many nested operators"},
+  };
+
+  for (const auto& [pattern, message] : cases)
+  {
+    try
+    {
+      dfa::Dfa::FromRegex(pattern);
+      ADD_FAILURE() << pattern << " was accepted";
+    }
+    catch (const std::invalid_argument& e)
+    {
+      EXPECT_EQ(e.what(), message) << pattern;
+    }
+  }
+}
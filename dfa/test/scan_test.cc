@@ -0,0 +1,154 @@
+/**
+ * @file scan_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/scan.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+namespace fs = std::filesystem;
+
+const std::string kEndsInA =
+    "states: q0 q1\n"
+    "alphabet: a b\n"
+    "startstate: q0\n"
+    "finalstate: q1\n"
+    "transition: q0 a q1\n"
+    "transition: q0 b q0\n"
+    "transition: q1 a q1\n"
+    "transition: q1 b q0";
+
+/**
+ * A directory of files with random records, and the counts that matching them line by line gives.
+ */
+class ScanTest : public ::testing::Test
+{
+ protected:
+  void SetUp() override
+  {
+    directory_ = fs::temp_directory_path() /
+                 ("scan_test_" + std::string(::testing::UnitTest::GetInstance()->current_test_info()->name()));
+    fs::remove_all(directory_);
+    fs::create_directories(directory_ / "nested");
+
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> length(0, 40);
+    std::uniform_int_distribution<int> symbol(0, 20);
+    for (int i = 0; i < 12; ++i)
+    {
+      const fs::path path = directory_ / (i % 3 == 0 ? "nested" : "") / ("file" + std::to_string(i) + ".txt");
+      std::ofstream file(path);
+      dfa::ScanResult& expected = expected_[path];
+      expected.path = path;
+      for (int line = 0; line < i * 50; ++line)
+      {
+        std::string record;
+        for (int j = length(random); j > 0; --j)
+        {
+          const int s = symbol(random);
+          record += s == 0 ? 'c' : s % 2 == 0 ? 'a' : 'b';
+        }
+        // The last line of odd files has no newline.
+        file << record << (i % 2 == 1 && line == i * 50 - 1 ? "" : "\n");
+        if (!record.empty())
+        {
+          ++expected.verdicts[dfa_.AcceptsString(record)];
+        }
+      }
+    }
+  }
+
+  void TearDown() override { fs::remove_all(directory_); }
+
+  void ExpectMatchesReference(const dfa::ScanOptions& options)
+  {
+    const auto files = dfa::ExpandScanTargets({directory_.string()});
+    ASSERT_EQ(files.size(), expected_.size());
+
+    std::map<fs::path, dfa::ScanResult> results;
+    const auto total = dfa::Scan(dfa_, files, options, [&](const dfa::ScanResult& result) {
+      EXPECT_TRUE(results.emplace(result.path, result).second);
+    });
+
+    dfa::ScanResult expected_total;
+    for (const auto& [path, expected] : expected_)
+    {
+      ASSERT_NE(results.find(path), results.end()) << path;
+      EXPECT_EQ(results[path].verdicts, expected.verdicts) << path;
+      EXPECT_TRUE(results[path].error.empty()) << results[path].error;
+      for (std::size_t i = 0; i < expected.verdicts.size(); ++i)
+      {
+        expected_total.verdicts[i] += expected.verdicts[i];
+      }
+    }
+    EXPECT_EQ(total.verdicts, expected_total.verdicts);
+  }
+
+  const dfa::Dfa dfa_{kEndsInA};
+
+  fs::path directory_;
+
+  std::map<fs::path, dfa::ScanResult> expected_;
+};
+}  // namespace
+
+TEST_F(ScanTest, IoUring)
+{
+  dfa::ScanOptions options;
+  options.threads = 3;
+  options.queue_depth = 8;
+  options.block_size = 37;
+  ExpectMatchesReference(options);
+}
+
+TEST_F(ScanTest, Pread)
+{
+  dfa::ScanOptions options;
+  options.threads = 2;
+  options.queue_depth = 4;
+  options.block_size = 64;
+  options.io_uring = false;
+  ExpectMatchesReference(options);
+}
+
+TEST_F(ScanTest, LargeBlocks)
+{
+  ExpectMatchesReference(dfa::ScanOptions());
+}
+
+TEST_F(ScanTest, ReportsUnreadableFiles)
+{
+  const std::vector<fs::path> files = {directory_ / "missing.txt", directory_};
+  std::vector<dfa::ScanResult> results;
+  dfa::Scan(dfa_, files, dfa::ScanOptions(), [&](const dfa::ScanResult& result) { results.push_back(result); });
+
+  ASSERT_EQ(results.size(), 2U);
+  for (const auto& result : results)
+  {
+    EXPECT_FALSE(result.error.empty()) << result.path;
+    EXPECT_EQ(result.Records(), 0U);
+  }
+}
+
+TEST_F(ScanTest, ExpandTargets)
+{
+  const auto nested = dfa::ExpandScanTargets({(directory_ / "nested").string()});
+  EXPECT_EQ(nested.size(), 4U);
+  EXPECT_TRUE(std::is_sorted(nested.begin(), nested.end()));
+
+  const auto globbed = dfa::ExpandScanTargets({(directory_ / "file1?.txt").string()});
+  EXPECT_EQ(globbed, (std::vector<fs::path>{directory_ / "file10.txt", directory_ / "file11.txt"}));
+
+  EXPECT_THROW(dfa::ExpandScanTargets({(directory_ / "*.missing").string()}), std::runtime_error);
+}
@@ -0,0 +1,247 @@
+/**
+ * @file server_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/server.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dfa/client.h"
+#include "dfa/protocol.h"
+
+namespace
+{
+namespace fs = std::filesystem;
+
+const std::string kEndsInA =
+    "states: q0 q1\n"
+    "alphabet: a b\n"
+    "startstate: q0\n"
+    "finalstate: q1\n"
+    "transition: q0 a q1\n"
+    "transition: q0 b q0\n"
+    "transition: q1 a q1\n"
+    "transition: q1 b q0";
+
+const std::string kEndsInB =
+    "states: q0 q1\n"
+    "alphabet: a b\n"
+    "startstate: q0\n"
+    "finalstate: q1\n"
+    "transition: q0 b q1\n"
+    "transition: q0 a q0\n"
+    "transition: q1 b q1\n"
+    "transition: q1 a q0";
+
+/**
+ * Runs a Server over the two automata above in a background thread.
+ */
+class ServerTest : public ::testing::Test
+{
+ protected:
+  void SetUp() override
+  {
+    socket_path_ = fs::temp_directory_path() /
+                   ("server_test_" + std::string(::testing::UnitTest::GetInstance()->current_test_info()->name()));
+    const std::vector<const dfa::AtomicSnapshot*> automata = {&ends_in_a_, &ends_in_b_};
+    server_ = std::make_unique<dfa::Server>(socket_path_, automata, 2);
+    thread_ = std::thread([this] { server_->Run(); });
+  }
+
+  void TearDown() override
+  {
+    server_->Stop();
+    thread_.join();
+    server_.reset();
+    EXPECT_FALSE(fs::exists(socket_path_));
+  }
+
+  dfa::AtomicSnapshot ends_in_a_{std::make_shared<const dfa::Dfa>(kEndsInA)};
+
+  dfa::AtomicSnapshot ends_in_b_{std::make_shared<const dfa::Dfa>(kEndsInB)};
+
+  fs::path socket_path_;
+
+  std::unique_ptr<dfa::Server> server_;
+
+  std::thread thread_;
+};
+}  // namespace
+
+TEST(Protocol, RequestRoundTrip)
+{
+  const std::vector<std::string> records = {"ab", "", "epsilon", std::string(1000, 'a')};
+  std::string frame;
+  dfa::AppendRequest(7, records, frame);
+  ASSERT_EQ(dfa::FrameSize(frame.data()), frame.size() - dfa::kFrameHeaderSize);
+
+  std::uint32_t automaton;
+  std::vector<std::string_view> parsed;
+  const std::string_view payload = std::string_view(frame).substr(dfa::kFrameHeaderSize);
+  ASSERT_TRUE(dfa::ParseRequest(payload, automaton, parsed));
+  EXPECT_EQ(automaton, 7U);
+  EXPECT_EQ(std::vector<std::string>(parsed.begin(), parsed.end()), records);
+
+  EXPECT_FALSE(dfa::ParseRequest(payload.substr(0, payload.size() - 1), automaton, parsed));
+  EXPECT_FALSE(dfa::ParseRequest(std::string(payload) + 'x', automaton, parsed));
+}
+
+TEST(Protocol, ResponseRoundTrip)
+{
+  const std::vector<dfa::Dfa::Acceptance> verdicts = {dfa::Dfa::ACCEPTS, dfa::Dfa::NO_TRANSITION, dfa::Dfa::REJECTS};
+  std::string frame;
+  dfa::AppendResponse(dfa::BATCH_OK, verdicts, frame);
+
+  std::vector<dfa::Dfa::Acceptance> parsed;
+  EXPECT_EQ(dfa::ParseResponse(std::string_view(frame).substr(dfa::kFrameHeaderSize), parsed), dfa::BATCH_OK);
+  EXPECT_EQ(parsed, verdicts);
+  EXPECT_THROW(dfa::ParseResponse(std::string_view(frame).substr(dfa::kFrameHeaderSize + 1), parsed),
+               std::runtime_error);
+}
+
+TEST_F(ServerTest, ClassifiesBatches)
+{
+  dfa::Client client(socket_path_);
+  const std::vector<std::string> records = {"a", "ab", "bba", "epsilon", "abc"};
+  EXPECT_EQ(client.Classify(records, 0),
+            (std::vector<dfa::Dfa::Acceptance>{dfa::Dfa::ACCEPTS, dfa::Dfa::REJECTS, dfa::Dfa::ACCEPTS,
+                                               dfa::Dfa::REJECTS, dfa::Dfa::INVALID_ALPHABET}));
+  EXPECT_EQ(client.Classify(records, 1),
+            (std::vector<dfa::Dfa::Acceptance>{dfa::Dfa::REJECTS, dfa::Dfa::ACCEPTS, dfa::Dfa::REJECTS,
+                                               dfa::Dfa::REJECTS, dfa::Dfa::INVALID_ALPHABET}));
+  EXPECT_TRUE(client.Classify({}, 0).empty());
+}
+
+TEST_F(ServerTest, ServesConcurrentClients)
+{
+  std::vector<std::thread> clients;
+  std::vector<int> mismatches(8, 0);
+  for (std::size_t c = 0; c < mismatches.size(); ++c)
+  {
+    clients.emplace_back([this, c, &mismatches] {
+      dfa::Client client(socket_path_);
+      for (int batch = 0; batch < 20; ++batch)
+      {
+        std::vector<std::string> records;
+        for (std::size_t i = 0; i < 500; ++i)
+        {
+          records.push_back(std::string(i % 7, 'b') + ((i + c) % 2 == 0 ? "a" : "b"));
+        }
+        const auto verdicts = client.Classify(records, static_cast<std::uint32_t>(c % 2));
+        for (std::size_t i = 0; i < records.size(); ++i)
+        {
+          const bool ends_in_a = records[i].back() == 'a';
+          const bool accepts = verdicts[i] == dfa::Dfa::ACCEPTS;
+          mismatches[c] += accepts != (c % 2 == 0 ? ends_in_a : !ends_in_a);
+        }
+      }
+    });
+  }
+  for (auto& client : clients)
+  {
+    client.join();
+  }
+
+  EXPECT_EQ(mismatches, std::vector<int>(mismatches.size(), 0));
+}
+
+TEST_F(ServerTest, RejectsUnknownAutomaton)
+{
+  dfa::Client client(socket_path_);
+  EXPECT_THROW(client.Classify({"a"}, 2), std::runtime_error);
+
+  // The connection stays usable.
+  EXPECT_EQ(client.Classify({"a"}, 0), std::vector<dfa::Dfa::Acceptance>{dfa::Dfa::ACCEPTS});
+}
+
+TEST_F(ServerTest, UsesCurrentSnapshot)
+{
+  dfa::Client client(socket_path_);
+  EXPECT_EQ(client.Classify({"b"}, 0), std::vector<dfa::Dfa::Acceptance>{dfa::Dfa::REJECTS});
+
+  ends_in_a_.Store(std::make_shared<const dfa::Dfa>(kEndsInB));
+  EXPECT_EQ(client.Classify({"b"}, 0), std::vector<dfa::Dfa::Acceptance>{dfa::Dfa::ACCEPTS});
+}
+
+TEST_F(ServerTest, DropsConnectionsWithoutDescriptors)
+{
+  // Use up the descriptors of the process, which the server shares, except for one for the connection.
+  rlimit limit;
+  ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &limit), 0);
+  rlimit lowered = limit;
+  lowered.rlim_cur = 256;
+  ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &lowered), 0);
+  std::vector<int> fillers;
+  for (int fd; (fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) >= 0;)
+  {
+    fillers.push_back(fd);
+  }
+  ASSERT_FALSE(fillers.empty());
+  close(fillers.back());
+  fillers.pop_back();
+
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  std::strncpy(address.sun_path, socket_path_.c_str(), sizeof(address.sun_path) - 1);
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)), 0);
+
+  // The server can't accept the connection, so it closes it rather than leaving it pending.
+  pollfd hangup{fd, POLLIN, 0};
+  EXPECT_EQ(poll(&hangup, 1, 5000), 1);
+  char byte;
+  EXPECT_EQ(recv(fd, &byte, 1, 0), 0);
+  close(fd);
+
+  for (const int filler : fillers)
+  {
+    close(filler);
+  }
+  ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &limit), 0);
+  dfa::Client client(socket_path_);
+  EXPECT_EQ(client.Classify({"a"}, 0), std::vector<dfa::Dfa::Acceptance>{dfa::Dfa::ACCEPTS});
+}
+
+TEST_F(ServerTest, AnswersAfterPeerStopsSending)
+{
+  // The peer stops sending right after its request, so the server sees the end of input while the batch is with a
+  // worker, and has to pick the connection up again to write the response.
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  std::strncpy(address.sun_path, socket_path_.c_str(), sizeof(address.sun_path) - 1);
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)), 0);
+  std::string frame;
+  dfa::AppendRequest(0, std::vector<std::string>(100000, "ab"), frame);
+  ASSERT_EQ(send(fd, frame.data(), frame.size(), MSG_NOSIGNAL), static_cast<ssize_t>(frame.size()));
+  ASSERT_EQ(shutdown(fd, SHUT_WR), 0);
+
+  std::string response;
+  char buffer[4096];
+  for (ssize_t received; (received = recv(fd, buffer, sizeof(buffer), 0)) > 0;)
+  {
+    response.append(buffer, static_cast<std::size_t>(received));
+  }
+  close(fd);
+  ASSERT_GE(response.size(), dfa::kFrameHeaderSize);
+  std::vector<dfa::Dfa::Acceptance> verdicts;
+  EXPECT_EQ(dfa::ParseResponse(std::string_view(response).substr(dfa::kFrameHeaderSize), verdicts), dfa::BATCH_OK);
+  EXPECT_EQ(verdicts, std::vector<dfa::Dfa::Acceptance>(100000, dfa::Dfa::REJECTS));
+}
@@ -0,0 +1,231 @@
+/**
+ * @file snapshot_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/snapshot.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+namespace fs = std::filesystem;
+
+const std::string kOnlyA =
+    "states: q0 q1\n"
+    "alphabet: a b\n"
+    "startstate: q0\n"
+    "finalstate: q1\n"
+    "transition: q0 a q1\n"
+    "transition: q0 b q0\n"
+    "transition: q1 a q1\n"
+    "transition: q1 b q0";
+
+const std::string kOnlyB =
+    "states: q0 q1\n"
+    "alphabet: a b\n"
+    "startstate: q0\n"
+    "finalstate: q1\n"
+    "transition: q0 b q1\n"
+    "transition: q0 a q0\n"
+    "transition: q1 b q1\n"
+    "transition: q1 a q0";
+
+void WriteFile(const fs::path& path, const std::string& contents)
+{
+  std::ofstream(path) << contents;
+}
+
+/**
+ * Waits until the generation moves past the given one, or a few seconds passed.
+ */
+bool WaitForGeneration(const dfa::AtomicSnapshot& snapshot, std::uint64_t generation)
+{
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (snapshot.Generation() == generation)
+  {
+    if (std::chrono::steady_clock::now() > deadline)
+    {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return true;
+}
+
+class SnapshotFile : public ::testing::Test
+{
+ protected:
+  void SetUp() override
+  {
+    path_ = fs::temp_directory_path() /
+            ("snapshot_test_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()) + "_" +
+             ::testing::UnitTest::GetInstance()->current_test_info()->name() + ".dfa");
+    WriteFile(path_, kOnlyA);
+  }
+
+  void TearDown() override { fs::remove(path_); }
+
+  fs::path path_;
+};
+}  // namespace
+
+TEST(AtomicSnapshot, StoreReplacesAndCountsGenerations)
+{
+  dfa::AtomicSnapshot current(std::make_shared<const dfa::Dfa>(kOnlyA));
+  const auto first = current.Load();
+  EXPECT_EQ(current.Generation(), 0U);
+
+  current.Store(std::make_shared<const dfa::Dfa>(kOnlyB));
+  EXPECT_EQ(current.Generation(), 1U);
+
+  // The old Snapshot stays usable by whoever holds it.
+  EXPECT_EQ(first->AcceptsString("a"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(current.Load()->AcceptsString("a"), dfa::Dfa::REJECTS);
+  EXPECT_EQ(current.Load()->AcceptsString("b"), dfa::Dfa::ACCEPTS);
+}
+
+TEST(AtomicSnapshot, ReadersSeeWholeSnapshots)
+{
+  const dfa::Snapshot only_a = std::make_shared<const dfa::Dfa>(kOnlyA);
+  const dfa::Snapshot only_b = std::make_shared<const dfa::Dfa>(kOnlyB);
+  dfa::AtomicSnapshot current(only_a);
+
+  std::atomic<bool> done{false};
+  std::atomic<std::size_t> mismatches{0};
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i)
+  {
+    readers.emplace_back([&] {
+      while (!done.load())
+      {
+        // Each Snapshot accepts exactly one of these, whichever one is current.
+        const auto snapshot = current.Load();
+        const bool accepts_a = snapshot->AcceptsString("aa") == dfa::Dfa::ACCEPTS;
+        const bool accepts_b = snapshot->AcceptsString("bb") == dfa::Dfa::ACCEPTS;
+        if (accepts_a == accepts_b)
+        {
+          ++mismatches;
+        }
+      }
+    });
+  }
+
+  for (int i = 0; i < 1000; ++i)
+  {
+    current.Store(i % 2 == 0 ? only_b : only_a);
+  }
+  done = true;
+  for (auto& reader : readers)
+  {
+    reader.join();
+  }
+
+  EXPECT_EQ(mismatches.load(), 0U);
+  EXPECT_EQ(current.Generation(), 1000U);
+}
+
+TEST_F(SnapshotFile, LoadSnapshot)
+{
+  EXPECT_EQ(dfa::LoadSnapshot(path_)->AcceptsString("a"), dfa::Dfa::ACCEPTS);
+  EXPECT_THROW(dfa::LoadSnapshot(path_.string() + ".missing"), std::runtime_error);
+
+  WriteFile(path_, "");
+  EXPECT_THROW(dfa::LoadSnapshot(path_), std::runtime_error);
+}
+
+TEST_F(SnapshotFile, LoadCompiledSnapshot)
+{
+  const auto compiled_path = path_.string() + "c";
+  {
+    std::ofstream out(compiled_path, std::ios::binary);
+    dfa::LoadSnapshot(path_)->Save(out);
+  }
+  EXPECT_EQ(dfa::LoadSnapshot(compiled_path)->AcceptsString("a"), dfa::Dfa::ACCEPTS);
+  fs::remove(compiled_path);
+}
+
+TEST_F(SnapshotFile, ReloadsChangedFile)
+{
+  const auto loaded_time = dfa::SnapshotReloader::ModificationTime(path_);
+  dfa::AtomicSnapshot current(dfa::LoadSnapshot(path_));
+  dfa::SnapshotReloader reloader(path_, dfa::Options(), current, loaded_time, nullptr, std::chrono::milliseconds(10));
+
+  WriteFile(path_, kOnlyB);
+  // Make sure the modification time differs, even on file systems with coarse timestamps.
+  fs::last_write_time(path_, fs::last_write_time(path_) + std::chrono::seconds(1));
+
+  ASSERT_TRUE(WaitForGeneration(current, 0));
+  EXPECT_EQ(current.Load()->AcceptsString("b"), dfa::Dfa::ACCEPTS);
+}
+
+TEST_F(SnapshotFile, KeepsSnapshotOnFailedReload)
+{
+  const auto loaded_time = dfa::SnapshotReloader::ModificationTime(path_);
+  dfa::AtomicSnapshot current(dfa::LoadSnapshot(path_));
+  std::atomic<std::size_t> errors{0};
+  dfa::SnapshotReloader reloader(
+      path_, dfa::Options(), current, loaded_time, [&](const std::string&) { ++errors; },
+      std::chrono::milliseconds(10));
+
+  WriteFile(path_, "states: q0\nnosuchsection: q1");
+  reloader.RequestReload();
+
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (errors.load() == 0 && std::chrono::steady_clock::now() < deadline)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  EXPECT_GE(errors.load(), 1U);
+  EXPECT_EQ(current.Generation(), 0U);
+  EXPECT_EQ(current.Load()->AcceptsString("a"), dfa::Dfa::ACCEPTS);
+}
+
+TEST_F(SnapshotFile, ReloadsOnRequest)
+{
+  const auto loaded_time = dfa::SnapshotReloader::ModificationTime(path_);
+  dfa::AtomicSnapshot current(dfa::LoadSnapshot(path_));
+  dfa::SnapshotReloader reloader(path_, dfa::Options(), current, loaded_time, nullptr, std::chrono::milliseconds(10));
+
+  reloader.RequestReload();
+  ASSERT_TRUE(WaitForGeneration(current, 0));
+  EXPECT_EQ(current.Load()->AcceptsString("a"), dfa::Dfa::ACCEPTS);
+}
+
+TEST_F(SnapshotFile, ReloadsAllOnRequest)
+{
+  const auto loaded_time = dfa::SnapshotReloader::ModificationTime(path_);
+  dfa::AtomicSnapshot first(dfa::LoadSnapshot(path_));
+  dfa::AtomicSnapshot second(dfa::LoadSnapshot(path_));
+  dfa::SnapshotReloader first_reloader(path_, dfa::Options(), first, loaded_time, nullptr,
+                                       std::chrono::milliseconds(10));
+  dfa::SnapshotReloader second_reloader(path_, dfa::Options(), second, loaded_time, nullptr,
+                                        std::chrono::milliseconds(10));
+
+  dfa::SnapshotReloader::RequestAllReloads();
+  ASSERT_TRUE(WaitForGeneration(first, 0));
+  ASSERT_TRUE(WaitForGeneration(second, 0));
+}
+
+TEST_F(SnapshotFile, ReloadsFileChangedWhileLoading)
+{
+  const auto loaded_time = dfa::SnapshotReloader::ModificationTime(path_);
+  dfa::AtomicSnapshot current(dfa::LoadSnapshot(path_));
+
+  // The file changes after it was loaded, but before the reloader starts watching it.
+  WriteFile(path_, kOnlyB);
+  fs::last_write_time(path_, fs::last_write_time(path_) + std::chrono::seconds(1));
+  dfa::SnapshotReloader reloader(path_, dfa::Options(), current, loaded_time, nullptr, std::chrono::milliseconds(10));
+
+  ASSERT_TRUE(WaitForGeneration(current, 0));
+  EXPECT_EQ(current.Load()->AcceptsString("b"), dfa::Dfa::ACCEPTS);
+}
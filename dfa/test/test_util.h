@@ -0,0 +1,39 @@
+/**
+ * @file test_util.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace dfa
+{
+namespace test
+{
+/**
+ * Every string over symbols of at most max_length, shortest first, to compare matchers exhaustively.
+ */
+inline std::vector<std::string> AllStrings(const std::string& symbols, std::size_t max_length)
+{
+  std::vector<std::string> strings = {""};
+  for (std::size_t begin = 0, length = 0; length < max_length; ++length)
+  {
+    const std::size_t end = strings.size();
+    for (std::size_t i = begin; i < end; ++i)
+    {
+      for (const char symbol : symbols)
+      {
+        strings.push_back(strings[i] + symbol);
+      }
+    }
+    begin = end;
+  }
+  return strings;
+}
+
+}  // namespace test
+}  // namespace dfa
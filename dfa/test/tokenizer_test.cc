@@ -0,0 +1,224 @@
+/**
+ * @file tokenizer_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/tokenizer.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <memory_resource>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dfa/dfa.h"
+
+namespace
+{
+const std::string kVerbs =
+    "states: q0 q1 q2\n"
+    "alphabet: GET POST PUT / x\n"
+    "startstate: q0\n"
+    "finalstate: q2\n"
+    "transition: q0 GET q1\n"
+    "transition: q0 POST q1\n"
+    "transition: q1 / q2\n"
+    "transition: q2 x q2";
+
+/**
+ * Splits input by longest match and runs the Symbols through a DFA, one at a time.
+ */
+dfa::Dfa::Acceptance Reference(const std::vector<std::string>& symbols,
+                               const std::map<std::pair<std::string, std::string>, std::string>& transitions,
+                               const std::string& final_state, const std::string& input)
+{
+  std::string state = "q0";
+  for (std::size_t pos = 0; pos < input.size();)
+  {
+    std::string longest;
+    for (const auto& symbol : symbols)
+    {
+      if (input.compare(pos, symbol.size(), symbol) == 0 && symbol.size() > longest.size())
+      {
+        longest = symbol;
+      }
+    }
+    if (longest.empty())
+    {
+      return dfa::Dfa::INVALID_ALPHABET;
+    }
+    const auto next = transitions.find({state, longest});
+    if (next == transitions.end())
+    {
+      return dfa::Dfa::NO_TRANSITION;
+    }
+    state = next->second;
+    pos += longest.size();
+  }
+  return state == final_state ? dfa::Dfa::ACCEPTS : dfa::Dfa::REJECTS;
+}
+
+/**
+ * Builds a DFA from the Symbols and transitions, and checks that it matches every input of up to max_pieces pieces like
+ * the reference does.
+ */
+void ExpectReferenceMatches(const std::vector<std::string>& symbols,
+                            const std::map<std::pair<std::string, std::string>, std::string>& transitions,
+                            const std::vector<std::string>& pieces, std::size_t max_pieces)
+{
+  std::string file = "states: q0 q1 q2\nalphabet:";
+  for (const auto& symbol : symbols)
+  {
+    file += " " + symbol;
+  }
+  file += "\nstartstate: q0\nfinalstate: q2\n";
+  for (const auto& [key, target] : transitions)
+  {
+    file += "transition: " + key.first + " " + key.second + " " + target + "\n";
+  }
+  const dfa::Dfa dfa(file);
+
+  std::vector<std::string> inputs = {""};
+  for (std::size_t begin = 0, length = 0; length < max_pieces; ++length)
+  {
+    const std::size_t end = inputs.size();
+    for (std::size_t i = begin; i < end; ++i)
+    {
+      for (const auto& piece : pieces)
+      {
+        inputs.push_back(inputs[i] + piece);
+      }
+    }
+    begin = end;
+  }
+  for (const auto& input : inputs)
+  {
+    EXPECT_EQ(dfa.AcceptsString(input), Reference(symbols, transitions, "q2", input)) << input;
+  }
+}
+}  // namespace
+
+TEST(Tokenizer, MatchesWholeSymbols)
+{
+  const dfa::Dfa dfa(kVerbs);
+  EXPECT_EQ(dfa.AcceptsString("GET/xx"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("POST/"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("GET"), dfa::Dfa::REJECTS);
+  EXPECT_EQ(dfa.AcceptsString("PUT/"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_EQ(dfa.AcceptsString("GET/GET"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_EQ(dfa.AcceptsString("GE"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("GEX"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("G/"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("GET/y"), dfa::Dfa::INVALID_ALPHABET);
+}
+
+TEST(Tokenizer, LongestMatchAgreesWithReference)
+{
+  ExpectReferenceMatches({"a", "b", "ab", "abc", "bca", "c"},
+                         {
+                             {{"q0", "a"}, "q0"},
+                             {{"q0", "b"}, "q1"},
+                             {{"q0", "abc"}, "q2"},
+                             {{"q1", "c"}, "q0"},
+                             {{"q1", "ab"}, "q2"},
+                             {{"q2", "bca"}, "q0"},
+                             {{"q2", "a"}, "q1"},
+                         },
+                         {"a", "b", "c", "d"}, 7);
+}
+
+TEST(Tokenizer, LongestMatchOfScalarValuesAgreesWithReference)
+{
+  // "é" and "è" share a lead byte, and "é" is a prefix of tokens while "è" isn't.
+  const std::string e_acute = "\xC3\xA9";
+  const std::string e_grave = "\xC3\xA8";
+  ExpectReferenceMatches({"a", "t", e_acute, e_grave, e_acute + "t", "t" + e_acute, e_acute + "t" + e_acute},
+                         {
+                             {{"q0", "a"}, "q0"},
+                             {{"q0", e_acute}, "q1"},
+                             {{"q0", e_acute + "t"}, "q2"},
+                             {{"q1", "t"}, "q2"},
+                             {{"q1", e_grave}, "q0"},
+                             {{"q2", "t" + e_acute}, "q0"},
+                             {{"q2", e_acute + "t" + e_acute}, "q1"},
+                             {{"q2", e_grave}, "q2"},
+                         },
+                         {"a", "t", e_acute, e_grave, "\xC3"}, 6);
+}
+
+TEST(Tokenizer, SaveAndLoad)
+{
+  const dfa::Dfa dfa(kVerbs);
+  std::stringstream file;
+  dfa.Save(file);
+  const auto loaded = dfa::Dfa::Load(file);
+
+  EXPECT_TRUE(loaded.Equivalent(dfa));
+  const dfa::Dfa::Alphabet bytes = {"/", "x"};
+  EXPECT_EQ(loaded.GetAlphabet(), bytes);
+  for (const std::string input : {"GET/xx", "POST/", "GET", "PUT/", "GE", "G/"})
+  {
+    EXPECT_EQ(loaded.AcceptsString(input), dfa.AcceptsString(input)) << input;
+  }
+}
+
+TEST(Tokenizer, CompilesIntermediateStates)
+{
+  // "ab" from state 0 goes to 1; "a" and "b" loop. "a" alone is an intermediate state, since "ab" may follow.
+  dfa::SymbolSet symbols;
+  symbols.bytes['a'] = symbols.bytes['b'] = true;
+  symbols.tokens = {"ab"};
+  dfa::TokenCompiler compiler(symbols);
+
+  std::pmr::vector<dfa::CompiledDfa::StateId> table(2 * 256, dfa::CompiledDfa::kInvalidSymbol);
+  table['a'] = table['b'] = 0;
+  table[256 + 'a'] = table[256 + 'b'] = dfa::CompiledDfa::kNoTransition;
+  const std::pmr::vector<dfa::TokenCompiler::Transitions> transitions = {{{0, 1}}, {}};
+  std::vector<dfa::CompiledDfa::StateId> ends;
+  compiler.Compile(transitions, table, ends);
+
+  ASSERT_EQ(ends.size(), 4);
+  ASSERT_EQ(table.size(), ends.size() * 256);
+  EXPECT_EQ(table['a'], 2);
+  EXPECT_EQ(table['b'], 0);
+  EXPECT_EQ(table['c'], dfa::CompiledDfa::kInvalidSymbol);
+  EXPECT_EQ(table[256 + 'a'], 3);
+  EXPECT_EQ(table[256 + 'b'], dfa::CompiledDfa::kNoTransition);
+  EXPECT_EQ(table[2 * 256 + 'b'], 1);
+  EXPECT_EQ(table[2 * 256 + 'a'], 2);
+  EXPECT_EQ(table[2 * 256 + 'c'], dfa::CompiledDfa::kInvalidSymbol);
+  EXPECT_EQ(ends[0], 0);
+  EXPECT_EQ(ends[1], 1);
+  EXPECT_EQ(ends[2], 0);
+  EXPECT_EQ(ends[3], dfa::CompiledDfa::kNoTransition);
+}
+
+TEST(Tokenizer, KeepsScalarRangesShared)
+{
+  // A token among the whole of Unicode only adds intermediate states for its own bytes.
+  const dfa::Dfa dfa(std::string("states: q0 q1\n"
+                                 "alphabet: \xC2\x80-\xF4\x8F\xBF\xBF GET \xC3\xA9t\xC3\xA9 /\n"
+                                 "startstate: q0\n"
+                                 "finalstate: q1\n"
+                                 "transition: q0 \xC2\x80-\xF4\x8F\xBF\xBF q0\n"
+                                 "transition: q0 GET q1\n"
+                                 "transition: q0 \xC3\xA9t\xC3\xA9 q1\n"
+                                 "transition: q1 / q0"));
+  EXPECT_LT(dfa.MemoryUsage().tables, 64 * 1024);
+
+  EXPECT_EQ(dfa.AcceptsString("GET"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("\xE4\xB8\x80\xF0\x9F\x98\x80GET"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("\xC3\xA9t\xC3\xA9"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("\xC3\xA9t\xC3\xA9/\xC3\xA9GET"), dfa::Dfa::ACCEPTS);
+  // "é" on its own is a scalar value, and so is "è", which shares its lead byte with the token "été".
+  EXPECT_EQ(dfa.AcceptsString("\xC3\xA9"), dfa::Dfa::REJECTS);
+  EXPECT_EQ(dfa.AcceptsString("\xC3\xA8GET"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("\xC3\xA9t"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("\xC3"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("GE"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("/"), dfa::Dfa::NO_TRANSITION);
+}
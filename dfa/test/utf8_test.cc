@@ -0,0 +1,191 @@
+/**
+ * @file utf8_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/utf8.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "dfa/dfa.h"
+
+namespace
+{
+const std::string kGreek =
+    "states: q1 q2\n"
+    "alphabet: a é α-ω\n"
+    "startstate: q1\n"
+    "finalstate: q2\n"
+    "transition: q1 é q2\n"
+    "transition: q2 α q2\n"
+    "transition: q2 a q1";
+}  // namespace
+
+TEST(Utf8, DecodeScalar)
+{
+  EXPECT_EQ(dfa::DecodeScalar("é"), char32_t{0xE9});
+  EXPECT_EQ(dfa::DecodeScalar("中"), char32_t{0x4E2D});
+  EXPECT_EQ(dfa::DecodeScalar("\xF0\x9F\x98\x80"), char32_t{0x1F600});
+  EXPECT_EQ(dfa::DecodeScalar("a"), std::nullopt);
+  EXPECT_EQ(dfa::DecodeScalar("ab"), std::nullopt);
+  EXPECT_EQ(dfa::DecodeScalar("\xC3"), std::nullopt);
+  EXPECT_EQ(dfa::DecodeScalar("éa"), std::nullopt);
+  EXPECT_EQ(dfa::DecodeScalar("\xC0\x80"), std::nullopt);
+  EXPECT_EQ(dfa::DecodeScalar("\xE0\x80\x80"), std::nullopt);
+  EXPECT_EQ(dfa::DecodeScalar("\xED\xA0\x80"), std::nullopt);
+  EXPECT_EQ(dfa::DecodeScalar("\xF4\x90\x80\x80"), std::nullopt);
+}
+
+TEST(Utf8, ParseRange)
+{
+  const auto bytes = dfa::ParseRange("a-z");
+  ASSERT_TRUE(bytes);
+  EXPECT_EQ(bytes->low, char32_t{'a'});
+  EXPECT_EQ(bytes->high, char32_t{'z'});
+  EXPECT_TRUE(bytes->bytes);
+
+  const auto greek = dfa::ParseRange("α-ω");
+  ASSERT_TRUE(greek);
+  EXPECT_EQ(greek->low, char32_t{0x3B1});
+  EXPECT_EQ(greek->high, char32_t{0x3C9});
+  EXPECT_FALSE(greek->bytes);
+
+  const auto mixed = dfa::ParseRange("a-é");
+  ASSERT_TRUE(mixed);
+  EXPECT_FALSE(mixed->bytes);
+
+  EXPECT_FALSE(dfa::ParseRange("-"));
+  EXPECT_FALSE(dfa::ParseRange("a-"));
+  EXPECT_FALSE(dfa::ParseRange("ab-c"));
+  EXPECT_FALSE(dfa::ParseRange("a-bc"));
+  EXPECT_THROW(dfa::ParseRange("z-a"), std::runtime_error);
+  EXPECT_THROW(dfa::ParseRange("ω-α"), std::runtime_error);
+  EXPECT_THROW(dfa::ParseRange("\xFF-é"), std::runtime_error);
+}
+
+TEST(Utf8, LabelRange)
+{
+  const auto byte = dfa::LabelRange("a");
+  ASSERT_TRUE(byte);
+  EXPECT_EQ(byte->low, U'a');
+  EXPECT_EQ(byte->high, U'a');
+  EXPECT_TRUE(byte->bytes);
+  const auto scalar = dfa::LabelRange("é");
+  ASSERT_TRUE(scalar);
+  EXPECT_EQ(scalar->low, char32_t{0xE9});
+  EXPECT_FALSE(scalar->bytes);
+  EXPECT_TRUE(dfa::LabelRange("a-z"));
+  EXPECT_FALSE(dfa::LabelRange("GET"));
+  EXPECT_THROW(dfa::LabelRange("z-a"), std::runtime_error);
+
+  EXPECT_EQ(dfa::RangeLabel({U'a', U'z', true}), "a-z");
+  EXPECT_EQ(dfa::RangeLabel({U'a', U'a', true}), "a");
+  EXPECT_EQ(dfa::RangeLabel({0x80, 0xFF, true}), "\x80-\xFF");
+  EXPECT_EQ(dfa::RangeLabel({U'a', 0xE9, false}), "a-é");
+  EXPECT_EQ(dfa::RangeLabel({0x3B1, 0x3B1, false}), "α");
+}
+
+TEST(Utf8, OverlappingRanges)
+{
+  const dfa::Dfa dfa(std::string(
+      "states: q1 q2\n"
+      "alphabet: a-z α-ω\n"
+      "startstate: q1\n"
+      "finalstate: q2\n"
+      "transition: q1 a-ω q1\n"
+      "transition: q1 β-δ q2"));
+  EXPECT_EQ(dfa.AcceptsString("aωγ"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("γa"), dfa::Dfa::REJECTS);
+  EXPECT_EQ(dfa.AcceptsString("é"), dfa::Dfa::INVALID_ALPHABET);
+
+  // The start state splits the range where β-δ starts and ends.
+  const dfa::Dfa::Transitions start = {{"a-α", {"q1"}}, {"β-δ", {"q1", "q2"}}, {"ε-ω", {"q1"}}};
+  EXPECT_EQ(dfa.GetTransitions().at({"q1"}), start);
+}
+
+TEST(Utf8, CollectSymbols)
+{
+  const auto symbols = dfa::CollectSymbols({"a", "é", "α-ω", "ab", "0-2", "x-ê"});
+  for (const char byte : std::string("a012xyz"))
+  {
+    EXPECT_TRUE(symbols.bytes[static_cast<unsigned char>(byte)]) << byte;
+  }
+  EXPECT_FALSE(symbols.bytes['b']);
+  const std::vector<std::pair<char32_t, char32_t>> scalars = {{0x80, 0xEA}, {0x3B1, 0x3C9}};
+  EXPECT_EQ(symbols.scalars, scalars);
+
+  EXPECT_THROW(dfa::CollectSymbols({"\xFF", "é"}), std::runtime_error);
+  EXPECT_NO_THROW(dfa::CollectSymbols({"\xFF", "\x80-\x90"}));
+}
+
+TEST(Utf8, MatchesScalars)
+{
+  const dfa::Dfa dfa(kGreek);
+  EXPECT_EQ(dfa.AcceptsString("é"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("éαα"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("éaé"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("éa"), dfa::Dfa::REJECTS);
+  EXPECT_EQ(dfa.AcceptsString("éβ"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_EQ(dfa.AcceptsString("α"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_EQ(dfa.AcceptsString("è"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("b"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("\xC3"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("\xC3" "a"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("\xA9"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("\xC1\xA9"), dfa::Dfa::INVALID_ALPHABET);
+}
+
+TEST(Utf8, AbsorbingStatesCheckTheRestOfTheInput)
+{
+  const dfa::Dfa dfa(std::string(
+      "states: q1 q2\n"
+      "alphabet: a é 一-龥\n"
+      "startstate: q1\n"
+      "finalstate: q2\n"
+      "transition: q1 中 q2\n"
+      "transition: q2 a q2\n"
+      "transition: q2 é q2"));
+  EXPECT_EQ(dfa.AcceptsString("中"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("中aéa"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(dfa.AcceptsString("国"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_EQ(dfa.AcceptsString("中国"), dfa::Dfa::NO_TRANSITION);
+  EXPECT_EQ(dfa.AcceptsString("中a\xC3"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("中a\xA9"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(dfa.AcceptsString("中aè"), dfa::Dfa::INVALID_ALPHABET);
+}
+
+TEST(Utf8, SaveAndLoad)
+{
+  const dfa::Dfa dfa(kGreek);
+  std::stringstream file;
+  dfa.Save(file);
+  const auto loaded = dfa::Dfa::Load(file);
+
+  EXPECT_TRUE(loaded.Equivalent(dfa));
+  const dfa::Dfa::Alphabet bytes = {"a"};
+  EXPECT_EQ(loaded.GetAlphabet(), bytes);
+  for (const std::string input : {"é", "éαα", "éa", "éβ", "è", "\xC3", "\xA9"})
+  {
+    EXPECT_EQ(loaded.AcceptsString(input), dfa.AcceptsString(input)) << input;
+  }
+}
+
+TEST(Utf8, EquivalenceIsOverScalars)
+{
+  std::string counterexample;
+  const dfa::Dfa other(std::string(
+      "states: q1 q2\n"
+      "alphabet: a é α-ω\n"
+      "startstate: q1\n"
+      "finalstate: q2\n"
+      "transition: q1 é q2\n"
+      "transition: q2 β q2\n"
+      "transition: q2 a q1"));
+  EXPECT_FALSE(dfa::Dfa(kGreek).Equivalent(other, &counterexample));
+  EXPECT_EQ(counterexample, "éα");
+}
@@ -0,0 +1,138 @@
+/**
+ * @file verdict_cache_test.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "dfa/verdict_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace
+{
+const std::string kOnlyA =
+    "states: q0 q1\n"
+    "alphabet: a b\n"
+    "startstate: q0\n"
+    "finalstate: q1\n"
+    "transition: q0 a q1\n"
+    "transition: q0 b q0\n"
+    "transition: q1 a q1\n"
+    "transition: q1 b q0";
+
+const std::string kOnlyB =
+    "states: q0 q1\n"
+    "alphabet: a b\n"
+    "startstate: q0\n"
+    "finalstate: q1\n"
+    "transition: q0 b q1\n"
+    "transition: q0 a q0\n"
+    "transition: q1 b q1\n"
+    "transition: q1 a q0";
+
+TEST(VerdictCache, HitsRepeatedInputs)
+{
+  const dfa::Dfa dfa(kOnlyA);
+  dfa::VerdictCache cache(16, 1);
+  EXPECT_EQ(cache.Match(dfa, 0, "aba"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(cache.Match(dfa, 0, "ab"), dfa::Dfa::REJECTS);
+  EXPECT_EQ(cache.Match(dfa, 0, "abc"), dfa::Dfa::INVALID_ALPHABET);
+  EXPECT_EQ(cache.Match(dfa, 0, "aba"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(cache.Match(dfa, 0, "ab"), dfa::Dfa::REJECTS);
+
+  const auto stats = cache.Stats();
+  EXPECT_EQ(stats.hits, 2);
+  EXPECT_EQ(stats.misses, 3);
+  EXPECT_DOUBLE_EQ(stats.HitRate(), 0.4);
+}
+
+TEST(VerdictCache, CachesEmptyInput)
+{
+  // A default-constructed string_view has a null data().
+  const dfa::Dfa dfa(kOnlyA);
+  dfa::VerdictCache cache(16, 1);
+  EXPECT_EQ(cache.Match(dfa, 0, std::string_view()), dfa::Dfa::REJECTS);
+  EXPECT_EQ(cache.Match(dfa, 0, ""), dfa::Dfa::REJECTS);
+  EXPECT_EQ(cache.Stats().hits, 1);
+}
+
+TEST(VerdictCache, EvictsWithClock)
+{
+  const dfa::Dfa dfa(kOnlyA);
+  dfa::VerdictCache cache(2, 1);
+  cache.Match(dfa, 0, "a");
+  cache.Match(dfa, 0, "b");
+  cache.Match(dfa, 0, "a");
+
+  // "a" was hit, so the hand passes it and evicts "b".
+  cache.Match(dfa, 0, "aa");
+  EXPECT_EQ(cache.Stats().evictions, 1);
+  cache.Match(dfa, 0, "a");
+  EXPECT_EQ(cache.Stats().hits, 2);
+  cache.Match(dfa, 0, "b");
+  EXPECT_EQ(cache.Stats().hits, 2);
+}
+
+TEST(VerdictCache, BypassesLongInputs)
+{
+  const dfa::Dfa dfa(kOnlyA);
+  dfa::VerdictCache cache(16, 1, 4);
+  const std::string input(100, 'a');
+  EXPECT_EQ(cache.Match(dfa, 0, input), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(cache.Match(dfa, 0, input), dfa::Dfa::ACCEPTS);
+  const auto stats = cache.Stats();
+  EXPECT_EQ(stats.bypassed, 2);
+  EXPECT_EQ(stats.hits + stats.misses, 0);
+}
+
+TEST(VerdictCache, InvalidatedBySnapshotStore)
+{
+  dfa::AtomicSnapshot automaton(std::make_shared<const dfa::Dfa>(kOnlyA));
+  dfa::VerdictCache cache(16, 1);
+  EXPECT_EQ(cache.Match(automaton, "a"), dfa::Dfa::ACCEPTS);
+  EXPECT_EQ(cache.Match(automaton, "a"), dfa::Dfa::ACCEPTS);
+
+  automaton.Store(std::make_shared<const dfa::Dfa>(kOnlyB));
+  EXPECT_EQ(cache.Match(automaton, "a"), dfa::Dfa::REJECTS);
+  EXPECT_EQ(cache.Match(automaton, "a"), dfa::Dfa::REJECTS);
+
+  // A reader that still holds the previous Snapshot isn't served newer verdicts.
+  const dfa::Dfa previous(kOnlyA);
+  EXPECT_EQ(cache.Match(previous, 0, "a"), dfa::Dfa::ACCEPTS);
+
+  const auto stats = cache.Stats();
+  EXPECT_EQ(stats.hits, 2);
+  EXPECT_EQ(stats.invalidations, 1);
+  EXPECT_EQ(stats.bypassed, 1);
+}
+
+TEST(VerdictCache, ConcurrentMatches)
+{
+  const dfa::Dfa dfa(kOnlyA);
+  dfa::VerdictCache cache(64, 2);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t)
+  {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 10000; ++i)
+      {
+        const std::string input(static_cast<std::size_t>(i % 16), i % 32 < 16 ? 'a' : 'b');
+        ASSERT_EQ(cache.Match(dfa, 0, input), dfa.AcceptsString(input));
+      }
+    });
+  }
+  for (auto& thread : threads)
+  {
+    thread.join();
+  }
+  const auto stats = cache.Stats();
+  EXPECT_EQ(stats.hits + stats.misses, 80000);
+  EXPECT_GT(stats.HitRate(), 0.5);
+}
+}  // namespace
@@ -0,0 +1,233 @@
+/**
+ * @file tokenizer.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "tokenizer.h"
+
+#include <algorithm>
+#include <tuple>
+
+namespace dfa
+{
+namespace
+{
+constexpr std::size_t kNumBytes = 256;
+
+/**
+ * Whether a path of the trie is a single byte or scalar value of the Alphabet.
+ */
+bool IsSingle(const SymbolSet& symbols, std::string_view path)
+{
+  if (path.size() == 1)
+  {
+    return symbols.bytes[static_cast<unsigned char>(path[0])];
+  }
+  const auto scalar = DecodeScalar(path);
+  if (!scalar)
+  {
+    return false;
+  }
+  const auto range = std::upper_bound(symbols.scalars.begin(), symbols.scalars.end(), *scalar,
+                                      [](char32_t value, const auto& r) { return value < r.first; });
+  return range != symbols.scalars.begin() && *scalar <= std::prev(range)->second;
+}
+}  // namespace
+
+TokenCompiler::TokenCompiler(const SymbolSet& symbols, std::pmr::memory_resource* memory)
+    : memory_(memory), nodes_(memory), children_(memory), config_ids_(memory), configs_(memory)
+{
+  nodes_.push_back({kNone, 0, 0, kNone, kNone, true});
+  for (std::size_t i = 0; i < symbols.tokens.size(); ++i)
+  {
+    const std::string& token = symbols.tokens[i];
+    std::uint32_t node = kRoot;
+    for (std::size_t length = 1; length <= token.size(); ++length)
+    {
+      const auto byte = static_cast<unsigned char>(token[length - 1]);
+      const auto [iter, inserted] =
+          children_.emplace((static_cast<std::uint64_t>(node) << 8U) | byte, static_cast<std::uint32_t>(nodes_.size()));
+      if (inserted)
+      {
+        nodes_[node].leaf = false;
+        const bool single = IsSingle(symbols, std::string_view(token).substr(0, length));
+        nodes_.push_back({node, byte, nodes_[node].depth + 1, single ? kSingle : kNone, kNone, true});
+      }
+      node = iter->second;
+    }
+    nodes_[node].symbol = static_cast<std::uint32_t>(i);
+  }
+
+  // Parents come before their children.
+  for (std::size_t n = 1; n < nodes_.size(); ++n)
+  {
+    nodes_[n].longest = nodes_[n].symbol != kNone ? static_cast<std::uint32_t>(n) : nodes_[nodes_[n].parent].longest;
+  }
+}
+
+void TokenCompiler::Compile(const std::pmr::vector<Transitions>& transitions, std::pmr::vector<StateId>& byte_table,
+                            std::vector<StateId>& ends)
+{
+  transitions_ = &transitions;
+  base_ = &byte_table;
+  num_base_rows_ = byte_table.size() / kNumBytes;
+  config_ids_.clear();
+  configs_.clear();
+
+  // Rows of DFA states only change where a token starts. The base rows are still read while intermediate states are
+  // discovered, so the changes are made at the end.
+  std::pmr::vector<unsigned char> first_bytes(memory_);
+  for (std::size_t b = 0; b < kNumBytes; ++b)
+  {
+    if (Child(kRoot, static_cast<unsigned char>(b)) != kNone)
+    {
+      first_bytes.push_back(static_cast<unsigned char>(b));
+    }
+  }
+  std::pmr::vector<std::tuple<std::size_t, StateId>> changes(memory_);
+  for (std::size_t state = 0; state < transitions.size(); ++state)
+  {
+    for (const auto b : first_bytes)
+    {
+      changes.emplace_back(state * kNumBytes + b, Feed(static_cast<StateId>(state), b));
+    }
+  }
+
+  // Intermediate states are discovered while filling in rows, and get theirs in turn.
+  std::pmr::vector<StateId> rows(memory_);
+  for (std::size_t config = 0; config < configs_.size(); ++config)
+  {
+    const auto id = static_cast<StateId>(num_base_rows_ + config);
+    for (std::size_t b = 0; b < kNumBytes; ++b)
+    {
+      rows.push_back(Feed(id, static_cast<unsigned char>(b)));
+    }
+  }
+
+  ends.resize(num_base_rows_ + configs_.size());
+  for (std::size_t id = 0; id < ends.size(); ++id)
+  {
+    ends[id] = End(static_cast<StateId>(id));
+  }
+
+  for (const auto& [slot, target] : changes)
+  {
+    byte_table[slot] = target;
+  }
+  byte_table.insert(byte_table.end(), rows.begin(), rows.end());
+  transitions_ = nullptr;
+  base_ = nullptr;
+}
+
+std::uint32_t TokenCompiler::Child(std::uint32_t node, unsigned char byte) const
+{
+  const auto iter = children_.find((static_cast<std::uint64_t>(node) << 8U) | byte);
+  return iter == children_.end() ? kNone : iter->second;
+}
+
+std::string TokenCompiler::Path(std::uint32_t node, std::uint32_t depth) const
+{
+  std::string path(nodes_[node].depth - depth, '\0');
+  for (std::uint32_t n = node; nodes_[n].depth > depth; n = nodes_[n].parent)
+  {
+    path[nodes_[n].depth - depth - 1] = static_cast<char>(nodes_[n].byte);
+  }
+  return path;
+}
+
+TokenCompiler::StateId TokenCompiler::Delta(StateId state, std::uint32_t node) const
+{
+  if (nodes_[node].symbol == kSingle)
+  {
+    // The base rows read single bytes and scalar values.
+    StateId id = state;
+    for (const char c : Path(node, 0))
+    {
+      if (id >= CompiledDfa::kFirstSentinel)
+      {
+        break;
+      }
+      id = BaseRow(id)[static_cast<unsigned char>(c)];
+    }
+    return id;
+  }
+
+  const auto& state_transitions = (*transitions_)[state];
+  const auto iter = std::lower_bound(state_transitions.begin(), state_transitions.end(),
+                                     std::make_pair(nodes_[node].symbol, StateId{0}));
+  return iter != state_transitions.end() && iter->first == nodes_[node].symbol ? iter->second
+                                                                               : CompiledDfa::kNoTransition;
+}
+
+TokenCompiler::StateId TokenCompiler::Config(StateId state, std::uint32_t node)
+{
+  if (node == kRoot)
+  {
+    return state;
+  }
+  const auto [iter, inserted] = config_ids_.emplace((static_cast<std::uint64_t>(state) << 32U) | node,
+                                                    static_cast<StateId>(num_base_rows_ + configs_.size()));
+  if (inserted)
+  {
+    configs_.emplace_back(state, node);
+  }
+  return iter->second;
+}
+
+TokenCompiler::StateId TokenCompiler::Feed(StateId id, unsigned char byte)
+{
+  if (id >= transitions_->size() && id < num_base_rows_)
+  {
+    // The rest of a scalar value that no token continues.
+    return BaseRow(id)[byte];
+  }
+  const auto [state, node] = id < num_base_rows_ ? std::make_pair(id, kRoot) : configs_[id - num_base_rows_];
+  const std::uint32_t child = Child(node, byte);
+  if (child != kNone)
+  {
+    // Nothing longer can follow a leaf, so its Symbol is taken right away.
+    return nodes_[child].leaf ? Delta(state, child) : Config(state, child);
+  }
+  return node == kRoot ? BaseRow(state)[byte] : Resume(state, node, byte);
+}
+
+TokenCompiler::StateId TokenCompiler::Resume(StateId state, std::uint32_t node, std::optional<unsigned char> next)
+{
+  // Without a Symbol on the way, the bytes read may still begin a scalar value that no token continues, which the base
+  // rows read from its first byte on.
+  const std::uint32_t longest = nodes_[node].longest;
+  StateId id = longest != kNone ? Delta(state, longest) : state;
+  const std::string rest = Path(node, longest != kNone ? nodes_[longest].depth : 0);
+  for (std::size_t i = 0; i < rest.size(); ++i)
+  {
+    if (id >= CompiledDfa::kFirstSentinel)
+    {
+      return id;
+    }
+    const auto byte = static_cast<unsigned char>(rest[i]);
+    id = longest == kNone && i == 0 ? BaseRow(id)[byte] : Feed(id, byte);
+  }
+  if (id >= CompiledDfa::kFirstSentinel)
+  {
+    return id;
+  }
+  return next ? Feed(id, *next) : End(id);
+}
+
+TokenCompiler::StateId TokenCompiler::End(StateId id)
+{
+  if (id < transitions_->size())
+  {
+    return id;
+  }
+  if (id < num_base_rows_)
+  {
+    // Input can't end in the middle of a scalar value.
+    return CompiledDfa::kInvalidSymbol;
+  }
+  const auto [state, node] = configs_[id - num_base_rows_];
+  return Resume(state, node, std::nullopt);
+}
+
+}  // namespace dfa
@@ -0,0 +1,158 @@
+/**
+ * @file tokenizer.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "dfa/compiled_dfa.h"
+#include "dfa/utf8.h"
+
+namespace dfa
+{
+/**
+ * Compiles a DFA over Symbols of several bytes, like "GET" or "POST", into byte-level transitions that split the input
+ * into Symbols by longest match while matching it.
+ *
+ * The tokens, as the Symbols of several bytes that aren't a single scalar value are called here, form a trie. Reading
+ * a byte from a DFA state that some token starts with walks the trie through intermediate states, one for each pair of
+ * DFA state and trie node. When the next byte doesn't continue any token, the longest Symbol read so far is taken, and
+ * the bytes after it are read again from the state it leads to. Since tokens are bounded, that second reading is
+ * folded into the targets of the intermediate state, so matching never goes back and still takes one table lookup
+ * per byte. Anchoring every match at the end of the previous Symbol makes the failure links of an Aho-Corasick
+ * automaton unnecessary.
+ *
+ * Single bytes and scalar values are not part of the trie: they are read by the byte-level table that the DFA has
+ * without tokens, and scalar values by the intermediate states that Utf8Compiler shares between all DFA states. The
+ * trie only marks the ones that lie on the way to a token, so that they take part in the longest match. Ranges of
+ * scalar values thus stay as cheap as without tokens.
+ *
+ * The input ending in an intermediate state also takes the longest Symbol and reads the rest again, which gives each
+ * intermediate state an end: the state that input ending there amounts to, as in CompiledDfa::End.
+ */
+class TokenCompiler
+{
+ public:
+  using StateId = CompiledDfa::StateId;
+
+  /**
+   * Transitions of a DFA state as (token index, target), sorted by token index. Targets are DFA states.
+   */
+  using Transitions = std::pmr::vector<std::pair<std::uint32_t, StateId>>;
+
+  /**
+   * @param symbols the Alphabet; its tokens are indexed in the order of SymbolSet::tokens
+   * @param memory where the trie and the intermediate states are allocated from, like a MemoryBudget
+   */
+  explicit TokenCompiler(const SymbolSet& symbols,
+                         std::pmr::memory_resource* memory = std::pmr::new_delete_resource());
+
+  /**
+   * Adds the tokens to the byte-level table of a DFA.
+   * @param transitions the transitions of each DFA state on tokens
+   * @param byte_table 256 targets for each DFA state, in the same order, that read its single bytes and the lead bytes
+   * of its scalar values, followed by the rows of the intermediate states that read the rest of scalar values, as
+   * Utf8Compiler builds them. The bytes that tokens start with are changed in the rows of DFA states, and the rows of
+   * the intermediate states that read tokens are appended.
+   * @param ends receives the end of each row
+   */
+  void Compile(const std::pmr::vector<Transitions>& transitions, std::pmr::vector<StateId>& byte_table,
+               std::vector<StateId>& ends);
+
+ private:
+  static constexpr std::uint32_t kNone = 0xFFFFFFFF;
+
+  /**
+   * The symbol of a node that is a single byte or scalar value of the Alphabet rather than a token.
+   */
+  static constexpr std::uint32_t kSingle = 0xFFFFFFFE;
+
+  static constexpr std::uint32_t kRoot = 0;
+
+  struct Node
+  {
+    std::uint32_t parent;
+    unsigned char byte;
+    std::uint32_t depth;
+    /**
+     * The token that ends here, kSingle, or kNone.
+     */
+    std::uint32_t symbol;
+    /**
+     * The deepest node from the root to this one, inclusive, where a Symbol ends, or kNone.
+     */
+    std::uint32_t longest;
+    bool leaf;
+  };
+
+  std::uint32_t Child(std::uint32_t node, unsigned char byte) const;
+
+  /**
+   * The bytes from the root to node, starting at depth.
+   */
+  std::string Path(std::uint32_t node, std::uint32_t depth) const;
+
+  /**
+   * The target of the Symbol that ends at node in state.
+   */
+  StateId Delta(StateId state, std::uint32_t node) const;
+
+  /**
+   * The ID of the state that has read the bytes of node since leaving state, which is state itself at the root.
+   */
+  StateId Config(StateId state, std::uint32_t node);
+
+  /**
+   * The target of byte in a state.
+   */
+  StateId Feed(StateId id, unsigned char byte);
+
+  /**
+   * Takes the longest Symbol that node has read from state, and reads the rest of its bytes again from the state
+   * that Symbol leads to, followed by next, or by the end of the input if there is none.
+   */
+  StateId Resume(StateId state, std::uint32_t node, std::optional<unsigned char> next);
+
+  StateId End(StateId id);
+
+  /**
+   * The row of a DFA state or of an intermediate state of scalar values, before tokens were added.
+   */
+  inline const StateId* BaseRow(StateId id) const { return base_->data() + static_cast<std::size_t>(id) * 256; }
+
+  std::pmr::memory_resource* memory_;
+
+  std::pmr::vector<Node> nodes_;
+
+  /**
+   * Trie edges, keyed by (node << 8) | byte.
+   */
+  std::pmr::unordered_map<std::uint64_t, std::uint32_t> children_;
+
+  const std::pmr::vector<Transitions>* transitions_ = nullptr;
+
+  const std::pmr::vector<StateId>* base_ = nullptr;
+
+  /**
+   * Rows of DFA states and of intermediate states of scalar values.
+   */
+  std::size_t num_base_rows_ = 0;
+
+  /**
+   * IDs of intermediate states, keyed by (DFA state << 32) | node, and the pair of each, in ID order.
+   */
+  std::pmr::unordered_map<std::uint64_t, StateId> config_ids_;
+
+  std::pmr::vector<std::pair<StateId, std::uint32_t>> configs_;
+};
+
+}  // namespace dfa
@@ -0,0 +1,374 @@
+/**
+ * @file utf8.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "utf8.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+namespace dfa
+{
+namespace
+{
+using StateId = CompiledDfa::StateId;
+
+constexpr char32_t kMaxScalar = 0x10FFFF;
+
+constexpr unsigned kContinuationBits = 6;
+
+constexpr unsigned char kContinuationMask = 0x3F;
+
+constexpr unsigned char kFirstContinuation = 0x80;
+
+constexpr unsigned char kLastContinuation = 0xBF;
+
+/**
+ * One end of a range: a single byte, or a scalar value.
+ */
+std::optional<std::pair<char32_t, bool>> ParseRangeEnd(std::string_view end)
+{
+  if (end.size() == 1)
+  {
+    return std::make_pair(char32_t{static_cast<unsigned char>(end[0])}, true);
+  }
+  if (const auto scalar = DecodeScalar(end))
+  {
+    return std::make_pair(*scalar, false);
+  }
+  return std::nullopt;
+}
+}  // namespace
+
+std::size_t SequenceLength(unsigned char lead)
+{
+  if ((lead & 0xE0U) == 0xC0U)
+  {
+    return 2;
+  }
+  if ((lead & 0xF0U) == 0xE0U)
+  {
+    return 3;
+  }
+  if ((lead & 0xF8U) == 0xF0U)
+  {
+    return 4;
+  }
+  return 1;
+}
+
+std::optional<char32_t> DecodeScalar(std::string_view symbol)
+{
+  if (symbol.empty())
+  {
+    return std::nullopt;
+  }
+  const auto lead = static_cast<unsigned char>(symbol[0]);
+  const std::size_t length = SequenceLength(lead);
+  if (length == 1 || symbol.size() != length)
+  {
+    return std::nullopt;
+  }
+
+  static constexpr std::array<char32_t, 5> kLeadMask = {0, 0, 0x1F, 0x0F, 0x07};
+  static constexpr std::array<char32_t, 5> kMinimum = {0, 0, 0x80, 0x800, 0x10000};
+  char32_t value = lead & kLeadMask[length];
+  for (std::size_t i = 1; i < length; ++i)
+  {
+    const auto byte = static_cast<unsigned char>(symbol[i]);
+    if ((byte & 0xC0U) != kFirstContinuation)
+    {
+      return std::nullopt;
+    }
+    value = (value << kContinuationBits) | (byte & kContinuationMask);
+  }
+
+  if (value < kMinimum[length] || value > kMaxScalar || IsSurrogate(value))
+  {
+    return std::nullopt;
+  }
+  return value;
+}
+
+std::string EncodeScalar(char32_t scalar)
+{
+  if (scalar < kFirstMultiByte)
+  {
+    return std::string(1, static_cast<char>(scalar));
+  }
+  const std::size_t length = scalar < 0x800 ? 2 : scalar < 0x10000 ? 3 : 4;
+  static constexpr std::array<unsigned char, 5> kLeadBits = {0, 0, 0xC0, 0xE0, 0xF0};
+  std::string bytes(length, '\0');
+  for (std::size_t i = length - 1; i > 0; --i)
+  {
+    bytes[i] = static_cast<char>(kFirstContinuation | (scalar & kContinuationMask));
+    scalar >>= kContinuationBits;
+  }
+  bytes[0] = static_cast<char>(kLeadBits[length] | scalar);
+  return bytes;
+}
+
+std::optional<SymbolRange> ParseRange(std::string_view symbol)
+{
+  if (symbol.empty())
+  {
+    return std::nullopt;
+  }
+  const std::size_t dash = SequenceLength(static_cast<unsigned char>(symbol[0]));
+  if (symbol.size() < dash + 2 || symbol[dash] != '-')
+  {
+    return std::nullopt;
+  }
+  const auto low = ParseRangeEnd(symbol.substr(0, dash));
+  const auto high = ParseRangeEnd(symbol.substr(dash + 1));
+  if (!low || !high)
+  {
+    return std::nullopt;
+  }
+
+  const bool bytes = low->second && high->second;
+  if (!bytes && ((low->second && low->first >= kFirstMultiByte) || (high->second && high->first >= kFirstMultiByte)))
+  {
+    throw std::runtime_error("Parsing error: range " + std::string(symbol) +
+                             " has a byte above 0x7f at one end and a UTF-8 scalar value at the other");
+  }
+  if (low->first > high->first)
+  {
+    throw std::runtime_error("Parsing error: range " + std::string(symbol) + " is out of order");
+  }
+  return SymbolRange{low->first, high->first, bytes};
+}
+
+std::optional<SymbolRange> LabelRange(std::string_view label)
+{
+  if (label.size() == 1)
+  {
+    const char32_t byte = static_cast<unsigned char>(label[0]);
+    return SymbolRange{byte, byte, true};
+  }
+  if (const auto scalar = DecodeScalar(label))
+  {
+    return SymbolRange{*scalar, *scalar, false};
+  }
+  return ParseRange(label);
+}
+
+std::string RangeSymbol(char32_t value, bool bytes)
+{
+  return bytes ? std::string(1, static_cast<char>(value)) : EncodeScalar(value);
+}
+
+std::string RangeLabel(const SymbolRange& range)
+{
+  if (range.low == range.high)
+  {
+    return RangeSymbol(range.low, range.bytes);
+  }
+  return RangeSymbol(range.low, range.bytes) + '-' + RangeSymbol(range.high, range.bytes);
+}
+
+std::optional<std::pair<unsigned char, unsigned char>> RangeBytes(const SymbolRange& range)
+{
+  // Bytes below 0x80 are ASCII characters, and the same scalar values.
+  const char32_t last_byte = range.bytes ? range.high : std::min<char32_t>(range.high, kFirstMultiByte - 1);
+  if (range.low > last_byte)
+  {
+    return std::nullopt;
+  }
+  return std::make_pair(static_cast<unsigned char>(range.low), static_cast<unsigned char>(last_byte));
+}
+
+SymbolSet CollectSymbols(const std::unordered_set<std::string>& alphabet)
+{
+  SymbolSet set;
+  std::vector<std::pair<char32_t, char32_t>> scalars;
+  for (const auto& symbol : alphabet)
+  {
+    if (symbol.size() == 1)
+    {
+      set.bytes[static_cast<unsigned char>(symbol[0])] = true;
+    }
+    else if (const auto scalar = DecodeScalar(symbol))
+    {
+      scalars.emplace_back(*scalar, *scalar);
+    }
+    else if (const auto range = ParseRange(symbol))
+    {
+      if (const auto bytes = RangeBytes(*range))
+      {
+        std::fill(set.bytes.begin() + bytes->first, set.bytes.begin() + bytes->second + 1, true);
+      }
+      if (!range->bytes && range->high >= kFirstMultiByte)
+      {
+        scalars.emplace_back(std::max(range->low, kFirstMultiByte), range->high);
+      }
+    }
+    else
+    {
+      set.tokens.push_back(symbol);
+    }
+  }
+  std::sort(set.tokens.begin(), set.tokens.end());
+
+  std::sort(scalars.begin(), scalars.end());
+  for (const auto& range : scalars)
+  {
+    if (!set.scalars.empty() && range.first <= set.scalars.back().second + 1)
+    {
+      set.scalars.back().second = std::max(set.scalars.back().second, range.second);
+    }
+    else
+    {
+      set.scalars.push_back(range);
+    }
+  }
+
+  if (!set.scalars.empty() &&
+      std::any_of(set.bytes.begin() + kFirstMultiByte, set.bytes.end(), [](bool in_alphabet) { return in_alphabet; }))
+  {
+    throw std::runtime_error("Parsing error: single byte Symbols above 0x7f can't be mixed with UTF-8 Symbols");
+  }
+  return set;
+}
+
+Utf8Compiler::Utf8Compiler(std::vector<std::pair<char32_t, char32_t>> scalars, StateId first_id,
+                           std::pmr::memory_resource* memory)
+    : scalars_(std::move(scalars)), first_id_(first_id), pieces_(memory), rows_(memory), ids_(memory),
+      uniform_ids_(memory)
+{
+}
+
+void Utf8Compiler::CompileRow(const std::pmr::vector<Transition>& transitions, StateId* row)
+{
+  // Lay the transitions over the Alphabet: its scalar values have no transition unless given one, and all others are
+  // invalid.
+  pieces_.clear();
+  pieces_.push_back({kFirstMultiByte, CompiledDfa::kInvalidSymbol});
+  const auto add = [this](char32_t start, StateId target) {
+    if (pieces_.back().start == start)
+    {
+      pieces_.pop_back();
+    }
+    if (pieces_.empty() || pieces_.back().target != target)
+    {
+      pieces_.push_back({start, target});
+    }
+  };
+  std::size_t t = 0;
+  for (const auto& [low, high] : scalars_)
+  {
+    char32_t next = low;
+    for (; t < transitions.size() && transitions[t].low <= high; ++t)
+    {
+      if (transitions[t].low > next)
+      {
+        add(next, CompiledDfa::kNoTransition);
+      }
+      add(transitions[t].low, transitions[t].target);
+      next = transitions[t].high + 1;
+    }
+    if (next <= high)
+    {
+      add(next, CompiledDfa::kNoTransition);
+    }
+    add(high + 1, CompiledDfa::kInvalidSymbol);
+  }
+
+  // Lead bytes of two, three and four byte sequences, and the range of the byte after each, which rules out overlong
+  // encodings, surrogates and values past U+10FFFF.
+  for (unsigned b = kFirstMultiByte; b < 256; ++b)
+  {
+    row[b] = CompiledDfa::kInvalidSymbol;
+  }
+  for (unsigned lead = 0xC2; lead <= 0xF4; ++lead)
+  {
+    unsigned remaining = 1;
+    char32_t base = (lead & 0x1FU) << kContinuationBits;
+    unsigned char low = kFirstContinuation;
+    unsigned char high = kLastContinuation;
+    if (lead >= 0xF0)
+    {
+      remaining = 3;
+      base = (lead & 0x07U) << (3 * kContinuationBits);
+      low = lead == 0xF0 ? 0x90 : low;
+      high = lead == 0xF4 ? 0x8F : high;
+    }
+    else if (lead >= 0xE0)
+    {
+      remaining = 2;
+      base = (lead & 0x0FU) << (2 * kContinuationBits);
+      low = lead == 0xE0 ? 0xA0 : low;
+      high = lead == 0xED ? 0x9F : high;
+    }
+
+    const char32_t block = char32_t{1} << (kContinuationBits * (remaining - 1));
+    const char32_t first = base + (low & kContinuationMask) * block;
+    const char32_t last = base + (high & kContinuationMask) * block + block - 1;
+    if (UniformTarget(first, last) != CompiledDfa::kInvalidSymbol)
+    {
+      row[lead] = Node(base, remaining, low, high);
+    }
+  }
+}
+
+std::optional<StateId> Utf8Compiler::UniformTarget(char32_t low, char32_t high) const
+{
+  auto piece = std::upper_bound(pieces_.begin(), pieces_.end(), low,
+                                [](char32_t value, const Piece& p) { return value < p.start; });
+  --piece;
+  if (piece + 1 != pieces_.end() && (piece + 1)->start <= high)
+  {
+    return std::nullopt;
+  }
+  return piece->target;
+}
+
+StateId Utf8Compiler::Node(char32_t base, unsigned remaining, unsigned char low, unsigned char high)
+{
+  std::array<StateId, 256> row;
+  row.fill(CompiledDfa::kInvalidSymbol);
+  const char32_t block = char32_t{1} << (kContinuationBits * (remaining - 1));
+  for (unsigned b = low; b <= high; ++b)
+  {
+    const char32_t first = base + (b & kContinuationMask) * block;
+    const auto uniform = UniformTarget(first, first + block - 1);
+    if (remaining == 1 || uniform == CompiledDfa::kInvalidSymbol)
+    {
+      row[b] = *uniform;
+    }
+    else if (uniform)
+    {
+      // Every sequence from here leads to the same target, so the rest of the sequence only needs to be read.
+      const auto [iter, inserted] =
+          uniform_ids_.emplace((static_cast<std::uint64_t>(remaining) << 32U) | *uniform, StateId{0});
+      if (inserted)
+      {
+        iter->second = Node(first, remaining - 1, kFirstContinuation, kLastContinuation);
+      }
+      row[b] = iter->second;
+    }
+    else
+    {
+      row[b] = Node(first, remaining - 1, kFirstContinuation, kLastContinuation);
+    }
+  }
+  return Intern(row);
+}
+
+StateId Utf8Compiler::Intern(const std::array<StateId, 256>& row)
+{
+  const auto [iter, inserted] =
+      ids_.emplace(std::pmr::string(reinterpret_cast<const char*>(row.data()), sizeof(row), rows_.get_allocator()),
+                   first_id_ + static_cast<StateId>(NumStates()));
+  if (inserted)
+  {
+    rows_.insert(rows_.end(), row.begin(), row.end());
+  }
+  return iter->second;
+}
+
+}  // namespace dfa
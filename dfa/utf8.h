@@ -0,0 +1,228 @@
+/**
+ * @file utf8.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "dfa/compiled_dfa.h"
+
+namespace dfa
+{
+/**
+ * The first scalar value that UTF-8 encodes in several bytes.
+ */
+constexpr char32_t kFirstMultiByte = 0x80;
+
+/**
+ * Surrogates, which UTF-16 uses in pairs, are not scalar values.
+ */
+constexpr char32_t kFirstSurrogate = 0xD800;
+
+constexpr char32_t kLastSurrogate = 0xDFFF;
+
+constexpr bool IsSurrogate(char32_t value) noexcept { return value >= kFirstSurrogate && value <= kLastSurrogate; }
+
+/**
+ * The scalar value after one, skipping surrogates.
+ */
+constexpr char32_t NextScalar(char32_t scalar) noexcept
+{
+  return scalar == kFirstSurrogate - 1 ? kLastSurrogate + 1 : scalar + 1;
+}
+
+/**
+ * Length of the UTF-8 sequence that a byte starts, or 1 if it doesn't start one.
+ */
+std::size_t SequenceLength(unsigned char lead);
+
+/**
+ * Decodes a Symbol that is a single Unicode scalar value of two to four bytes in UTF-8. Overlong encodings,
+ * surrogates and values past U+10FFFF are not scalars.
+ */
+std::optional<char32_t> DecodeScalar(std::string_view symbol);
+
+/**
+ * Encodes a scalar value in UTF-8.
+ */
+std::string EncodeScalar(char32_t scalar);
+
+/**
+ * An inclusive range of Symbols, written "lo-hi".
+ */
+struct SymbolRange
+{
+  char32_t low;
+  char32_t high;
+  /**
+   * Whether both ends are single bytes, in which case the range is one of bytes rather than of scalar values.
+   */
+  bool bytes;
+};
+
+/**
+ * Parses a Symbol of the form "lo-hi", where lo and hi are single bytes or UTF-8 encoded scalar values.
+ * @return nothing if the Symbol doesn't have that form, like "-" or "ab"
+ * @throws std::runtime_error if lo comes after hi, or only one end is a byte above 0x7f
+ */
+std::optional<SymbolRange> ParseRange(std::string_view symbol);
+
+/**
+ * The range of Symbols that a transition label stands for: a single byte, a scalar value, or a range.
+ * @return nothing for other labels, like "GET"
+ * @throws std::runtime_error if the label is a malformed range, like ParseRange
+ */
+std::optional<SymbolRange> LabelRange(std::string_view label);
+
+/**
+ * The Symbol of one value of a range: a single byte, or a UTF-8 encoded scalar value.
+ * @param bytes whether the value is a byte; values below 0x80 are the same either way
+ */
+std::string RangeSymbol(char32_t value, bool bytes);
+
+/**
+ * Writes a range as a transition label: the Symbol of its only value, or "lo-hi".
+ */
+std::string RangeLabel(const SymbolRange& range);
+
+/**
+ * The single byte Symbols in a range: all of it if it is a range of bytes, and its ASCII characters otherwise.
+ * @return the first and last byte, or nothing if there are none
+ */
+std::optional<std::pair<unsigned char, unsigned char>> RangeBytes(const SymbolRange& range);
+
+/**
+ * The inputs that an Alphabet accepts, in terms of bytes.
+ */
+struct SymbolSet
+{
+  /**
+   * Bytes that are Symbols by themselves: single byte Symbols, and bytes of ranges.
+   */
+  std::array<bool, 256> bytes{};
+
+  /**
+   * Scalar values from U+0080 up that are Symbols, as sorted, disjoint and non-adjacent inclusive ranges. If there
+   * are any, the Alphabet is made of UTF-8 text.
+   */
+  std::vector<std::pair<char32_t, char32_t>> scalars;
+
+  /**
+   * The other Symbols of several bytes, like "GET", in ascending order. Input is split into Symbols by longest match
+   * if there are any; see TokenCompiler.
+   */
+  std::vector<std::string> tokens;
+};
+
+/**
+ * Sorts the Symbols of an Alphabet into single bytes, scalar values, and other Symbols of several bytes.
+ * @throws std::runtime_error if ranges are malformed, or if a byte above 0x7f is a Symbol of an Alphabet that also
+ * has UTF-8 Symbols, which would make the input ambiguous
+ */
+SymbolSet CollectSymbols(const std::unordered_set<std::string>& alphabet);
+
+/**
+ * Compiles transitions on scalar values into byte-level transitions that recognize UTF-8 directly.
+ *
+ * A state's lead bytes lead to intermediate states, which read the continuation bytes of a sequence and then move
+ * on to the target of its scalar value. Intermediate states only depend on what the rest of a sequence can lead to,
+ * so identical ones are shared between all states and sequences: a range of scalars with one target takes just a
+ * handful of them, and matching still takes one table lookup per byte.
+ */
+class Utf8Compiler
+{
+ public:
+  using StateId = CompiledDfa::StateId;
+
+  /**
+   * A transition on every scalar value in [low, high].
+   */
+  struct Transition
+  {
+    char32_t low;
+    char32_t high;
+    StateId target;
+  };
+
+  /**
+   * @param scalars the scalar values of the Alphabet, as in SymbolSet
+   * @param first_id the ID of the first intermediate state; IDs are handed out consecutively from here
+   * @param memory where the intermediate states are allocated from, like a MemoryBudget
+   */
+  Utf8Compiler(std::vector<std::pair<char32_t, char32_t>> scalars, StateId first_id,
+               std::pmr::memory_resource* memory = std::pmr::new_delete_resource());
+
+  /**
+   * Fills in the bytes from 0x80 up of a state's row: lead bytes of the Alphabet's scalar values lead to intermediate
+   * states, and all others are kInvalidSymbol.
+   * @param transitions the state's transitions on scalar values; sorted, disjoint, and inside the Alphabet. Scalar
+   * values of the Alphabet without a transition lead to kNoTransition.
+   * @param row the 256 targets of the state
+   */
+  void CompileRow(const std::pmr::vector<Transition>& transitions, StateId* row);
+
+  /**
+   * Rows of the intermediate states, 256 targets each, in ID order.
+   */
+  inline const std::pmr::vector<StateId>& Rows() const noexcept { return rows_; }
+
+  inline std::size_t NumStates() const noexcept { return rows_.size() / 256; }
+
+ private:
+  /**
+   * Start of a run of scalar values that lead to the same target. The run ends where the next one starts.
+   */
+  struct Piece
+  {
+    char32_t start;
+    StateId target;
+  };
+
+  /**
+   * The target of every scalar value in [low, high], or nothing if they differ.
+   */
+  std::optional<StateId> UniformTarget(char32_t low, char32_t high) const;
+
+  /**
+   * Builds the intermediate state that reads the next continuation byte of sequences with remaining continuation
+   * bytes left, for the scalar values base + (byte & 0x3f) << (6 * (remaining - 1)) and up, for bytes in [low, high].
+   */
+  StateId Node(char32_t base, unsigned remaining, unsigned char low, unsigned char high);
+
+  /**
+   * The ID of an intermediate state with this row, which is added if there is none yet.
+   */
+  StateId Intern(const std::array<StateId, 256>& row);
+
+  std::vector<std::pair<char32_t, char32_t>> scalars_;
+
+  StateId first_id_;
+
+  /**
+   * The row that CompileRow works on, as Pieces that cover every value from U+0080 on.
+   */
+  std::pmr::vector<Piece> pieces_;
+
+  std::pmr::vector<StateId> rows_;
+
+  std::pmr::unordered_map<std::pmr::string, StateId> ids_;
+
+  /**
+   * Intermediate states after which every sequence leads to one target, by (remaining bytes << 32) | target.
+   */
+  std::pmr::unordered_map<std::uint64_t, StateId> uniform_ids_;
+};
+
+}  // namespace dfa
@@ -0,0 +1,185 @@
+/**
+ * @file verdict_cache.cc
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#include "verdict_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+namespace dfa
+{
+namespace
+{
+/**
+ * Hands out the shard slots of threads, round-robin in the order threads first use a cache.
+ */
+std::atomic<std::size_t> next_thread_slot{0};
+
+thread_local const std::size_t thread_slot = next_thread_slot.fetch_add(1, std::memory_order_relaxed);
+
+constexpr std::size_t kThreadsPerShard = 4;
+}  // namespace
+
+VerdictCache::VerdictCache(std::size_t capacity, std::size_t shards, std::size_t max_input_size)
+    : max_input_size_(max_input_size)
+{
+  if (shards == 0)
+  {
+    shards = std::max<std::size_t>(1, std::thread::hardware_concurrency() / kThreadsPerShard);
+  }
+  const std::size_t shard_capacity = std::max<std::size_t>(1, (capacity + shards - 1) / shards);
+  shards_.reserve(shards);
+  for (std::size_t i = 0; i < shards; ++i)
+  {
+    shards_.push_back(std::make_unique<Shard>(shard_capacity));
+  }
+}
+
+Dfa::Acceptance VerdictCache::Match(const AtomicSnapshot& automaton, std::string_view input)
+{
+  const std::uint64_t generation = automaton.Generation();
+  const Snapshot snapshot = automaton.Load();
+  return Match(*snapshot, generation, input);
+}
+
+Dfa::Acceptance VerdictCache::Match(const Dfa& dfa, std::uint64_t generation, std::string_view input)
+{
+  Shard& shard = LocalShard();
+  const bool cacheable = input.size() <= max_input_size_;
+  const std::uint64_t hash = cacheable ? Hash(input) : 0;
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (!cacheable || !Synchronize(shard, generation))
+    {
+      ++shard.stats.bypassed;
+    }
+    else
+    {
+      if (const auto iter = shard.index.find(hash); iter != shard.index.end())
+      {
+        Entry& entry = shard.entries[iter->second];
+        if (entry.input == input)
+        {
+          entry.referenced = true;
+          ++shard.stats.hits;
+          return entry.verdict;
+        }
+      }
+      ++shard.stats.misses;
+    }
+  }
+
+  // The lock isn't held while matching, so other threads of the group can hit in the meantime.
+  const Dfa::Acceptance verdict = dfa.AcceptsString(input);
+  if (cacheable)
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (Synchronize(shard, generation))
+    {
+      Insert(shard, hash, input, verdict);
+    }
+  }
+  return verdict;
+}
+
+VerdictCacheStats VerdictCache::Stats() const
+{
+  VerdictCacheStats total;
+  for (const auto& shard : shards_)
+  {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    total.hits += shard->stats.hits;
+    total.misses += shard->stats.misses;
+    total.evictions += shard->stats.evictions;
+    total.invalidations += shard->stats.invalidations;
+    total.bypassed += shard->stats.bypassed;
+  }
+  return total;
+}
+
+std::uint64_t VerdictCache::Hash(std::string_view input) noexcept
+{
+  constexpr std::uint64_t kMultiplier = 0x9E3779B97F4A7C15ULL;
+  std::uint64_t hash = input.size() * kMultiplier;
+  std::size_t i = 0;
+  for (; i + sizeof(std::uint64_t) <= input.size(); i += sizeof(std::uint64_t))
+  {
+    std::uint64_t word;
+    std::memcpy(&word, input.data() + i, sizeof(word));
+    hash = (hash ^ word) * kMultiplier;
+    hash ^= hash >> 32U;
+  }
+  // An empty input may have a null data(), which memcpy must not be given even to copy nothing.
+  std::uint64_t tail = 0;
+  if (i < input.size())
+  {
+    std::memcpy(&tail, input.data() + i, input.size() - i);
+  }
+  hash = (hash ^ tail) * kMultiplier;
+  return hash ^ (hash >> 29U);
+}
+
+VerdictCache::Shard& VerdictCache::LocalShard() { return *shards_[thread_slot % shards_.size()]; }
+
+bool VerdictCache::Synchronize(Shard& shard, std::uint64_t generation)
+{
+  if (generation < shard.generation)
+  {
+    return false;
+  }
+  if (generation > shard.generation)
+  {
+    if (!shard.index.empty())
+    {
+      shard.index.clear();
+      for (auto& entry : shard.entries)
+      {
+        entry.used = false;
+        entry.referenced = false;
+      }
+      ++shard.stats.invalidations;
+    }
+    shard.generation = generation;
+  }
+  return true;
+}
+
+void VerdictCache::Insert(Shard& shard, std::uint64_t hash, std::string_view input, Dfa::Acceptance verdict)
+{
+  const auto [iter, inserted] = shard.index.emplace(hash, shard.hand);
+  if (!inserted)
+  {
+    // Another thread cached the same input meanwhile, or a different one with the same hash.
+    Entry& entry = shard.entries[iter->second];
+    entry.input.assign(input);
+    entry.verdict = verdict;
+    return;
+  }
+
+  // Entries that were hit since the last sweep get another round.
+  while (shard.entries[shard.hand].used && shard.entries[shard.hand].referenced)
+  {
+    shard.entries[shard.hand].referenced = false;
+    shard.hand = (shard.hand + 1) % shard.entries.size();
+  }
+  Entry& victim = shard.entries[shard.hand];
+  if (victim.used)
+  {
+    shard.index.erase(victim.hash);
+    ++shard.stats.evictions;
+  }
+  victim.input.assign(input);
+  victim.hash = hash;
+  victim.verdict = verdict;
+  victim.referenced = false;
+  victim.used = true;
+  iter->second = shard.hand;
+  shard.hand = (shard.hand + 1) % shard.entries.size();
+}
+
+}  // namespace dfa
@@ -0,0 +1,157 @@
+/**
+ * @file verdict_cache.h
+ * @author Antony Kellermann
+ * @copyright 2020 Antony Kellermann
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "dfa/dfa.h"
+#include "dfa/snapshot.h"
+
+namespace dfa
+{
+/**
+ * Counters of a VerdictCache.
+ */
+struct VerdictCacheStats
+{
+  std::uint64_t hits = 0;
+
+  std::uint64_t misses = 0;
+
+  /**
+   * Cached verdicts that were replaced to make room for others.
+   */
+  std::uint64_t evictions = 0;
+
+  /**
+   * Times a shard was emptied because the automaton changed.
+   */
+  std::uint64_t invalidations = 0;
+
+  /**
+   * Inputs that were too long to be cached. They are matched without counting as misses.
+   */
+  std::uint64_t bypassed = 0;
+
+  /**
+   * Share of lookups that hit, between 0 and 1.
+   */
+  inline double HitRate() const noexcept
+  {
+    return hits + misses == 0 ? 0 : static_cast<double>(hits) / static_cast<double>(hits + misses);
+  }
+};
+
+/**
+ * A bounded cache of verdicts by input, for traffic where a few distinct inputs make up most records. A hit costs a
+ * hash of the input, a probe, and a comparison with the cached input, instead of a walk through the table.
+ *
+ * The cache is split into shards, each with its own lock and a share of the capacity. Every thread keeps to one shard,
+ * so contention is limited to the threads of a group, and a shard's entries stay in the caches of the cores that use
+ * them. Within a shard, entries are evicted by the CLOCK algorithm: a hand sweeps the entries, sparing those that were
+ * hit since it last passed them.
+ *
+ * Verdicts are tagged with the Generation of the AtomicSnapshot they were matched against. A shard that sees a newer
+ * generation drops its entries, so a reload invalidates the cache without any coordination. Thread-safe.
+ */
+class VerdictCache
+{
+ public:
+  /**
+   * @param capacity most verdicts kept, across all shards; at least one per shard is kept
+   * @param shards number of shards; 0 uses one per four hardware threads
+   * @param max_input_size longer inputs are always matched, so that a few long inputs don't take up all the memory
+   */
+  explicit VerdictCache(std::size_t capacity, std::size_t shards = 0, std::size_t max_input_size = 4096);
+
+  /**
+   * Matches input against the current Snapshot of automaton, unless its verdict is cached.
+   */
+  Dfa::Acceptance Match(const AtomicSnapshot& automaton, std::string_view input);
+
+  /**
+   * Matches input against dfa, unless its verdict is cached for the same generation.
+   * @param generation identifies dfa; read it from AtomicSnapshot::Generation before loading the Snapshot, so that a
+   * verdict is never tagged with a generation newer than the Snapshot it came from
+   */
+  Dfa::Acceptance Match(const Dfa& dfa, std::uint64_t generation, std::string_view input);
+
+  /**
+   * Sums the counters of all shards.
+   */
+  VerdictCacheStats Stats() const;
+
+  inline std::size_t Shards() const noexcept { return shards_.size(); }
+
+  /**
+   * Hashes bytes eight at a time.
+   */
+  static std::uint64_t Hash(std::string_view input) noexcept;
+
+ private:
+  struct Entry
+  {
+    std::string input;
+
+    std::uint64_t hash = 0;
+
+    Dfa::Acceptance verdict = Dfa::REJECTS;
+
+    /**
+     * Whether the entry was hit since the hand last passed it.
+     */
+    bool referenced = false;
+
+    bool used = false;
+  };
+
+  struct Shard
+  {
+    explicit Shard(std::size_t capacity) : entries(capacity) {}
+
+    std::mutex mutex;
+
+    std::vector<Entry> entries;
+
+    /**
+     * Index of the entry of each hash. Inputs whose hashes collide replace each other.
+     */
+    std::unordered_map<std::uint64_t, std::size_t> index;
+
+    std::size_t hand = 0;
+
+    std::uint64_t generation = 0;
+
+    VerdictCacheStats stats;
+  };
+
+  /**
+   * The shard of the calling thread.
+   */
+  Shard& LocalShard();
+
+  /**
+   * Brings a shard to generation, dropping its entries if that is newer.
+   * @return false if generation is older than the shard's, in which case it shouldn't be used
+   */
+  static bool Synchronize(Shard& shard, std::uint64_t generation);
+
+  static void Insert(Shard& shard, std::uint64_t hash, std::string_view input, Dfa::Acceptance verdict);
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  std::size_t max_input_size_;
+};
+
+}  // namespace dfa